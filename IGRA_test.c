@@ -10,11 +10,14 @@
 /*
  * Example for how to use Kriging clustering algorithm on IGRA dataset.
  * 60 days data are read in. Chi-square values for Kriging with clustering and Kriging without clustering are computed and write to csv files for each time stamps. For example IGRA_compare_0.txt is comparison for time stamp 0.
+ * Run as 'IGRA_test warm' to start each day from the previous day's clusters instead of clustering every day from scratch.
 */
-int main(void){
+int main(int argc,char** argv){
 	//Read IGRA data
 	Objects* data=read_IGRA("US_IGRA",60,221,TRUE);
-	DWORD i,j,index=0;
+	TimeIndex* time_index=build_time_index(data);
+	Objects slice;
+	DWORD j,index=0;
 	char file_name[100];
 	//printf("filtered size=%lld\n",index);
 	//Construct variogram
@@ -26,44 +29,56 @@ int main(void){
 	distances[0]=30;
 	distances[1]=DIS_UNCHECKED;
 	DTYPE increment=-88;
+	BOOLEAN warm_start=argc>1&&strcmp(argv[1],"warm")==0;
+	Clusters* previous=NULL;
+	DWORD* labels;
 	for(j=0;j<60;j++){
 		//Data for day i are read
-		Object** filtered=Calloc(data->size,Object*);
-		index=0;
 		if(j%2==0){
 			increment+=88;
 		}else{
 			increment+=12;
 		}
-		for(i=0;i<data->size;i++){
-			//printf("x=%lf,y=%lf,t=%lf,time=%lf\n",data->objects[i]->spatial_coordinates[0],data->objects[i]->spatial_coordinates[1],data->objects[i]->attribute,data->objects[i]->time);
-			if(data->objects[i]->time==2014010100+increment&&data->objects[i]->attribute!=-9999){
-				filtered[index++]=data->objects[i];
-			}
-		}
+		//Objects with missing attributes are excluded by the time index
+		get_time_slice(time_index,2014010100+increment,&slice,FALSE);
+		index=slice.size;
 		//printf("index=%lld\n",index);
-		filtered=(Object**)realloc(filtered,sizeof(Object*)*index);
-		//shuffle_objects(filtered,index);
+		if(index<2){
+			continue;
+		}
+		//shuffle_objects(slice.objects,index);
 		//Kriging without clustering (unlimited error boundary, everything will be in the same cluster)
-		Clusters* clusters=krig_clustering(filtered,index,99999,C,distances,EXPONENTIAL_VARIOGRAM);
+		Clusters* clusters=krig_clustering(slice.objects,index,99999,C,distances,EXPONENTIAL_VARIOGRAM);
 		//Compute chi-sqaure value for Kriging without clustering.
 		DTYPE benchmark=chi_square_coefficient(clusters,C,distances,EXPONENTIAL_VARIOGRAM);
 		destroy_clusters(clusters);
-		//Kriging with clustering, threshold is 0.6.
-		clusters=krig_clustering(filtered,index,0.6,C,distances,EXPONENTIAL_VARIOGRAM);
+		//Kriging with clustering, threshold is 0.6. With warm start, start from previous time stamp's clusters if there are any.
+		if(previous!=NULL){
+			labels=map_cluster_labels(previous,slice.objects,index);
+			clusters=krig_clustering_warm_start(slice.objects,index,labels,0.6,C,distances,EXPONENTIAL_VARIOGRAM);
+			Free(labels);
+			destroy_clusters(previous);
+			previous=NULL;
+		}else{
+			clusters=krig_clustering(slice.objects,index,0.6,C,distances,EXPONENTIAL_VARIOGRAM);
+		}
 		//print_clusters(clusters);
 		//Compute chi-sqaure value for Kriging with clustering
 		DTYPE test_statistics=chi_square_coefficient(clusters,C,distances,EXPONENTIAL_VARIOGRAM);
 		//write out day i's comparison result
-		Objects* objects=Calloc(1,Objects);
-		objects->objects=filtered;
-		objects->size=index;
 		sprintf(file_name, "IGRA_compare_%lld.txt",j);
-		write_normal_squares(file_name,objects,clusters,C,distances,EXPONENTIAL_VARIOGRAM);
+		write_normal_squares(file_name,&slice,clusters,C,distances,EXPONENTIAL_VARIOGRAM);
 		printf("%lld,%lld,%lf,%lf,%lf\n",index,clusters->size,benchmark,test_statistics,NMSE_error(clusters,C,distances,EXPONENTIAL_VARIOGRAM));
-		Free(filtered);
-		Free(objects);
+		if(warm_start){
+			previous=clusters;
+		}else{
+			destroy_clusters(clusters);
+		}
+	}
+	if(previous!=NULL){
+		destroy_clusters(previous);
 	}
+	destroy_time_index(time_index);
 	Free(C);
 	Free(distances);
 	return 0;
@@ -6,6 +6,23 @@
 #include "random.h"
 #include "clusterfunctions.h"
 #include "datafunctions.h"
+#include <time.h>
+
+/*
+ * Hours since the epoch of an IGRA time stamp yyyymmddhh, so that temporal lags are uniform across days and months.
+*/
+static DTYPE IGRA_hours(TEMPORAL_TYPE time){
+	struct tm date;
+	DWORD stamp=(DWORD)time;
+	memset(&date,0,sizeof(struct tm));
+	date.tm_hour=stamp%100;
+	stamp/=100;
+	date.tm_mday=stamp%100;
+	stamp/=100;
+	date.tm_mon=stamp%100-1;
+	date.tm_year=stamp/100-1900;
+	return mktime(&date)/3600.;
+}
 
 int main(void){
 	DTYPE angle_bound=M_PI*2+1, step_size=3,bound=step_size/2;
@@ -13,7 +30,9 @@ int main(void){
 	DWORD steps=10,angle_steps=1;
 	DWORD epochs=100,n_particles=200,variogram_type=SPHERICAL_VARIOGRAM;
 	Objects* data=read_IGRA("US_IGRA",60,221,TRUE);
-	DWORD i,j,index=0;
+	TimeIndex* time_index=build_time_index(data);
+	Objects slice;
+	DWORD i,j;
 	DTYPE* C=Calloc(3,DTYPE);
 	DTYPE increment=-88;
 	DWORD variogram_size=variogram_model_length(variogram_type);
@@ -23,22 +42,16 @@ int main(void){
 
 	for(j=0;j<60;j++){
 		//Data for day i are read
-		Object** filtered=Calloc(data->size,Object*);
-		index=0;
 		if(j%2==0){
 			increment+=88;
 		}else{
 			increment+=12;
 		}
-		for(i=0;i<data->size;i++){
-			//printf("x=%lf,y=%lf,t=%lf,time=%lf\n",data->objects[i]->spatial_coordinates[0],data->objects[i]->spatial_coordinates[1],data->objects[i]->attribute,data->objects[i]->time);
-			if(data->objects[i]->time==2014010100+increment&&data->objects[i]->attribute!=-9999){
-				filtered[index++]=data->objects[i];
-			}
+		//Objects with missing attributes are excluded by the time index
+		if(!get_time_slice(time_index,2014010100+increment,&slice,FALSE)||slice.size<2){
+			continue;
 		}
-		Objects* filtered_data=Calloc(1,Objects);
-		filtered_data->size=index;
-		filtered_data->objects=filtered;
+		Objects* filtered_data=&slice;
 		Samples* samples=variogram_sampling(filtered_data, bound, angle_bound, step_size, steps,angle_steps, C, smoothing_type);
 		//print_samples(samples);
 		randomize_variogram(samples, C, variogram_type);
@@ -49,7 +62,8 @@ int main(void){
 		printf("real mse=%lf\n",evaluate_model(samples, C, variogram_type));
 		
 		//C=variogram_PSO(data,samples,epochs, n_particles, variogram_type, c1,c2,alpha);
-		variogram_WLS(samples,C,2000, variogram_type,.5);
+		variogram_LM(samples,C,variogram_type,NULL,NULL,100,1e-9);
+		//variogram_WLS(samples,C,2000, variogram_type,.5);
 
 		for(i=0;i<3;i++){
 			printf("C[%lld]=%lf,",i,C[i]);
@@ -57,8 +71,30 @@ int main(void){
 		printf("real mse=%lf\n",evaluate_model(samples, C, variogram_type));
 		//write_variogram_result("test.txt", TRUE, samples, C, variogram_type);
 		destroy_samples(samples);
-		Free(filtered);
-		Free(filtered_data);
 	}
+	destroy_time_index(time_index);
+	Free(C);
+	//Space-time fit over all days, with temporal lags in hours
+	Objects valid;
+	valid.objects=Calloc(data->size,Object*);
+	valid.size=0;
+	for(i=0;i<data->size;i++){
+		if(data->objects[i]->attribute!=MISSING_ATTRIBUTE){
+			data->objects[i]->time=IGRA_hours(data->objects[i]->time);
+			valid.objects[valid.size++]=data->objects[i];
+		}
+	}
+	variogram_type=ST_EXPONENTIAL_PRODUCT_VARIOGRAM;
+	Samples* samples=variogram_sampling_ST(&valid,bound,step_size,steps,6,12,6,NULL,smoothing_type);
+	PSOSettings settings;
+	default_PSO_settings(&settings);
+	C=variogram_PSO_multistart(samples,variogram_type,&settings,NULL);
+	printf("ST LM iterations=%lld\n",variogram_LM(samples,C,variogram_type,NULL,NULL,100,1e-9));
+	for(i=0;i<variogram_model_length(variogram_type);i++){
+		printf("C[%lld]=%lf,",i,C[i]);
+	}
+	printf("real mse=%lf\n",evaluate_model(samples,C,variogram_type));
+	destroy_samples(samples);
+	Free(valid.objects);
 	Free(C);
 }
@@ -25,9 +25,14 @@ int main(void){
 	Matrix* coefficients=construct_st_model(data,0,7);
 	data->size=size;
 	print_matrix(coefficients);
+	//Index the whole dataset once for all predictions
+	KDTree* tree=build_kd_tree(data);
+	TimeIndex* index=build_time_index(data);
 	for(i=data->size*9/10;i<data->size;i++){
-		printf("%lf,%lf\n",data->objects[i]->attribute,predict_attribute(data,data->objects[i],0,7,coefficients));
+		printf("%lf,%lf\n",data->objects[i]->attribute,predict_attribute_indexed(tree,index,data->objects[i],0,7,coefficients));
 	}
+	destroy_kd_tree(tree);
+	destroy_time_index(index);
 	destroy_matrix(coefficients);
 	return 0;
 }
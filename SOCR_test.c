@@ -6,6 +6,7 @@
 #include "random.h"
 #include "clusterfunctions.h"
 #include "datafunctions.h"
+#include "krigprofile.h"
 /*
  * This file explains how to use Kriging clustering algorithm for SOCR data
 */
@@ -82,7 +83,12 @@ int main(void){
 	distances[0]=DIS_UNCHECKED;
 	distances[1]=DIS_UNCHECKED;
 	//Kriging clustering for data.
+	krig_profile_reset();
 	Clusters* clusters=krig_clustering(data->objects,data->size,1,C,distances,ANISOTROPHY_POWER_VARIOGRAM);
+#ifdef KRIG_PROFILE
+	//Phase timers of the clustering run, only available when built with 'make PROFILE=1'.
+	krig_profile_write_json("SOCR_profile.json");
+#endif
 	print_clusters(clusters);
 	//Write clusters to local file.
 	write_clusters(clusters,"SOCR_",TRUE);
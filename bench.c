@@ -0,0 +1,277 @@
+/*
+*  Copyright (C) 2016, Northwestern University.
+*/
+#include "cluster.h"
+#include "matrix.h"
+#include "clusterfunctions.h"
+#include "krigfunctions.h"
+#include "random.h"
+/*
+ * Microbenchmarks for the numerical kernels used by Kriging clustering and variogram training.
+ * Every kernel is run over a sweep of problem sizes on synthetic inputs with a fixed seed.
+ * A measurement repeats the kernel until it takes at least BENCH_MIN_SAMPLE_NS, and the first BENCH_WARMUP measurements are dropped.
+ * Results are written to stdout as csv with columns (kernel,n,repeats,inner,median_ns,p10_ns,p90_ns,gflops), times are per operation.
+ * gflops is left empty for kernels without a meaningful floating point operation count.
+ * Usage: ./bench [max_n] [repeats]
+*/
+#define BENCH_WARMUP 2
+#define BENCH_MIN_SAMPLE_NS 2000000LL
+#define BENCH_DEFAULT_MAX_N 512
+#define BENCH_DEFAULT_REPEATS 11
+
+typedef void (*BenchKernel)(void* arg);
+
+typedef struct{
+	Matrix* A;
+	Matrix* B;
+	Matrix* b;
+	Objects* objects;
+	Cluster* cluster;
+	Object* target;
+	Samples* samples;
+	DTYPE* C;
+	DTYPE max_distance[2];
+} BenchInput;
+
+static volatile DTYPE sink;
+
+static DWORD now_ns(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (DWORD)t.tv_sec*1000000000LL+t.tv_nsec;
+}
+
+static int dword_cmp(const void* a,const void* b){
+	DWORD x=*(DWORD*)a,y=*(DWORD*)b;
+	return x<y?-1:(x>y);
+}
+
+/*
+ * Fill a square matrix with a diagonally dominant random matrix, so that every factorization succeeds without pivoting trouble.
+*/
+static Matrix* random_matrix(DWORD n_row,DWORD n_column){
+	Matrix* m=create_matrix(n_row,n_column);
+	DWORD i,j;
+	for(i=0;i<n_row;i++){
+		for(j=0;j<n_column;j++){
+			m->matrix[i][j]=genrand_real2()-.5;
+		}
+		if(i<n_column){
+			m->matrix[i][i]+=n_column;
+		}
+	}
+	return m;
+}
+
+static Object* random_object(){
+	Object* object=Calloc(1,Object);
+	object->spatial_coordinates=create_spatial_coordinates(genrand_real2()*1000,genrand_real2()*1000);
+	object->time=0;
+	object->attribute=sin(object->spatial_coordinates[0]/100)*100+cos(object->spatial_coordinates[1]/150)*80+genrand_real2()*10;
+	object->normalized_value=0;
+	object->neighbors=-1;
+	return object;
+}
+
+static void destroy_object(Object* object){
+	Free(object->spatial_coordinates);
+	Free(object);
+}
+
+static Objects* random_objects(DWORD size){
+	Objects* objects=Calloc(1,Objects);
+	objects->objects=Calloc(size,Object*);
+	objects->size=size;
+	DWORD i;
+	for(i=0;i<size;i++){
+		objects->objects[i]=random_object();
+	}
+	return objects;
+}
+
+static Samples* random_samples(DWORD size){
+	Samples* samples=create_samples(size);
+	DWORD i;
+	for(i=0;i<size;i++){
+		samples->x[i]=genrand_real2()*300+1;
+		samples->phi[i]=genrand_real2()*M_PI;
+		samples->y[i]=genrand_real2()*20000+100;
+		samples->N[i]=genrand_int32()%500+1;
+	}
+	return samples;
+}
+
+static void bench_lu(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix** LUP=lower_upper_permutation(input->A);
+	DWORD i;
+	sink=LUP[1]->matrix[0][0];
+	for(i=0;i<4;i++){
+		destroy_matrix(LUP[i]);
+	}
+	Free(LUP);
+}
+
+static void bench_solve(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix* x=solve_linear_system(input->A,input->b);
+	sink=x->matrix[0][0];
+	destroy_matrix(x);
+}
+
+static void bench_solve_mixed(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix* x=solve_mixed_precision(input->A,input->b);
+	sink=x==NULL?0:x->matrix[0][0];
+	destroy_matrix(x);
+}
+
+static void bench_matrix_multiplication(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix* m=matrix_multiplication(input->A,input->B);
+	sink=m->matrix[0][0];
+	destroy_matrix(m);
+}
+
+static void bench_strassen(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix* m=strassen_multiplication(input->A,input->B);
+	sink=m->matrix[0][0];
+	destroy_matrix(m);
+}
+
+static void bench_naive(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix* m=naive_multiplication(input->A,input->B);
+	sink=m->matrix[0][0];
+	destroy_matrix(m);
+}
+
+static void bench_krig_weights(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	Matrix* lambda=krig_weights(input->objects,input->target,input->C,ANISOTROPHY_POWER_VARIOGRAM);
+	sink=lambda->matrix[0][0];
+	destroy_matrix(lambda);
+}
+
+static void bench_krig_normalize(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	sink=krig_normalize(input->cluster,input->target,input->C,input->max_distance,ANISOTROPHY_POWER_VARIOGRAM);
+}
+
+static void bench_variogram_sampling(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	DTYPE step_size=25;
+	Samples* samples=variogram_sampling(input->objects,step_size/2,M_PI/16,step_size,10,8,input->C,UNIFORM_SMOOTHING);
+	sink=samples->size;
+	destroy_samples(samples);
+}
+
+static void bench_evaluate_model(void* arg){
+	BenchInput* input=(BenchInput*)arg;
+	sink=evaluate_model(input->samples,input->C,ANISOTROPHY_POWER_VARIOGRAM);
+}
+
+/*
+ * Time a kernel and print one csv row.
+ * flops: Floating point operations of a single call, or a non-positive value if not meaningful.
+*/
+static void run_benchmark(char* name,DWORD n,BenchKernel kernel,void* arg,DWORD repeats,DTYPE flops){
+	DWORD inner=1,i,j,start,elapsed;
+	DWORD* times=Calloc(repeats,DWORD);
+	/*Calibrate the number of calls per measurement, this also serves as warm up.*/
+	while(1){
+		start=now_ns();
+		for(j=0;j<inner;j++){
+			kernel(arg);
+		}
+		elapsed=now_ns()-start;
+		if(elapsed>=BENCH_MIN_SAMPLE_NS){
+			break;
+		}
+		inner*=2;
+	}
+	for(i=0;i<BENCH_WARMUP+repeats;i++){
+		start=now_ns();
+		for(j=0;j<inner;j++){
+			kernel(arg);
+		}
+		elapsed=now_ns()-start;
+		if(i>=BENCH_WARMUP){
+			times[i-BENCH_WARMUP]=elapsed/inner;
+		}
+	}
+	qsort(times,repeats,sizeof(DWORD),dword_cmp);
+	DWORD median=times[repeats/2];
+	DWORD p10=times[(repeats-1)/10];
+	DWORD p90=times[(repeats-1)-(repeats-1)/10];
+	printf("%s,%lld,%lld,%lld,%lld,%lld,%lld,",name,n,repeats,inner,median,p10,p90);
+	if(flops>0&&median>0){
+		printf("%.4lf\n",flops/median);
+	}else{
+		printf("\n");
+	}
+	fflush(stdout);
+	Free(times);
+}
+
+int main(int argc,char** argv){
+	DWORD max_n=BENCH_DEFAULT_MAX_N,repeats=BENCH_DEFAULT_REPEATS,n,i;
+	DTYPE C[4]={14000,38,15,1.99};
+	BenchInput input;
+	if(argc>1){
+		max_n=atoll(argv[1]);
+	}
+	if(argc>2){
+		repeats=atoll(argv[2]);
+	}
+	if(repeats<1){
+		repeats=1;
+	}
+	init_genrand(555);
+	input.C=C;
+	input.max_distance[0]=DIS_UNCHECKED;
+	input.max_distance[1]=DIS_UNCHECKED;
+	printf("kernel,n,repeats,inner,median_ns,p10_ns,p90_ns,gflops\n");
+	/*Dense linear algebra*/
+	for(n=16;n<=max_n;n*=2){
+		input.A=random_matrix(n,n);
+		input.B=random_matrix(n,n);
+		input.b=random_matrix(n,1);
+		run_benchmark("lower_upper_permutation",n,bench_lu,&input,repeats,2.0/3*n*n*n);
+		run_benchmark("solve_linear_system",n,bench_solve,&input,repeats,2.0/3*n*n*n+2.0*n*n);
+		run_benchmark("solve_mixed_precision",n,bench_solve_mixed,&input,repeats,2.0/3*n*n*n+2.0*n*n);
+		run_benchmark("matrix_multiplication",n,bench_matrix_multiplication,&input,repeats,2.0*n*n*n);
+		run_benchmark("strassen_multiplication",n,bench_strassen,&input,repeats,2.0*n*n*n);
+		run_benchmark("naive_multiplication",n,bench_naive,&input,repeats,2.0*n*n*n);
+		destroy_matrix(input.A);
+		destroy_matrix(input.B);
+		destroy_matrix(input.b);
+	}
+	/*Kriging system for a single target, the nominal count covers the solve of the (n+1)x(n+1) system.*/
+	for(n=16;n<=max_n;n*=2){
+		input.objects=random_objects(n);
+		input.target=random_object();
+		input.cluster=create_cluster();
+		for(i=0;i<n;i++){
+			add_to_cluster(input.cluster,input.objects->objects[i]);
+		}
+		run_benchmark("krig_weights",n,bench_krig_weights,&input,repeats,2.0/3*(n+1)*(n+1)*(n+1)+2.0*(n+1)*(n+1));
+		run_benchmark("krig_normalize",n,bench_krig_normalize,&input,repeats,2.0/3*(n+1)*(n+1)*(n+1)+2.0*(n+1)*(n+1));
+		destroy_cluster(input.cluster);
+		destroy_object(input.target);
+		destroy_objects(input.objects);
+	}
+	/*Variogram training*/
+	for(n=16;n<=max_n;n*=2){
+		input.objects=random_objects(n);
+		run_benchmark("variogram_sampling",n,bench_variogram_sampling,&input,repeats,0);
+		destroy_objects(input.objects);
+	}
+	for(n=64;n<=max_n*64;n*=4){
+		input.samples=random_samples(n);
+		run_benchmark("evaluate_model",n,bench_evaluate_model,&input,repeats,0);
+		destroy_samples(input.samples);
+	}
+	return 0;
+}
@@ -74,24 +74,165 @@ typedef struct{
 	Cluster** clusters;
 	DWORD size;
 } Clusters;
+/*
+ * Index of a dataset by time stamp.
+ * objects: All objects sorted by time. Inside each time stamp, objects with valid attributes are placed before missing ones.
+ * size: Number of objects.
+ * times: Distinct time stamps in ascending order.
+ * offsets: Bucket b contains objects[offsets[b]] to objects[offsets[b+1]-1]. Array has n_buckets+1 elements.
+ * valid: Number of objects with valid attributes at the front of each bucket.
+ * n_buckets: Number of distinct time stamps.
+*/
+typedef struct{
+	Object** objects;
+	DWORD size;
+	TEMPORAL_TYPE* times;
+	DWORD* offsets;
+	DWORD* valid;
+	DWORD n_buckets;
+} TimeIndex;
+/*
+ * Spatial k-d tree over a set of objects, stored as an implicit balanced tree.
+ * The node of the position range [low,high) is at (low+high)/2 and splits the range on axis[(low+high)/2].
+ * objects: Objects in tree order.
+ * dimension: 2 for planar distances. 3 for chordal and great-circle distances, where the tree is built on the unit vectors.
+ * coordinates: Coordinates in tree order, coordinates[d] for axis d<dimension.
+ * order: Position of every object in the dataset the tree was built from. Ties in distance go to the smaller position.
+ * axis: Split axis of every node.
+ * size: Number of objects.
+*/
+typedef struct{
+	Object** objects;
+	WORD dimension;
+	SPATIAL_TYPE* coordinates[3];
+	DWORD* order;
+	WORD* axis;
+	DWORD size;
+} KDTree;
+/*
+ * Uniform grid over the bounding box of a set of objects, used to enumerate pairs within a cutoff distance.
+ * Cell (cx,cy,cz) is c=(cz*ny+cy)*nx+cx and holds indices members[start[c]] to members[start[c+1]-1] in ascending order.
+ * Planar grids cover the first two coordinates and have nz=1. For chordal and great-circle distances the grid covers the unit vectors, and cell_size is a chord.
+*/
+typedef struct{
+	DTYPE x_min;
+	DTYPE y_min;
+	DTYPE z_min;
+	DTYPE cell_size;
+	DWORD nx;
+	DWORD ny;
+	DWORD nz;
+	DWORD* start;
+	DWORD* members;
+} CellList;
+/*
+ * Objects with co-located duplicates merged, see coalesce_objects.
+ * objects: One conditioning object per group, at the mean location of its members and holding their mean attribute. Owned by the structure.
+ * group: Group of every original object.
+ * counts: Number of members of every group.
+ * size: Number of original objects.
+*/
+typedef struct{
+	Objects* objects;
+	DWORD* group;
+	DWORD* counts;
+	DWORD size;
+} CoalescedObjects;
+/*
+ * State of a Kriging clustering run, see write_clustering_snapshot.
+ * size: Number of objects. Objects are identified by their position in the array passed to the clustering.
+ * n_clusters: Number of clusters.
+ * position: Next cluster to go through the filtering and revision phases. n_clusters for a finished run.
+ * phase, element, change, next: Where the run stopped inside cluster position: FILTERING_PHASE or REVISION_PHASE, number of members of the scanned cluster kept before the next one, whether the pass changed anything so far, and the cluster receiving filtered objects (-1 for none).
+ * filter_steps, revision_steps: Steps taken so far.
+ * variogram_type, n_parameters, C, bound, max_distance: Parameters of the run.
+ * records: (x, y, time stamp, attribute) of every object.
+ * cluster_start, members: Members of cluster c in list order are members[cluster_start[c]] to members[cluster_start[c+1]-1].
+ * labels: Cluster of every object.
+ * mapping, mapping_size: File mapping that holds the arrays of a loaded snapshot, NULL if they are allocated.
+*/
+typedef struct{
+	DWORD size;
+	DWORD n_clusters;
+	DWORD position;
+	DWORD phase;
+	DWORD element;
+	DWORD change;
+	DWORD next;
+	DWORD filter_steps;
+	DWORD revision_steps;
+	DWORD variogram_type;
+	DWORD n_parameters;
+	DTYPE* C;
+	DTYPE bound;
+	DTYPE max_distance[2];
+	DTYPE* records;
+	DWORD* cluster_start;
+	DWORD* members;
+	DWORD* labels;
+	void* mapping;
+	size_t mapping_size;
+} ClusteringSnapshot;
 /*
  * Training sample for variogram
+ * x: Lag of every bin.
+ * phi: Direction of every bin.
+ * y: Empirical variogram of every bin.
+ * N: Number of pairs in every bin. Estimated for approximate sampling.
+ * se: Sampling standard error of y. Zero when every pair is used.
+ * u: Temporal lag of every bin, used by spatio-temporal models. Zero for purely spatial samples.
 */
 typedef struct{
 	DTYPE* x;
 	DTYPE* phi;
 	DTYPE* y;
 	DWORD* N;
+	DTYPE* se;
+	DTYPE* u;
 	DWORD size;
 } Samples;
 /*
- * Particle used in PSO algorithm
+ * Settings of particle swarm optimization for variogram fitting.
+ * swarms: Number of independent swarms (multi-start), all advanced in the same epoch loop.
+ * n_particles: Particles per swarm.
+ * epochs: Maximum number of epochs.
+ * stagnation_epochs: A swarm stops after this many epochs without a relative improvement of at least tolerance. 0 disables early stopping.
+ * tolerance: Relative improvement of the swarm best that resets the stagnation counter.
+ * c1, c2: Cognitive and social acceleration coefficients.
+ * alpha: Inertia weight of the velocity.
+ * variable_projection: Replace the linear parameters of every particle by their least squares solution (see variogram_projection), so the swarm only searches the nonlinear ones. Ignored for models without linear parameters.
+ * validation: If not NULL, particles are scored by variogram_cross_validation on these objects instead of evaluate_model on the samples. Samples still seed the swarms and, with variable_projection, set the linear parameters.
 */
 typedef struct{
-	DTYPE* C;
-	DTYPE* velocity;
-	DTYPE* local_best;
-	DTYPE mse;
-} Particle;
+	DWORD swarms;
+	DWORD n_particles;
+	DWORD epochs;
+	DWORD stagnation_epochs;
+	DTYPE tolerance;
+	DTYPE c1;
+	DTYPE c2;
+	DTYPE alpha;
+	BOOLEAN variable_projection;
+	Objects* validation;
+} PSOSettings;
+/*
+ * Convergence statistics of particle swarm optimization.
+ * best: Objective value of the returned fit.
+ * best_swarm: Swarm that found the returned fit.
+ * evaluations: Number of objective evaluations.
+ * epochs: Number of epochs run before every swarm stopped.
+ * history: Best objective over all swarms after every epoch, epochs+1 entries starting with the initial swarms.
+ * swarm_best: Best objective of every swarm.
+ * swarm_epochs: Epochs every swarm ran before it stopped.
+*/
+typedef struct{
+	DTYPE best;
+	DWORD best_swarm;
+	DWORD evaluations;
+	DWORD epochs;
+	DTYPE* history;
+	DTYPE* swarm_best;
+	DWORD* swarm_epochs;
+} PSOStats;
 
 #endif
@@ -91,6 +91,17 @@ void destroy_clusters(Clusters* clusters){
 	Free(clusters);
 }
 
+void destroy_objects(Objects* data){
+	//Free every object together with its coordinates, then the array
+	DWORD i;
+	for(i=0;i<data->size;i++){
+		Free(data->objects[i]->spatial_coordinates);
+		Free(data->objects[i]);
+	}
+	Free(data->objects);
+	Free(data);
+}
+
 void print_cluster(Cluster* cluster,DWORD i){
 	printf("    ----Printing cluster %lld----\n",i);
 	Object** data=get_objects(cluster);
@@ -179,3 +190,144 @@ void remove_cluster_front(Cluster* cluster){
 		cluster->size-=1;
 	}
 }
+
+static DISTANCE_TYPE distance_mode=PLANAR_DISTANCE;
+
+void set_distance_type(DISTANCE_TYPE distance_type){
+	distance_mode=distance_type;
+}
+
+DISTANCE_TYPE get_distance_type(void){
+	return distance_mode;
+}
+
+void set_unit_vector(SPATIAL_TYPE* coordinates){
+	DTYPE longitude=coordinates[0]*M_PI/180,latitude=coordinates[1]*M_PI/180;
+	coordinates[2]=cos(latitude)*cos(longitude);
+	coordinates[3]=cos(latitude)*sin(longitude);
+	coordinates[4]=sin(latitude);
+}
+
+SPATIAL_TYPE* create_spatial_coordinates(SPATIAL_TYPE x,SPATIAL_TYPE y){
+	SPATIAL_TYPE* coordinates=Calloc(GEODESIC_COORDINATES,SPATIAL_TYPE);
+	coordinates[0]=x;
+	coordinates[1]=y;
+	set_unit_vector(coordinates);
+	return coordinates;
+}
+
+void attach_unit_vectors(Objects* objects){
+	DWORD i;
+	for(i=0;i<objects->size;i++){
+		objects->objects[i]->spatial_coordinates=(SPATIAL_TYPE*)realloc(objects->objects[i]->spatial_coordinates,sizeof(SPATIAL_TYPE)*GEODESIC_COORDINATES);
+		set_unit_vector(objects->objects[i]->spatial_coordinates);
+	}
+}
+
+DTYPE chord_to_distance(DTYPE chord){
+	if(distance_mode==CHORDAL_DISTANCE){
+		return EARTH_RADIUS*chord;
+	}
+	/*Rounding can push the chord of antipodal points slightly above 2*/
+	return 2*EARTH_RADIUS*asin(fmin(chord/2,1));
+}
+
+DTYPE distance_to_chord(DTYPE distance){
+	if(distance_mode==PLANAR_DISTANCE){
+		return distance;
+	}
+	if(distance_mode==CHORDAL_DISTANCE){
+		return distance/EARTH_RADIUS;
+	}
+	/*Every pair is within half the circumference, whose chord is the diameter*/
+	if(distance/EARTH_RADIUS>=M_PI){
+		return 2;
+	}
+	return 2*sin(distance/(2*EARTH_RADIUS));
+}
+
+/*
+ * Coordinates the cell list is laid out in, the unit vector for chordal and great-circle distances.
+*/
+static SPATIAL_TYPE* cell_coordinates(SPATIAL_TYPE* coordinates){
+	return distance_mode==PLANAR_DISTANCE?coordinates:coordinates+2;
+}
+
+DWORD cell_of(CellList* cells,SPATIAL_TYPE* coordinates,DWORD* cx,DWORD* cy,DWORD* cz){
+	SPATIAL_TYPE* p=cell_coordinates(coordinates);
+	*cx=(DWORD)((p[0]-cells->x_min)/cells->cell_size);
+	*cy=(DWORD)((p[1]-cells->y_min)/cells->cell_size);
+	*cz=distance_mode==PLANAR_DISTANCE?0:(DWORD)((p[2]-cells->z_min)/cells->cell_size);
+	if(*cx>=cells->nx){
+		*cx=cells->nx-1;
+	}
+	if(*cy>=cells->ny){
+		*cy=cells->ny-1;
+	}
+	if(*cz>=cells->nz){
+		*cz=cells->nz-1;
+	}
+	return (*cz*cells->ny+*cy)*cells->nx+*cx;
+}
+
+CellList* build_cell_list(Objects* objects,DTYPE cell_size){
+	CellList* cells=Calloc(1,CellList);
+	BOOLEAN geodesic=distance_mode!=PLANAR_DISTANCE;
+	SPATIAL_TYPE* p=cell_coordinates(objects->objects[0]->spatial_coordinates);
+	DTYPE x_max,y_max,z_max;
+	DWORD i,c,cx,cy,cz,n_cells;
+	cells->x_min=x_max=p[0];
+	cells->y_min=y_max=p[1];
+	cells->z_min=z_max=geodesic?p[2]:0;
+	for(i=1;i<objects->size;i++){
+		p=cell_coordinates(objects->objects[i]->spatial_coordinates);
+		cells->x_min=fmin(cells->x_min,p[0]);
+		x_max=fmax(x_max,p[0]);
+		cells->y_min=fmin(cells->y_min,p[1]);
+		y_max=fmax(y_max,p[1]);
+		if(geodesic){
+			cells->z_min=fmin(cells->z_min,p[2]);
+			z_max=fmax(z_max,p[2]);
+		}
+	}
+	if(!(cell_size>0)){
+		/*Exact matches only, any size works. Unit vectors start at a chord of about 600m.*/
+		cell_size=geodesic?1e-4:1;
+	}else{
+		cell_size=distance_to_chord(cell_size);
+	}
+	/*Counted in floating point, a small cell_size must not overflow the number of cells*/
+	while(((x_max-cells->x_min)/cell_size+1)*((y_max-cells->y_min)/cell_size+1)*((z_max-cells->z_min)/cell_size+1)>4*objects->size+16){
+		cell_size*=2;
+	}
+	cells->nx=(DWORD)((x_max-cells->x_min)/cell_size)+1;
+	cells->ny=(DWORD)((y_max-cells->y_min)/cell_size)+1;
+	cells->nz=(DWORD)((z_max-cells->z_min)/cell_size)+1;
+	cells->cell_size=cell_size;
+	n_cells=cells->nx*cells->ny*cells->nz;
+	cells->start=Calloc(n_cells+1,DWORD);
+	cells->members=Calloc(objects->size,DWORD);
+	memset(cells->start,0,sizeof(DWORD)*(n_cells+1));
+	/*Counting sort keeps indices ascending inside every cell*/
+	for(i=0;i<objects->size;i++){
+		c=cell_of(cells,objects->objects[i]->spatial_coordinates,&cx,&cy,&cz);
+		cells->start[c+1]++;
+	}
+	for(c=0;c<n_cells;c++){
+		cells->start[c+1]+=cells->start[c];
+	}
+	DWORD* fill=Calloc(n_cells,DWORD);
+	memcpy(fill,cells->start,sizeof(DWORD)*n_cells);
+	for(i=0;i<objects->size;i++){
+		c=cell_of(cells,objects->objects[i]->spatial_coordinates,&cx,&cy,&cz);
+		cells->members[fill[c]++]=i;
+	}
+	Free(fill);
+	return cells;
+}
+
+void destroy_cell_list(CellList* cells){
+	Free(cells->start);
+	Free(cells->members);
+	Free(cells);
+}
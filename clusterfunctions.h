@@ -44,6 +44,11 @@ extern void destroy_cluster(Cluster* cluster);
  * cluster: cluster to be destroyed.
 */
 extern void destroy_clusters(Clusters* clusters);
+/*
+ * Free an array of objects, including the objects and their spatial coordinates.
+ * Only use it for objects that own their coordinates, e.g. objects produced by data readers or the data generator.
+*/
+extern void destroy_objects(Objects* data);
 /*
  * Print a cluster given its id to console.
  * cluster: cluster to be printed.
@@ -102,4 +107,54 @@ extern Samples* create_samples(DWORD size);
  * Free memory space for samples.
 */
 extern void destroy_samples(Samples *samples);
+/*
+ * Select how distance() measures spatial distances, PLANAR_DISTANCE by default.
+ * With CHORDAL_DISTANCE or GREAT_CIRCLE_DISTANCE coordinates are longitude and latitude in degrees and distances are in kilometers.
+ * Like set_solver_type the setting is process wide and applies to every dataset, so select it once before any distance is computed.
+ * Every object involved must then carry a unit vector. Objects from the loaders and the generator do, objects built by the caller need create_spatial_coordinates or attach_unit_vectors.
+*/
+extern void set_distance_type(DISTANCE_TYPE distance_type);
+/*
+ * Current distance type.
+*/
+extern DISTANCE_TYPE get_distance_type(void);
+/*
+ * Fill entries 2,3 and 4 of coordinates with the unit vector of the longitude and latitude in entries 0 and 1.
+ * coordinates: Must have room for GEODESIC_COORDINATES entries.
+*/
+extern void set_unit_vector(SPATIAL_TYPE* coordinates);
+/*
+ * Allocate spatial coordinates with room for GEODESIC_COORDINATES entries, the unit vector of x and y taken as longitude and latitude attached.
+ * Use it for every object, the unit vector is harmless for planar distances and needed for the others.
+*/
+extern SPATIAL_TYPE* create_spatial_coordinates(SPATIAL_TYPE x,SPATIAL_TYPE y);
+/*
+ * Enlarge the coordinates of every object to GEODESIC_COORDINATES entries and attach their unit vectors.
+ * Only needed for objects whose coordinates were not allocated by create_spatial_coordinates, or were moved since.
+*/
+extern void attach_unit_vectors(Objects* objects);
+/*
+ * Distance of two points whose unit vectors are chord apart, in the current distance type.
+ * Chordal: EARTH_RADIUS*chord. Great-circle: 2*EARTH_RADIUS*asin(chord/2).
+*/
+extern DTYPE chord_to_distance(DTYPE chord);
+/*
+ * Shortest chord between unit vectors of points at least distance apart, the inverse of chord_to_distance. Used to turn cutoffs into chords.
+ * Planar: distance itself. Chordal: distance/EARTH_RADIUS. Great-circle: 2*sin(distance/(2*EARTH_RADIUS)), at most 2.
+*/
+extern DTYPE distance_to_chord(DTYPE distance);
+/*
+ * Build a cell list with cells no smaller than cell_size. Cells are enlarged if the grid would have many more cells than objects.
+ * For chordal and great-circle distances the grid covers the unit vectors, cell_size in kilometers is turned into a chord by distance_to_chord.
+ * Points within cell_size of each other are then in the same or adjacent cells in every distance type.
+*/
+extern CellList* build_cell_list(Objects* objects,DTYPE cell_size);
+/*
+ * Cell of a point, clamped to the grid. Column, row and layer are returned in cx, cy and cz. cz is 0 for planar grids.
+*/
+extern DWORD cell_of(CellList* cells,SPATIAL_TYPE* coordinates,DWORD* cx,DWORD* cy,DWORD* cz);
+/*
+ * Free memory space for a cell list.
+*/
+extern void destroy_cell_list(CellList* cells);
 #endif
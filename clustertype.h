@@ -38,6 +38,30 @@
 #define ST_SPHERICAL_PRODUCT_VARIOGRAM 0x7235
 //Spatio-temporal exponential product variogram constant value
 #define ST_EXPONENTIAL_PRODUCT_VARIOGRAM 0x7236
+//Type for linear solver
+#define SOLVER_TYPE WORD
+//Double precision LU solver constant value
+#define DOUBLE_SOLVER 0x9121
+//Mixed precision solver constant value, single precision LU with iterative refinement in double precision
+#define MIXED_PRECISION_SOLVER 0x9122
+//Type for the low precision factorization of the mixed precision solver
+#define FACTOR_TYPE float
+//Type for the distance between spatial coordinates
+#define DISTANCE_TYPE WORD
+//Euclidean distance of the first two spatial coordinates constant value
+#define PLANAR_DISTANCE 0x8241
+//Chord through the sphere constant value, spatial coordinates are longitude and latitude in degrees
+#define CHORDAL_DISTANCE 0x8242
+//Great-circle distance constant value, spatial coordinates are longitude and latitude in degrees
+#define GREAT_CIRCLE_DISTANCE 0x8243
+//Radius of the sphere for chordal and great-circle distances, in kilometers
+#define EARTH_RADIUS 6371.0
+//Number of spatial coordinates with an attached unit vector: longitude, latitude and x,y,z on the unit sphere
+#define GEODESIC_COORDINATES 5
+//Filtering phase of Kriging clustering constant value
+#define FILTERING_PHASE 0x5161
+//Revision phase of Kriging clustering constant value
+#define REVISION_PHASE 0x5162
 //Type for temporal distance
 #define TEMPORAL_DISTANCE 0x725
 //Type for spatial distance
@@ -51,7 +75,7 @@
  * a: number of elements.
  * b: type of element.
 */
-#define Calloc(a,b) ((b*)malloc(sizeof(b)*a))
+#define Calloc(a,b) ((b*)malloc(sizeof(b)*(a)))
 #define Free free
 #define DIS_UNCHECKED -1
 #endif
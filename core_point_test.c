@@ -17,15 +17,15 @@ int main(){
 	DTYPE* distances=Calloc(2,DTYPE);
 	distances[0]=30;
 	distances[1]=DIS_UNCHECKED;
-	Object** filtered=Calloc(data->size,Object*);
-	for(i=0;i<data->size;i++){
-		if(data->objects[i]->time==2014010100&&data->objects[i]->attribute!=-9999){
-			filtered[index++]=data->objects[i];
-			printf("x=%lf,y=%lf,t=%lf,time=%lf\n",data->objects[i]->spatial_coordinates[0],data->objects[i]->spatial_coordinates[1],data->objects[i]->attribute,data->objects[i]->time);
-		}
+	TimeIndex* time_index=build_time_index(data);
+	Objects slice;
+	get_time_slice(time_index,2014010100,&slice,FALSE);
+	Object** filtered=slice.objects;
+	index=slice.size;
+	for(i=0;i<index;i++){
+		printf("x=%lf,y=%lf,t=%lf,time=%lf\n",filtered[i]->spatial_coordinates[0],filtered[i]->spatial_coordinates[1],filtered[i]->attribute,filtered[i]->time);
 	}
 	//printf("index=%lld\n",index);
-	filtered=(Object**)realloc(filtered,sizeof(Object*)*index);
 	Objects* objects=Calloc(1,Objects);
 	objects->objects=filtered+1;
 	objects->size=index-1;
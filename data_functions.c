@@ -3,7 +3,12 @@
 * This file contains data I/O interface for the rest of program.
 * See also datafunctions.h
 */
+//strptime is declared by time.h only for X/Open sources.
+#define _GNU_SOURCE
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include "clusterfunctions.h"
 #include "datafunctions.h"
 #include "krigfunctions.h"
@@ -34,7 +39,7 @@ void read_IGRA_station(Object** data,char* path,DWORD time_elapse,char* cx,char*
 	//Initialize strings
 	char header[HEADER_LENGTH+2];
 	header[HEADER_LENGTH]='\0';
-	char record[DATA_LENGTH+1];
+	char record[DATA_LENGTH+2];
 	record[DATA_LENGTH]='\0';
 	char attribute[ATTRIBUTE_LENGTH+2];
 	attribute[ATTRIBUTE_LENGTH]='\0';
@@ -55,9 +60,7 @@ void read_IGRA_station(Object** data,char* path,DWORD time_elapse,char* cx,char*
 		memcpy(date,header+6,sizeof(char)*DATE_LENGTH);
 		//2 dimensional coordinates
 		data[i]=Calloc(1,Object);
-		data[i]->spatial_coordinates=Calloc(2,SPATIAL_TYPE);
-		data[i]->spatial_coordinates[0]=x;
-		data[i]->spatial_coordinates[1]=y;
+		data[i]->spatial_coordinates=create_spatial_coordinates(x,y);
 		data[i]->time=atof(date);
 		data[i]->neighbors=-1;
 		data[i]->normalized_value=0;
@@ -74,7 +77,7 @@ void read_IGRA_station(Object** data,char* path,DWORD time_elapse,char* cx,char*
 			if(record[20]=='B'&&record[0]=='2'&&record[1]=='1'){
 				memcpy(attribute,record+15,sizeof(char)*ATTRIBUTE_LENGTH);
 				//printf("temperature=%s\n",temperature);
-				if(atof(attribute)!=-9999){
+				if(atof(attribute)!=MISSING_ATTRIBUTE){
 					data[i]->attribute+=atof(attribute);
 					counter++;
 				}
@@ -88,7 +91,7 @@ void read_IGRA_station(Object** data,char* path,DWORD time_elapse,char* cx,char*
 			//printf("%ld\n",counter);
 		}else{
 			//-9999 means this attribute does not exist
-			data[i]->attribute=-9999;
+			data[i]->attribute=MISSING_ATTRIBUTE;
 			strcpy(buffer,"-9999");
 		}
 		//Store to local file stream if needed.
@@ -124,7 +127,7 @@ void write_clusters(Clusters* clusters,char* filename,BOOLEAN header){
 void write_variogram_result(char* filename, BOOLEAN header, Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type){
 	FILE* local_copy = fopen( filename , "w" );
 	DWORD i;
-	DTYPE parameters[2];
+	DTYPE parameters[3];
 	DTYPE gamma_hat;
 	if(header){
 		fprintf(local_copy,"%s,%s,%s,%s,%s\n","x","phi","N","y","predict");
@@ -132,6 +135,7 @@ void write_variogram_result(char* filename, BOOLEAN header, Samples* samples, DT
 	for(i=0;i<samples->size;i++){
 		parameters[0]=samples->x[i];
 		parameters[1]=samples->phi[i];
+		parameters[2]=samples->u[i];
 		gamma_hat=compute_variogram_by_parameters(parameters,C,variogram_type);
 		fprintf(local_copy,"%lf,%lf,%lld,%lf,%lf\n",samples->x[i],samples->phi[i],samples->N[i],samples->y[i],gamma_hat);
 	}
@@ -150,6 +154,256 @@ void write_spatial_temporal_data(Objects* data,char* filename,BOOLEAN header){
 	fclose(local_copy);
 }
 
+void write_binary_data(Objects* data,char* filename){
+	FILE* file=fopen(filename,"wb");
+	DWORD i,header[2];
+	DTYPE record[4];
+	if(file==NULL){
+		printf("Cannot open %s\n",filename);
+		return;
+	}
+	header[0]=BINARY_DATA_MAGIC;
+	header[1]=data->size;
+	fwrite(header,sizeof(DWORD),2,file);
+	for(i=0;i<data->size;i++){
+		record[0]=data->objects[i]->spatial_coordinates[0];
+		record[1]=data->objects[i]->spatial_coordinates[1];
+		record[2]=data->objects[i]->time;
+		record[3]=data->objects[i]->attribute;
+		fwrite(record,sizeof(DTYPE),4,file);
+	}
+	fclose(file);
+}
+
+Objects* read_binary_data(char* filename){
+	FILE* file=fopen(filename,"rb");
+	DWORD i,header[2];
+	DTYPE record[4];
+	if(file==NULL){
+		printf("Cannot open %s\n",filename);
+		return NULL;
+	}
+	if(fread(header,sizeof(DWORD),2,file)!=2||header[0]!=BINARY_DATA_MAGIC||header[1]<0){
+		printf("%s is not a binary data file\n",filename);
+		fclose(file);
+		return NULL;
+	}
+	Objects* result=Calloc(1,Objects);
+	result->objects=Calloc(header[1],Object*);
+	result->size=0;
+	for(i=0;i<header[1];i++){
+		if(fread(record,sizeof(DTYPE),4,file)!=4){
+			printf("%s is truncated after %lld records\n",filename,i);
+			break;
+		}
+		Object* object=Calloc(1,Object);
+		object->spatial_coordinates=create_spatial_coordinates(record[0],record[1]);
+		object->time=record[2];
+		object->attribute=record[3];
+		object->neighbors=-1;
+		object->normalized_value=0;
+		result->objects[i]=object;
+		result->size++;
+	}
+	fclose(file);
+	return result;
+}
+
+BOOLEAN write_clustering_snapshot(ClusteringSnapshot* snapshot,char* filename){
+	DWORD header[SNAPSHOT_HEADER_SIZE];
+	DTYPE parameters[3];
+	BOOLEAN written;
+	char* temporary=Calloc(strlen(filename)+5,char);
+	sprintf(temporary,"%s.tmp",filename);
+	FILE* file=fopen(temporary,"wb");
+	if(file==NULL){
+		printf("Cannot open %s\n",temporary);
+		Free(temporary);
+		return FALSE;
+	}
+	header[0]=SNAPSHOT_MAGIC;
+	header[1]=SNAPSHOT_VERSION;
+	header[2]=snapshot->size;
+	header[3]=snapshot->n_clusters;
+	header[4]=snapshot->position;
+	header[5]=snapshot->phase;
+	header[6]=snapshot->element;
+	header[7]=snapshot->change;
+	header[8]=snapshot->next;
+	header[9]=snapshot->filter_steps;
+	header[10]=snapshot->revision_steps;
+	header[11]=snapshot->variogram_type;
+	header[12]=snapshot->n_parameters;
+	parameters[0]=snapshot->bound;
+	parameters[1]=snapshot->max_distance[0];
+	parameters[2]=snapshot->max_distance[1];
+	written=fwrite(header,sizeof(DWORD),SNAPSHOT_HEADER_SIZE,file)==SNAPSHOT_HEADER_SIZE
+		&&fwrite(parameters,sizeof(DTYPE),3,file)==3
+		&&fwrite(snapshot->C,sizeof(DTYPE),snapshot->n_parameters,file)==(size_t)snapshot->n_parameters
+		&&fwrite(snapshot->records,sizeof(DTYPE),4*snapshot->size,file)==(size_t)(4*snapshot->size)
+		&&fwrite(snapshot->cluster_start,sizeof(DWORD),snapshot->n_clusters+1,file)==(size_t)(snapshot->n_clusters+1)
+		&&fwrite(snapshot->members,sizeof(DWORD),snapshot->size,file)==(size_t)snapshot->size
+		&&fwrite(snapshot->labels,sizeof(DWORD),snapshot->size,file)==(size_t)snapshot->size;
+	if(fclose(file)!=0){
+		written=FALSE;
+	}
+	if(!written||rename(temporary,filename)!=0){
+		printf("Cannot write snapshot %s\n",filename);
+		remove(temporary);
+		written=FALSE;
+	}
+	Free(temporary);
+	return written;
+}
+
+/*
+ * Whether the contents of a mapped snapshot describe a clustering that krig_clustering_checkpointed can continue.
+ * Every object is a member of exactly one cluster, the one its label names, and the position in the run refers to existing clusters and members.
+*/
+static BOOLEAN snapshot_consistent(ClusteringSnapshot* snapshot){
+	DWORD c,k,m;
+	BOOLEAN consistent=snapshot->cluster_start[0]==0&&snapshot->cluster_start[snapshot->n_clusters]==snapshot->size;
+	for(c=0;c<snapshot->n_clusters&&consistent;c++){
+		consistent=snapshot->cluster_start[c]<=snapshot->cluster_start[c+1]&&snapshot->cluster_start[c+1]<=snapshot->size;
+	}
+	/*With the ranges in order the members fill exactly size slots, so each object is listed once if none is listed twice*/
+	BOOLEAN* seen=Calloc(snapshot->size>0?snapshot->size:1,BOOLEAN);
+	memset(seen,0,sizeof(BOOLEAN)*snapshot->size);
+	for(c=0;c<snapshot->n_clusters&&consistent;c++){
+		for(k=snapshot->cluster_start[c];k<snapshot->cluster_start[c+1];k++){
+			m=snapshot->members[k];
+			if(m<0||m>=snapshot->size||seen[m]||snapshot->labels[m]!=c){
+				consistent=FALSE;
+				break;
+			}
+			seen[m]=TRUE;
+		}
+	}
+	Free(seen);
+	if(!consistent||snapshot->position<0||snapshot->position>snapshot->n_clusters||snapshot->filter_steps<0||snapshot->revision_steps<0){
+		return FALSE;
+	}
+	if(snapshot->position==snapshot->n_clusters){
+		return TRUE;
+	}
+	if(snapshot->next<-1||snapshot->next>=snapshot->n_clusters||(snapshot->change!=0&&snapshot->change!=1)||snapshot->element<0||snapshot->element>snapshot->size){
+		return FALSE;
+	}
+	/*The revision phase works on the cluster of filtered objects, which must exist*/
+	return snapshot->phase==FILTERING_PHASE||(snapshot->phase==REVISION_PHASE&&snapshot->next>=0);
+}
+
+ClusteringSnapshot* load_clustering_snapshot(char* filename){
+	struct stat status;
+	DWORD* header;
+	DTYPE* parameters;
+	size_t expected,remaining;
+	int file=open(filename,O_RDONLY);
+	if(file<0){
+		printf("Cannot open %s\n",filename);
+		return NULL;
+	}
+	if(fstat(file,&status)!=0||(size_t)status.st_size<sizeof(DWORD)*SNAPSHOT_HEADER_SIZE+sizeof(DTYPE)*3){
+		printf("%s is not a snapshot file\n",filename);
+		close(file);
+		return NULL;
+	}
+	void* mapping=mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,file,0);
+	close(file);
+	if(mapping==MAP_FAILED){
+		printf("Cannot map %s\n",filename);
+		return NULL;
+	}
+	header=(DWORD*)mapping;
+	/*Every count is bounded by the file size before the expected size is computed, so corrupt counts cannot overflow it*/
+	remaining=(size_t)status.st_size-sizeof(DWORD)*SNAPSHOT_HEADER_SIZE-sizeof(DTYPE)*3;
+	if(header[0]!=SNAPSHOT_MAGIC||header[1]!=SNAPSHOT_VERSION||header[2]<0||(size_t)header[2]>remaining/(sizeof(DTYPE)*4+sizeof(DWORD)*2)||header[3]<0||(size_t)header[3]>=remaining/sizeof(DWORD)||header[12]<0||(size_t)header[12]>remaining/sizeof(DTYPE)){
+		printf("%s is not a snapshot file of version %d\n",filename,SNAPSHOT_VERSION);
+		munmap(mapping,status.st_size);
+		return NULL;
+	}
+	expected=sizeof(DWORD)*SNAPSHOT_HEADER_SIZE+sizeof(DTYPE)*(3+header[12]+4*header[2])+sizeof(DWORD)*(header[3]+1+2*header[2]);
+	if(expected!=(size_t)status.st_size){
+		printf("%s is not a snapshot file of version %d\n",filename,SNAPSHOT_VERSION);
+		munmap(mapping,status.st_size);
+		return NULL;
+	}
+	ClusteringSnapshot* snapshot=Calloc(1,ClusteringSnapshot);
+	snapshot->size=header[2];
+	snapshot->n_clusters=header[3];
+	snapshot->position=header[4];
+	snapshot->phase=header[5];
+	snapshot->element=header[6];
+	snapshot->change=header[7];
+	snapshot->next=header[8];
+	snapshot->filter_steps=header[9];
+	snapshot->revision_steps=header[10];
+	snapshot->variogram_type=header[11];
+	snapshot->n_parameters=header[12];
+	parameters=(DTYPE*)(header+SNAPSHOT_HEADER_SIZE);
+	snapshot->bound=parameters[0];
+	snapshot->max_distance[0]=parameters[1];
+	snapshot->max_distance[1]=parameters[2];
+	snapshot->C=parameters+3;
+	snapshot->records=snapshot->C+snapshot->n_parameters;
+	snapshot->cluster_start=(DWORD*)(snapshot->records+4*snapshot->size);
+	snapshot->members=snapshot->cluster_start+snapshot->n_clusters+1;
+	snapshot->labels=snapshot->members+snapshot->size;
+	snapshot->mapping=mapping;
+	snapshot->mapping_size=status.st_size;
+	if(!snapshot_consistent(snapshot)){
+		printf("%s is corrupted\n",filename);
+		destroy_clustering_snapshot(snapshot);
+		return NULL;
+	}
+	return snapshot;
+}
+
+void destroy_clustering_snapshot(ClusteringSnapshot* snapshot){
+	if(snapshot->mapping!=NULL){
+		munmap(snapshot->mapping,snapshot->mapping_size);
+	}else{
+		Free(snapshot->C);
+		Free(snapshot->records);
+		Free(snapshot->cluster_start);
+		Free(snapshot->members);
+		Free(snapshot->labels);
+	}
+	Free(snapshot);
+}
+
+Objects* snapshot_objects(ClusteringSnapshot* snapshot){
+	DWORD i;
+	Objects* result=Calloc(1,Objects);
+	result->objects=Calloc(snapshot->size,Object*);
+	result->size=snapshot->size;
+	for(i=0;i<snapshot->size;i++){
+		Object* object=Calloc(1,Object);
+		object->spatial_coordinates=create_spatial_coordinates(snapshot->records[4*i],snapshot->records[4*i+1]);
+		object->time=snapshot->records[4*i+2];
+		object->attribute=snapshot->records[4*i+3];
+		object->neighbors=-1;
+		object->normalized_value=0;
+		result->objects[i]=object;
+	}
+	return result;
+}
+
+Clusters* snapshot_clusters(ClusteringSnapshot* snapshot,Object** data){
+	DWORD c,k;
+	Clusters* result=Calloc(1,Clusters);
+	result->size=snapshot->n_clusters;
+	result->clusters=Calloc(snapshot->n_clusters,Cluster*);
+	for(c=0;c<snapshot->n_clusters;c++){
+		result->clusters[c]=create_cluster();
+		for(k=snapshot->cluster_start[c];k<snapshot->cluster_start[c+1];k++){
+			data[snapshot->members[k]]->neighbors=-1;
+			add_to_cluster(result->clusters[c],data[snapshot->members[k]]);
+		}
+	}
+	return result;
+}
+
 Objects* read_IGRA(char* dir_name,DWORD time_elapse,DWORD station_size,BOOLEAN local_copy_flag){
 	//Intialize strings with constant size.
 
@@ -246,7 +500,11 @@ DWORD count_lines(char* filename){
 */
 TEMPORAL_TYPE parse_time(char* time){
 	struct tm tm;
-	strptime(time, "%Y-%m-%d  %H:%M:%S", &tm);
+	memset(&tm,0,sizeof(struct tm));
+	/*Time stamps written by write_spatial_temporal_data are plain numbers*/
+	if(strptime(time, "%Y-%m-%d  %H:%M:%S", &tm)==NULL){
+		return atof(time);
+	}
 	time_t t = mktime(&tm);
 	return (DTYPE) t;
 }
@@ -258,7 +516,7 @@ TEMPORAL_TYPE parse_time(char* time){
 */
 Object* read_spatial_temporal_object(char* line){
 	Object* object=Calloc(1,Object);
-	object->spatial_coordinates=Calloc(2,SPATIAL_TYPE);
+	object->spatial_coordinates=Calloc(GEODESIC_COORDINATES,SPATIAL_TYPE);
 	//parse for x coordinate
 	char* cpt=line;
 	DWORD size=0;
@@ -283,6 +541,7 @@ Object* read_spatial_temporal_object(char* line){
 	y[size]='\0';
 	memcpy(y,line,sizeof(char)*size);
 	object->spatial_coordinates[1]=atof(y);
+	set_unit_vector(object->spatial_coordinates);
 	//parse for time value
 	line=cpt;
 	size=0;
@@ -318,7 +577,7 @@ Object* read_spatial_temporal_object(char* line){
 */
 Object* read_object(char* line){
 	Object* object=Calloc(1,Object);
-	object->spatial_coordinates=Calloc(2,SPATIAL_TYPE);
+	object->spatial_coordinates=Calloc(GEODESIC_COORDINATES,SPATIAL_TYPE);
 	char* cpt=line;
 	//locate coma
 	DWORD size=0;
@@ -344,6 +603,7 @@ Object* read_object(char* line){
 	y[size]='\0';
 	memcpy(y,line,sizeof(char)*size);
 	object->spatial_coordinates[1]=atof(y);
+	set_unit_vector(object->spatial_coordinates);
 	size=0;
 	line=cpt;
 	while(*cpt!='\0'){
@@ -409,6 +669,119 @@ Objects* read_csv(char* filename,WORD type,BOOLEAN header){
 	result->objects=objects;
 	return result;
 }
+/*
+ * Sorting key for time index. Position in the original dataset keeps the sort stable.
+*/
+typedef struct{
+	Object* object;
+	DWORD position;
+} TimeKey;
+
+int time_key_cmp(const void* k1,const void* k2){
+	TimeKey* a=(TimeKey*)k1;
+	TimeKey* b=(TimeKey*)k2;
+	BOOLEAN missing_a,missing_b;
+	if(a->object->time!=b->object->time){
+		return a->object->time<b->object->time?-1:1;
+	}
+	/*Valid attributes are placed before missing ones inside a time stamp*/
+	missing_a=a->object->attribute==MISSING_ATTRIBUTE;
+	missing_b=b->object->attribute==MISSING_ATTRIBUTE;
+	if(missing_a!=missing_b){
+		return missing_a?1:-1;
+	}
+	return a->position<b->position?-1:(a->position>b->position);
+}
+
+TimeIndex* build_time_index(Objects* data){
+	TimeIndex* index=Calloc(1,TimeIndex);
+	TimeKey* keys=Calloc(data->size,TimeKey);
+	DWORD i,bucket=0;
+	for(i=0;i<data->size;i++){
+		keys[i].object=data->objects[i];
+		keys[i].position=i;
+	}
+	qsort(keys,data->size,sizeof(TimeKey),time_key_cmp);
+	index->size=data->size;
+	index->objects=Calloc(data->size,Object*);
+	/*Number of buckets is bounded by number of objects, arrays are truncated later*/
+	index->times=Calloc(data->size+1,TEMPORAL_TYPE);
+	index->offsets=Calloc(data->size+1,DWORD);
+	index->valid=Calloc(data->size+1,DWORD);
+	for(i=0;i<data->size;i++){
+		index->objects[i]=keys[i].object;
+		if(i==0||keys[i].object->time!=keys[i-1].object->time){
+			index->times[bucket]=keys[i].object->time;
+			index->offsets[bucket]=i;
+			index->valid[bucket]=0;
+			bucket++;
+		}
+		if(keys[i].object->attribute!=MISSING_ATTRIBUTE){
+			index->valid[bucket-1]++;
+		}
+	}
+	index->offsets[bucket]=data->size;
+	index->n_buckets=bucket;
+	index->times=(TEMPORAL_TYPE*)realloc(index->times,sizeof(TEMPORAL_TYPE)*(bucket+1));
+	index->offsets=(DWORD*)realloc(index->offsets,sizeof(DWORD)*(bucket+1));
+	index->valid=(DWORD*)realloc(index->valid,sizeof(DWORD)*(bucket+1));
+	Free(keys);
+	return index;
+}
+
+void destroy_time_index(TimeIndex* index){
+	Free(index->objects);
+	Free(index->times);
+	Free(index->offsets);
+	Free(index->valid);
+	Free(index);
+}
+
+DWORD find_time_bucket(TimeIndex* index,TEMPORAL_TYPE time){
+	DWORD low=0,high=index->n_buckets-1,middle;
+	while(low<=high){
+		middle=(low+high)/2;
+		if(index->times[middle]==time){
+			return middle;
+		}
+		if(index->times[middle]<time){
+			low=middle+1;
+		}else{
+			high=middle-1;
+		}
+	}
+	return -1;
+}
+
+DWORD time_lower_bound(TimeIndex* index,TEMPORAL_TYPE time){
+	DWORD low=0,high=index->n_buckets,middle;
+	/*Search over buckets, then convert the bucket to a position in the sorted array*/
+	while(low<high){
+		middle=(low+high)/2;
+		if(index->times[middle]<time){
+			low=middle+1;
+		}else{
+			high=middle;
+		}
+	}
+	return index->offsets[low];
+}
+
+BOOLEAN get_time_slice(TimeIndex* index,TEMPORAL_TYPE time,Objects* slice,BOOLEAN include_missing){
+	DWORD bucket=find_time_bucket(index,time);
+	if(bucket<0){
+		slice->objects=NULL;
+		slice->size=0;
+		return FALSE;
+	}
+	slice->objects=index->objects+index->offsets[bucket];
+	if(include_missing){
+		slice->size=index->offsets[bucket+1]-index->offsets[bucket];
+	}else{
+		slice->size=index->valid[bucket];
+	}
+	return TRUE;
+}
 
 /*
 int main(void){
@@ -13,10 +13,21 @@
 #define SPATIAL_DATA 0x1415
 //Spatio-temporal data identifier
 #define SPATIAL_TEMPORAL_DATA 0x1963
+//Attribute value for missing records
+#define MISSING_ATTRIBUTE -9999
+//First word of binary data files
+#define BINARY_DATA_MAGIC 0x4B52494744415441LL
+//First word of clustering snapshot files
+#define SNAPSHOT_MAGIC 0x4B524947534E4150LL
+//Layout version of clustering snapshot files
+#define SNAPSHOT_VERSION 1
+//Number of DWORDs before the floating point section of a snapshot file
+#define SNAPSHOT_HEADER_SIZE 13
 
 
 /*
  * Read raw IGRA data from a folder and convert the data into objects.
+ * Spatial coordinates are longitude and latitude in degrees, with their unit vectors attached. For distances in kilometers select GREAT_CIRCLE_DISTANCE with set_distance_type.
  * dir_name: The directory that contains all IGRA data.
  * time_elapse: How many distinct time stamps a user want to read from these data.
  * station_size: Number of spatial coordinates, which is the number of folders that are contained in the folder.
@@ -40,6 +51,18 @@ extern Objects* read_csv(char* filename,WORD type,BOOLEAN header);
  * header: If headers for columns should be added.
 */
 extern void write_spatial_temporal_data(Objects* data,char* filename,BOOLEAN header);
+/*
+ * Write objects to a binary file in native byte order.
+ * Layout: BINARY_DATA_MAGIC and the number of records as two DWORDs, followed by (x, y, time stamp, attribute) as four DTYPEs per record.
+ * data: Array of objects that will be exported.
+ * filename: The file to be written.
+*/
+extern void write_binary_data(Objects* data,char* filename);
+/*
+ * Read a binary file written by write_binary_data.
+ * Return: An array of objects, or NULL if the file cannot be read.
+*/
+extern Objects* read_binary_data(char* filename);
 /*
  * Write an array of clusters to local file system.
  * Each cluster will be represented by a single file with in form 'filename'_'clusterid'.txt
@@ -48,6 +71,64 @@ extern void write_spatial_temporal_data(Objects* data,char* filename,BOOLEAN hea
  * header: If headers for columns should be added.
 */
 extern void write_clusters(Clusters* clusters,char* filename,BOOLEAN header);
+/*
+ * Write the state of a clustering run to a binary file in native byte order. Every field is 8 bytes wide, so that a mapped file can be used in place.
+ * Layout: SNAPSHOT_MAGIC, SNAPSHOT_VERSION, size, n_clusters, position, phase, element, change, next, filter_steps, revision_steps, variogram_type and n_parameters as DWORDs,
+ * then bound, max_distance[0], max_distance[1], C and (x, y, time stamp, attribute) of every object as DTYPEs, then cluster_start, members and labels as DWORDs.
+ * The file is written under filename.tmp first and renamed, so a crash never leaves a partial snapshot behind.
+ * Return: TRUE if the snapshot was written.
+*/
+extern BOOLEAN write_clustering_snapshot(ClusteringSnapshot* snapshot,char* filename);
+/*
+ * Map a snapshot written by write_clustering_snapshot into memory. Arrays of the result point into the read-only mapping, nothing is parsed or copied.
+ * The header counts are checked against the file size, and the clusters, labels and position in the run against each other.
+ * Return: The snapshot, NULL if the file cannot be read, is not a snapshot of this version or is inconsistent.
+*/
+extern ClusteringSnapshot* load_clustering_snapshot(char* filename);
+/*
+ * Unmap a loaded snapshot, or free the arrays of a snapshot built in memory.
+*/
+extern void destroy_clustering_snapshot(ClusteringSnapshot* snapshot);
+/*
+ * Create the objects of a snapshot from its records.
+*/
+extern Objects* snapshot_objects(ClusteringSnapshot* snapshot);
+/*
+ * Create the clusters of a snapshot, in the order of their members.
+ * data: The objects the snapshot was taken from, or the result of snapshot_objects.
+*/
+extern Clusters* snapshot_clusters(ClusteringSnapshot* snapshot,Object** data);
 
 extern void write_variogram_result(char* filename, BOOLEAN header, Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type);
+/*
+ * Build a time stamp index for a dataset. The dataset itself is not modified.
+ * data: The dataset to be indexed.
+ * Return: Objects sorted by time with bucket offsets for every distinct time stamp.
+*/
+extern TimeIndex* build_time_index(Objects* data);
+/*
+ * Free a time index. Objects referenced by the index are not freed.
+*/
+extern void destroy_time_index(TimeIndex* index);
+/*
+ * Binary search for the bucket of a time stamp.
+ * index: The time index.
+ * time: The time stamp to be located.
+ * Return: Bucket number, or -1 if the time stamp does not exist.
+*/
+extern DWORD find_time_bucket(TimeIndex* index,TEMPORAL_TYPE time);
+/*
+ * Binary search for the first object whose time stamp is not earlier than time.
+ * Return: Position in index->objects. Every object before this position has an earlier time stamp.
+*/
+extern DWORD time_lower_bound(TimeIndex* index,TEMPORAL_TYPE time);
+/*
+ * Zero-copy view of a single time stamp. slice->objects points into the index, so it must not be freed.
+ * index: The time index.
+ * time: The time stamp of the slice.
+ * slice: Output view.
+ * include_missing: If objects with MISSING_ATTRIBUTE are included in the view.
+ * Return: FALSE if the time stamp does not exist, in which case slice is empty.
+*/
+extern BOOLEAN get_time_slice(TimeIndex* index,TEMPORAL_TYPE time,Objects* slice,BOOLEAN include_missing);
 #endif
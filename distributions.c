@@ -20,6 +20,14 @@ DWORD poisson(DTYPE lambda){
 	return --k;
 }
 
+DTYPE gaussian(void){
+	//Box-Muller transform. Only one variate is used, so the sequence depends on the seed alone.
+	//1-u is in (0,1], so the logarithm is finite.
+	DTYPE u=1-genrand_real2();
+	DTYPE v=genrand_real2();
+	return sqrt(-2*log(u))*cos(2*M_PI*v);
+}
+
 unsigned int* random_ints(int n,int size){
 	unsigned int* indices=Calloc(n,unsigned int);
 	unsigned int i,temp;
@@ -1,64 +1,418 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "krigfunctions.h"
 #include "random.h"
 #include "clusterfunctions.h"
 #include "datafunctions.h"
+#include "generator.h"
 /*
- * Kriging clustering example for random data.
+ * Kriging clustering example for synthetic data.
+ * A Gaussian random field with an exponential variogram, three planted regimes and a few outliers is generated for two time stamps.
+ * The dataset is written in csv and binary layout, read back from the binary file, and the first time stamp is clustered.
+ * Tiled clustering of the same time stamp is checked against krig_clustering and across numbers of processes.
+ * A checkpointed run is killed in the filtering phase and another in a revision pass down to its last member, and both must end with the clusters of the uninterrupted run when resumed.
+ * Finally the sites are placed on a box across the date line and clustered with great-circle distances, which must not change when the box is rotated off the date line.
+ * Usage: ./generated_test [grid_size] [n_sites]
 */
 
+/*
+ * Cluster label of every object of slice.
+*/
+static DWORD* cluster_labels(Clusters* clusters,Objects* slice){
+	DWORD i,j;
+	DWORD* labels=Calloc(slice->size,DWORD);
+	for(i=0;i<clusters->size;i++){
+		Node* current=clusters->clusters[i]->head;
+		while(current!=NULL){
+			for(j=0;j<slice->size;j++){
+				if(slice->objects[j]==current->object){
+					labels[j]=i;
+					break;
+				}
+			}
+			current=current->next;
+		}
+	}
+	return labels;
+}
+
+/*
+ * Whether distance() between two points given by longitude and latitude is within 1e-6 km of expected.
+*/
+static BOOLEAN check_distance(DTYPE longitude1,DTYPE latitude1,DTYPE longitude2,DTYPE latitude2,DTYPE expected){
+	SPATIAL_TYPE* p=create_spatial_coordinates(longitude1,latitude1);
+	SPATIAL_TYPE* q=create_spatial_coordinates(longitude2,latitude2);
+	DTYPE d=distance(p,q);
+	Free(p);
+	Free(q);
+	if(fabs(d-expected)>1e-6){
+		printf("distance between (%lf,%lf) and (%lf,%lf) is %lf km, expected %lf km\n",longitude1,latitude1,longitude2,latitude2,d,expected);
+		return FALSE;
+	}
+	return TRUE;
+}
 
-void print_data(Objects* data){
+/*
+ * Place the sites of slice on a 10x10 degree box starting at the given longitude and latitude 40, longitudes wrapped into [-180,180).
+ * Site positions come from the coordinates generated on [0,extent)^2, which are kept in original.
+*/
+static void place_on_sphere(Objects* slice,SPATIAL_TYPE* original,DTYPE extent,DTYPE longitude){
 	DWORD i;
-	for(i=0;i<data->size;i++){
-		printf("x=%lf,y=%lf,attribute=%lf,time=%lf\n",data->objects[i]->spatial_coordinates[0],data->objects[i]->spatial_coordinates[1],data->objects[i]->attribute,data->objects[i]->time);
+	SPATIAL_TYPE* p;
+	for(i=0;i<slice->size;i++){
+		p=slice->objects[i]->spatial_coordinates;
+		p[0]=longitude+10*original[2*i]/extent;
+		if(p[0]>=180){
+			p[0]-=360;
+		}
+		p[1]=40+10*original[2*i+1]/extent;
+		set_unit_vector(p);
+		slice->objects[i]->neighbors=-1;
 	}
 }
 
-int main(void){
 /*
-	struct timeval start;
-	gettimeofday(&start,NULL);
-	init_genrand(start.tv_usec);
-	DWORD cluster_size=10,max_size=500,min_points=10;
-	DTYPE max_distance=0.02,max_distance2=2.0,x_min=0,x_max=1,y_min=0,y_max=1,t_min=30,t_max=50,alpha=1.3;
-	Stack* stack=random_data(cluster_size,max_size,min_points,max_distance,max_distance2,x_min,x_max,y_min,y_max,t_max,t_min,alpha);
-	Object** objects=Calloc(max_size,Object*);
-	DWORD i=0;
-	while(!is_empty(stack)){
-		objects[i]=pop(stack);
-		objects[i]->classification=UNCLASSIFIED;
-		i++;
-	}
-	DTYPE* C=Calloc(2,DTYPE);
-	C[0]=.2;
-	C[1]=.5;
-	DTYPE* distances=Calloc(2,DTYPE);
-	distances[0]=max_distance2;
-	distances[1]=DIS_UNCHECKED;
-	Objects* data=Calloc(1,Objects);
-	data->size=max_size;
-	data->objects=objects;
-	write_spatial_temporal_data(data,"random.csv",TRUE);
+ * Whether two clusterings of slice group the objects the same way, whatever the order of their clusters.
 */
-	Objects* data=read_csv("random.csv",SPATIAL_TEMPORAL_DATA,TRUE);
-	print_data(data);
-	Object** objects=data->objects;
-	DWORD cluster_size=10,max_size=500,min_points=10;
-	DTYPE max_distance=0.02,max_distance2=.3,x_min=0,x_max=1,y_min=0,y_max=1,t_min=30,t_max=50,alpha=1.3;
-	DTYPE* C=Calloc(2,DTYPE);
-	C[0]=0.4;
-	C[1]=.4;
-	DTYPE* distances=Calloc(2,DTYPE);
-	distances[0]=max_distance2;
-	distances[1]=DIS_UNCHECKED;
-	Clusters* clusters=krig_clustering(objects,max_size,3,C,distances,EXPONENTIAL_VARIOGRAM);
+static BOOLEAN same_partition(Clusters* a,Clusters* b,Objects* slice){
+	DWORD i,j;
+	BOOLEAN same=a->size==b->size;
+	DWORD* labels_a=cluster_labels(a,slice);
+	DWORD* labels_b=cluster_labels(b,slice);
+	for(i=0;i<slice->size&&same;i++){
+		for(j=i+1;j<slice->size;j++){
+			if((labels_a[i]==labels_a[j])!=(labels_b[i]==labels_b[j])){
+				same=FALSE;
+				break;
+			}
+		}
+	}
+	Free(labels_a);
+	Free(labels_b);
+	return same;
+}
+
+//Phase in which a checkpointed run kills its process, 0 for none. Only set in child processes, see rename.
+static DWORD stop_phase=0;
+
+/*
+ * Checkpointed runs publish every snapshot by renaming it into place, and this definition takes the place of the one of the C library in this program.
+ * With stop_phase set, the process kills itself right after publishing the first snapshot taken in that phase: a quarter of the way into the filtering steps, or in a revision pass with a single member left in the revised cluster.
+ * The run is thus interrupted at the same step however fast the machine is.
+*/
+int rename(const char* old_name,const char* new_name){
+	int result=renameat(AT_FDCWD,old_name,AT_FDCWD,new_name);
+	if(result==0&&stop_phase!=0){
+		ClusteringSnapshot* snapshot=load_clustering_snapshot((char*)new_name);
+		if(snapshot!=NULL){
+			BOOLEAN stop=snapshot->position<snapshot->n_clusters&&snapshot->phase==stop_phase;
+			if(stop_phase==FILTERING_PHASE){
+				stop=stop&&snapshot->filter_steps>=snapshot->size/4;
+			}else{
+				stop=stop&&snapshot->cluster_start[snapshot->next+1]-snapshot->cluster_start[snapshot->next]==1;
+			}
+			destroy_clustering_snapshot(snapshot);
+			if(stop){
+				raise(SIGKILL);
+			}
+		}
+	}
+	return result;
+}
+
+/*
+ * Run a checkpointed clustering of slice in a child process killed in phase and resume it from its last snapshot.
+ * The resumed run must take the steps of an uninterrupted run and end with its clusters.
+*/
+static BOOLEAN interrupt_and_resume(Objects* slice,DWORD phase,char* checkpoint,DTYPE* C,DTYPE* distances){
+	DWORD i,filter_steps,revision_steps;
+	int status;
+	char* name=phase==FILTERING_PHASE?"filtering":"revision";
+	for(i=0;i<slice->size;i++){
+		slice->objects[i]->neighbors=-1;
+	}
+	unlink(checkpoint);
+	Clusters* clusters=krig_clustering_checkpointed(slice->objects,slice->size,3,C,distances,EXPONENTIAL_VARIOGRAM,checkpoint,3600);
+	ClusteringSnapshot* snapshot=load_clustering_snapshot(checkpoint);
+	if(snapshot==NULL){
+		destroy_clusters(clusters);
+		return FALSE;
+	}
+	filter_steps=snapshot->filter_steps;
+	revision_steps=snapshot->revision_steps;
+	destroy_clustering_snapshot(snapshot);
+	for(i=0;i<slice->size;i++){
+		slice->objects[i]->neighbors=-1;
+	}
+	unlink(checkpoint);
+	fflush(stdout);
+	pid_t child=fork();
+	if(child==0){
+		stop_phase=phase;
+		krig_clustering_checkpointed(slice->objects,slice->size,3,C,distances,EXPONENTIAL_VARIOGRAM,checkpoint,0);
+		_exit(0);
+	}
+	waitpid(child,&status,0);
+	snapshot=WIFSIGNALED(status)?load_clustering_snapshot(checkpoint):NULL;
+	if(snapshot==NULL||snapshot->phase!=phase){
+		printf("The checkpointed run was not interrupted in the %s phase\n",name);
+		if(snapshot!=NULL){
+			destroy_clustering_snapshot(snapshot);
+		}
+		destroy_clusters(clusters);
+		return FALSE;
+	}
+	printf("interrupted in the %s phase of cluster %lld of %lld after %lld filtering and %lld revision steps\n",name,snapshot->position,snapshot->n_clusters,snapshot->filter_steps,snapshot->revision_steps);
+	destroy_clustering_snapshot(snapshot);
+	for(i=0;i<slice->size;i++){
+		slice->objects[i]->neighbors=-1;
+	}
+	Clusters* resumed=krig_clustering_checkpointed(slice->objects,slice->size,3,C,distances,EXPONENTIAL_VARIOGRAM,checkpoint,3600);
+	snapshot=load_clustering_snapshot(checkpoint);
+	BOOLEAN same=snapshot!=NULL&&snapshot->filter_steps==filter_steps&&snapshot->revision_steps==revision_steps&&same_partition(resumed,clusters,slice);
+	if(!same){
+		printf("Clustering resumed in the %s phase differs from the uninterrupted run\n",name);
+	}
+	if(snapshot!=NULL){
+		destroy_clustering_snapshot(snapshot);
+	}
+	destroy_clusters(resumed);
+	destroy_clusters(clusters);
+	unlink(checkpoint);
+	return same;
+}
+
+int main(int argc,char** argv){
+	GeneratorSettings settings;
+	TimeIndex* index;
+	Objects slice;
+	DWORD i,j,size,purity;
+	DTYPE C[3]={1,20,.01};
+	DTYPE distances[2]={DIS_UNCHECKED,DIS_UNCHECKED};
+	default_generator_settings(&settings);
+	settings.grid_size=64;
+	settings.n_sites=200;
+	settings.time_slices=2;
+	settings.temporal_correlation=.8;
+	settings.regimes=3;
+	settings.regime_shift=20;
+	settings.outlier_rate=.01;
+	settings.outlier_scale=30;
+	settings.C=C;
+	settings.variogram_type=EXPONENTIAL_VARIOGRAM;
+	if(argc>1){
+		settings.grid_size=atoll(argv[1]);
+	}
+	if(argc>2){
+		settings.n_sites=atoll(argv[2]);
+	}
+	size=generated_size(&settings);
+	DWORD* regimes=Calloc(size,DWORD);
+	BOOLEAN* outliers=Calloc(size,BOOLEAN);
+	Objects* generated=generate_spatial_temporal_data(&settings,regimes,outliers);
+	if(generated==NULL){
+		return 1;
+	}
+	//Export in both layouts
+	write_spatial_temporal_data(generated,"generated.csv",TRUE);
+	write_binary_data(generated,"generated.bin");
+	Objects* data=read_binary_data("generated.bin");
+	printf("generated %lld objects, read back %lld objects\n",generated->size,data->size);
+	//Cluster the first time stamp
+	index=build_time_index(data);
+	get_time_slice(index,0,&slice,FALSE);
+	Clusters* clusters=krig_clustering(slice.objects,slice.size,3,C,distances,EXPONENTIAL_VARIOGRAM);
 	printf("# of clusters=%lld\n",clusters->size);
-	print_clusters(clusters);
-	DTYPE test_statistics=chi_square_coefficient(clusters,C,distances,EXPONENTIAL_VARIOGRAM);
-	printf("chi square test statistics=%lf\n",test_statistics);
-	Free(C);
-	Free(distances);
-	Free(data->objects);
-	Free(data);
+	printf("chi square test statistics=%lf\n",chi_square_coefficient(clusters,C,distances,EXPONENTIAL_VARIOGRAM));
+	//Compare with planted regimes. Objects are generated by time stamp, then by site, so slice 0 keeps its order.
+	purity=0;
+	for(i=0;i<clusters->size;i++){
+		DWORD* counts=Calloc(settings.regimes,DWORD);
+		memset(counts,0,sizeof(DWORD)*settings.regimes);
+		DWORD best=0;
+		Node* current=clusters->clusters[i]->head;
+		while(current!=NULL){
+			for(j=0;j<slice.size;j++){
+				if(slice.objects[j]==current->object){
+					counts[regimes[j]]++;
+					break;
+				}
+			}
+			current=current->next;
+		}
+		for(j=0;j<settings.regimes;j++){
+			if(counts[j]>best){
+				best=counts[j];
+			}
+		}
+		purity+=best;
+		Free(counts);
+	}
+	printf("regime purity=%lf\n",(DTYPE)purity/slice.size);
+	//A single tile reproduces krig_clustering, and more tiles give the same partition with any number of processes
+	TilingSettings tiling;
+	default_tiling_settings(&tiling);
+	tiling.tiles_x=1;
+	tiling.tiles_y=1;
+	tiling.processes=1;
+	Clusters* tiled=krig_clustering_tiled(slice.objects,slice.size,&tiling,3,C,distances,EXPONENTIAL_VARIOGRAM);
+	if(tiled==NULL||!same_partition(tiled,clusters,&slice)){
+		printf("Tiled clustering with a single tile differs from krig_clustering\n");
+		return 1;
+	}
+	destroy_clusters(tiled);
+	tiling.tiles_x=2;
+	tiling.tiles_y=2;
+	tiled=krig_clustering_tiled(slice.objects,slice.size,&tiling,3,C,distances,EXPONENTIAL_VARIOGRAM);
+	tiling.processes=4;
+	Clusters* forked=krig_clustering_tiled(slice.objects,slice.size,&tiling,3,C,distances,EXPONENTIAL_VARIOGRAM);
+	if(tiled==NULL||forked==NULL||!same_partition(tiled,forked,&slice)){
+		printf("Tiled clustering depends on the number of processes\n");
+		return 1;
+	}
+	printf("# of clusters with 2x2 tiles=%lld, 1 and 4 processes agree\n",tiled->size);
+	destroy_clusters(tiled);
+	destroy_clusters(forked);
+	//Checkpoint every step in child processes killed at a fixed step of each phase, and resume from their last snapshots
+	char* checkpoint="generated.ckpt";
+	if(!interrupt_and_resume(&slice,FILTERING_PHASE,checkpoint,C,distances)){
+		return 1;
+	}
+	//A site next to an outlier is filtered out with it and revised back first, which leaves the revision pass with the outlier alone
+	Objects pair_site;
+	pair_site.size=27;
+	pair_site.objects=Calloc(pair_site.size,Object*);
+	for(i=0;i<pair_site.size;i++){
+		pair_site.objects[i]=Calloc(1,Object);
+		pair_site.objects[i]->time=0;
+		if(i<25){
+			pair_site.objects[i]->spatial_coordinates=create_spatial_coordinates(10*(i/5),10*(i%5));
+			pair_site.objects[i]->attribute=.1*(i/5)-.1*(i%5);
+		}else{
+			pair_site.objects[i]->spatial_coordinates=create_spatial_coordinates(99+i-25,100);
+			pair_site.objects[i]->attribute=i==25?0:60;
+		}
+	}
+	if(!interrupt_and_resume(&pair_site,REVISION_PHASE,checkpoint,C,distances)){
+		return 1;
+	}
+	for(i=0;i<pair_site.size;i++){
+		Free(pair_site.objects[i]->spatial_coordinates);
+		Free(pair_site.objects[i]);
+	}
+	Free(pair_site.objects);
+	printf("resumed clusterings match the uninterrupted runs\n");
+	//Geodesic distances across the date line and over the pole, in kilometers
+	set_distance_type(GREAT_CIRCLE_DISTANCE);
+	if(!check_distance(179.5,0,-179.5,0,EARTH_RADIUS*M_PI/180)||!check_distance(0,89.9,180,89.9,EARTH_RADIUS*.2*M_PI/180)||!check_distance(0,0,180,0,EARTH_RADIUS*M_PI)){
+		return 1;
+	}
+	set_distance_type(CHORDAL_DISTANCE);
+	if(!check_distance(179.5,0,-179.5,0,2*EARTH_RADIUS*sin(.5*M_PI/180))){
+		return 1;
+	}
+	set_distance_type(GREAT_CIRCLE_DISTANCE);
+	//Co-located objects on the two sides of the date line are coalesced on the date line, not on the far side of the globe
+	Objects pair;
+	pair.size=2;
+	pair.objects=Calloc(2,Object*);
+	for(i=0;i<2;i++){
+		pair.objects[i]=Calloc(1,Object);
+		pair.objects[i]->spatial_coordinates=create_spatial_coordinates(i==0?179.99999:-179.99999,10);
+		pair.objects[i]->attribute=i;
+		pair.objects[i]->time=0;
+	}
+	CoalescedObjects* coalesced=coalesce_objects(&pair,1);
+	SPATIAL_TYPE* merged=coalesced->objects->objects[0]->spatial_coordinates;
+	if(coalesced->objects->size!=1||fabs(merged[0])<179.9999||fabs(merged[1]-10)>1e-9){
+		printf("objects across the date line are coalesced at (%lf,%lf)\n",merged[0],merged[1]);
+		return 1;
+	}
+	destroy_coalesced_objects(coalesced);
+	for(i=0;i<2;i++){
+		Free(pair.objects[i]->spatial_coordinates);
+		Free(pair.objects[i]);
+	}
+	Free(pair.objects);
+	//The sites of the first time stamp on a box across the date line, with local Kriging in a 300 km ball
+	SPATIAL_TYPE* original=Calloc(2*slice.size,SPATIAL_TYPE);
+	for(i=0;i<slice.size;i++){
+		original[2*i]=slice.objects[i]->spatial_coordinates[0];
+		original[2*i+1]=slice.objects[i]->spatial_coordinates[1];
+	}
+	DTYPE ball[2]={300,DIS_UNCHECKED};
+	place_on_sphere(&slice,original,settings.extent,175);
+	//The cell list over unit vectors finds every pair within the ball
+	CellList* cells=build_cell_list(&slice,ball[0]);
+	DWORD cx,cy,cz,x,y,z,c,k,pairs=0,brute_force=0;
+	for(i=0;i<slice.size;i++){
+		for(j=i+1;j<slice.size;j++){
+			if(distance(slice.objects[i]->spatial_coordinates,slice.objects[j]->spatial_coordinates)<=ball[0]){
+				brute_force++;
+			}
+		}
+		cell_of(cells,slice.objects[i]->spatial_coordinates,&cx,&cy,&cz);
+		for(z=cz>0?cz-1:0;z<=cz+1&&z<cells->nz;z++){
+			for(y=cy>0?cy-1:0;y<=cy+1&&y<cells->ny;y++){
+				for(x=cx>0?cx-1:0;x<=cx+1&&x<cells->nx;x++){
+					c=(z*cells->ny+y)*cells->nx+x;
+					for(k=cells->start[c];k<cells->start[c+1];k++){
+						j=cells->members[k];
+						if(j>i&&distance(slice.objects[i]->spatial_coordinates,slice.objects[j]->spatial_coordinates)<=ball[0]){
+							pairs++;
+						}
+					}
+				}
+			}
+		}
+	}
+	destroy_cell_list(cells);
+	if(pairs!=brute_force||pairs==0){
+		printf("cell list finds %lld of %lld pairs within %lf km\n",pairs,brute_force,ball[0]);
+		return 1;
+	}
+	//Great-circle distances do not change when the box is rotated off the date line, neither does the clustering
+	Clusters* straddling=krig_clustering(slice.objects,slice.size,3,C,ball,EXPONENTIAL_VARIOGRAM);
+	place_on_sphere(&slice,original,settings.extent,-5);
+	Clusters* rotated=krig_clustering(slice.objects,slice.size,3,C,ball,EXPONENTIAL_VARIOGRAM);
+	if(!same_partition(straddling,rotated,&slice)){
+		printf("Geodesic clustering changes when the data are rotated off the date line\n");
+		return 1;
+	}
+	//Tiling with the halo taken from the ball range in kilometers
+	tiling.tiles_x=1;
+	tiling.tiles_y=1;
+	tiling.processes=1;
+	tiling.halo=0;
+	tiled=krig_clustering_tiled(slice.objects,slice.size,&tiling,3,C,ball,EXPONENTIAL_VARIOGRAM);
+	if(tiled==NULL||!same_partition(tiled,rotated,&slice)){
+		printf("Geodesic tiled clustering with a single tile differs from krig_clustering\n");
+		return 1;
+	}
+	destroy_clusters(tiled);
+	tiling.tiles_x=2;
+	tiling.tiles_y=2;
+	tiled=krig_clustering_tiled(slice.objects,slice.size,&tiling,3,C,ball,EXPONENTIAL_VARIOGRAM);
+	tiling.processes=4;
+	forked=krig_clustering_tiled(slice.objects,slice.size,&tiling,3,C,ball,EXPONENTIAL_VARIOGRAM);
+	if(tiled==NULL||forked==NULL||!same_partition(tiled,forked,&slice)){
+		printf("Geodesic tiled clustering depends on the number of processes\n");
+		return 1;
+	}
+	printf("geodesic: %lld pairs within %lf km, # of clusters=%lld, %lld with 2x2 tiles\n",pairs,ball[0],rotated->size,tiled->size);
+	destroy_clusters(tiled);
+	destroy_clusters(forked);
+	destroy_clusters(straddling);
+	destroy_clusters(rotated);
+	Free(original);
+	set_distance_type(PLANAR_DISTANCE);
+	destroy_clusters(clusters);
+	destroy_time_index(index);
+	destroy_objects(data);
+	destroy_objects(generated);
+	Free(regimes);
+	Free(outliers);
 	return 0;
 }
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2016, Northwestern University.
+ * Synthetic spatio-temporal data with known ground truth for scaling tests.
+ * Gaussian random fields are simulated on a regular grid by circulant embedding and optionally subsampled to scattered sites.
+ * Planted regimes, outliers and correlated time slices are added on top of the field.
+ * See spatial_temporal_generator.c, and generated_test.c for example usage.
+*/
+#ifndef KRIG_GENERATOR_H
+#define KRIG_GENERATOR_H
+
+#include "cluster.h"
+
+/*
+ * Settings of the generator.
+ * grid_size: Number of grid points per side. The field lives on grid_size*grid_size points with spacing extent/grid_size.
+ * extent: Side length of the square domain [0,extent)^2.
+ * n_sites: Number of distinct grid points sampled as sites. 0 keeps every grid point.
+ * time_slices: Number of time stamps 0,1,...,time_slices-1. Every site is observed at every time stamp.
+ * temporal_correlation: AR(1) coefficient between consecutive time slices, in [0,1).
+ * regimes: Number of planted regimes. Regimes are Voronoi cells of random centers, regime k adds k*regime_shift to the field.
+ * regime_shift: Mean shift between consecutive regimes.
+ * outlier_rate: Probability that an observation is an outlier.
+ * outlier_scale: Standard deviation of the Gaussian noise added to outliers.
+ * C: Variogram parameters, in the same form as for Kriging functions. The nugget C[0] is simulated as white noise.
+ * variogram_type: EXPONENTIAL_VARIOGRAM or SPHERICAL_VARIOGRAM. Power variograms have no covariance function and are not supported.
+ * seed: Seed of MT19937.
+*/
+typedef struct{
+	DWORD grid_size;
+	DTYPE extent;
+	DWORD n_sites;
+	DWORD time_slices;
+	DTYPE temporal_correlation;
+	DWORD regimes;
+	DTYPE regime_shift;
+	DTYPE outlier_rate;
+	DTYPE outlier_scale;
+	DTYPE* C;
+	VARIOGRAM_TYPE variogram_type;
+	unsigned long seed;
+} GeneratorSettings;
+
+/*
+ * Fill settings with defaults: 256x256 grid on [0,1000)^2, all sites, a single time slice, no regimes and no outliers.
+ * C and variogram_type are not touched.
+*/
+extern void default_generator_settings(GeneratorSettings* settings);
+/*
+ * Number of objects generate_spatial_temporal_data produces with these settings.
+*/
+extern DWORD generated_size(GeneratorSettings* settings);
+/*
+ * Generate a dataset.
+ * settings: Generator settings.
+ * regimes: Output, regime of every object. May be NULL. Must hold generated_size(settings) elements.
+ * outliers: Output, TRUE for every planted outlier. May be NULL. Must hold generated_size(settings) elements.
+ * Return: Objects ordered by time stamp, then by site. NULL if the settings are not valid. Free with destroy_objects.
+*/
+extern Objects* generate_spatial_temporal_data(GeneratorSettings* settings,DWORD* regimes,BOOLEAN* outliers);
+#endif
@@ -4,145 +4,953 @@
  * See also krigfunctions.h
 */
 
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "clusterfunctions.h"
 #include "krigfunctions.h"
+#include "krigprofile.h"
+#include "parallel.h"
+#include "datafunctions.h"
 
-Clusters* krig_clustering(Object** data,DWORD size,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+typedef struct{
+	Object* object;
+	DWORD position;
+} ObjectPosition;
+
+static int object_position_cmp(const void* p1,const void* p2){
+	size_t a=(size_t)((ObjectPosition*)p1)->object;
+	size_t b=(size_t)((ObjectPosition*)p2)->object;
+	return a<b?-1:(a>b);
+}
+
+/*
+ * Working state shared by the filtering and revision phases.
+ * clusters: Array of clusters, grows by one every time a cluster creates a cluster for filtered points.
+ * size: Number of clusters in the array.
+ * filter_time, revision_time: Accumulated time of the two phases in nanoseconds.
+ * checkpoint: Snapshot file written every interval nanoseconds, NULL for none. positions maps objects to their position in data, sorted by object.
+ * resume: The next call of filter_and_revise continues at phase, element, change and next instead of starting over.
+*/
+typedef struct{
+	Cluster** clusters;
+	DWORD size;
+	DWORD filter_steps;
+	DWORD revision_steps;
+	DWORD filter_time;
+	DWORD revision_time;
+	char* checkpoint;
+	DWORD interval;
+	DWORD last_checkpoint;
+	Object** data;
+	DWORD data_size;
+	ObjectPosition* positions;
+	DTYPE bound;
+	DTYPE* C;
+	DTYPE* max_distance;
+	VARIOGRAM_TYPE variogram_type;
+	BOOLEAN resume;
+	WORD phase;
+	DWORD element;
+	BOOLEAN change;
+	DWORD next;
+} ClusteringState;
+
+static void init_state(ClusteringState* state){
+	state->filter_steps=0;
+	state->revision_steps=0;
+	state->filter_time=0;
+	state->revision_time=0;
+	state->checkpoint=NULL;
+	state->resume=FALSE;
+}
+
+/*
+ * Snapshot of the state, taken before the element-th kept member of the scanned cluster of the given phase is processed.
+*/
+static ClusteringSnapshot* state_snapshot(ClusteringState* state,DWORD position,WORD phase,DWORD element,BOOLEAN change,DWORD next){
+	DWORD i,k,c;
+	Node* current;
+	ObjectPosition key,*found;
+	ClusteringSnapshot* snapshot=Calloc(1,ClusteringSnapshot);
+	snapshot->size=state->data_size;
+	snapshot->n_clusters=state->size;
+	snapshot->position=position;
+	snapshot->phase=phase;
+	snapshot->element=element;
+	snapshot->change=change;
+	snapshot->next=next;
+	snapshot->filter_steps=state->filter_steps;
+	snapshot->revision_steps=state->revision_steps;
+	snapshot->variogram_type=state->variogram_type;
+	/*Unknown models store no parameters*/
+	snapshot->n_parameters=variogram_model_length(state->variogram_type)>0?variogram_model_length(state->variogram_type):0;
+	snapshot->C=Calloc(snapshot->n_parameters,DTYPE);
+	memcpy(snapshot->C,state->C,sizeof(DTYPE)*snapshot->n_parameters);
+	snapshot->bound=state->bound;
+	snapshot->max_distance[0]=state->max_distance[0];
+	snapshot->max_distance[1]=state->max_distance[1];
+	snapshot->records=Calloc(4*state->data_size,DTYPE);
+	for(i=0;i<state->data_size;i++){
+		snapshot->records[4*i]=state->data[i]->spatial_coordinates[0];
+		snapshot->records[4*i+1]=state->data[i]->spatial_coordinates[1];
+		snapshot->records[4*i+2]=state->data[i]->time;
+		snapshot->records[4*i+3]=state->data[i]->attribute;
+	}
+	snapshot->cluster_start=Calloc(state->size+1,DWORD);
+	snapshot->members=Calloc(state->data_size,DWORD);
+	snapshot->labels=Calloc(state->data_size,DWORD);
+	k=0;
+	for(c=0;c<state->size;c++){
+		snapshot->cluster_start[c]=k;
+		current=state->clusters[c]->head;
+		while(current!=NULL){
+			key.object=current->object;
+			found=(ObjectPosition*)bsearch(&key,state->positions,state->data_size,sizeof(ObjectPosition),object_position_cmp);
+			snapshot->members[k++]=found->position;
+			snapshot->labels[found->position]=c;
+			current=current->next;
+		}
+	}
+	snapshot->cluster_start[state->size]=k;
+	snapshot->mapping=NULL;
+	return snapshot;
+}
+
+/*
+ * Write a snapshot if the last one is at least interval old.
+*/
+static void checkpoint_state(ClusteringState* state,DWORD position,WORD phase,DWORD element,BOOLEAN change,DWORD next){
+	if(state->checkpoint==NULL||krig_clock_ns()-state->last_checkpoint<state->interval){
+		return;
+	}
+	ClusteringSnapshot* snapshot=state_snapshot(state,position,phase,element,change,next);
+	write_clustering_snapshot(snapshot,state->checkpoint);
+	destroy_clustering_snapshot(snapshot);
+	state->last_checkpoint=krig_clock_ns();
+}
+
+/*
+ * Run filtering and revision phases on cluster i of the state.
+ * Objects filtered out of cluster i are collected in a new cluster appended to the end of the array and revised from there.
+ * The new cluster is not processed by this function.
+*/
+static void filter_and_revise(ClusteringState* state,DWORD i,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
 	/*Initialize variables*/
-	struct timeval start,end; /*Timing variables*/
-	DWORD i,j,k=1,counter,change; /*Temporary variables*/
-	DWORD revision_time=0,filter_time=0; /*Counter variables for iterations.*/
+	DWORD start; /*Timing variable*/
+	KRIG_PROFILE_DECLARE(consistency_start);
+	DWORD j,counter,change; /*Temporary variables*/
+	DWORD next=-1; /*Index of cluster that receives filtered points*/
+	DWORD element=0,skip=0; /*Members kept so far in the current pass, and members to skip when resuming*/
+	WORD phase=FILTERING_PHASE;
+	BOOLEAN resumed=FALSE;
 	//Cluster* clone;
 	Node *temp,*current,*previous; /*Temporary variables for iterating linked list (cluster)*/
 	DTYPE predict;
-	Cluster** clusters=Calloc(size,Cluster*);
-	clusters[0]=create_cluster();
-	DWORD filter_steps=0;
-	DWORD revision_steps=0;
-	add_to_cluster(clusters[0],data[0]);
-	/*Add all data to a single cluster.*/
-	for(i=1;i<size;i++){
-		add_to_cluster(clusters[0],data[i]);
-		clusters[i]=NULL;
+	BOOLEAN consistent;
+	Cluster** clusters=state->clusters;
+	change=TRUE;
+	/*A resumed run continues in the pass where its checkpoint was taken*/
+	if(state->resume){
+		phase=state->phase;
+		element=skip=state->element;
+		change=state->change;
+		next=state->next;
+		resumed=TRUE;
+		state->resume=FALSE;
 	}
-	for(i=0;i<k;i++){
-		change=TRUE;
-		//printf("Begin to filter--------------------------------\n");
-		/*Filtering phase starts.*/
-		/*For each clusters that are not filtered yet.*/
-		while(change&&clusters[i]->size>1){
-			current=clusters[i]->head;
-			previous=NULL;
+	//printf("Begin to filter--------------------------------\n");
+	/*Filtering phase starts.*/
+	/*For each clusters that are not filtered yet.*/
+	while(phase==FILTERING_PHASE&&(change||resumed)&&clusters[i]->size>1){
+		current=clusters[i]->head;
+		previous=NULL;
+		if(resumed){
+			for(j=0;j<skip&&current!=NULL;j++){
+				previous=current;
+				current=current->next;
+			}
+			resumed=FALSE;
+		}else{
+			element=0;
 			change=FALSE;
-			Node* tail=clusters[i]->tail;
-			//clone=clone_cluster(clusters[i]);
-			counter=0;
-			/*For each element in the cluster*/
-			while(clusters[i]->size>1&&current!=NULL){
-				filter_steps++;
-				counter++;
-				gettimeofday(&start,NULL);
-				//printf("cluster=%lld,size=%lld\n",i,clusters[i]->size);
-				/*Remove the element from the cluster*/
-				remove_from_cluster(clusters[i],previous,current);
-				/*Use the rest of points in the same cluster to predict its non-spatial attribute*/
-				predict=krig_normalize(clusters[i],current->object,C,max_distance,variogram_type);
-				//predict=krig_normalize(clone,current->object,C,max_distance,variogram_type);
-				//printf("cluster size=%lld,filter step=%lld,normalized error=%lf\n",clusters[i]->size,counter,predict);
-				//printf("var=%lf,predicted=%lf,real=%lf\n",krig_variance(clusters[i],current->object,C,max_distance,variogram_type),krig_prediction(clusters[i],current->object,C,max_distance,variogram_type),current->object->attribute);
-				/*Insert the point being filtered back to the cluster.*/
-				insert_to_cluster(clusters[i],previous,current);
-				if(clusters[i]->tail!=tail){
-					/*Should not reach here, testing purpose*/
-					printf("warning\n");
+		}
+		Node* tail=clusters[i]->tail;
+		//clone=clone_cluster(clusters[i]);
+		counter=0;
+		/*For each element in the cluster*/
+		while(clusters[i]->size>1&&current!=NULL){
+			checkpoint_state(state,i,FILTERING_PHASE,element,change,next);
+			state->filter_steps++;
+			counter++;
+			start=krig_clock_ns();
+			//printf("cluster=%lld,size=%lld\n",i,clusters[i]->size);
+			/*Remove the element from the cluster*/
+			remove_from_cluster(clusters[i],previous,current);
+			/*Use the rest of points in the same cluster to predict its non-spatial attribute*/
+			predict=krig_normalize_exact(clusters[i],current->object,C,max_distance,variogram_type);
+			//predict=krig_normalize(clone,current->object,C,max_distance,variogram_type);
+			//printf("cluster size=%lld,filter step=%lld,normalized error=%lf\n",clusters[i]->size,counter,predict);
+			//printf("var=%lf,predicted=%lf,real=%lf\n",krig_variance(clusters[i],current->object,C,max_distance,variogram_type),krig_prediction(clusters[i],current->object,C,max_distance,variogram_type),current->object->attribute);
+			/*Insert the point being filtered back to the cluster.*/
+			insert_to_cluster(clusters[i],previous,current);
+			if(clusters[i]->tail!=tail){
+				/*Should not reach here, testing purpose*/
+				printf("warning\n");
+			}
+			if(fabs(predict)>bound){
+				/*Filtered out case*/
+				change=TRUE;
+				/*Create a new cluster if the algorithm has not*/
+				if(next<0){
+					next=state->size;
+					state->size++;
+					state->clusters=(Cluster**)realloc(state->clusters,sizeof(Cluster*)*state->size);
+					clusters=state->clusters;
+					clusters[next]=create_cluster();
 				}
-				if(fabs(predict)>bound){
-					/*Filtered out case*/
-					change=TRUE;
-					/*Create a new cluster if the algorithm has not*/
-					if(clusters[i+1]==NULL){
-						k++;
-						clusters[i+1]=create_cluster();
-					}
-					/*Add the filtered point to next cluster*/
-					add_to_cluster(clusters[i+1],current->object);
-					current->object->neighbors=-1;
-					remove_from_cluster(clusters[i],previous,current);
-					temp=current;
-					current=current->next;
-					Free(temp);
-				}else{
-					/*The point stays in the cluster by passing the filtering phase*/
-					previous=current;
-					current=current->next;
+				/*Add the filtered point to next cluster*/
+				add_to_cluster(clusters[next],current->object);
+				current->object->neighbors=-1;
+				remove_from_cluster(clusters[i],previous,current);
+				temp=current;
+				current=current->next;
+				Free(temp);
+			}else{
+				/*The point stays in the cluster by passing the filtering phase*/
+				previous=current;
+				current=current->next;
+				element++;
+			}
+			/*Timing for filtering phase*/
+			start=krig_clock_ns()-start;
+			state->filter_time+=start;
+			KRIG_PROFILE_ADD(KRIG_PHASE_FILTER,start);
+
+		}
+		//destroy_cluster(clone);
+		//filter_cluster(clusters[i],clusters[next]);
+	}
+	//printf("i=%lld,size=%lld\n",i,clusters[i]->size);'
+	/*A run resumed in the revision phase finishes the pass it was in, even if a single member of cluster next is left, as the uninterrupted run does*/
+	resumed=resumed&&phase==REVISION_PHASE;
+	/*If nothing has been filtered, exit*/
+	if(!resumed&&(next<0||clusters[next]->size==1)){
+		return;
+	}
+	//printf("Begin to revise--------------------------------\n");
+	/*Reinforcement (revising) phase starts*/
+	if(!resumed){
+		change=TRUE;
+	}
+	while(resumed||(change&&clusters[next]->size>1)){
+		current=clusters[next]->head;
+		previous=NULL;
+		if(resumed){
+			for(j=0;j<skip&&current!=NULL;j++){
+				previous=current;
+				current=current->next;
+			}
+			resumed=FALSE;
+		}else{
+			element=0;
+			change=FALSE;
+		}
+		counter=0;
+		//Iterate all points in the cluster that contains points filtered out at filtering phase.
+		while(current!=NULL){
+			checkpoint_state(state,i,REVISION_PHASE,element,change,next);
+			counter++;
+			state->revision_steps++;
+			start=krig_clock_ns();
+			/*Use all points in the cluster that was filtered to predict its non-spatial attribute*/
+			predict=krig_normalize_exact(clusters[i],current->object,C,max_distance,variogram_type);
+			//printf("cluster size=%lld,predict for revising=%lf,step=%lld\n",clusters[next]->size,predict,counter);
+			//remove_from_cluster(clusters[next],previous,current);
+			add_to_cluster_front(clusters[i],current->object);
+			//printf("check5\n");
+			consistent=FALSE;
+			if(fabs(predict)<=bound){
+				KRIG_PROFILE_START(consistency_start);
+				consistent=krig_consistency(clusters[i],bound,C,max_distance,variogram_type);
+				KRIG_PROFILE_STOP(consistency_start,KRIG_PHASE_CONSISTENCY);
+			}
+			if(!consistent){
+				/*If not consistent, keep the point in the current cluster*/
+				remove_cluster_front(clusters[i]);
+				previous=current;
+				Objects* objects=get_adjacent_objects(clusters[i],current->object,max_distance);
+				for(j=0;j<objects->size;j++){
+					objects->objects[j]->neighbors=-1;
 				}
-				/*Timing for filtering phase*/
-				gettimeofday(&end,NULL);
-				filter_time+=(end.tv_sec-start.tv_sec);
+				Free(objects->objects);
+				Free(objects);
+				current->object->neighbors=-1;
+				current=current->next;
+				element++;
+			}else{
+				/*If consistent, put the point back to the cluster that it was filtered out from.*/
+				change=TRUE;
+				remove_from_cluster(clusters[next],previous,current);
+				current->object->neighbors=-1;
+				current=current->next;
+			}
+			start=krig_clock_ns()-start;
+			state->revision_time+=start;
+			KRIG_PROFILE_ADD(KRIG_PHASE_REVISION,start);
+		}
+		//printf("%lld\n",clusters[next]->size);
+	}
+}
 
+Clusters* krig_clustering(Object** data,DWORD size,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+	DWORD i;
+	ClusteringState state;
+	init_state(&state);
+	state.clusters=Calloc(1,Cluster*);
+	state.size=1;
+	state.clusters[0]=create_cluster();
+	/*Add all data to a single cluster.*/
+	for(i=0;i<size;i++){
+		add_to_cluster(state.clusters[0],data[i]);
+	}
+	/*Every cluster filters its points into the cluster that follows it, until nothing is filtered out.*/
+	for(i=0;i<state.size;i++){
+		filter_and_revise(&state,i,bound,C,max_distance,variogram_type);
+	}
+	/*Point out timing statistics*/
+	printf("filters=%lld,revisions=%lld,filter time=%lf s,revision time =%lf s\n",state.filter_steps,state.revision_steps,state.filter_time*1e-9,state.revision_time*1e-9);
+	Clusters *result=Calloc(1,Clusters);
+	result->size=state.size;
+	result->clusters=state.clusters;
+	return result;
+}
+/*
+ * Whether a snapshot was taken from the same data with the same parameters.
+*/
+static BOOLEAN snapshot_matches(ClusteringSnapshot* snapshot,ClusteringState* state){
+	DWORD i;
+	if(snapshot->size!=state->data_size||snapshot->variogram_type!=state->variogram_type||snapshot->n_parameters!=(variogram_model_length(state->variogram_type)>0?variogram_model_length(state->variogram_type):0)||snapshot->bound!=state->bound||snapshot->max_distance[0]!=state->max_distance[0]||snapshot->max_distance[1]!=state->max_distance[1]){
+		return FALSE;
+	}
+	if(memcmp(snapshot->C,state->C,sizeof(DTYPE)*snapshot->n_parameters)!=0){
+		return FALSE;
+	}
+	for(i=0;i<snapshot->size;i++){
+		if(snapshot->records[4*i]!=state->data[i]->spatial_coordinates[0]||snapshot->records[4*i+1]!=state->data[i]->spatial_coordinates[1]||snapshot->records[4*i+2]!=state->data[i]->time||snapshot->records[4*i+3]!=state->data[i]->attribute){
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+Clusters* krig_clustering_checkpointed(Object** data,DWORD size,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type,char* checkpoint,DWORD interval){
+	DWORD i,c,k,first=0;
+	ClusteringState state;
+	ClusteringSnapshot* snapshot=NULL;
+	init_state(&state);
+	state.checkpoint=checkpoint;
+	state.interval=interval*1000000000LL;
+	state.last_checkpoint=krig_clock_ns();
+	state.data=data;
+	state.data_size=size;
+	state.bound=bound;
+	state.C=C;
+	state.max_distance=max_distance;
+	state.variogram_type=variogram_type;
+	state.positions=Calloc(size,ObjectPosition);
+	for(i=0;i<size;i++){
+		state.positions[i].object=data[i];
+		state.positions[i].position=i;
+	}
+	qsort(state.positions,size,sizeof(ObjectPosition),object_position_cmp);
+	if(access(checkpoint,F_OK)==0){
+		snapshot=load_clustering_snapshot(checkpoint);
+		if(snapshot!=NULL&&!snapshot_matches(snapshot,&state)){
+			printf("%s was taken from other data or parameters, starting over\n",checkpoint);
+			destroy_clustering_snapshot(snapshot);
+			snapshot=NULL;
+		}
+	}
+	if(snapshot!=NULL){
+		/*Rebuild the clusters in list order and continue where the snapshot was taken*/
+		state.size=snapshot->n_clusters;
+		state.clusters=Calloc(state.size>0?state.size:1,Cluster*);
+		for(c=0;c<state.size;c++){
+			state.clusters[c]=create_cluster();
+			for(k=snapshot->cluster_start[c];k<snapshot->cluster_start[c+1];k++){
+				data[snapshot->members[k]]->neighbors=-1;
+				add_to_cluster(state.clusters[c],data[snapshot->members[k]]);
 			}
-			//destroy_cluster(clone);
-			//filter_cluster(clusters[i],clusters[i+1]);
 		}
-		//printf("i=%lld,size=%lld\n",i,clusters[i]->size);'
-		/*If nothing has been filtered, exit the loop*/
-		if(clusters[i+1]==NULL||clusters[i+1]->size==1){
+		state.filter_steps=snapshot->filter_steps;
+		state.revision_steps=snapshot->revision_steps;
+		first=snapshot->position;
+		if(first<state.size){
+			state.resume=TRUE;
+			state.phase=snapshot->phase;
+			state.element=snapshot->element;
+			state.change=snapshot->change;
+			state.next=snapshot->next;
+		}
+		printf("Resuming from %s at cluster %lld of %lld\n",checkpoint,first,state.size);
+		destroy_clustering_snapshot(snapshot);
+	}else{
+		state.clusters=Calloc(1,Cluster*);
+		state.size=1;
+		state.clusters[0]=create_cluster();
+		for(i=0;i<size;i++){
+			add_to_cluster(state.clusters[0],data[i]);
+		}
+	}
+	for(i=first;i<state.size;i++){
+		filter_and_revise(&state,i,bound,C,max_distance,variogram_type);
+	}
+	/*The final snapshot holds the finished clustering*/
+	snapshot=state_snapshot(&state,state.size,FILTERING_PHASE,0,FALSE,-1);
+	write_clustering_snapshot(snapshot,checkpoint);
+	destroy_clustering_snapshot(snapshot);
+	Free(state.positions);
+	printf("filters=%lld,revisions=%lld,filter time=%lf s,revision time =%lf s\n",state.filter_steps,state.revision_steps,state.filter_time*1e-9,state.revision_time*1e-9);
+	Clusters *result=Calloc(1,Clusters);
+	result->size=state.size;
+	result->clusters=state.clusters;
+	return result;
+}
+/*
+ * Distance between an object and the closest member of a cluster.
+*/
+static DTYPE nearest_member_distance(Cluster* cluster,Object* object){
+	DTYPE result=INFINITY,dis;
+	Node* current=cluster->head;
+	while(current!=NULL){
+		dis=distance(current->object->spatial_coordinates,object->spatial_coordinates);
+		if(dis<result){
+			result=dis;
+		}
+		current=current->next;
+	}
+	return result;
+}
+
+typedef struct{
+	DWORD cluster;
+	DTYPE distance;
+} ClusterCandidate;
+
+static int candidate_cmp(const void* c1,const void* c2){
+	DTYPE d1=((ClusterCandidate*)c1)->distance;
+	DTYPE d2=((ClusterCandidate*)c2)->distance;
+	return d1<d2?-1:(d1>d2);
+}
+
+DWORD krig_clustering_insert(Clusters* clusters,Object* object,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+	DWORD i,n_candidates=0,target=-1,old_size;
+	DTYPE predict;
+	ClusteringState state;
+	ClusterCandidate* candidates=Calloc(clusters->size,ClusterCandidate);
+	object->neighbors=-1;
+	/*Clusters are scored from the spatially closest one. Clusters without neighbors in range cannot predict the object.*/
+	for(i=0;i<clusters->size;i++){
+		if(clusters->clusters[i]->size==0){
+			continue;
+		}
+		candidates[n_candidates].cluster=i;
+		candidates[n_candidates].distance=nearest_member_distance(clusters->clusters[i],object);
+		if(max_distance[0]==DIS_UNCHECKED||candidates[n_candidates].distance<max_distance[0]){
+			n_candidates++;
+		}
+	}
+	qsort(candidates,n_candidates,sizeof(ClusterCandidate),candidate_cmp);
+	for(i=0;i<n_candidates;i++){
+		predict=krig_normalize_exact(clusters->clusters[candidates[i].cluster],object,C,max_distance,variogram_type);
+		if(fabs(predict)<=bound){
+			target=candidates[i].cluster;
 			break;
 		}
-		//printf("Begin to revise--------------------------------\n");
-		/*Reinforcement (revising) phase starts*/
-		change=TRUE;
-		while(change&&clusters[i+1]->size>1){
-			change=FALSE;
-			current=clusters[i+1]->head;
-			previous=NULL;
-			counter=0;
-			//Iterate all points in the cluster that contains points filtered out at filtering phase.
-			while(current!=NULL){
-				counter++;
-				revision_steps++;
-				gettimeofday(&start,NULL);
-				/*Use all points in the cluster that was filtered to predict its non-spatial attribute*/
-				predict=krig_normalize(clusters[i],current->object,C,max_distance,variogram_type);
-				//printf("cluster size=%lld,predict for revising=%lf,step=%lld\n",clusters[i+1]->size,predict,counter);
-				//remove_from_cluster(clusters[i+1],previous,current);
-				add_to_cluster_front(clusters[i],current->object);
-				//printf("check5\n");
-				if(fabs(predict)>bound||!krig_consistency(clusters[i],bound,C,max_distance,variogram_type)){
-					/*If not consistent, keep the point in the current cluster*/
-					remove_cluster_front(clusters[i]);
-					previous=current;
-					Objects* objects=get_adjacent_objects(clusters[i],current->object,max_distance);
-					for(j=0;j<objects->size;j++){
-						objects->objects[j]->neighbors=-1;
-					}
-					Free(objects->objects);
-					Free(objects);
-					current->object->neighbors=-1;
-					current=current->next;
-				}else{
-					/*If consistent, put the point back to the cluster that it was filtered out from.*/
-					change=TRUE;
-					remove_from_cluster(clusters[i+1],previous,current);
-					current->object->neighbors=-1;
-					current=current->next;
-				}
-				gettimeofday(&end,NULL);
-				revision_time+=(end.tv_sec-start.tv_sec);
+	}
+	Free(candidates);
+	if(target<0){
+		/*No cluster accepts the object, it starts a cluster of its own.*/
+		clusters->clusters=(Cluster**)realloc(clusters->clusters,sizeof(Cluster*)*(clusters->size+1));
+		clusters->clusters[clusters->size]=create_cluster();
+		add_to_cluster(clusters->clusters[clusters->size],object);
+		clusters->size++;
+		return clusters->size-1;
+	}
+	add_to_cluster(clusters->clusters[target],object);
+	/*Local re-filtering pass on the affected cluster and on clusters created by it.*/
+	init_state(&state);
+	state.clusters=clusters->clusters;
+	state.size=clusters->size;
+	old_size=state.size;
+	filter_and_revise(&state,target,bound,C,max_distance,variogram_type);
+	for(i=old_size;i<state.size;i++){
+		filter_and_revise(&state,i,bound,C,max_distance,variogram_type);
+	}
+	clusters->clusters=state.clusters;
+	clusters->size=state.size;
+	return target;
+}
+
+Clusters* krig_clustering_warm_start(Object** data,DWORD size,DWORD* labels,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+	DWORD i,max_label=-1;
+	DWORD* cluster_of_label;
+	ClusteringState state;
+	Clusters *result;
+	for(i=0;i<size;i++){
+		if(labels[i]>max_label){
+			max_label=labels[i];
+		}
+	}
+	if(max_label<0){
+		/*Nothing to start from*/
+		return krig_clustering(data,size,bound,C,max_distance,variogram_type);
+	}
+	/*Seed one cluster for every label in use. Labels of stations that disappeared never show up, so they produce no cluster.*/
+	cluster_of_label=Calloc(max_label+1,DWORD);
+	for(i=0;i<=max_label;i++){
+		cluster_of_label[i]=-1;
+	}
+	init_state(&state);
+	state.clusters=Calloc(max_label+1,Cluster*);
+	state.size=0;
+	for(i=0;i<size;i++){
+		if(labels[i]<0){
+			continue;
+		}
+		if(cluster_of_label[labels[i]]<0){
+			cluster_of_label[labels[i]]=state.size;
+			state.clusters[state.size]=create_cluster();
+			state.size++;
+		}
+		data[i]->neighbors=-1;
+		add_to_cluster(state.clusters[cluster_of_label[labels[i]]],data[i]);
+	}
+	Free(cluster_of_label);
+	/*Seeded clusters go through the same filtering and revision phases as a cold start, including clusters split off from them.*/
+	for(i=0;i<state.size;i++){
+		filter_and_revise(&state,i,bound,C,max_distance,variogram_type);
+	}
+	printf("filters=%lld,revisions=%lld,filter time=%lf s,revision time =%lf s\n",state.filter_steps,state.revision_steps,state.filter_time*1e-9,state.revision_time*1e-9);
+	result=Calloc(1,Clusters);
+	result->size=state.size;
+	result->clusters=state.clusters;
+	/*Objects without a label (e.g. new stations) are inserted incrementally.*/
+	for(i=0;i<size;i++){
+		if(labels[i]<0){
+			krig_clustering_insert(result,data[i],bound,C,max_distance,variogram_type);
+		}
+	}
+	return result;
+}
+
+typedef struct{
+	SPATIAL_TYPE x;
+	SPATIAL_TYPE y;
+	DWORD label;
+} LocationLabel;
+
+static int location_cmp(const void* l1,const void* l2){
+	LocationLabel* a=(LocationLabel*)l1;
+	LocationLabel* b=(LocationLabel*)l2;
+	if(a->x!=b->x){
+		return a->x<b->x?-1:1;
+	}
+	return a->y<b->y?-1:(a->y>b->y);
+}
+
+DWORD* map_cluster_labels(Clusters* previous,Object** data,DWORD size){
+	DWORD i,n=0;
+	Node* current;
+	LocationLabel key,*found;
+	DWORD* labels=Calloc(size,DWORD);
+	for(i=0;i<previous->size;i++){
+		n+=previous->clusters[i]->size;
+	}
+	LocationLabel* locations=Calloc(n+1,LocationLabel);
+	n=0;
+	for(i=0;i<previous->size;i++){
+		current=previous->clusters[i]->head;
+		while(current!=NULL){
+			locations[n].x=current->object->spatial_coordinates[0];
+			locations[n].y=current->object->spatial_coordinates[1];
+			locations[n].label=i;
+			n++;
+			current=current->next;
+		}
+	}
+	qsort(locations,n,sizeof(LocationLabel),location_cmp);
+	/*An object keeps the label of the previous object at the same location, objects at new locations are unlabelled.*/
+	for(i=0;i<size;i++){
+		key.x=data[i]->spatial_coordinates[0];
+		key.y=data[i]->spatial_coordinates[1];
+		found=(LocationLabel*)bsearch(&key,locations,n,sizeof(LocationLabel),location_cmp);
+		labels[i]=found==NULL?-1:found->label;
+	}
+	Free(locations);
+	return labels;
+}
+
+void default_tiling_settings(TilingSettings* settings){
+	settings->tiles_x=2;
+	settings->tiles_y=2;
+	settings->halo=0;
+	settings->processes=0;
+	settings->revise=FALSE;
+}
+
+/*
+ * Decomposition shared by the worker processes.
+ * Members of tile t, the objects it owns and those in its halo in ascending order, are members[start[t]] to members[start[t+1]-1].
+ * labels, cluster_counts and next live in shared memory. labels holds the cluster of every member within its tile, cluster_counts the number of clusters of every tile, -1 while the tile is unfinished.
+*/
+typedef struct{
+	Object** data;
+	DWORD* start;
+	DWORD* members;
+	DWORD* labels;
+	DWORD* cluster_counts;
+	DWORD* next;
+	DWORD n_tiles;
+	DTYPE bound;
+	DTYPE* C;
+	DTYPE* max_distance;
+	VARIOGRAM_TYPE variogram_type;
+} TileJob;
+
+/*
+ * Pair of the cluster that owns an object and a cluster of another tile that has it in its halo.
+*/
+typedef struct{
+	DWORD owner;
+	DWORD halo;
+} ClusterPair;
+
+static int cluster_pair_cmp(const void* p1,const void* p2){
+	ClusterPair* a=(ClusterPair*)p1;
+	ClusterPair* b=(ClusterPair*)p2;
+	if(a->halo!=b->halo){
+		return a->halo<b->halo?-1:1;
+	}
+	return a->owner<b->owner?-1:(a->owner>b->owner);
+}
+
+static DWORD tile_index(DTYPE value,DTYPE low,DTYPE width,DWORD n){
+	DWORD index=(DWORD)floor((value-low)/width);
+	if(index<0){
+		return 0;
+	}
+	return index>=n?n-1:index;
+}
+
+/*
+ * Halo in degrees of longitude around a point at latitude, for a halo of angle degrees on the sphere.
+ * Points within angle of it lie at latitudes up to |latitude|+angle, where a degree of longitude is shortest. The whole circle is covered if that band reaches a pole.
+*/
+static DTYPE longitude_halo(DTYPE latitude,DTYPE angle){
+	DTYPE highest=fabs(latitude)+angle;
+	if(highest>=90){
+		return 360;
+	}
+	return angle/cos(highest*M_PI/180);
+}
+
+static DWORD find_root(DWORD* parent,DWORD c){
+	while(parent[c]!=c){
+		parent[c]=parent[parent[c]];
+		c=parent[c];
+	}
+	return c;
+}
+
+/*
+ * Cluster the members of tile t and publish their labels.
+*/
+static void cluster_tile(TileJob* job,DWORD t){
+	DWORD i,k,count=job->start[t+1]-job->start[t];
+	DWORD* labels=job->labels+job->start[t];
+	Node* current;
+	ObjectPosition key,*found;
+	if(count==0){
+		job->cluster_counts[t]=0;
+		return;
+	}
+	Object** objects=Calloc(count,Object*);
+	ObjectPosition* positions=Calloc(count,ObjectPosition);
+	for(k=0;k<count;k++){
+		objects[k]=job->data[job->members[job->start[t]+k]];
+		/*Halo objects may carry neighbor counts of another tile*/
+		objects[k]->neighbors=-1;
+		positions[k].object=objects[k];
+		positions[k].position=k;
+	}
+	qsort(positions,count,sizeof(ObjectPosition),object_position_cmp);
+	Clusters* clusters=krig_clustering(objects,count,job->bound,job->C,job->max_distance,job->variogram_type);
+	for(i=0;i<clusters->size;i++){
+		current=clusters->clusters[i]->head;
+		while(current!=NULL){
+			key.object=current->object;
+			found=(ObjectPosition*)bsearch(&key,positions,count,sizeof(ObjectPosition),object_position_cmp);
+			labels[found->position]=i;
+			current=current->next;
+		}
+	}
+	/*Written last, so that a tile counts as finished only with all of its labels*/
+	job->cluster_counts[t]=clusters->size;
+	destroy_clusters(clusters);
+	Free(objects);
+	Free(positions);
+}
+
+static void run_tiles(TileJob* job){
+	DWORD t;
+	/*Tiles are claimed one at a time until none are left*/
+	while((t=__sync_fetch_and_add(job->next,1))<job->n_tiles){
+		cluster_tile(job,t);
+	}
+}
+
+Clusters* krig_clustering_tiled(Object** data,DWORD size,TilingSettings* settings,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+	DWORD i,k,t,tx,ty,tx_min,tx_max,ty_min,ty_max,n_tiles,n_members,n_clusters,n_pairs,n_merged,count,a,b;
+	WORD w,processes,threads;
+	DTYPE x_min,x_max,y_min,y_max,width,height,halo,halo_x;
+	BOOLEAN geodesic=FALSE;
+	SPATIAL_TYPE* p;
+	TileJob job;
+	Clusters* result;
+	int status;
+	if(settings->tiles_x<1||settings->tiles_y<1||settings->halo<0){
+		printf("Invalid tiling settings\n");
+		return NULL;
+	}
+	if(size<1){
+		return krig_clustering(data,size,bound,C,max_distance,variogram_type);
+	}
+	n_tiles=settings->tiles_x*settings->tiles_y;
+	x_min=x_max=data[0]->spatial_coordinates[0];
+	y_min=y_max=data[0]->spatial_coordinates[1];
+	for(i=1;i<size;i++){
+		x_min=fmin(x_min,data[i]->spatial_coordinates[0]);
+		x_max=fmax(x_max,data[i]->spatial_coordinates[0]);
+		y_min=fmin(y_min,data[i]->spatial_coordinates[1]);
+		y_max=fmax(y_max,data[i]->spatial_coordinates[1]);
+	}
+	width=(x_max-x_min)/settings->tiles_x;
+	height=(y_max-y_min)/settings->tiles_y;
+	if(!(width>0)){
+		width=1;
+	}
+	if(!(height>0)){
+		height=1;
+	}
+	halo=settings->halo;
+	if(halo==0&&max_distance[0]!=DIS_UNCHECKED){
+		halo=max_distance[0];
+	}
+	if(halo==0){
+		halo=TILE_DEFAULT_HALO*fmin(width,height);
+	}else if(get_distance_type()!=PLANAR_DISTANCE){
+		/*Kilometers to the angle they span on the sphere, in degrees. This is the halo in latitude, longitude widens with latitude.*/
+		halo=2*asin(fmin(distance_to_chord(halo)/2,1))*180/M_PI;
+		geodesic=TRUE;
+	}
+	/*Members of every tile are counted first and then filled in, in ascending order of objects*/
+	DWORD* owner=Calloc(size,DWORD);
+	job.start=Calloc(n_tiles+1,DWORD);
+	memset(job.start,0,sizeof(DWORD)*(n_tiles+1));
+	for(i=0;i<size;i++){
+		p=data[i]->spatial_coordinates;
+		owner[i]=tile_index(p[1],y_min,height,settings->tiles_y)*settings->tiles_x+tile_index(p[0],x_min,width,settings->tiles_x);
+		halo_x=geodesic?longitude_halo(p[1],halo):halo;
+		tx_min=tile_index(p[0]-halo_x,x_min,width,settings->tiles_x);
+		tx_max=tile_index(p[0]+halo_x,x_min,width,settings->tiles_x);
+		ty_min=tile_index(p[1]-halo,y_min,height,settings->tiles_y);
+		ty_max=tile_index(p[1]+halo,y_min,height,settings->tiles_y);
+		for(ty=ty_min;ty<=ty_max;ty++){
+			for(tx=tx_min;tx<=tx_max;tx++){
+				job.start[ty*settings->tiles_x+tx+1]++;
+			}
+		}
+	}
+	for(t=0;t<n_tiles;t++){
+		job.start[t+1]+=job.start[t];
+	}
+	n_members=job.start[n_tiles];
+	job.members=Calloc(n_members,DWORD);
+	DWORD* fill=Calloc(n_tiles,DWORD);
+	memcpy(fill,job.start,sizeof(DWORD)*n_tiles);
+	for(i=0;i<size;i++){
+		p=data[i]->spatial_coordinates;
+		halo_x=geodesic?longitude_halo(p[1],halo):halo;
+		tx_min=tile_index(p[0]-halo_x,x_min,width,settings->tiles_x);
+		tx_max=tile_index(p[0]+halo_x,x_min,width,settings->tiles_x);
+		ty_min=tile_index(p[1]-halo,y_min,height,settings->tiles_y);
+		ty_max=tile_index(p[1]+halo,y_min,height,settings->tiles_y);
+		for(ty=ty_min;ty<=ty_max;ty++){
+			for(tx=tx_min;tx<=tx_max;tx++){
+				job.members[fill[ty*settings->tiles_x+tx]++]=i;
+			}
+		}
+	}
+	Free(fill);
+	/*Labels, cluster counts and the tile counter are shared with the workers*/
+	size_t shared_size=sizeof(DWORD)*(n_members+n_tiles+1);
+	DWORD* shared=(DWORD*)mmap(NULL,shared_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(shared==MAP_FAILED){
+		printf("Shared memory for %lld tile members could not be mapped\n",n_members);
+		Free(owner);
+		Free(job.start);
+		Free(job.members);
+		return NULL;
+	}
+	job.data=data;
+	job.labels=shared;
+	job.cluster_counts=shared+n_members;
+	job.next=job.cluster_counts+n_tiles;
+	job.n_tiles=n_tiles;
+	job.bound=bound;
+	job.C=C;
+	job.max_distance=max_distance;
+	job.variogram_type=variogram_type;
+	for(t=0;t<n_tiles;t++){
+		job.cluster_counts[t]=-1;
+	}
+	*job.next=0;
+	threads=krig_thread_count();
+	processes=settings->processes>0?settings->processes:threads;
+	if(processes>n_tiles){
+		processes=n_tiles;
+	}
+	/*Every worker gets its share of the threads, and the calling process takes part as worker 0*/
+	set_krig_thread_count(threads/processes>1?threads/processes:1);
+	pid_t* workers=Calloc(processes,pid_t);
+	/*Workers count into their own profile, which the calling process adds to its counters once the worker is done*/
+	KrigProfile* profiles=(KrigProfile*)mmap(NULL,sizeof(KrigProfile)*processes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(profiles==MAP_FAILED){
+		profiles=NULL;
+	}
+	fflush(stdout);
+	for(w=1;w<processes;w++){
+		workers[w]=fork();
+		if(workers[w]==0){
+			krig_profile_reset();
+			run_tiles(&job);
+			if(profiles!=NULL){
+				krig_profile_get(&profiles[w]);
 			}
-			//printf("%lld\n",clusters[i+1]->size);
+			fflush(stdout);
+			_exit(0);
 		}
-		/*If there is only one point left in the reinforced cluster after reinforcement phase, algorithm exits*/
-		if(clusters[i+1]->size<=1){
+		if(workers[w]<0){
+			/*Remaining tiles are picked up by the workers that did start*/
 			break;
 		}
-		//printf("i=%lld,size=%lld\n",i,clusters[i]->size);
 	}
-	/*Point out timing statistics*/
-	printf("filters=%lld,revisions=%lld,filter time=%lld s,revision time =%lld s\n",filter_steps,revision_steps,filter_time,revision_time);
-	clusters=(Cluster**)realloc(clusters,sizeof(Cluster*)*k);
-	Clusters *result=Calloc(1,Clusters);
-	result->size=k;
-	result->clusters=clusters;
+	run_tiles(&job);
+	for(w=w-1;w>0;w--){
+		if(waitpid(workers[w],&status,0)<0||!WIFEXITED(status)||WEXITSTATUS(status)!=0){
+			printf("Tile worker %d failed\n",w);
+		}else if(profiles!=NULL){
+			krig_profile_merge(&profiles[w]);
+		}
+	}
+	Free(workers);
+	if(profiles!=NULL){
+		munmap(profiles,sizeof(KrigProfile)*processes);
+	}
+	/*Tiles a failed worker did not finish*/
+	for(t=0;t<n_tiles;t++){
+		if(job.cluster_counts[t]<0){
+			cluster_tile(&job,t);
+		}
+	}
+	set_krig_thread_count(threads);
+	/*Tile clusters get consecutive global numbers, tile by tile*/
+	DWORD* offsets=Calloc(n_tiles+1,DWORD);
+	offsets[0]=0;
+	for(t=0;t<n_tiles;t++){
+		offsets[t+1]=offsets[t]+job.cluster_counts[t];
+	}
+	n_clusters=offsets[n_tiles];
+	DWORD* parent=Calloc(n_clusters,DWORD);
+	DWORD* halo_counts=Calloc(n_clusters,DWORD);
+	for(a=0;a<n_clusters;a++){
+		parent[a]=a;
+		halo_counts[a]=0;
+	}
+	DWORD* cluster_of=Calloc(size,DWORD);
+	for(t=0;t<n_tiles;t++){
+		for(k=job.start[t];k<job.start[t+1];k++){
+			if(owner[job.members[k]]==t){
+				cluster_of[job.members[k]]=offsets[t]+job.labels[k];
+			}
+		}
+	}
+	ClusterPair* pairs=Calloc(n_members-size+1,ClusterPair);
+	n_pairs=0;
+	for(t=0;t<n_tiles;t++){
+		for(k=job.start[t];k<job.start[t+1];k++){
+			if(owner[job.members[k]]!=t){
+				pairs[n_pairs].owner=cluster_of[job.members[k]];
+				pairs[n_pairs].halo=offsets[t]+job.labels[k];
+				halo_counts[pairs[n_pairs].halo]++;
+				n_pairs++;
+			}
+		}
+	}
+	/*A halo cluster joins the owning cluster of the majority of its halo members. Merges are transitive.*/
+	qsort(pairs,n_pairs,sizeof(ClusterPair),cluster_pair_cmp);
+	for(k=0;k<n_pairs;k+=count){
+		for(count=1;k+count<n_pairs&&pairs[k+count].halo==pairs[k].halo&&pairs[k+count].owner==pairs[k].owner;count++);
+		if(2*count>halo_counts[pairs[k].halo]){
+			a=find_root(parent,pairs[k].owner);
+			b=find_root(parent,pairs[k].halo);
+			if(a<b){
+				parent[b]=a;
+			}else{
+				parent[a]=b;
+			}
+		}
+	}
+	/*Merged clusters are numbered in order of their first object*/
+	DWORD* labels=Calloc(size,DWORD);
+	DWORD* merged=Calloc(n_clusters,DWORD);
+	for(a=0;a<n_clusters;a++){
+		merged[a]=-1;
+	}
+	n_merged=0;
+	for(i=0;i<size;i++){
+		a=find_root(parent,cluster_of[i]);
+		if(merged[a]<0){
+			merged[a]=n_merged++;
+		}
+		labels[i]=merged[a];
+	}
+	printf("tiles=%lld,tile clusters=%lld,merged clusters=%lld\n",n_tiles,n_clusters,n_merged);
+	munmap(shared,shared_size);
+	Free(owner);
+	Free(job.start);
+	Free(job.members);
+	Free(offsets);
+	Free(parent);
+	Free(halo_counts);
+	Free(cluster_of);
+	Free(pairs);
+	Free(merged);
+	if(settings->revise){
+		result=krig_clustering_warm_start(data,size,labels,bound,C,max_distance,variogram_type);
+	}else{
+		result=Calloc(1,Clusters);
+		result->size=n_merged;
+		result->clusters=Calloc(n_merged,Cluster*);
+		for(a=0;a<n_merged;a++){
+			result->clusters[a]=create_cluster();
+		}
+		for(i=0;i<size;i++){
+			data[i]->neighbors=-1;
+			add_to_cluster(result->clusters[labels[i]],data[i]);
+		}
+	}
+	Free(labels);
 	return result;
 }
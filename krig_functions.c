@@ -6,12 +6,21 @@
 #include "matrix.h"
 #include "clusterfunctions.h"
 #include "krigfunctions.h"
+#include "krigprofile.h"
 
 
 DTYPE distance(SPATIAL_TYPE* coordinates1,SPATIAL_TYPE* coordinates2){
-	DTYPE d1=coordinates1[0]-coordinates2[0];
-	DTYPE d2=coordinates1[1]-coordinates2[1];
-	return sqrt(d1*d1+d2*d2);
+	DTYPE d1,d2,d3;
+	if(get_distance_type()==PLANAR_DISTANCE){
+		d1=coordinates1[0]-coordinates2[0];
+		d2=coordinates1[1]-coordinates2[1];
+		return sqrt(d1*d1+d2*d2);
+	}
+	/*The chord from the difference of the unit vectors costs as much as 2-2*dot, but keeps its precision for close points*/
+	d1=coordinates1[2]-coordinates2[2];
+	d2=coordinates1[3]-coordinates2[3];
+	d3=coordinates1[4]-coordinates2[4];
+	return chord_to_distance(sqrt(d1*d1+d2*d2+d3*d3));
 }
 
 DTYPE exponential_variogram(DTYPE r,DTYPE C0,DTYPE C1,DTYPE C2){
@@ -28,6 +37,10 @@ DTYPE anisotropy_power_variogram(DTYPE r,DTYPE phi,DTYPE C0,DTYPE C1,DTYPE C2,DT
 }
 
 DTYPE spherical_variogram(DTYPE r,DTYPE C0,DTYPE C1,DTYPE C2){
+	/*The sill is reached at the range C2, the covariance is exactly zero beyond it*/
+	if(r>=C2){
+		return C0+2*C1*C1;
+	}
 	return C0+2*C1*C1*(1.5*r/C2-0.5*r*r*r/(C2*C2*C2));
 }
 
@@ -109,6 +122,40 @@ DTYPE compute_variogram(Object* o1,Object* o2,DTYPE* C,VARIOGRAM_TYPE variogram_
 /*
  * parameters[0]=r, parameters[1]=phi, parameters[2]=u
 */
+DWORD variogram_model_length(VARIOGRAM_TYPE variogram_type){
+	switch(variogram_type){
+		case EXPONENTIAL_VARIOGRAM:{
+			return 3;
+			break;
+		}
+		case SPHERICAL_VARIOGRAM:{
+			return 3;
+			break;
+		}
+		case POWER_VARIOGRAM:{
+			return 3;
+			break;
+		}
+		case ANISOTROPHY_POWER_VARIOGRAM:{
+			return 4;
+			break;
+		}
+		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
+			return 10;
+			break;
+		}
+		case ST_EXPONENTIAL_PRODUCT_VARIOGRAM:{
+			return 7;
+			break;
+		}
+		default:{
+			
+			break;
+		}
+	}
+	return -1;
+}
+
 DTYPE compute_variogram_by_parameters(DTYPE *parameters,DTYPE* C,VARIOGRAM_TYPE variogram_type){
 	switch(variogram_type){
 		case EXPONENTIAL_VARIOGRAM:{
@@ -136,6 +183,125 @@ DTYPE compute_variogram_by_parameters(DTYPE *parameters,DTYPE* C,VARIOGRAM_TYPE
 	}
 }
 
+/*
+ * Derivatives of one spherical term c0+c1*(1.5-q^2)*q, q=h/c2, of the ST spherical product variogram. The term is zero beyond the range.
+ * derivatives[3] is the derivative with respect to h.
+*/
+static void ST_spherical_term_derivatives(DTYPE h,DTYPE c1,DTYPE c2,DTYPE* derivatives){
+	DTYPE q=h/c2;
+	if(q<=1){
+		derivatives[0]=1;
+		derivatives[1]=(1.5-q*q)*q;
+		derivatives[3]=c1*(1.5-3*q*q)/c2;
+		derivatives[2]=-derivatives[3]*q;
+	}else{
+		derivatives[0]=0;
+		derivatives[1]=0;
+		derivatives[2]=0;
+		derivatives[3]=0;
+	}
+}
+
+void compute_variogram_derivatives(DTYPE *parameters,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* derivatives){
+	DTYPE r=parameters[0];
+	switch(variogram_type){
+		case EXPONENTIAL_VARIOGRAM:{
+			DTYPE e=exp(-C[2]*r);
+			derivatives[0]=1;
+			derivatives[1]=1-e;
+			derivatives[2]=C[1]*r*e;
+			break;
+		}
+		case POWER_VARIOGRAM:{
+			derivatives[0]=1;
+			if(r>0){
+				derivatives[1]=pow(r,C[2]);
+				derivatives[2]=C[1]*derivatives[1]*log(r);
+			}else{
+				derivatives[1]=0;
+				derivatives[2]=0;
+			}
+			break;
+		}
+		case ANISOTROPHY_POWER_VARIOGRAM:{
+			/*gamma=C0+S^(P/2) with S=r^2*(C1^(2/P)*a+C2^(2/P)*b)*/
+			DTYPE P=C[3],r2=r*r;
+			DTYPE a=pow(cos(M_PI/4-parameters[1]),2),b=pow(cos(M_PI/4+parameters[1]),2);
+			DTYPE p1=pow(C[1],2/P),p2=pow(C[2],2/P);
+			DTYPE S=r2*(p1*a+p2*b),power,dS;
+			derivatives[0]=1;
+			if(S<=0){
+				derivatives[1]=0;
+				derivatives[2]=0;
+				derivatives[3]=0;
+				break;
+			}
+			power=pow(S,P/2);
+			derivatives[1]=C[1]>0?power/S*r2*a*p1/C[1]:0;
+			derivatives[2]=C[2]>0?power/S*r2*b*p2/C[2]:0;
+			dS=0;
+			if(C[1]>0){
+				dS+=a*p1*log(C[1]);
+			}
+			if(C[2]>0){
+				dS+=b*p2*log(C[2]);
+			}
+			dS*=-2*r2/(P*P);
+			derivatives[3]=power*(0.5*log(S)+0.5*P*dS/S);
+			break;
+		}
+		case SPHERICAL_VARIOGRAM:{
+			DTYPE q=r/C[2];
+			derivatives[0]=1;
+			if(q>=1){
+				derivatives[1]=4*C[1];
+				derivatives[2]=0;
+				break;
+			}
+			derivatives[1]=4*C[1]*(1.5*q-0.5*q*q*q);
+			derivatives[2]=2*C[1]*C[1]*(1.5*q*q*q-1.5*q)/C[2];
+			break;
+		}
+		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
+			DTYPE u=parameters[2],ku=C[0]*u,h=sqrt(r*r+ku*ku);
+			DTYPE term[4];
+			ST_spherical_term_derivatives(r,C[2],C[3],term);
+			derivatives[1]=term[0];
+			derivatives[2]=term[1];
+			derivatives[3]=term[2];
+			ST_spherical_term_derivatives(u,C[5],C[6],term);
+			derivatives[4]=term[0];
+			derivatives[5]=term[1];
+			derivatives[6]=term[2];
+			ST_spherical_term_derivatives(h,C[8],C[9],term);
+			derivatives[7]=term[0];
+			derivatives[8]=term[1];
+			derivatives[9]=term[2];
+			/*k only enters through the joint lag h*/
+			derivatives[0]=h>0?term[3]*ku*u/h:0;
+			break;
+		}
+		case ST_EXPONENTIAL_PRODUCT_VARIOGRAM:{
+			DTYPE u=parameters[2],k=C[0];
+			DTYPE es=exp(-C[3]*r),et=exp(-C[6]*u);
+			DTYPE vs=C[1]+C[2]*(1-es),vt=C[4]+C[5]*(1-et);
+			/*Derivatives of gamma with respect to vs and vt*/
+			DTYPE ds=k+C[2]-k*vt,dt=k+C[5]-k*vs;
+			derivatives[0]=vs+vt-vs*vt;
+			derivatives[1]=ds;
+			derivatives[2]=vs+ds*(1-es);
+			derivatives[3]=ds*C[2]*r*es;
+			derivatives[4]=dt;
+			derivatives[5]=vt+dt*(1-et);
+			derivatives[6]=dt*C[5]*u*et;
+			break;
+		}
+		default:{
+			break;
+		}
+	}
+}
+
 DTYPE DistanceSum(Cluster* cluster,Object* object,DTYPE r){
 	DWORD j;
 	DTYPE sum=0;
@@ -164,6 +330,8 @@ DTYPE InverseDistanceInterpolation(Cluster* cluster,Object* object,DTYPE r){
 }
 
 Objects* get_adjacent_objects(Cluster* cluster,Object* object,DTYPE* max_distance){
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
 	Object** objects=Calloc(cluster->size,Object*);
 	Node* front=cluster->head;
 	DWORD i,index=0;
@@ -179,10 +347,652 @@ Objects* get_adjacent_objects(Cluster* cluster,Object* object,DTYPE* max_distanc
 	Objects* result=Calloc(1,Objects);
 	result->objects=objects;
 	result->size=index;
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_NEIGHBOR);
+	return result;
+}
+
+/*Time stamp and position of an object, sorted to find temporal neighbors*/
+typedef struct{
+	TEMPORAL_TYPE time;
+	DWORD index;
+} TimeEntry;
+
+static int time_entry_cmp(const void* a,const void* b){
+	TEMPORAL_TYPE x=((TimeEntry*)a)->time,y=((TimeEntry*)b)->time;
+	return x<y?-1:(x>y);
+}
+
+static int column_cmp(const void* a,const void* b){
+	DWORD x=*(DWORD*)a,y=*(DWORD*)b;
+	return x<y?-1:(x>y);
+}
+
+BOOLEAN krig_sparse_supported(DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range){
+	switch(variogram_type){
+		case SPHERICAL_VARIOGRAM:{
+			return C[2]>0;
+		}
+		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
+			return C[3]>0&&C[6]>0&&C[9]>0;
+		}
+		case EXPONENTIAL_VARIOGRAM:{
+			return taper_range>0;
+		}
+		default:{
+			return FALSE;
+		}
+	}
+}
+
+/*
+ * Sill of the covariance form of the sparse system, zero for the spatio-temporal spherical model which is assembled as a variogram.
+*/
+static DTYPE sparse_krig_sill(DTYPE* C,VARIOGRAM_TYPE variogram_type){
+	switch(variogram_type){
+		case SPHERICAL_VARIOGRAM:{
+			return C[0]+2*C[1]*C[1];
+		}
+		case EXPONENTIAL_VARIOGRAM:{
+			return C[0]+C[1];
+		}
+		default:{
+			return 0;
+		}
+	}
+}
+
+/*
+ * Off-diagonal entry of the sparse system between two objects, zero beyond the range.
+*/
+static DTYPE sparse_krig_entry(Object* o1,Object* o2,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range){
+	DTYPE r,s;
+	switch(variogram_type){
+		case SPHERICAL_VARIOGRAM:{
+			r=distance(o1->spatial_coordinates,o2->spatial_coordinates);
+			return r>=C[2]?0:C[0]+2*C[1]*C[1]-spherical_variogram(r,C[0],C[1],C[2]);
+		}
+		case EXPONENTIAL_VARIOGRAM:{
+			r=distance(o1->spatial_coordinates,o2->spatial_coordinates);
+			if(r>=taper_range){
+				return 0;
+			}
+			s=r/taper_range;
+			return C[1]*exp(-C[2]*r)*(1-1.5*s+0.5*s*s*s);
+		}
+		default:{
+			return compute_variogram(o1,o2,C,variogram_type);
+		}
+	}
+}
+
+SparseMatrix* krig_sparse_system(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range){
+	Object** data=objects->objects;
+	DWORD n=objects->size,i,j,k,c,cx,cy,cz,x,y,z,count,capacity,low,high,middle;
+	DTYPE cutoff,time_cutoff=-1,value,sill;
+	TimeEntry* times=NULL;
+	if(n==0||!krig_sparse_supported(C,variogram_type,taper_range)){
+		return NULL;
+	}
+	switch(variogram_type){
+		case SPHERICAL_VARIOGRAM:{
+			cutoff=C[2];
+			break;
+		}
+		case EXPONENTIAL_VARIOGRAM:{
+			cutoff=taper_range;
+			break;
+		}
+		default:{
+			/*The joint term vanishes beyond C[9] in space, so every pair in range is within max(C[3],C[9]) in space or C[6] in time*/
+			cutoff=fmax(C[3],C[9]);
+			time_cutoff=C[6];
+			break;
+		}
+	}
+	sill=sparse_krig_sill(C,variogram_type);
+	CellList* cells=build_cell_list(objects,cutoff*1.0001);
+	if(time_cutoff>=0){
+		times=Calloc(n,TimeEntry);
+		for(i=0;i<n;i++){
+			times[i].time=data[i]->time;
+			times[i].index=i;
+		}
+		qsort(times,n,sizeof(TimeEntry),time_entry_cmp);
+	}
+	DWORD* marker=Calloc(n,DWORD);
+	DWORD* row=Calloc(n,DWORD);
+	for(i=0;i<n;i++){
+		marker[i]=-1;
+	}
+	SparseMatrix* result=Calloc(1,SparseMatrix);
+	result->n_row=n+1;
+	result->n_column=n+1;
+	result->row_start=Calloc(n+2,DWORD);
+	capacity=8*(n+1);
+	result->columns=Calloc(capacity,DWORD);
+	result->values=Calloc(capacity,DTYPE);
+	result->row_start[0]=0;
+	k=0;
+	for(i=0;i<n;i++){
+		/*Candidates from the neighboring cells and the time window, each taken once*/
+		count=0;
+		marker[i]=i;
+		row[count++]=i;
+		cell_of(cells,data[i]->spatial_coordinates,&cx,&cy,&cz);
+		for(z=cz>0?cz-1:0;z<=cz+1&&z<cells->nz;z++){
+			for(y=cy>0?cy-1:0;y<=cy+1&&y<cells->ny;y++){
+				for(x=cx>0?cx-1:0;x<=cx+1&&x<cells->nx;x++){
+					c=(z*cells->ny+y)*cells->nx+x;
+					for(j=cells->start[c];j<cells->start[c+1];j++){
+						if(marker[cells->members[j]]!=i){
+							marker[cells->members[j]]=i;
+							row[count++]=cells->members[j];
+						}
+					}
+				}
+			}
+		}
+		if(times!=NULL){
+			low=0;
+			high=n;
+			while(low<high){
+				middle=(low+high)/2;
+				if(times[middle].time<data[i]->time-time_cutoff){
+					low=middle+1;
+				}else{
+					high=middle;
+				}
+			}
+			for(j=low;j<n&&times[j].time<=data[i]->time+time_cutoff;j++){
+				if(marker[times[j].index]!=i){
+					marker[times[j].index]=i;
+					row[count++]=times[j].index;
+				}
+			}
+		}
+		qsort(row,count,sizeof(DWORD),column_cmp);
+		if(k+count+1>capacity){
+			while(k+count+1>capacity){
+				capacity*=2;
+			}
+			result->columns=(DWORD*)realloc(result->columns,sizeof(DWORD)*capacity);
+			result->values=(DTYPE*)realloc(result->values,sizeof(DTYPE)*capacity);
+		}
+		for(j=0;j<count;j++){
+			if(row[j]==i){
+				/*Same convention as the dense system, the variogram of an object with itself is zero*/
+				value=sill;
+			}else{
+				value=sparse_krig_entry(data[i],data[row[j]],C,variogram_type,taper_range);
+				if(value==0){
+					continue;
+				}
+			}
+			result->columns[k]=row[j];
+			result->values[k]=value;
+			k++;
+		}
+		result->columns[k]=n;
+		result->values[k]=1;
+		k++;
+		result->row_start[i+1]=k;
+	}
+	/*Unbiasedness constraint*/
+	if(k+n>capacity){
+		capacity=k+n;
+		result->columns=(DWORD*)realloc(result->columns,sizeof(DWORD)*capacity);
+		result->values=(DTYPE*)realloc(result->values,sizeof(DTYPE)*capacity);
+	}
+	for(j=0;j<n;j++){
+		result->columns[k]=j;
+		result->values[k]=1;
+		k++;
+	}
+	result->row_start[n+1]=k;
+	destroy_cell_list(cells);
+	Free(times);
+	Free(marker);
+	Free(row);
+	return result;
+}
+
+/*
+ * Solve an assembled sparse system for the weights of an object.
+ * The preconditioner is the inverse diagonal, or the inverse absolute row sum where the diagonal is not positive. The border row is scaled by the matching Schur complement.
+*/
+static Matrix* solve_sparse_krig(SparseMatrix* A,Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range,Matrix** gamma){
+	Object** data=objects->objects;
+	DWORD n=objects->size,i,k,iterations;
+	DTYPE diagonal,sum,schur=0,sill=sparse_krig_sill(C,variogram_type);
+	DTYPE* b=Calloc(n+1,DTYPE);
+	DTYPE* x=Calloc(n+1,DTYPE);
+	DTYPE* weights=Calloc(n+1,DTYPE);
+	for(i=0;i<n;i++){
+		b[i]=sparse_krig_entry(object,data[i],C,variogram_type,taper_range);
+		diagonal=0;
+		sum=0;
+		for(k=A->row_start[i];k<A->row_start[i+1]-1;k++){
+			if(A->columns[k]==i){
+				diagonal=A->values[k];
+			}
+			sum+=fabs(A->values[k]);
+		}
+		if(!(diagonal>0)){
+			diagonal=sum>0?sum:1;
+		}
+		weights[i]=1/diagonal;
+		schur+=weights[i];
+	}
+	b[n]=1;
+	weights[n]=1/schur;
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
+	iterations=solve_minres(A,b,x,weights,SPARSE_KRIG_MAX_ITERATIONS,SPARSE_KRIG_TOLERANCE);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_FACTORIZATION);
+	if(iterations<0){
+		printf("Sparse Kriging system did not converge\n");
+		Free(b);
+		Free(x);
+		Free(weights);
+		return NULL;
+	}
+	Matrix* lambda=create_matrix(n+1,1);
+	for(i=0;i<n;i++){
+		lambda->matrix[i][0]=x[i];
+	}
+	/*In covariance form the Lagrange multiplier changes sign*/
+	lambda->matrix[n][0]=variogram_type!=ST_SPHERICAL_PRODUCT_VARIOGRAM?-x[n]:x[n];
+	if(gamma!=NULL){
+		*gamma=create_matrix(n+1,1);
+		for(i=0;i<n;i++){
+			(*gamma)->matrix[i][0]=variogram_type!=ST_SPHERICAL_PRODUCT_VARIOGRAM?sill-b[i]:b[i];
+		}
+		(*gamma)->matrix[n][0]=1;
+	}
+	Free(b);
+	Free(x);
+	Free(weights);
+	return lambda;
+}
+
+Matrix* krig_weights_sparse(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range,Matrix** gamma){
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
+	SparseMatrix* A=krig_sparse_system(objects,C,variogram_type,taper_range);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
+	if(A==NULL){
+		return NULL;
+	}
+	Matrix* lambda=solve_sparse_krig(A,objects,object,C,variogram_type,taper_range,gamma);
+	destroy_sparse_matrix(A);
+	return lambda;
+}
+
+/*
+ * Sparse path taken automatically by the dense Kriging functions for large systems with spherical variograms.
+ * The spatio-temporal spherical model is assembled as an indefinite variogram matrix on which MINRES may need thousands of iterations, so it is only solved sparsely on request.
+ * Return: NULL if the system is small, the variogram is not supported, the system is not sparse enough or MINRES did not converge.
+*/
+static Matrix* krig_weights_auto_sparse(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,Matrix** gamma){
+	DWORD n=objects->size;
+	if(n<SPARSE_KRIG_THRESHOLD||variogram_type!=SPHERICAL_VARIOGRAM||!krig_sparse_supported(C,variogram_type,0)){
+		return NULL;
+	}
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
+	SparseMatrix* A=krig_sparse_system(objects,C,variogram_type,0);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
+	if(A->row_start[n+1]>SPARSE_KRIG_MAX_DENSITY*(n+1)*(n+1)){
+		destroy_sparse_matrix(A);
+		return NULL;
+	}
+	Matrix* lambda=solve_sparse_krig(A,objects,object,C,variogram_type,0,gamma);
+	destroy_sparse_matrix(A);
+	return lambda;
+}
+
+static DTYPE hierarchical_krig_entry(DWORD i,DWORD j,void* arg){
+	HKrigSystem* system=(HKrigSystem*)arg;
+	if(i==j){
+		return system->sill;
+	}
+	return system->sill-compute_variogram(system->objects->objects[i],system->objects->objects[j],system->C,system->variogram_type);
+}
+
+HKrigSystem* build_hierarchical_krig_system(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE tolerance){
+	DWORD i;
+	if(objects->size<1||(variogram_type!=EXPONENTIAL_VARIOGRAM&&variogram_type!=SPHERICAL_VARIOGRAM)){
+		printf("Variogram type %x has no covariance function, use an exponential or spherical variogram\n",variogram_type);
+		return NULL;
+	}
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
+	HKrigSystem* system=Calloc(1,HKrigSystem);
+	system->objects=objects;
+	system->C=C;
+	system->variogram_type=variogram_type;
+	system->sill=sparse_krig_sill(C,variogram_type);
+	SPATIAL_TYPE** points=Calloc(objects->size,SPATIAL_TYPE*);
+	/*Geodesic distances are smooth in the unit vectors, whose boxes do not degenerate at the poles or the date line*/
+	for(i=0;i<objects->size;i++){
+		points[i]=get_distance_type()==PLANAR_DISTANCE?objects->objects[i]->spatial_coordinates:objects->objects[i]->spatial_coordinates+2;
+	}
+	system->covariance=build_hmatrix(objects->size,points,get_distance_type()==PLANAR_DISTANCE?2:3,hierarchical_krig_entry,system,tolerance);
+	Free(points);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
+	return system;
+}
+
+void destroy_hierarchical_krig_system(HKrigSystem* system){
+	if(system==NULL){
+		return;
+	}
+	destroy_hmatrix(system->covariance);
+	Free(system);
+}
+
+/*
+ * Bordered covariance system of a hierarchical Kriging system with one object possibly left out.
+ * The row and column of the excluded object are replaced by the identity, so its weight is zero and the other weights are those of the remaining objects.
+*/
+typedef struct{
+	HKrigSystem* system;
+	DWORD excluded;
+	DTYPE* weights;
+} HKrigOperator;
+
+static void hierarchical_krig_product(DTYPE* x,DTYPE* y,void* arg){
+	HKrigOperator* op=(HKrigOperator*)arg;
+	DWORD n=op->system->objects->size,i;
+	DTYPE excluded_value=0,sum=0;
+	if(op->excluded>=0){
+		excluded_value=x[op->excluded];
+		x[op->excluded]=0;
+	}
+	hmatrix_multiply_vector(op->system->covariance,x,y);
+	for(i=0;i<n;i++){
+		y[i]+=x[n];
+		sum+=x[i];
+	}
+	y[n]=sum;
+	if(op->excluded>=0){
+		x[op->excluded]=excluded_value;
+		y[op->excluded]=excluded_value;
+	}
+}
+
+static void hierarchical_krig_preconditioner(DTYPE* r,DTYPE* y,void* arg){
+	HKrigOperator* op=(HKrigOperator*)arg;
+	DWORD i;
+	for(i=0;i<=op->system->objects->size;i++){
+		y[i]=op->weights[i]*r[i];
+	}
+}
+
+Matrix* krig_weights_hierarchical(HKrigSystem* system,Object* object,DWORD excluded,Matrix** gamma){
+	Object** data=system->objects->objects;
+	DWORD n=system->objects->size,i,iterations;
+	HKrigOperator op;
+	if(excluded>=n){
+		excluded=-1;
+	}
+	op.system=system;
+	op.excluded=excluded;
+	op.weights=Calloc(n+1,DTYPE);
+	DTYPE* b=Calloc(n+1,DTYPE);
+	DTYPE* x=Calloc(n+1,DTYPE);
+	/*Diagonal preconditioner, the border row is scaled by the matching Schur complement*/
+	for(i=0;i<n;i++){
+		b[i]=i==excluded?0:system->sill-compute_variogram(object,data[i],system->C,system->variogram_type);
+		op.weights[i]=i==excluded?1:1/system->sill;
+	}
+	b[n]=1;
+	op.weights[n]=system->sill/(excluded>=0?n-1:n);
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
+	iterations=solve_minres_operator(n+1,hierarchical_krig_product,hierarchical_krig_preconditioner,&op,b,x,SPARSE_KRIG_MAX_ITERATIONS,SPARSE_KRIG_TOLERANCE);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_FACTORIZATION);
+	Free(op.weights);
+	if(iterations<0){
+		printf("Hierarchical Kriging system did not converge\n");
+		Free(b);
+		Free(x);
+		return NULL;
+	}
+	Matrix* lambda=create_matrix(n+1,1);
+	for(i=0;i<n;i++){
+		lambda->matrix[i][0]=x[i];
+	}
+	/*Back to the variogram convention of krig_weights*/
+	lambda->matrix[n][0]=-x[n];
+	if(gamma!=NULL){
+		*gamma=create_matrix(n+1,1);
+		for(i=0;i<n;i++){
+			(*gamma)->matrix[i][0]=system->sill-b[i];
+		}
+		(*gamma)->matrix[n][0]=1;
+	}
+	Free(b);
+	Free(x);
+	return lambda;
+}
+
+/*
+ * Group of every object and size of every group for coalesce_objects.
+ * Return: Number of groups.
+*/
+static DWORD group_objects(Objects* objects,DTYPE tolerance,DWORD* group,DWORD* counts){
+	Object** data=objects->objects;
+	DWORD n=objects->size,i,j,k,c,cx,cy,cz,x,y,z,g,n_groups=0;
+	if(n==0){
+		return 0;
+	}
+	for(i=0;i<n;i++){
+		group[i]=-1;
+	}
+	if(tolerance<0){
+		tolerance=0;
+	}
+	CellList* cells=build_cell_list(objects,tolerance*1.0001);
+	/*Every object not yet grouped starts a group with the objects of its time stamp within tolerance*/
+	for(i=0;i<n;i++){
+		if(group[i]>=0){
+			continue;
+		}
+		g=n_groups++;
+		group[i]=g;
+		counts[g]=1;
+		cell_of(cells,data[i]->spatial_coordinates,&cx,&cy,&cz);
+		for(z=cz>0?cz-1:0;z<=cz+1&&z<cells->nz;z++){
+			for(y=cy>0?cy-1:0;y<=cy+1&&y<cells->ny;y++){
+				for(x=cx>0?cx-1:0;x<=cx+1&&x<cells->nx;x++){
+					c=(z*cells->ny+y)*cells->nx+x;
+					for(k=cells->start[c];k<cells->start[c+1];k++){
+						j=cells->members[k];
+						if(group[j]<0&&data[j]->time==data[i]->time&&distance(data[i]->spatial_coordinates,data[j]->spatial_coordinates)<=tolerance){
+							group[j]=g;
+							counts[g]++;
+						}
+					}
+				}
+			}
+		}
+	}
+	destroy_cell_list(cells);
+	return n_groups;
+}
+
+/*
+ * Mean objects of the groups found by group_objects.
+*/
+static CoalescedObjects* merge_groups(Objects* objects,DWORD* group,DWORD* counts,DWORD n_groups){
+	Object** data=objects->objects;
+	DWORD n=objects->size,i,g;
+	WORD d,dimension=get_distance_type()==PLANAR_DISTANCE?2:GEODESIC_COORDINATES;
+	DTYPE norm;
+	SPATIAL_TYPE* p;
+	CoalescedObjects* result=Calloc(1,CoalescedObjects);
+	result->size=n;
+	result->group=group;
+	result->counts=counts;
+	result->objects=Calloc(1,Objects);
+	result->objects->objects=Calloc(n_groups,Object*);
+	result->objects->size=n_groups;
+	for(g=0;g<n_groups;g++){
+		Object* object=Calloc(1,Object);
+		object->spatial_coordinates=Calloc(GEODESIC_COORDINATES,SPATIAL_TYPE);
+		for(d=0;d<GEODESIC_COORDINATES;d++){
+			object->spatial_coordinates[d]=0;
+		}
+		object->attribute=0;
+		object->time=0;
+		object->normalized_value=0;
+		object->neighbors=-1;
+		result->objects->objects[g]=object;
+	}
+	for(i=0;i<n;i++){
+		Object* object=result->objects->objects[result->group[i]];
+		for(d=0;d<dimension;d++){
+			object->spatial_coordinates[d]+=data[i]->spatial_coordinates[d];
+		}
+		object->attribute+=data[i]->attribute;
+		object->time=data[i]->time;
+	}
+	for(g=0;g<n_groups;g++){
+		Object* object=result->objects->objects[g];
+		p=object->spatial_coordinates;
+		p[0]/=result->counts[g];
+		p[1]/=result->counts[g];
+		if(dimension>2){
+			/*Degrees do not average across the date line, the group is placed at the normalized mean of the unit vectors instead*/
+			norm=sqrt(p[2]*p[2]+p[3]*p[3]+p[4]*p[4]);
+			if(norm>0){
+				p[2]/=norm;
+				p[3]/=norm;
+				p[4]/=norm;
+				p[0]=atan2(p[3],p[2])*180/M_PI;
+				p[1]=asin(fmax(-1,fmin(1,p[4])))*180/M_PI;
+			}else{
+				set_unit_vector(p);
+			}
+		}
+		object->attribute/=result->counts[g];
+	}
 	return result;
 }
 
+CoalescedObjects* coalesce_objects(Objects* objects,DTYPE tolerance){
+	DWORD* group=Calloc(objects->size,DWORD);
+	DWORD* counts=Calloc(objects->size,DWORD);
+	DWORD n_groups=group_objects(objects,tolerance,group,counts);
+	return merge_groups(objects,group,counts,n_groups);
+}
+
+void destroy_coalesced_objects(CoalescedObjects* coalesced){
+	destroy_objects(coalesced->objects);
+	Free(coalesced->group);
+	Free(coalesced->counts);
+	Free(coalesced);
+}
+
+Matrix* krig_weights_coalesced(CoalescedObjects* coalesced,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,Matrix** gamma){
+	Object** data=coalesced->objects->objects;
+	DWORD n=coalesced->objects->size,i,j;
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
+	Matrix* Gamma=create_matrix(n+1,n+1);
+	Matrix* rhs=create_matrix(n+1,1);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			Gamma->matrix[i][j]=compute_variogram(data[i],data[j],C,variogram_type);
+		}
+		/*The nugget of a group mean shrinks with the number of measurements averaged, a single measurement keeps the zero diagonal*/
+		Gamma->matrix[i][i]*=1-1.0/coalesced->counts[i];
+		rhs->matrix[i][0]=compute_variogram(object,data[i],C,variogram_type);
+		Gamma->matrix[i][n]=1;
+		Gamma->matrix[n][i]=1;
+	}
+	Gamma->matrix[n][n]=0;
+	rhs->matrix[n][0]=1;
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
+	KRIG_PROFILE_START(start);
+	Matrix* lambda=solve_linear_system(Gamma,rhs);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_FACTORIZATION);
+	KRIG_PROFILE_SOLVE(Gamma->n_row);
+	destroy_matrix(Gamma);
+	if(lambda==NULL){
+		destroy_matrix(rhs);
+		return NULL;
+	}
+	/*Members share the weight of their group*/
+	Matrix* result=create_matrix(coalesced->size+1,1);
+	for(i=0;i<coalesced->size;i++){
+		result->matrix[i][0]=lambda->matrix[coalesced->group[i]][0]/coalesced->counts[coalesced->group[i]];
+	}
+	result->matrix[coalesced->size][0]=lambda->matrix[n][0];
+	if(gamma!=NULL){
+		*gamma=create_matrix(coalesced->size+1,1);
+		for(i=0;i<coalesced->size;i++){
+			(*gamma)->matrix[i][0]=rhs->matrix[coalesced->group[i]][0];
+		}
+		(*gamma)->matrix[coalesced->size][0]=1;
+	}
+	destroy_matrix(lambda);
+	destroy_matrix(rhs);
+	return result;
+}
+
+/*
+ * Coalesced solve taken automatically by the Kriging functions when some objects share their location and time stamp exactly.
+ * Return: NULL if there are no duplicates or the coalesced system is singular.
+*/
+static Matrix* krig_weights_auto_coalesced(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,Matrix** gamma){
+	Matrix* lambda;
+	DWORD* group=Calloc(objects->size,DWORD);
+	DWORD* counts=Calloc(objects->size,DWORD);
+	DWORD n_groups=group_objects(objects,0,group,counts);
+	if(n_groups==objects->size){
+		Free(group);
+		Free(counts);
+		return NULL;
+	}
+	CoalescedObjects* coalesced=merge_groups(objects,group,counts,n_groups);
+	lambda=krig_weights_coalesced(coalesced,object,C,variogram_type,gamma);
+	destroy_coalesced_objects(coalesced);
+	return lambda;
+}
+
+/*
+ * Hierarchical path taken automatically by the Kriging functions for large systems that the sparse path does not take, e.g. exponential variograms or global Kriging with a long range.
+ * The system is compressed for the single target only. Callers solving many targets against one set of objects should keep an HKrigSystem, see write_normal_squares.
+ * Return: NULL if the system is small, the variogram has no covariance function or MINRES did not converge.
+*/
+static Matrix* krig_weights_auto_hierarchical(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,Matrix** gamma){
+	if(objects->size<HMATRIX_KRIG_THRESHOLD||(variogram_type!=EXPONENTIAL_VARIOGRAM&&variogram_type!=SPHERICAL_VARIOGRAM)){
+		return NULL;
+	}
+	HKrigSystem* system=build_hierarchical_krig_system(objects,C,variogram_type,HMATRIX_KRIG_TOLERANCE);
+	if(system==NULL){
+		return NULL;
+	}
+	Matrix* lambda=krig_weights_hierarchical(system,object,-1,gamma);
+	destroy_hierarchical_krig_system(system);
+	return lambda;
+}
+
 Matrix* krig_weights(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type){
+	Matrix* lambda=krig_weights_auto_coalesced(objects,object,C,variogram_type,NULL);
+	if(lambda==NULL){
+		lambda=krig_weights_auto_sparse(objects,object,C,variogram_type,NULL);
+	}
+	if(lambda==NULL){
+		lambda=krig_weights_auto_hierarchical(objects,object,C,variogram_type,NULL);
+	}
+	if(lambda!=NULL){
+		return lambda;
+	}
+	KRIG_PROFILE_DECLARE(start);
+	KRIG_PROFILE_START(start);
 	Object** data=objects->objects;
 	Matrix* Gamma=create_matrix(objects->size+1,objects->size+1);
 	Matrix* gamma=create_matrix(objects->size+1,1);
@@ -206,8 +1016,12 @@ Matrix* krig_weights(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE var
 	Gamma->matrix[objects->size][objects->size]=0;
 	//print_matrix(Gamma);
 	//print_matrix(gamma);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
 	/*Solve the Kriging weights for the linear system*/
-	Matrix* lambda=solve_linear_system(Gamma,gamma);
+	KRIG_PROFILE_START(start);
+	lambda=solve_linear_system(Gamma,gamma);
+	KRIG_PROFILE_STOP(start,KRIG_PHASE_FACTORIZATION);
+	KRIG_PROFILE_SOLVE(Gamma->n_row);
 	/*Test code, the if condition should not be true*/
 	if(lambda==NULL){
 		printf("Unsolvable linear system\n");
@@ -235,6 +1049,11 @@ DTYPE krig_prediction(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distan
 	}
 	Object** data=objects->objects;
 	Matrix* lambda=krig_weights(objects,object,C,variogram_type);
+	if(lambda==NULL){
+		Free(data);
+		Free(objects);
+		return INFINITY;
+	}
 	DTYPE result=0;
 	//DTYPE sum=0;
 //printf("check\n");
@@ -260,25 +1079,41 @@ DTYPE krig_variance(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance
 		return 0;
 	}
 	Object** data=objects->objects;
-	Matrix* Gamma=create_matrix(objects->size+1,objects->size+1);
-	Matrix* gamma=create_matrix(objects->size+1,1);
 	DWORD i,j;
-	for(i=0;i<objects->size;i++){
+	Matrix* gamma=NULL;
+	Matrix* lambda=krig_weights_auto_coalesced(objects,object,C,variogram_type,&gamma);
+	if(lambda==NULL){
+		KRIG_PROFILE_DECLARE(start);
+		KRIG_PROFILE_START(start);
+		Matrix* Gamma=create_matrix(objects->size+1,objects->size+1);
+		gamma=create_matrix(objects->size+1,1);
+		for(i=0;i<objects->size;i++){
+			for(j=0;j<objects->size;j++){
+				Gamma->matrix[i][j]=compute_variogram(data[i],data[j],C,variogram_type);
+			}
+			//Gamma->matrix[i][i]=0;
+			gamma->matrix[i][0]=compute_variogram(object,data[i],C,variogram_type);
+			Gamma->matrix[i][objects->size]=1;
+		}
+		gamma->matrix[objects->size][0]=1;
 		for(j=0;j<objects->size;j++){
-			Gamma->matrix[i][j]=compute_variogram(data[i],data[j],C,variogram_type);
+			Gamma->matrix[objects->size][j]=1;
+		}
+		Gamma->matrix[objects->size][objects->size]=0;
+		KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
+		KRIG_PROFILE_START(start);
+		lambda=solve_linear_system(Gamma,gamma);
+		KRIG_PROFILE_STOP(start,KRIG_PHASE_FACTORIZATION);
+		KRIG_PROFILE_SOLVE(Gamma->n_row);
+		destroy_matrix(Gamma);
+		//printf("internal check 2\n");
+		if(lambda==NULL){
+			destroy_matrix(gamma);
+			Free(data);
+			Free(objects);
+			return INFINITY;
 		}
-		//Gamma->matrix[i][i]=0;
-		gamma->matrix[i][0]=compute_variogram(object,data[i],C,variogram_type);
-		Gamma->matrix[i][objects->size]=1;
-	}
-	gamma->matrix[objects->size][0]=1;
-	for(j=0;j<objects->size;j++){
-		Gamma->matrix[objects->size][j]=1;
 	}
-	Gamma->matrix[objects->size][objects->size]=0;
-	Matrix* lambda=solve_linear_system(Gamma,gamma);
-	destroy_matrix(Gamma);
-	//printf("internal check 2\n");
 	/*Compute Kriging variance from Kriging weights*/
 	DTYPE result=lambda->matrix[objects->size][0];
 	for(i=0;i<objects->size;i++){
@@ -298,7 +1133,10 @@ DTYPE krig_variance(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance
  * Because it is more efficient to compute Kriging interpolation and Kriging variance at the same time, a separate function is provided in stead of calling these two functions separately.
  * Caching described in the implementation section of the published paper is also implemented here
 */
-DTYPE krig_normalize(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+/*
+ * Shared by krig_normalize and krig_normalize_exact, hierarchical tells whether large systems may be compressed.
+*/
+static DTYPE normalized_error(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type,BOOLEAN hierarchical){
 	Objects* objects=get_adjacent_objects(cluster,object,max_distance);
 	if(objects->size==0){
 		return INFINITY;
@@ -314,35 +1152,51 @@ DTYPE krig_normalize(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distanc
 	}
 */
 	Object** data=objects->objects;
-	Matrix* Gamma=create_matrix(objects->size+1,objects->size+1);
-	Matrix* gamma=create_matrix(objects->size+1,1);
 	DWORD i,j;
-	for(i=0;i<objects->size;i++){
-		for(j=0;j<objects->size;j++){
-			Gamma->matrix[i][j]=compute_variogram(data[i],data[j],C,variogram_type);
-		}
-		Gamma->matrix[i][i]=0;
-		gamma->matrix[i][0]=compute_variogram(object,data[i],C,variogram_type);
-		Gamma->matrix[i][objects->size]=1;
+	Matrix* gamma=NULL;
+	Matrix* lambda=krig_weights_auto_coalesced(objects,object,C,variogram_type,&gamma);
+	if(lambda==NULL){
+		lambda=krig_weights_auto_sparse(objects,object,C,variogram_type,&gamma);
 	}
-	gamma->matrix[objects->size][0]=1;
-	for(j=0;j<objects->size;j++){
-		Gamma->matrix[objects->size][j]=1;
+	if(lambda==NULL&&hierarchical){
+		lambda=krig_weights_auto_hierarchical(objects,object,C,variogram_type,&gamma);
 	}
-	Gamma->matrix[objects->size][objects->size]=0;
-	//print_matrix(gamma);
-	Matrix* lambda=solve_linear_system(Gamma,gamma);
 	if(lambda==NULL){
-		printf("Unsolvable linear system\n");
-		printf("object={%lf,%lf,%lf}\n",object->spatial_coordinates[0],object->spatial_coordinates[1],object->attribute);
-		printf("first neighbor={%lf,%lf,%lf}\n",data[0]->spatial_coordinates[0],data[0]->spatial_coordinates[1],data[0]->attribute);
-		printf("Gamma\n");
-		print_matrix(Gamma);
-		printf("gamma\n");
-		print_matrix(gamma);
-		return INFINITY;
+		KRIG_PROFILE_DECLARE(start);
+		KRIG_PROFILE_START(start);
+		Matrix* Gamma=create_matrix(objects->size+1,objects->size+1);
+		gamma=create_matrix(objects->size+1,1);
+		for(i=0;i<objects->size;i++){
+			for(j=0;j<objects->size;j++){
+				Gamma->matrix[i][j]=compute_variogram(data[i],data[j],C,variogram_type);
+			}
+			Gamma->matrix[i][i]=0;
+			gamma->matrix[i][0]=compute_variogram(object,data[i],C,variogram_type);
+			Gamma->matrix[i][objects->size]=1;
+		}
+		gamma->matrix[objects->size][0]=1;
+		for(j=0;j<objects->size;j++){
+			Gamma->matrix[objects->size][j]=1;
+		}
+		Gamma->matrix[objects->size][objects->size]=0;
+		//print_matrix(gamma);
+		KRIG_PROFILE_STOP(start,KRIG_PHASE_ASSEMBLY);
+		KRIG_PROFILE_START(start);
+		lambda=solve_linear_system(Gamma,gamma);
+		KRIG_PROFILE_STOP(start,KRIG_PHASE_FACTORIZATION);
+		KRIG_PROFILE_SOLVE(Gamma->n_row);
+		if(lambda==NULL){
+			printf("Unsolvable linear system\n");
+			printf("object={%lf,%lf,%lf}\n",object->spatial_coordinates[0],object->spatial_coordinates[1],object->attribute);
+			printf("first neighbor={%lf,%lf,%lf}\n",data[0]->spatial_coordinates[0],data[0]->spatial_coordinates[1],data[0]->attribute);
+			printf("Gamma\n");
+			print_matrix(Gamma);
+			printf("gamma\n");
+			print_matrix(gamma);
+			return INFINITY;
+		}
+		destroy_matrix(Gamma);
 	}
-	destroy_matrix(Gamma);
 	DTYPE result=0;
 	DTYPE var=lambda->matrix[objects->size][0];
 	for(i=0;i<objects->size;i++){
@@ -356,6 +1210,14 @@ DTYPE krig_normalize(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distanc
 	object->normalized_value=(result-object->attribute)/sqrt(fabs(var));
 	return object->normalized_value;
 }
+
+DTYPE krig_normalize(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+	return normalized_error(cluster,object,C,max_distance,variogram_type,TRUE);
+}
+
+DTYPE krig_normalize_exact(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type){
+	return normalized_error(cluster,object,C,max_distance,variogram_type,FALSE);
+}
 /*
  * Compute Kriging sum square error in a cluster
  * cluster: The cluster to be evaluated.
@@ -427,6 +1289,12 @@ void write_normal_squares(char* filename,Objects* objects,Clusters* clusters,DTY
 	FILE* local_copy = fopen( filename , "w" );
 	fprintf(local_copy,"%s,%s\n","unclustered","clustered");
 	DTYPE var,predict,benchmark;
+	HKrigSystem* system=NULL;
+	Matrix* lambda;
+	/*Large global systems are compressed once and solved with one object left out at a time*/
+	if(objects->size>=HMATRIX_KRIG_THRESHOLD&&max_distance[0]==DIS_UNCHECKED&&max_distance[1]==DIS_UNCHECKED&&(variogram_type==EXPONENTIAL_VARIOGRAM||variogram_type==SPHERICAL_VARIOGRAM)){
+		system=build_hierarchical_krig_system(objects,C,variogram_type,HMATRIX_KRIG_TOLERANCE);
+	}
 	/*For each clusters*/
 	for(i=0;i<clusters->size;i++){
 		if(clusters->clusters[i]->size<2){
@@ -440,14 +1308,27 @@ void write_normal_squares(char* filename,Objects* objects,Clusters* clusters,DTY
 			remove_from_cluster(cluster,previous,current);
 			predict=krig_prediction(cluster,current->object,C,max_distance,variogram_type);
 			var=fabs(predict-current->object->attribute);
-			global=create_cluster();
-			for(j=0;j<objects->size;j++){
-				if(objects->objects[j]!=current->object){
-					add_to_cluster(global,objects->objects[j]);
+			lambda=NULL;
+			if(system!=NULL){
+				for(j=0;j<objects->size&&objects->objects[j]!=current->object;j++);
+				lambda=krig_weights_hierarchical(system,current->object,j,NULL);
+			}
+			if(lambda!=NULL){
+				benchmark=0;
+				for(j=0;j<objects->size;j++){
+					benchmark+=lambda->matrix[j][0]*objects->objects[j]->attribute;
+				}
+				destroy_matrix(lambda);
+			}else{
+				global=create_cluster();
+				for(j=0;j<objects->size;j++){
+					if(objects->objects[j]!=current->object){
+						add_to_cluster(global,objects->objects[j]);
+					}
 				}
+				benchmark=krig_prediction(global,current->object,C,max_distance,variogram_type);
+				destroy_cluster(global);
 			}
-			benchmark=krig_prediction(global,current->object,C,max_distance,variogram_type);
-			destroy_cluster(global);
 			benchmark=fabs(benchmark-current->object->attribute);
 			if(benchmark!=INFINITY&&var!=INFINITY){
 				fprintf(local_copy,"%lf,%lf\n",benchmark,var);
@@ -457,6 +1338,7 @@ void write_normal_squares(char* filename,Objects* objects,Clusters* clusters,DTY
 			current=current->next;
 		}
 	}
+	destroy_hierarchical_krig_system(system);
 }
 /*
  * Compute the chi-square statistics for an array of clusters.
@@ -485,6 +1367,57 @@ DTYPE chi_square_coefficient(Clusters* clusters,DTYPE* C,DTYPE* max_distance,VAR
 	//printf("\n");
 	return x;
 }
+
+DTYPE krig_leave_one_out(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* errors,DTYPE* variances){
+	DWORD n=objects->size,i,j;
+	Object** data=objects->objects;
+	DTYPE residual,error,variance,result=0;
+	if(n<2){
+		return INFINITY;
+	}
+	/*Same Kriging system as krig_normalize, built once for all objects*/
+	Matrix* Gamma=create_matrix(n+1,n+1);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			Gamma->matrix[i][j]=compute_variogram(data[i],data[j],C,variogram_type);
+		}
+		Gamma->matrix[i][i]=0;
+		Gamma->matrix[i][n]=1;
+		Gamma->matrix[n][i]=1;
+	}
+	Gamma->matrix[n][n]=0;
+	Matrix* H=matrix_inversion(Gamma);
+	destroy_matrix(Gamma);
+	if(H==NULL){
+		return INFINITY;
+	}
+	/*
+	 * Dubrule (1983): with H the inverse of the system, leaving object i out gives
+	 * the error attribute-prediction=(H*[z;0])_i/H_ii and the Kriging variance -1/H_ii.
+	*/
+	for(i=0;i<n;i++){
+		residual=0;
+		for(j=0;j<n;j++){
+			residual+=H->matrix[i][j]*data[j]->attribute;
+		}
+		error=residual/H->matrix[i][i];
+		variance=-1/H->matrix[i][i];
+		/*A valid variogram gives positive variances, anything else is not a Kriging system worth scoring*/
+		if(!(variance>0)){
+			destroy_matrix(H);
+			return INFINITY;
+		}
+		if(errors!=NULL){
+			errors[i]=error;
+		}
+		if(variances!=NULL){
+			variances[i]=variance;
+		}
+		result+=error*error/variance;
+	}
+	destroy_matrix(H);
+	return result;
+}
 /*
  * Compute the variance of physical attributes for all points in a cluster.
  * cluster: The cluster to be evaluated.
@@ -579,7 +1512,7 @@ BOOLEAN krig_consistency(Cluster* cluster,DTYPE bound,DTYPE* C,DTYPE* max_distan
 	while(copy->size>1&&current!=NULL){
 		//printf("check\n");
 		remove_from_cluster(copy,previous,current);
-		predict=krig_normalize(copy,current->object,C,max_distance,variogram_type);
+		predict=krig_normalize_exact(copy,current->object,C,max_distance,variogram_type);
 		insert_to_cluster(copy,previous,current);
 		if(fabs(predict)>bound){
 			return FALSE;
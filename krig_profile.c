@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2016, Northwestern University.
+ * Counters for Kriging clustering instrumentation.
+ * See also krigprofile.h
+*/
+
+#include "krigprofile.h"
+
+static KrigProfile profile;
+
+static const char* phase_names[KRIG_PHASES]={"filter","revision","consistency","neighbor_lookup","gamma_assembly","factorization"};
+
+DWORD krig_clock_ns(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (DWORD)t.tv_sec*1000000000LL+t.tv_nsec;
+}
+
+void krig_profile_reset(void){
+	memset(&profile,0,sizeof(KrigProfile));
+}
+
+void krig_profile_get(KrigProfile* result){
+	memcpy(result,&profile,sizeof(KrigProfile));
+}
+
+void krig_profile_merge(KrigProfile* other){
+	WORD i;
+	for(i=0;i<KRIG_PHASES;i++){
+		__sync_fetch_and_add(&profile.phase_time[i],other->phase_time[i]);
+		__sync_fetch_and_add(&profile.phase_count[i],other->phase_count[i]);
+	}
+	__sync_fetch_and_add(&profile.solves,other->solves);
+	for(i=0;i<KRIG_SIZE_BUCKETS;i++){
+		__sync_fetch_and_add(&profile.system_sizes[i],other->system_sizes[i]);
+	}
+}
+
+const char* krig_profile_phase_name(WORD phase){
+	if(phase<0||phase>=KRIG_PHASES){
+		return NULL;
+	}
+	return phase_names[phase];
+}
+
+/*Recorders run inside parallel_for tasks too, e.g. cross validation of PSO particles, so every update is atomic.*/
+void krig_profile_add(WORD phase,DWORD elapsed){
+	__sync_fetch_and_add(&profile.phase_time[phase],elapsed);
+	__sync_fetch_and_add(&profile.phase_count[phase],1);
+}
+
+void krig_profile_solve(DWORD size){
+	WORD bucket=0;
+	__sync_fetch_and_add(&profile.solves,1);
+	while(size>1&&bucket<KRIG_SIZE_BUCKETS-1){
+		size>>=1;
+		bucket++;
+	}
+	__sync_fetch_and_add(&profile.system_sizes[bucket],1);
+}
+
+void krig_profile_write_json(char* filename){
+	FILE* file=stdout;
+	WORD i,last=-1;
+	if(filename!=NULL){
+		file=fopen(filename,"w");
+		if(file==NULL){
+			printf("Cannot open %s\n",filename);
+			return;
+		}
+	}
+	fprintf(file,"{\n\t\"phases\":{\n");
+	for(i=0;i<KRIG_PHASES;i++){
+		fprintf(file,"\t\t\"%s\":{\"time_ns\":%lld,\"count\":%lld}%s\n",phase_names[i],profile.phase_time[i],profile.phase_count[i],i+1<KRIG_PHASES?",":"");
+	}
+	fprintf(file,"\t},\n\t\"solves\":%lld,\n\t\"system_sizes\":[",profile.solves);
+	/*Histogram is written up to the largest bucket in use, entry b counts sizes in [2^b,2^(b+1)).*/
+	for(i=0;i<KRIG_SIZE_BUCKETS;i++){
+		if(profile.system_sizes[i]>0){
+			last=i;
+		}
+	}
+	for(i=0;i<=last;i++){
+		fprintf(file,"%s%lld",i>0?",":"",profile.system_sizes[i]);
+	}
+	fprintf(file,"]\n}\n");
+	if(file!=stdout){
+		fclose(file);
+	}
+}
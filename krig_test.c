@@ -9,8 +9,74 @@
  * This function is a testing funtion for Kriging interpolation.
  * The first example used is in Sherman's book chapter 2.2.
  * The second example is a robust test for repeated spatial coordinates.
+ * The third example checks coalesced Kriging systems against the full variogram system, for exact and for near duplicates.
 */
 
+//Object at (x,y) with time stamp 0.
+Object* test_object(DTYPE x,DTYPE y,DTYPE attribute){
+	Object* object=Calloc(1,Object);
+	object->spatial_coordinates=Calloc(2,SPATIAL_TYPE);
+	object->spatial_coordinates[0]=x;
+	object->spatial_coordinates[1]=y;
+	object->attribute=attribute;
+	object->time=0;
+	object->neighbors=-1;
+	return object;
+}
+
+//Weights of the full exponential variogram system, without coalescing. Its right hand side is returned in gamma_out.
+Matrix* dense_weights(Objects* objects,Object* target,DTYPE* C,Matrix** gamma_out){
+	DWORD n=objects->size,i,j;
+	DTYPE parameters[3]={0,0,0};
+	Matrix* Gamma=create_matrix(n+1,n+1);
+	Matrix* gamma=create_matrix(n+1,1);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			parameters[0]=distance(objects->objects[i]->spatial_coordinates,objects->objects[j]->spatial_coordinates);
+			Gamma->matrix[i][j]=i==j?0:compute_variogram_by_parameters(parameters,C,EXPONENTIAL_VARIOGRAM);
+		}
+		parameters[0]=distance(target->spatial_coordinates,objects->objects[i]->spatial_coordinates);
+		gamma->matrix[i][0]=compute_variogram_by_parameters(parameters,C,EXPONENTIAL_VARIOGRAM);
+		Gamma->matrix[i][n]=1;
+		Gamma->matrix[n][i]=1;
+	}
+	Gamma->matrix[n][n]=0;
+	gamma->matrix[n][0]=1;
+	Matrix* lambda=solve_linear_system(Gamma,gamma);
+	destroy_matrix(Gamma);
+	*gamma_out=gamma;
+	return lambda;
+}
+
+//Compare coalesced weights and Kriging variance with the full system. Return: Number of groups, -1 if they differ by more than tolerance.
+DWORD compare_coalesced(Objects* objects,Object* target,DTYPE* C,DTYPE coalesce_tolerance,DTYPE tolerance){
+	DWORD i,n_groups;
+	DTYPE variance=0,dense_variance=0;
+	Matrix *gamma,*dense_gamma;
+	CoalescedObjects* coalesced=coalesce_objects(objects,coalesce_tolerance);
+	Matrix* lambda=krig_weights_coalesced(coalesced,target,C,EXPONENTIAL_VARIOGRAM,&gamma);
+	Matrix* dense=dense_weights(objects,target,C,&dense_gamma);
+	n_groups=coalesced->objects->size;
+	for(i=0;i<=objects->size;i++){
+		variance+=lambda->matrix[i][0]*gamma->matrix[i][0];
+		dense_variance+=dense->matrix[i][0]*dense_gamma->matrix[i][0];
+		if(fabs(lambda->matrix[i][0]-dense->matrix[i][0])>tolerance){
+			printf("weight %lld: coalesced=%lf,full=%lf\n",i,lambda->matrix[i][0],dense->matrix[i][0]);
+			n_groups=-1;
+		}
+	}
+	printf("groups=%lld,variance=%lf,full variance=%lf\n",coalesced->objects->size,variance,dense_variance);
+	if(fabs(variance-dense_variance)>tolerance){
+		n_groups=-1;
+	}
+	destroy_matrix(lambda);
+	destroy_matrix(gamma);
+	destroy_matrix(dense);
+	destroy_matrix(dense_gamma);
+	destroy_coalesced_objects(coalesced);
+	return n_groups;
+}
+
 
 int main(void){
 	//Fill up all objects
@@ -64,5 +130,43 @@ int main(void){
 	Free(objects[1]->spatial_coordinates);
 	Free(objects[2]->spatial_coordinates);
 	Free(objects);
+
+	//Test for coalescing. With a nugget the full system is regular even with duplicates, and a group of k duplicates with diagonal gamma(0)*(1-1/k) and weight split by k gives the same solution.
+	DTYPE* C_nugget=Calloc(3,DTYPE);
+	C_nugget[0]=.3;
+	C_nugget[1]=1;
+	C_nugget[2]=.5;
+	Objects* duplicates=Calloc(1,Objects);
+	duplicates->size=9;
+	duplicates->objects=Calloc(duplicates->size,Object*);
+	duplicates->objects[0]=test_object(0,0,1);
+	duplicates->objects[1]=test_object(4,1,2.5);
+	duplicates->objects[2]=test_object(0,0,2);
+	duplicates->objects[3]=test_object(2,5,0.5);
+	duplicates->objects[4]=test_object(4,1,3);
+	duplicates->objects[5]=test_object(6,6,1.5);
+	duplicates->objects[6]=test_object(0,0,3);
+	duplicates->objects[7]=test_object(1,3,2);
+	duplicates->objects[8]=test_object(6,6,1);
+	Object* target=test_object(3,2,0);
+	if(compare_coalesced(duplicates,target,C_nugget,0,1e-9)!=5){
+		printf("Coalesced system of exact duplicates does not match the full system.\n");
+		return 1;
+	}
+	//Near duplicates are only grouped with a positive tolerance, and then approximate the full system.
+	duplicates->objects[4]->spatial_coordinates[0]+=1e-7;
+	duplicates->objects[8]->spatial_coordinates[1]-=2e-7;
+	if(compare_coalesced(duplicates,target,C_nugget,0,1e-9)!=7){
+		printf("Near duplicates are grouped without a tolerance.\n");
+		return 1;
+	}
+	if(compare_coalesced(duplicates,target,C_nugget,1e-6,1e-6)!=5){
+		printf("Coalesced system of near duplicates does not match the full system.\n");
+		return 1;
+	}
+	destroy_objects(duplicates);
+	Free(target->spatial_coordinates);
+	Free(target);
+	Free(C_nugget);
 	return 0;
 }
@@ -11,8 +11,53 @@
 #include "cluster.h"
 #include "matrix.h"
 
+//Systems with at least this many objects and a spherical variogram are solved by the sparse path in krig_weights and krig_normalize, see krig_weights_sparse.
+#define SPARSE_KRIG_THRESHOLD 256
+//The sparse path is only taken automatically if at most this fraction of the system is nonzero.
+#define SPARSE_KRIG_MAX_DENSITY .1
+//Relative residual and iteration limit of MINRES for sparse and hierarchical Kriging systems.
+#define SPARSE_KRIG_TOLERANCE 1e-10
+#define SPARSE_KRIG_MAX_ITERATIONS 10000
+//Systems with at least this many objects and an exponential or spherical variogram use a hierarchical matrix in krig_weights, krig_normalize and the global Kriging benchmark of write_normal_squares, unless the sparse path takes them. Kriging clustering solves exactly, see krig_normalize_exact.
+#define HMATRIX_KRIG_THRESHOLD 2000
+//Relative accuracy of the compressed blocks of hierarchical Kriging systems.
+#define HMATRIX_KRIG_TOLERANCE 1e-8
+//Halo of krig_clustering_tiled as a fraction of the shorter tile side, if neither a halo nor a spatial ball range is given.
+#define TILE_DEFAULT_HALO .1
+
+/*
+ * Kriging system of a fixed set of objects whose covariance matrix, sill minus variogram, is compressed as a hierarchical matrix.
+ * Built once, it is solved for any number of targets, optionally leaving one of the objects out.
+*/
+typedef struct{
+	Objects* objects;
+	DTYPE* C;
+	VARIOGRAM_TYPE variogram_type;
+	DTYPE sill;
+	HMatrix* covariance;
+} HKrigSystem;
+
+/*
+ * Settings of krig_clustering_tiled.
+ * tiles_x, tiles_y: Number of tiles along the first and the second spatial coordinate. Tiles split the bounding box of the data evenly.
+ * halo: Width of the overlap around every tile, in units of the spatial coordinates. 0 takes the spatial ball range max_distance[0], or TILE_DEFAULT_HALO of the shorter tile side for global Kriging.
+ *       For chordal and great-circle distances a halo or ball range in kilometers is turned into degrees of latitude, and of longitude at the highest latitude it reaches.
+ *       Tiles do not wrap around the date line, objects on its two sides only meet when a tile spans it.
+ * processes: Number of worker processes, the calling process included. 0 takes krig_thread_count().
+ * revise: Run the merged clusters through the filtering and revision phases again, as krig_clustering_warm_start does.
+ *         This restores consistency across tile borders, but is only cheap with local Kriging, i.e. a spatial ball range.
+*/
+typedef struct{
+	DWORD tiles_x;
+	DWORD tiles_y;
+	DTYPE halo;
+	WORD processes;
+	BOOLEAN revise;
+} TilingSettings;
+
 /*
  * Compute distance between two spatial coordinates. 2D data is assumed.
+ * Planar by default. Chordal and great-circle distances of longitude and latitude use the unit vectors in entries 2 to 4, see set_distance_type.
  * Modify the function in krig_functions.c for high dimensional data usage.
  * coordiantes1: Spatial coordinate of first point.
  * coordinates2: Spatial coordinate of second point.
@@ -57,6 +102,58 @@ extern DTYPE krig_prediction(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max
  * Return: An array of clusters satisfying consistency and maximality constraints discussed in the paper.
 */
 extern Clusters* krig_clustering(Object** data,DWORD size,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
+/*
+ * Kriging clustering that can be stopped and resumed.
+ * The state is written to checkpoint at most every interval seconds, between two filtering or revision steps, and once more when the run is finished.
+ * If checkpoint holds a snapshot of the same data and parameters, the run continues where the snapshot was taken. A finished snapshot returns its clusters right away.
+ * data, size, bound, C, max_distance, variogram_type: Same as krig_clustering.
+ * checkpoint: Snapshot file, see write_clustering_snapshot.
+ * interval: Seconds between two snapshots.
+ * Return: Same as krig_clustering.
+*/
+extern Clusters* krig_clustering_checkpointed(Object** data,DWORD size,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type,char* checkpoint,DWORD interval);
+/*
+ * Incremental Kriging clustering. Insert a newly arriving object into an existing clustering result without reclustering.
+ * Clusters are scored from the spatially closest one. The object joins the first cluster whose normalized Kriging error for it is within bound, then only that cluster goes through the filtering and revision phases again.
+ * If no cluster accepts the object, a new cluster is created for it.
+ * clusters: Result of krig_clustering or previous insertions. Modified in place.
+ * object: The new object.
+ * bound, C, max_distance, variogram_type: Same as krig_clustering.
+ * Return: Index of the cluster the object was inserted into.
+*/
+extern DWORD krig_clustering_insert(Clusters* clusters,Object* object,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
+/*
+ * Kriging clustering started from an initial partition instead of a single cluster containing everything.
+ * Every seeded cluster goes through the filtering and revision phases. Unlabelled objects are inserted afterwards by krig_clustering_insert.
+ * data: An array of objects that will be clustered.
+ * size: The number of objects.
+ * labels: Initial cluster label for each object. Labels do not have to be contiguous. -1 means the object has no label.
+ * bound, C, max_distance, variogram_type: Same as krig_clustering.
+ * Return: An array of clusters satisfying the consistency constraint. Seeded clusters are never merged, so the result is not guaranteed to be maximal.
+*/
+extern Clusters* krig_clustering_warm_start(Object** data,DWORD size,DWORD* labels,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
+/*
+ * Map a previous clustering result onto a new array of objects by location, e.g. previous time stamp's clusters onto today's stations.
+ * previous: Previous clusters.
+ * data: The new objects.
+ * size: Number of new objects.
+ * Return: Labels for krig_clustering_warm_start. Objects at a location that is not in previous are labelled -1.
+*/
+extern DWORD* map_cluster_labels(Clusters* previous,Object** data,DWORD size);
+/*
+ * Fill settings with defaults: 2x2 tiles, automatic halo, one process per thread, no revision of merged clusters.
+*/
+extern void default_tiling_settings(TilingSettings* settings);
+/*
+ * Kriging clustering by spatial domain decomposition, for datasets too large for a single cluster containing everything.
+ * Every tile is clustered by krig_clustering together with the objects in its halo, in worker processes created by fork. Labels come back through shared memory.
+ * Every object belongs to the tile that contains it. A cluster of its halo is merged into the cluster of the neighboring tile that owns most of its halo members.
+ * Tiles left unfinished by a failed worker are clustered by the calling process.
+ * data, size, bound, C, max_distance, variogram_type: Same as krig_clustering.
+ * settings: Decomposition settings, see default_tiling_settings.
+ * Return: An array of clusters, NULL if the settings are invalid.
+*/
+extern Clusters* krig_clustering_tiled(Object** data,DWORD size,TilingSettings* settings,DTYPE bound,DTYPE *C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
 /*
  * Evaluate a set of clusters by computing the chi-square coefficient.
  * This measurement was proposed in "A Filtering-based Clustering Algorithm for Improving Spatio-temporal Kriging Interpolation Accuracy", CIKM 2016
@@ -73,6 +170,17 @@ extern Clusters* krig_clustering(Object** data,DWORD size,DTYPE bound,DTYPE *C,D
  * Return: The chi-square error.
 */
 extern DTYPE chi_square_coefficient(Clusters* clusters,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
+/*
+ * Leave-one-out cross validation of Kriging over a set of objects from a single inversion of the Kriging system.
+ * Equal to the chi-square coefficient of a single cluster holding all objects, with unlimited range, at the cost of one Kriging system instead of one per object.
+ * objects: The objects being evaluated.
+ * C: Parameters for Kriging interpolation, see chi_square_coefficient.
+ * variogram_type: The type of variogram. Constant values in "clustertype.h"
+ * errors: Output, may be NULL. Leave-one-out error, attribute minus prediction, of every object.
+ * variances: Output, may be NULL. Leave-one-out Kriging variance of every object.
+ * Return: Square sum of normalized leave-one-out errors, INFINITY if there are fewer than two objects, the system is singular or a variance is not positive.
+*/
+extern DTYPE krig_leave_one_out(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* errors,DTYPE* variances);
 /*
  * Compute the normalized Kriging error for an object using clustering-based Kriging interpolation by (prediction-actual)/variance.
  * cluster: The cluster used for clustering-based Kriging interpolation.
@@ -88,6 +196,11 @@ extern DTYPE chi_square_coefficient(Clusters* clusters,DTYPE* C,DTYPE* max_dista
  * Return: The normalized Kriging error.
 */
 extern DTYPE krig_normalize(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
+/*
+ * Same as krig_normalize, but large systems are never compressed as a hierarchical matrix.
+ * Used by Kriging clustering, which solves a different system for every object it scores and must not depend on the compression tolerance.
+*/
+extern DTYPE krig_normalize_exact(Cluster* cluster,Object* object,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
 /*
  * Check if a cluster is consistent in terms of normalized clustering-based Kriging interpolation error.
  * Definition of consistency was proposed in "A Filtering-based Clustering Algorithm for Improving Spatio-temporal Kriging Interpolation Accuracy", CIKM 2016
@@ -184,15 +297,166 @@ extern void write_normal_squares(char* filename,Objects* objects,Clusters* clust
 extern DTYPE sum_krig_square_differences(Cluster* cluster,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
 extern DTYPE sum_krig_normalized_variance(Cluster* cluster,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
 extern DTYPE sum_krig_variance(Cluster* cluster,DTYPE* C,DTYPE* max_distance,VARIOGRAM_TYPE variogram_type);
+/*
+ * Kriging weights of an object, in the order of objects, followed by the Lagrange multiplier.
+ * Objects sharing location and time stamp exactly are coalesced first, see krig_weights_coalesced, so duplicates do not make the system singular.
+ * Return: NULL if the system is singular.
+*/
 extern Matrix* krig_weights(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type);
+/*
+ * Group co-located objects, so that every group enters a Kriging system as one conditioning point.
+ * Objects are grouped with a seed, taken in input order, if they share its time stamp and lie within tolerance of it.
+ * objects: The objects to group. They are not modified.
+ * tolerance: Largest distance to the seed of a group. 0 groups exact duplicates only.
+ * Return: One object per group holding the mean location and the mean attribute of its members, and the group of every object.
+ *         For chordal and great-circle distances the mean location is the normalized mean of the unit vectors, so groups across the date line stay on it.
+*/
+extern CoalescedObjects* coalesce_objects(Objects* objects,DTYPE tolerance);
+/*
+ * Free memory space for coalesced objects, including the group objects. The original objects are not freed.
+*/
+extern void destroy_coalesced_objects(CoalescedObjects* coalesced);
+/*
+ * Kriging weights from the system of coalesced objects, mapped back to the original objects.
+ * A group of k measurements has measurement error nugget gamma(0)/k on the diagonal of the variogram matrix, i.e. the diagonal is gamma(0)*(1-1/k). Single measurements keep the zero diagonal of krig_weights.
+ * Every member gets the weight of its group divided by k, so the prediction uses the group mean.
+ * gamma: Output, may be NULL. Right hand side in variogram form for the original objects, for computing the Kriging variance.
+ * Return: Weights in the layout of krig_weights for the original objects, NULL if the system is singular.
+*/
+extern Matrix* krig_weights_coalesced(CoalescedObjects* coalesced,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,Matrix** gamma);
+/*
+ * Check if the Kriging system of a variogram can be assembled in sparse form, i.e. the covariance vanishes beyond a finite range.
+ * Spherical and spatio-temporal spherical product variograms qualify with positive ranges. Exponential variograms qualify only when tapered.
+ * taper_range: Range of the spherical taper applied to the exponential covariance. Zero or negative for no taper.
+*/
+extern BOOLEAN krig_sparse_supported(DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range);
+/*
+ * Assemble the bordered Kriging system of a set of objects in CSR form, keeping only pairs within range. Pairs are found through a cell list, and through a time window for spatio-temporal models.
+ * Spherical and tapered exponential models are assembled as covariances, sill minus variogram, so that entries beyond the range are zero. Tapering multiplies the exponential covariance by 1-1.5s+0.5s^3, s=r/taper_range.
+ * The spatio-temporal spherical product variogram is zero beyond its ranges and is assembled as is.
+ * Return: A (n+1)*(n+1) sparse matrix, NULL if the variogram is not supported.
+*/
+extern SparseMatrix* krig_sparse_system(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range);
+/*
+ * Kriging weights from the sparse system, solved by MINRES with a diagonal preconditioner.
+ * Time and memory scale with the number of pairs within range instead of n^2 and n^3.
+ * gamma: Output, may be NULL. Right hand side in variogram form, as used by krig_weights, for computing the Kriging variance.
+ * Return: Weights in the same layout as krig_weights, the last entry being the Lagrange multiplier. NULL if the variogram is not supported or MINRES did not converge.
+*/
+extern Matrix* krig_weights_sparse(Objects* objects,Object* object,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE taper_range,Matrix** gamma);
+/*
+ * Compress the Kriging system of a set of objects into a hierarchical matrix, for systems too large for dense LU.
+ * Storage and the cost of a product grow about as n*log(n), blocks are filled in parallel.
+ * The cluster tree splits the first two coordinates, or the unit vectors for chordal and great-circle distances.
+ * objects, C: Referenced, not copied, and must outlive the system.
+ * variogram_type: Exponential or spherical variogram, the models with a covariance function.
+ * tolerance: Relative accuracy of the compressed blocks, e.g. HMATRIX_KRIG_TOLERANCE.
+ * Return: The system, NULL if the variogram is not supported.
+*/
+extern HKrigSystem* build_hierarchical_krig_system(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE tolerance);
+/*
+ * Kriging weights of an object from a hierarchical Kriging system, solved by MINRES.
+ * excluded: Index of an object of the system to leave out, its weight is zero. -1 to use all objects.
+ * gamma: Output, may be NULL. Right hand side in variogram form, as used by krig_weights, for computing the Kriging variance.
+ * Return: Weights in the same layout as krig_weights, NULL if MINRES did not converge.
+*/
+extern Matrix* krig_weights_hierarchical(HKrigSystem* system,Object* object,DWORD excluded,Matrix** gamma);
+/*
+ * Free memory space for a hierarchical Kriging system. The objects are not freed.
+*/
+extern void destroy_hierarchical_krig_system(HKrigSystem* system);
 
 //Variogram related functions.
 extern DWORD variogram_model_length(VARIOGRAM_TYPE variogram_type);
 extern DTYPE compute_variogram_by_parameters(DTYPE *parameters,DTYPE* C,VARIOGRAM_TYPE variogram_type);
+/*
+ * Partial derivatives of the variogram with respect to its parameters.
+ * parameters: parameters[0]=r, parameters[1]=phi, parameters[2]=u, as in compute_variogram_by_parameters.
+ * derivatives: Output, derivatives[i] is the derivative with respect to C[i]. Needs variogram_model_length(variogram_type) entries.
+*/
+extern void compute_variogram_derivatives(DTYPE *parameters,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* derivatives);
+/*
+ * Empirical variogram in (lag, angle) bins. All pairs are enumerated once through a cell list, pairs beyond the largest lag plus bound are skipped.
+ * Bins with no positive estimate are dropped.
+*/
 extern Samples* variogram_sampling(Objects *objects,DTYPE bound,DTYPE angle_bound,DTYPE step_size,DWORD steps,DWORD angle_steps,DTYPE *C,SMOOTHING_TYPE smoothing_type);
+/*
+ * Approximate empirical variogram from randomly drawn pairs, with the same bins as variogram_sampling. Uses MT19937, seed it with init_genrand.
+ * Pairs are drawn per lag until every direction bin of the lag holds target pairs, or budget/steps draws are spent on the lag.
+ * target: Number of pairs wanted in every bin.
+ * budget: Maximum number of pair draws in total. Cost is proportional to the draws, not to the square of the number of objects.
+ * Return: Samples with estimated pair counts N and the standard error se of every estimate.
+*/
+extern Samples* variogram_sampling_approximate(Objects *objects,DTYPE bound,DTYPE angle_bound,DTYPE step_size,DWORD steps,DWORD angle_steps,DTYPE *C,SMOOTHING_TYPE smoothing_type,DWORD target,DWORD budget);
+/*
+ * Empirical space-time variogram in (spatial lag, temporal lag) bins, for the ST product variograms. Samples carry the temporal lag in u.
+ * bound, step_size, steps: Spatial bins as in variogram_sampling, centered at step_size/2+k*step_size.
+ * time_bound, time_step, time_steps: Temporal bins centered at l*time_step, l=0 holds pairs at the same time.
+ * Bins with no positive estimate are dropped.
+*/
+extern Samples* variogram_sampling_ST(Objects *objects,DTYPE bound,DTYPE step_size,DWORD steps,DTYPE time_bound,DTYPE time_step,DWORD time_steps,DTYPE *C,SMOOTHING_TYPE smoothing_type);
 extern DTYPE evaluate_model(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type);
+/*
+ * Single swarm particle swarm optimization, see variogram_PSO_multistart. objects is not used.
+*/
 extern DTYPE* variogram_PSO(Objects* objects,Samples* samples,DWORD epochs, DWORD n_particles, VARIOGRAM_TYPE variogram_type, DTYPE c1,DTYPE c2,DTYPE alpha);
+/*
+ * Default PSO settings: 4 swarms of 50 particles, at most 200 epochs, stop a swarm after 30 epochs without relative improvement of 1e-6, c1=c2=2, alpha=0.729, no variable projection and no cross validation.
+*/
+extern void default_PSO_settings(PSOSettings* settings);
+/*
+ * Fit a variogram model to samples with several independent particle swarms, minimizing evaluate_model.
+ * Swarms are initialized with randomize_variogram and advanced together. The objective of all particles is evaluated in parallel, random numbers are drawn in the calling thread, so results do not depend on the number of threads.
+ * samples: Empirical variogram.
+ * variogram_type: The type of variogram.
+ * settings: PSO settings.
+ * stats: Output for convergence statistics, may be NULL. Free its arrays with destroy_PSO_stats.
+ * Return: Best parameters found, or NULL if the settings or samples are empty.
+*/
+extern DTYPE* variogram_PSO_multistart(Samples* samples,VARIOGRAM_TYPE variogram_type,PSOSettings* settings,PSOStats* stats);
+extern void destroy_PSO_stats(PSOStats* stats);
 extern void variogram_WLS(Samples* samples,DTYPE* C,DWORD epochs, VARIOGRAM_TYPE variogram_type,DTYPE learning_rate);
+/*
+ * Default parameter bounds for variogram_LM: every parameter is non-negative, ranges are positive and power exponents are at most 2.
+ * lower, upper: Output, variogram_model_length(variogram_type) entries each.
+*/
+extern void default_variogram_bounds(VARIOGRAM_TYPE variogram_type,DTYPE* lower,DTYPE* upper);
+/*
+ * Fit a variogram model to samples with Levenberg-Marquardt, minimizing evaluate_model.
+ * Residuals sqrt(N)*(gamma_hat/y-1) are linearized with the analytic derivatives of compute_variogram_derivatives. Steps are projected onto the bounds.
+ * C: Initial parameters, overwritten by the fit. Use randomize_variogram or variogram_PSO_multistart for a starting point.
+ * lower, upper: Parameter bounds, NULL for default_variogram_bounds.
+ * max_iterations: Maximum number of accepted steps.
+ * tolerance: Stop when a step lowers the objective by less than this relative amount or changes no parameter by more than this relative amount.
+ * Return: Number of iterations.
+*/
+extern DWORD variogram_LM(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* lower,DTYPE* upper,DWORD max_iterations,DTYPE tolerance);
+/*
+ * Whether variogram_projection and variogram_VP support the model: exponential, spherical, power and anisotropy power variograms.
+*/
+extern BOOLEAN variogram_projection_supported(VARIOGRAM_TYPE variogram_type);
+/*
+ * Solve the parameters that enter the variogram linearly by non-negative weighted least squares on samples, for fixed nonlinear parameters.
+ * Exponential and power: C[0] and C[1] for given C[2]. Spherical: C[0] and 2*C[1]^2 for given C[2].
+ * Anisotropy power: C[0] and the common scale of C[1] and C[2], for given C[3] and given ratio of C[2] to C[1].
+ * C: Model parameters, the linear ones are overwritten.
+ * Return: evaluate_model of the updated parameters, INFINITY if the model is not supported or the parameters are invalid.
+*/
+extern DTYPE variogram_projection(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type);
+/*
+ * Variable projection fit: the linear parameters are solved by variogram_projection and the nonlinear ones by a bracketed search,
+ * a grid bracket followed by golden-section search on the range, rate or exponent, and coordinate-wise on exponent and axis ratio for the anisotropy model.
+ * C: Output, the fitted parameters.
+ * tolerance: Relative width of the final search interval.
+ * Return: evaluate_model of the fit, INFINITY if the model is not supported.
+*/
+extern DTYPE variogram_VP(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE tolerance);
+/*
+ * Cross validation objective of a variogram for Kriging, computed by krig_leave_one_out with one Kriging system per call.
+ * The score is the mean of e^2/v+log(v) over the leave-one-out errors e and variances v. It is smallest when the chi-square statistic is close to the number of objects and the errors are small.
+ * Return: The score, INFINITY if it cannot be computed, e.g. when a leave-one-out variance is not positive.
+*/
+extern DTYPE variogram_cross_validation(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type);
 extern void variogram_WLS_line_search(Samples* samples,DTYPE *C, DWORD epochs, VARIOGRAM_TYPE variogram_type);
 extern void randomize_variogram(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type);
 extern void print_samples(Samples* samples);
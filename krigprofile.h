@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016, Northwestern University.
+ * Instrumentation for Kriging clustering. Phase timers use a monotonic clock with nanosecond resolution.
+ * Instrumentation points are macros that expand to nothing unless the package is compiled with -DKRIG_PROFILE.
+ * The query functions are always available, without KRIG_PROFILE every counter stays zero.
+ * Counters are process wide. Updates are atomic, so solves run by several threads of parallel_for are all counted. Reset and get are not meant to run concurrently with a profiled computation.
+ * Worker processes of krig_clustering_tiled count separately, their counters are merged into the calling process when they finish. Counters of a failed worker are lost.
+ * See krig_profile.c
+*/
+
+#ifndef KRIG_PROFILE_H
+#define KRIG_PROFILE_H
+
+#include "cluster.h"
+
+//Filtering steps in krig_clustering, including everything done for the step.
+#define KRIG_PHASE_FILTER 0
+//Revision steps in krig_clustering, including consistency checks.
+#define KRIG_PHASE_REVISION 1
+//Cluster consistency checks during revision.
+#define KRIG_PHASE_CONSISTENCY 2
+//Neighbour lookup for a Kriging system.
+#define KRIG_PHASE_NEIGHBOR 3
+//Assembly of the Gamma matrix and gamma vector.
+#define KRIG_PHASE_ASSEMBLY 4
+//Factorization and solve of the Kriging system.
+#define KRIG_PHASE_FACTORIZATION 5
+//Number of phases.
+#define KRIG_PHASES 6
+//Number of buckets in the system size histogram. Bucket b counts systems with 2^b<=size<2^(b+1).
+#define KRIG_SIZE_BUCKETS 32
+
+/*
+ * Snapshot of all counters.
+ * phase_time: Accumulated time of every phase in nanoseconds. Phases nest, e.g. filter time contains the neighbour lookup done for it.
+ * phase_count: Number of times every phase was entered.
+ * solves: Number of Kriging systems solved.
+ * system_sizes: Histogram of the dimensions of solved systems.
+*/
+typedef struct{
+	DWORD phase_time[KRIG_PHASES];
+	DWORD phase_count[KRIG_PHASES];
+	DWORD solves;
+	DWORD system_sizes[KRIG_SIZE_BUCKETS];
+} KrigProfile;
+
+/*
+ * Monotonic clock in nanoseconds.
+*/
+extern DWORD krig_clock_ns(void);
+/*
+ * Set every counter to zero.
+*/
+extern void krig_profile_reset(void);
+/*
+ * Copy current counters into profile.
+*/
+extern void krig_profile_get(KrigProfile* profile);
+/*
+ * Add the counters of profile to the current counters, e.g. those of another process.
+*/
+extern void krig_profile_merge(KrigProfile* profile);
+/*
+ * Write current counters as a JSON object.
+ * filename: The file to be written. Standard output is used if filename is NULL.
+*/
+extern void krig_profile_write_json(char* filename);
+/*
+ * Name of a phase as it appears in the JSON output.
+*/
+extern const char* krig_profile_phase_name(WORD phase);
+/*
+ * Low level recorders used by the macros below.
+*/
+extern void krig_profile_add(WORD phase,DWORD elapsed);
+extern void krig_profile_solve(DWORD size);
+
+#ifdef KRIG_PROFILE
+#define KRIG_PROFILE_DECLARE(name) DWORD name
+#define KRIG_PROFILE_START(name) name=krig_clock_ns()
+#define KRIG_PROFILE_STOP(name,phase) krig_profile_add(phase,krig_clock_ns()-name)
+#define KRIG_PROFILE_ADD(phase,elapsed) krig_profile_add(phase,elapsed)
+#define KRIG_PROFILE_SOLVE(size) krig_profile_solve(size)
+#else
+#define KRIG_PROFILE_DECLARE(name)
+#define KRIG_PROFILE_START(name)
+#define KRIG_PROFILE_STOP(name,phase)
+#define KRIG_PROFILE_ADD(phase,elapsed)
+#define KRIG_PROFILE_SOLVE(size)
+#endif
+
+#endif
@@ -12,8 +12,18 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <float.h>
 #include "clustertype.h"
 
+//Systems with at least this many rows are factorized by the blocked LU with partial pivoting, see lower_upper_in_place.
+#define LU_BLOCKED_THRESHOLD 128
+//Number of columns in a panel of the blocked LU.
+#define LU_BLOCK_SIZE 64
+//Maximum number of points in a leaf of the cluster tree of a hierarchical matrix.
+#define HMATRIX_LEAF_SIZE 32
+//A block of a hierarchical matrix is compressed if the smaller diameter of its two clusters is at most this times their distance.
+#define HMATRIX_ADMISSIBILITY 2.0
+
 /*
  * Definition for matrix in 2 dimensional array pointer form.
 */
@@ -22,6 +32,68 @@ typedef struct{
 	DWORD n_column;
 	DTYPE **matrix;
 }Matrix;
+/*
+ * Sparse matrix in compressed sparse row (CSR) form.
+ * row_start: Row i has the entries row_start[i] to row_start[i+1]-1. Array has n_row+1 elements.
+ * columns: Column of every entry, ascending inside a row.
+ * values: Value of every entry.
+*/
+typedef struct{
+	DWORD n_row;
+	DWORD n_column;
+	DWORD* row_start;
+	DWORD* columns;
+	DTYPE* values;
+}SparseMatrix;
+/*
+ * Callback computing y=A*x for a matrix that is not stored explicitly.
+*/
+typedef void (*LinearOperator)(DTYPE* x,DTYPE* y,void* arg);
+/*
+ * Callback returning entry (i,j) of a matrix that is not stored explicitly. Called from several threads at once.
+*/
+typedef DTYPE (*MatrixEntry)(DWORD i,DWORD j,void* arg);
+/*
+ * Node of the cluster tree of a hierarchical matrix, a bounding box over consecutive points in tree order.
+ * start, size: The node holds points start to start+size-1 in tree order.
+ * box: Bounding box {x_min,y_min,z_min,x_max,y_max,z_max}, z is 0 for 2D points.
+ * children: Halves of the node split along the longest side of the box, NULL for leaves.
+*/
+typedef struct HCluster{
+	DWORD start;
+	DWORD size;
+	DTYPE box[6];
+	struct HCluster* children[2];
+}HCluster;
+/*
+ * Block of a hierarchical matrix between a row cluster and a column cluster, indices in tree order.
+ * Admissible blocks are stored as U*V^T with rank columns, U is n_row*rank and V is n_column*rank, both column by column.
+ * Inadmissible leaf blocks are stored dense in row major order. Other blocks are split into four children.
+*/
+typedef struct HBlock{
+	DWORD row_start;
+	DWORD n_row;
+	DWORD column_start;
+	DWORD n_column;
+	BOOLEAN low_rank;
+	DWORD rank;
+	DTYPE* U;
+	DTYPE* V;
+	DTYPE* dense;
+	struct HBlock* children[4];
+}HBlock;
+/*
+ * Hierarchical matrix over a set of 2D or 3D points.
+ * order: Point at every position of the tree order.
+ * tree: Cluster tree.
+ * root: Block tree.
+*/
+typedef struct{
+	DWORD n;
+	DWORD* order;
+	HCluster* tree;
+	HBlock* root;
+}HMatrix;
 /*
  * Initialize a matrix by giving its column and row numbers.
  * n_row: Number of rows.
@@ -42,7 +114,8 @@ extern void destroy_matrix(Matrix* matrix);
 */
 extern Matrix* matrix_addition(Matrix* m1,Matrix* m2);
 /*
- * Multiply two matrix together. Automatically determine if naive or strassen algorithm is used based on matrix size.
+ * Multiply two matrix together of any shape with a packed, cache blocked kernel.
+ * Large products are split into row blocks that run on krig_thread_count() threads, see parallel.h. Every entry is summed in the same order, so results do not depend on the number of threads.
  * m1: The first matrix.
  * m2: The second matrix.
  * Return: A new matrix that is the product of the two matrices.
@@ -70,15 +143,54 @@ extern Matrix* matrix_transpose(Matrix* m);
  * Find lower upper permutation of a matrix m.
  * m: The matrix to be decomposed.
  * Return: 3 matrices. The first one is L, the second one is U, and the third one is P. We have Pm=LU.
+ * Matrices with at least LU_BLOCKED_THRESHOLD rows are factorized by lower_upper_in_place, which pivots on the largest entry instead of the first nonzero one.
 */
 extern Matrix** lower_upper_permutation(Matrix* m);
+/*
+ * Factorize a square matrix in place with a blocked LU and partial pivoting.
+ * Each panel of LU_BLOCK_SIZE columns is factorized on its own, and the trailing matrix is updated with the blocked multiplication on krig_thread_count() threads.
+ * Rows are exchanged by swapping row pointers, so the rows of m are reordered.
+ * m: The matrix to be decomposed. Replaced by U on and above the diagonal and by L below it, L has a unit diagonal.
+ * permutation: Array of n_row entries. Row i of the result belongs to row permutation[i] of the input.
+ * Return: 0, or -1 if m is not square. A singular matrix is factorized with a zero on the diagonal of U.
+*/
+extern int lower_upper_in_place(Matrix* m,DWORD* permutation);
+/*
+ * Invert a square matrix with a single lower upper permutation.
+ * m: The matrix to be inverted.
+ * Return: A new matrix that is the inversion of m, NULL if m is singular or not square.
+ * With set_solver_type(MIXED_PRECISION_SOLVER) the inverse is solved by solve_mixed_precision for all columns of the identity at once.
+*/
+extern Matrix* matrix_inversion(Matrix* m);
 /*
  * Solve a linear system of equation using lower upper permutation.
+ * Systems with at least LU_BLOCKED_THRESHOLD rows use the blocked, multithreaded lower_upper_in_place on a copy of Gamma.
+ * With set_solver_type(MIXED_PRECISION_SOLVER) solve_mixed_precision is tried first.
  * Gamma: The coefficients of linear system on LHS.
  * gamma: The result of linear system on RHS.
  * Return: The value of variables at LHS. In the end Gamma*variables=gamma.
 */
 extern Matrix* solve_linear_system(Matrix* Gamma,Matrix* gamma);
+/*
+ * Solve a linear system with a FACTOR_TYPE LU and iterative refinement, the residuals are computed in DTYPE.
+ * Gamma: The coefficients of linear system on LHS.
+ * gamma: The result of linear system on RHS, one or more columns.
+ * Return: The value of variables at LHS with DTYPE accuracy. NULL if the factorization breaks down or refinement does not converge, the caller should then use the DTYPE solver.
+*/
+extern Matrix* solve_mixed_precision(Matrix* Gamma,Matrix* gamma);
+/*
+ * Select the solver used by solve_linear_system and matrix_inversion, and with them by Kriging and the leave-one-out metrics.
+ * solver_type: DOUBLE_SOLVER (default) or MIXED_PRECISION_SOLVER. The mixed precision solver falls back to DOUBLE_SOLVER for systems it cannot refine.
+*/
+extern void set_solver_type(SOLVER_TYPE solver_type);
+extern SOLVER_TYPE get_solver_type(void);
+/*
+ * Solve a symmetric positive definite linear system with Cholesky decomposition. Only the lower triangle of A is read.
+ * A: The coefficients of linear system on LHS.
+ * b: The result of linear system on RHS.
+ * Return: The value of variables, NULL if A is not positive definite.
+*/
+extern Matrix* solve_cholesky(Matrix* A,Matrix* b);
 /*
  * Multiply two matrix together using naive matrix multiplication algorithm.
  * m1: The first matrix.
@@ -88,11 +200,67 @@ extern Matrix* solve_linear_system(Matrix* Gamma,Matrix* gamma);
 extern Matrix* naive_multiplication(Matrix* m1,Matrix* m2);
 /*
  * Multiply two matrix together using strassen matrix multiplication algorithm.
- * A: The first matrix.
- * B: The second matrix.
+ * The sub products are computed with matrix_multiplication.
+ * A: The first square matrix. The size must be a power of two or at most 64.
+ * B: The second square matrix of the same size.
  * Return: A new matrix that is the product of the two matrices.
 */
 extern Matrix* strassen_multiplication(Matrix* A,Matrix* B);
+/*
+ * Destroy a sparse matrix. Free all memory space.
+*/
+extern void destroy_sparse_matrix(SparseMatrix* m);
+/*
+ * Multiply a sparse matrix with a vector, y=m*x.
+ * x: Vector of n_column entries.
+ * y: Vector of n_row entries, overwritten.
+*/
+extern void sparse_multiply_vector(SparseMatrix* m,DTYPE* x,DTYPE* y);
+/*
+ * Solve a symmetric, possibly indefinite, sparse linear system with preconditioned MINRES (Paige and Saunders, 1975).
+ * Only the matrix vector product is used, so time and memory scale with the number of entries.
+ * A: Symmetric sparse matrix.
+ * b: Right hand side.
+ * x: Solution, overwritten. The iteration starts from zero.
+ * weights: Diagonal of the inverse of a symmetric positive definite preconditioner, NULL for none.
+ * max_iterations: Maximum number of iterations.
+ * tolerance: The iteration stops when the preconditioned residual norm is below tolerance times its initial value.
+ * Return: Number of iterations, -1 if it did not converge.
+*/
+extern DWORD solve_minres(SparseMatrix* A,DTYPE* b,DTYPE* x,DTYPE* weights,DWORD max_iterations,DTYPE tolerance);
+/*
+ * Matrix free form of solve_minres.
+ * n: Size of the system.
+ * product: Computes y=A*x for the symmetric system matrix A.
+ * preconditioner: Computes y=M^-1*r for a symmetric positive definite preconditioner M.
+ * arg: User argument passed to both callbacks.
+ * Return: Number of iterations, -1 if it did not converge.
+*/
+extern DWORD solve_minres_operator(DWORD n,LinearOperator product,LinearOperator preconditioner,void* arg,DTYPE* b,DTYPE* x,DWORD max_iterations,DTYPE tolerance);
+/*
+ * Build a hierarchical matrix approximation of a matrix whose entries decay smoothly with the distance of 2D or 3D points.
+ * Points are sorted into a cluster tree by recursive bisection. Blocks between well separated clusters are compressed by adaptive cross approximation with partial pivoting, blocks between close clusters are stored dense.
+ * Storage and the cost of a product grow about as n*log(n) times the ranks. Blocks are filled in parallel.
+ * n: Number of points, also the size of the matrix.
+ * points: Coordinates of every point, points[i] has dimension entries.
+ * dimension: 2, or 3 e.g. for unit vectors on the sphere.
+ * entry: Entry callback, indices refer to the original point order.
+ * arg: User argument of entry.
+ * tolerance: Relative Frobenius error of every compressed block, relative to the block or to the largest diagonal entry, whichever is larger.
+*/
+extern HMatrix* build_hmatrix(DWORD n,SPATIAL_TYPE** points,WORD dimension,MatrixEntry entry,void* arg,DTYPE tolerance);
+/*
+ * Multiply a hierarchical matrix with a vector, y=m*x, both in the original point order.
+*/
+extern void hmatrix_multiply_vector(HMatrix* m,DTYPE* x,DTYPE* y);
+/*
+ * Number of stored entries of a hierarchical matrix, n*n for a dense matrix.
+*/
+extern DWORD hmatrix_storage(HMatrix* m);
+/*
+ * Destroy a hierarchical matrix. Free all memory space.
+*/
+extern void destroy_hmatrix(HMatrix* m);
 extern void resize_matrix(Matrix* m,DWORD n_row,DWORD n_column);
 extern void print_matrix(Matrix* m);
 extern Matrix* vector_self_multiplication(Matrix* m);
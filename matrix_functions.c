@@ -1,4 +1,5 @@
 #include "matrix.h"
+#include "parallel.h"
 
 /*
  *===========================Description===========================
@@ -143,6 +144,40 @@ Matrix* read_lower_triangle_solution(Matrix* Gamma,Matrix* gamma){
 	}
 	return result;
 }
+/*
+ * Solve LUx=Pgamma from the output of lower_upper_in_place. Return NULL if U has a zero on its diagonal.
+*/
+static Matrix* lower_upper_solve(Matrix* LU,DWORD* permutation,Matrix* gamma){
+	DWORD n=LU->n_row,i,j;
+	Matrix* result=create_matrix(n,1);
+	for(i=0;i<n;i++){
+		result->matrix[i][0]=gamma->matrix[permutation[i]][0];
+		for(j=0;j<i;j++){
+			result->matrix[i][0]-=LU->matrix[i][j]*result->matrix[j][0];
+		}
+	}
+	for(i=n-1;i>=0;i--){
+		if(LU->matrix[i][i]==0){
+			destroy_matrix(result);
+			return NULL;
+		}
+		for(j=i+1;j<n;j++){
+			result->matrix[i][0]-=LU->matrix[i][j]*result->matrix[j][0];
+		}
+		result->matrix[i][0]/=LU->matrix[i][i];
+	}
+	return result;
+}
+
+static Matrix* copy_matrix(Matrix* m){
+	Matrix* result=create_matrix(m->n_row,m->n_column);
+	DWORD i;
+	for(i=0;i<m->n_row;i++){
+		memcpy(result->matrix[i],m->matrix[i],m->n_column*sizeof(DTYPE));
+	}
+	return result;
+}
+
 /*
 Matrix* solve_linear_system(Matrix* Gamma,Matrix* gamma){
 	Matrix *m1,*m2,*m3;
@@ -170,6 +205,21 @@ Matrix* solve_linear_system(Matrix* Gamma,Matrix* gamma){
 
 Matrix* solve_linear_system(Matrix* Gamma,Matrix* gamma){
 	Matrix *m1,*m2;
+	if(get_solver_type()==MIXED_PRECISION_SOLVER){
+		m1=solve_mixed_precision(Gamma,gamma);
+		if(m1!=NULL){
+			return m1;
+		}
+	}
+	if(Gamma->n_row>=LU_BLOCKED_THRESHOLD&&Gamma->n_row==Gamma->n_column){
+		DWORD* permutation=Calloc(Gamma->n_row,DWORD);
+		m1=copy_matrix(Gamma);
+		lower_upper_in_place(m1,permutation);
+		m2=lower_upper_solve(m1,permutation,gamma);
+		destroy_matrix(m1);
+		Free(permutation);
+		return m2;
+	}
 	Matrix** LUP=lower_upper_permutation(Gamma);
 	Matrix* left=Calloc(1,Matrix);
 	left->n_row=gamma->n_row;
@@ -196,37 +246,6 @@ Matrix* solve_linear_system(Matrix* Gamma,Matrix* gamma){
 	return m2;
 }
 
-Matrix* expand_to_power(Matrix* m,DWORD n){
-	DTYPE exponent=log(n)/log(2);
-	if(floorf(exponent)!=exponent){
-		n=(DWORD)pow(2,floorf(exponent)+1);
-	}
-	//printf("n=%ld\n",n);
-	Matrix* result=create_matrix(n,n);
-	DWORD i,j;
-	for(i=0;i<m->n_row;i++){
-		memcpy(result->matrix[i],m->matrix[i],m->n_column*sizeof(DTYPE));
-		for(j=m->n_column;j<n;j++){
-			result->matrix[i][j]=0;
-		}
-	}
-	for(i=m->n_row;i<n;i++){
-		for(j=0;j<n;j++){
-			result->matrix[i][j]=0;
-		}
-	}
-	return result;
-}
-
-Matrix* resize(Matrix* m,DWORD n_row,DWORD n_column){
-	Matrix* result=create_matrix(n_row,n_column);
-	DWORD i;
-	for(i=0;i<result->n_row;i++){
-		memcpy(result->matrix[i],m->matrix[i],n_column*sizeof(DTYPE));
-	}
-	return result;
-}
-
 Matrix* naive_multiplication(Matrix* m1,Matrix* m2){
 	if(m1->n_column!=m2->n_row){
 		return NULL;
@@ -292,6 +311,7 @@ Matrix* strassen_multiplication(Matrix* A,Matrix* B){
 	//Compute M5
 	temp1=matrix_addition(A11,A12);
 	Matrix* M5=matrix_multiplication(temp1,B22);
+	destroy_matrix(temp1);
 	//Compute M6
 	temp1=matrix_subtraction(A21,A11);
 	temp2=matrix_addition(B11,B12);
@@ -348,36 +368,179 @@ Matrix* vector_self_multiplication(Matrix* m){
 	return result;
 }
 
-Matrix* matrix_multiplication(Matrix* m1,Matrix* m2){
-	if(m1->n_column!=m2->n_row){
-		return NULL;
+/*
+ * Packed, cache blocked matrix multiplication.
+ * B is packed into KC*NC panels of NR wide column strips and A into MC*KC blocks of MR high row strips, so the micro-kernel streams both operands from contiguous memory.
+ * Strips at the border are zero filled in the packed buffers, the matrices themselves are never padded.
+*/
+#define GEMM_MR 4
+#define GEMM_NR 4
+#define GEMM_KC 256
+#define GEMM_MC 96
+#define GEMM_NC 2048
+//Products with fewer multiply-adds run in the calling thread.
+#define GEMM_PARALLEL_WORK 1000000
+
+//Two lanes fit the 128 bit registers every x86-64 and AArch64 target has, wider vectors spill without -mavx.
+typedef DTYPE GemmVector __attribute__((vector_size(2*sizeof(DTYPE))));
+
+typedef struct{
+	DTYPE** A;
+	DTYPE** B;
+	DTYPE** C;
+	DWORD a_column;
+	DWORD b_column;
+	DWORD c_column;
+	DWORD m;
+	DTYPE alpha;
+	DTYPE* packed_B;
+	DTYPE* packed_A;
+	DWORD jc;
+	DWORD pc;
+	DWORD nc;
+	DWORD kc;
+} GemmJob;
+
+static void pack_A(DTYPE** A,DWORD ic,DWORD pc,DWORD mc,DWORD kc,DTYPE alpha,DTYPE* packed){
+	DWORD i,p,r,rows;
+	for(i=0;i<mc;i+=GEMM_MR){
+		rows=mc-i<GEMM_MR?mc-i:GEMM_MR;
+		for(r=0;r<rows;r++){
+			DTYPE* row=A[ic+i+r]+pc;
+			for(p=0;p<kc;p++){
+				packed[p*GEMM_MR+r]=alpha*row[p];
+			}
+		}
+		for(;r<GEMM_MR;r++){
+			for(p=0;p<kc;p++){
+				packed[p*GEMM_MR+r]=0;
+			}
+		}
+		packed+=GEMM_MR*kc;
 	}
-	DWORD n;
-	if(m1->n_row>=m1->n_column){
-		if(m1->n_row>=m2->n_column){
-			n=m1->n_row;
-		}else{
-			n=m2->n_column;
+}
+
+static void pack_B(DTYPE** B,DWORD pc,DWORD jc,DWORD kc,DWORD nc,DTYPE* packed){
+	DWORD j,p,columns;
+	for(j=0;j<nc;j+=GEMM_NR){
+		columns=nc-j<GEMM_NR?nc-j:GEMM_NR;
+		for(p=0;p<kc;p++){
+			DTYPE* row=B[pc+p]+jc+j;
+			memcpy(packed+p*GEMM_NR,row,columns*sizeof(DTYPE));
+			memset(packed+p*GEMM_NR+columns,0,(GEMM_NR-columns)*sizeof(DTYPE));
 		}
-	}else{
-		if(m1->n_column>=m2->n_column){
-			n=m1->n_column;
-		}else{
-			n=m2->n_column;
+		packed+=GEMM_NR*kc;
+	}
+}
+
+/*
+ * C[0:rows,0:columns]+=a*b for one MR*NR tile. The tile is kept in eight vector registers during the k loop.
+*/
+static void gemm_micro_kernel(DWORD kc,DTYPE* a,DTYPE* b,DTYPE** C,DWORD row,DWORD column,DWORD rows,DWORD columns){
+	GemmVector c00={0,0},c01={0,0},c10={0,0},c11={0,0},c20={0,0},c21={0,0},c30={0,0},c31={0,0},b0,b1,x;
+	DTYPE tile[GEMM_MR][GEMM_NR];
+	DWORD p,i,j;
+	for(p=0;p<kc;p++){
+		memcpy(&b0,b,sizeof(GemmVector));
+		memcpy(&b1,b+2,sizeof(GemmVector));
+		x=(GemmVector){a[0],a[0]};
+		c00+=x*b0;
+		c01+=x*b1;
+		x=(GemmVector){a[1],a[1]};
+		c10+=x*b0;
+		c11+=x*b1;
+		x=(GemmVector){a[2],a[2]};
+		c20+=x*b0;
+		c21+=x*b1;
+		x=(GemmVector){a[3],a[3]};
+		c30+=x*b0;
+		c31+=x*b1;
+		a+=GEMM_MR;
+		b+=GEMM_NR;
+	}
+	memcpy(tile[0],&c00,sizeof(GemmVector));
+	memcpy(tile[0]+2,&c01,sizeof(GemmVector));
+	memcpy(tile[1],&c10,sizeof(GemmVector));
+	memcpy(tile[1]+2,&c11,sizeof(GemmVector));
+	memcpy(tile[2],&c20,sizeof(GemmVector));
+	memcpy(tile[2]+2,&c21,sizeof(GemmVector));
+	memcpy(tile[3],&c30,sizeof(GemmVector));
+	memcpy(tile[3]+2,&c31,sizeof(GemmVector));
+	for(i=0;i<rows;i++){
+		DTYPE* target=C[row+i]+column;
+		for(j=0;j<columns;j++){
+			target[j]+=tile[i][j];
 		}
 	}
-	Matrix* A=expand_to_power(m1,n);
-	Matrix* B=expand_to_power(m2,n);
-	Matrix* C;
-	if(A->n_row>64){
-		C=strassen_multiplication(A,B);
-	}else{
-		C=naive_multiplication(A,B);
+}
+
+/*
+ * One MC high row block of C for the current B panel. Blocks write disjoint rows of C, so no reduction is needed.
+*/
+static void gemm_block(DWORD task,WORD thread,void* arg){
+	GemmJob* job=(GemmJob*)arg;
+	DWORD ic=task*GEMM_MC,mc,i,j;
+	DTYPE* packed_A=job->packed_A+(DWORD)thread*GEMM_MC*GEMM_KC;
+	mc=job->m-ic<GEMM_MC?job->m-ic:GEMM_MC;
+	pack_A(job->A,ic,job->a_column+job->pc,mc,job->kc,job->alpha,packed_A);
+	for(j=0;j<job->nc;j+=GEMM_NR){
+		for(i=0;i<mc;i+=GEMM_MR){
+			gemm_micro_kernel(job->kc,packed_A+i*job->kc,job->packed_B+j*job->kc,job->C,ic+i,job->c_column+job->jc+j,mc-i<GEMM_MR?mc-i:GEMM_MR,job->nc-j<GEMM_NR?job->nc-j:GEMM_NR);
+		}
+	}
+}
+
+/*
+ * C[0:m,c_column:c_column+n]+=alpha*A[0:m,a_column:a_column+k]*B[0:k,b_column:b_column+n] on row pointer arrays.
+ * Sub matrices are addressed by offsetting the row pointer arrays and passing the first column.
+*/
+static void gemm_update(DWORD m,DWORD n,DWORD k,DTYPE alpha,DTYPE** A,DWORD a_column,DTYPE** B,DWORD b_column,DTYPE** C,DWORD c_column){
+	DWORD i,blocks;
+	GemmJob job;
+	WORD threads;
+	if(m==0||n==0||k==0){
+		return;
+	}
+	threads=(DTYPE)m*n*k<GEMM_PARALLEL_WORK?1:krig_thread_count();
+	blocks=(m+GEMM_MC-1)/GEMM_MC;
+	job.A=A;
+	job.B=B;
+	job.C=C;
+	job.a_column=a_column;
+	job.b_column=b_column;
+	job.c_column=c_column;
+	job.m=m;
+	job.alpha=alpha;
+	job.packed_B=Calloc(GEMM_KC*(GEMM_NC<n+GEMM_NR?GEMM_NC:n+GEMM_NR),DTYPE);
+	job.packed_A=Calloc((DWORD)threads*GEMM_MC*GEMM_KC,DTYPE);
+	for(job.jc=0;job.jc<n;job.jc+=GEMM_NC){
+		job.nc=n-job.jc<GEMM_NC?n-job.jc:GEMM_NC;
+		for(job.pc=0;job.pc<k;job.pc+=GEMM_KC){
+			job.kc=k-job.pc<GEMM_KC?k-job.pc:GEMM_KC;
+			pack_B(B,job.pc,b_column+job.jc,job.kc,job.nc,job.packed_B);
+			if(threads>1){
+				parallel_for(blocks,gemm_block,&job);
+			}else{
+				for(i=0;i<blocks;i++){
+					gemm_block(i,0,&job);
+				}
+			}
+		}
+	}
+	Free(job.packed_B);
+	Free(job.packed_A);
+}
+
+Matrix* matrix_multiplication(Matrix* m1,Matrix* m2){
+	if(m1->n_column!=m2->n_row){
+		return NULL;
 	}
-	destroy_matrix(A);
-	destroy_matrix(B);
-	Matrix* result=resize(C,m1->n_row,m2->n_column);
-	destroy_matrix(C);
+	DWORD i;
+	Matrix* result=create_matrix(m1->n_row,m2->n_column);
+	for(i=0;i<result->n_row;i++){
+		memset(result->matrix[i],0,result->n_column*sizeof(DTYPE));
+	}
+	gemm_update(m1->n_row,m2->n_column,m1->n_column,1,m1->matrix,0,m2->matrix,0,result->matrix,0);
 	return result;
 }
 
@@ -443,6 +606,51 @@ Matrix* cholesky_decomposition(Matrix* m){
 	return result;
 }
 
+Matrix* solve_cholesky(Matrix* A,Matrix* b){
+	if(A->n_row!=A->n_column||A->n_row!=b->n_row){
+		return NULL;
+	}
+	DWORD n=A->n_row,i,j,k;
+	DTYPE sum;
+	Matrix* L=create_matrix(n,n);
+	/*A=LL' column by column, stop at the first pivot that is not positive*/
+	for(j=0;j<n;j++){
+		sum=A->matrix[j][j];
+		for(k=0;k<j;k++){
+			sum-=L->matrix[j][k]*L->matrix[j][k];
+		}
+		if(!(sum>0)){
+			destroy_matrix(L);
+			return NULL;
+		}
+		L->matrix[j][j]=sqrt(sum);
+		for(i=j+1;i<n;i++){
+			sum=A->matrix[i][j];
+			for(k=0;k<j;k++){
+				sum-=L->matrix[i][k]*L->matrix[j][k];
+			}
+			L->matrix[i][j]=sum/L->matrix[j][j];
+		}
+	}
+	Matrix* x=create_matrix(n,1);
+	for(i=0;i<n;i++){
+		sum=b->matrix[i][0];
+		for(k=0;k<i;k++){
+			sum-=L->matrix[i][k]*x->matrix[k][0];
+		}
+		x->matrix[i][0]=sum/L->matrix[i][i];
+	}
+	for(i=n-1;i>=0;i--){
+		sum=x->matrix[i][0];
+		for(k=i+1;k<n;k++){
+			sum-=L->matrix[k][i]*x->matrix[k][0];
+		}
+		x->matrix[i][0]=sum/L->matrix[i][i];
+	}
+	destroy_matrix(L);
+	return x;
+}
+
 void swap_row(Matrix* m,DWORD x,DWORD y){
 	DTYPE* temp;
 	temp=m->matrix[x];
@@ -465,6 +673,25 @@ Matrix** lower_upper_permutation(Matrix* m){
 	result[3]=CP;
 	DWORD i,j,k;
 	DTYPE multiplier,temp;
+	if(m->n_row>=LU_BLOCKED_THRESHOLD){
+		DWORD* permutation=Calloc(m->n_row,DWORD);
+		for(i=0;i<m->n_row;i++){
+			memcpy(U->matrix[i],m->matrix[i],m->n_column*sizeof(DTYPE));
+		}
+		lower_upper_in_place(U,permutation);
+		for(i=0;i<m->n_row;i++){
+			for(j=0;j<m->n_column;j++){
+				L->matrix[i][j]=j<i?U->matrix[i][j]:(j==i?1:0);
+				P->matrix[i][j]=j==permutation[i]?1:0;
+			}
+			for(j=0;j<i;j++){
+				U->matrix[i][j]=0;
+			}
+			CP->matrix[i][0]=permutation[i];
+		}
+		Free(permutation);
+		return result;
+	}
 	for(i=0;i<m->n_row;i++){
 		for(j=0;j<m->n_column;j++){
 			U->matrix[i][j]=m->matrix[i][j];
@@ -496,7 +723,8 @@ Matrix** lower_upper_permutation(Matrix* m){
 		for(j=i+1;j<m->n_row;j++){
 			multiplier=U->matrix[j][i]/U->matrix[i][i];
 			L->matrix[j][i]=multiplier;
-			for(k=0;k<m->n_column;k++){
+			//Columns left of i are already zero in both rows
+			for(k=i;k<m->n_column;k++){
 				U->matrix[j][k]-=multiplier*U->matrix[i][k];
 			}
 		}
@@ -504,6 +732,607 @@ Matrix** lower_upper_permutation(Matrix* m){
 	return result;
 }
 
+/*
+ * Unblocked factorization of the panel m[k:n,k:k+b] with partial pivoting.
+ * Pivot rows are swapped by their row pointers, which moves the whole row, including the part of L and U already computed.
+*/
+static void lower_upper_panel(Matrix* m,DWORD* permutation,DWORD k,DWORD b){
+	DWORD n=m->n_row,i,j,c,pivot;
+	DWORD swap;
+	DTYPE multiplier,largest;
+	DTYPE* temp;
+	for(j=k;j<k+b;j++){
+		pivot=j;
+		largest=fabs(m->matrix[j][j]);
+		for(i=j+1;i<n;i++){
+			if(fabs(m->matrix[i][j])>largest){
+				largest=fabs(m->matrix[i][j]);
+				pivot=i;
+			}
+		}
+		if(pivot!=j){
+			temp=m->matrix[j];
+			m->matrix[j]=m->matrix[pivot];
+			m->matrix[pivot]=temp;
+			swap=permutation[j];
+			permutation[j]=permutation[pivot];
+			permutation[pivot]=swap;
+		}
+		if(largest==0){
+			//Singular, the zero pivot is reported by the triangular solves.
+			continue;
+		}
+		for(i=j+1;i<n;i++){
+			multiplier=m->matrix[i][j]/m->matrix[j][j];
+			m->matrix[i][j]=multiplier;
+			for(c=j+1;c<k+b;c++){
+				m->matrix[i][c]-=multiplier*m->matrix[j][c];
+			}
+		}
+	}
+}
+
+int lower_upper_in_place(Matrix* m,DWORD* permutation){
+	DWORD n=m->n_row,i,j,k,b,c;
+	DTYPE multiplier;
+	if(m->n_column!=n){
+		return -1;
+	}
+	for(i=0;i<n;i++){
+		permutation[i]=i;
+	}
+	for(k=0;k<n;k+=LU_BLOCK_SIZE){
+		b=n-k<LU_BLOCK_SIZE?n-k:LU_BLOCK_SIZE;
+		lower_upper_panel(m,permutation,k,b);
+		//U12=L11^-1*A12, L11 has a unit diagonal
+		for(j=k+1;j<k+b;j++){
+			for(i=k;i<j;i++){
+				multiplier=m->matrix[j][i];
+				for(c=k+b;c<n;c++){
+					m->matrix[j][c]-=multiplier*m->matrix[i][c];
+				}
+			}
+		}
+		//A22-=L21*U12, this is where almost all the work is and it runs in parallel
+		gemm_update(n-k-b,n-k-b,b,-1,m->matrix+k+b,k,m->matrix+k,k+b,m->matrix+k+b,k+b);
+	}
+	return 0;
+}
+
+
+/*
+ * Mixed precision solver. Gamma is factorized in FACTOR_TYPE, where a 128 bit register holds twice as many lanes and the factors take half the memory.
+ * The solution is then refined with residuals computed in DTYPE until it reaches full DTYPE accuracy.
+*/
+#define FACTOR_NR 8
+//Refinement steps before the solver gives up, as in LAPACK dsgesv.
+#define MIXED_PRECISION_ITERATIONS 30
+
+typedef FACTOR_TYPE FactorVector __attribute__((vector_size(4*sizeof(FACTOR_TYPE))));
+
+static SOLVER_TYPE solver=DOUBLE_SOLVER;
+
+typedef struct{
+	FACTOR_TYPE** A;
+	FACTOR_TYPE** C;
+	DWORD a_column;
+	DWORD c_column;
+	DWORD m;
+	FACTOR_TYPE* packed_B;
+	FACTOR_TYPE* packed_A;
+	DWORD jc;
+	DWORD nc;
+	DWORD kc;
+} FactorGemmJob;
+
+void set_solver_type(SOLVER_TYPE solver_type){
+	solver=solver_type;
+}
+
+SOLVER_TYPE get_solver_type(void){
+	return solver;
+}
+
+static void pack_factor_A(FACTOR_TYPE** A,DWORD ic,DWORD pc,DWORD mc,DWORD kc,FACTOR_TYPE* packed){
+	DWORD i,p,r,rows;
+	for(i=0;i<mc;i+=GEMM_MR){
+		rows=mc-i<GEMM_MR?mc-i:GEMM_MR;
+		for(r=0;r<rows;r++){
+			FACTOR_TYPE* row=A[ic+i+r]+pc;
+			for(p=0;p<kc;p++){
+				packed[p*GEMM_MR+r]=-row[p];
+			}
+		}
+		for(;r<GEMM_MR;r++){
+			for(p=0;p<kc;p++){
+				packed[p*GEMM_MR+r]=0;
+			}
+		}
+		packed+=GEMM_MR*kc;
+	}
+}
+
+static void pack_factor_B(FACTOR_TYPE** B,DWORD jc,DWORD kc,DWORD nc,FACTOR_TYPE* packed){
+	DWORD j,p,columns;
+	for(j=0;j<nc;j+=FACTOR_NR){
+		columns=nc-j<FACTOR_NR?nc-j:FACTOR_NR;
+		for(p=0;p<kc;p++){
+			memcpy(packed+p*FACTOR_NR,B[p]+jc+j,columns*sizeof(FACTOR_TYPE));
+			memset(packed+p*FACTOR_NR+columns,0,(FACTOR_NR-columns)*sizeof(FACTOR_TYPE));
+		}
+		packed+=FACTOR_NR*kc;
+	}
+}
+
+/*
+ * Same as gemm_micro_kernel for a MR*FACTOR_NR tile of FACTOR_TYPE.
+*/
+static void factor_micro_kernel(DWORD kc,FACTOR_TYPE* a,FACTOR_TYPE* b,FACTOR_TYPE** C,DWORD row,DWORD column,DWORD rows,DWORD columns){
+	FactorVector c00={0,0,0,0},c01={0,0,0,0},c10={0,0,0,0},c11={0,0,0,0},c20={0,0,0,0},c21={0,0,0,0},c30={0,0,0,0},c31={0,0,0,0},b0,b1,x;
+	FACTOR_TYPE tile[GEMM_MR][FACTOR_NR];
+	DWORD p,i,j;
+	for(p=0;p<kc;p++){
+		memcpy(&b0,b,sizeof(FactorVector));
+		memcpy(&b1,b+4,sizeof(FactorVector));
+		x=(FactorVector){a[0],a[0],a[0],a[0]};
+		c00+=x*b0;
+		c01+=x*b1;
+		x=(FactorVector){a[1],a[1],a[1],a[1]};
+		c10+=x*b0;
+		c11+=x*b1;
+		x=(FactorVector){a[2],a[2],a[2],a[2]};
+		c20+=x*b0;
+		c21+=x*b1;
+		x=(FactorVector){a[3],a[3],a[3],a[3]};
+		c30+=x*b0;
+		c31+=x*b1;
+		a+=GEMM_MR;
+		b+=FACTOR_NR;
+	}
+	memcpy(tile[0],&c00,sizeof(FactorVector));
+	memcpy(tile[0]+4,&c01,sizeof(FactorVector));
+	memcpy(tile[1],&c10,sizeof(FactorVector));
+	memcpy(tile[1]+4,&c11,sizeof(FactorVector));
+	memcpy(tile[2],&c20,sizeof(FactorVector));
+	memcpy(tile[2]+4,&c21,sizeof(FactorVector));
+	memcpy(tile[3],&c30,sizeof(FactorVector));
+	memcpy(tile[3]+4,&c31,sizeof(FactorVector));
+	for(i=0;i<rows;i++){
+		FACTOR_TYPE* target=C[row+i]+column;
+		for(j=0;j<columns;j++){
+			target[j]+=tile[i][j];
+		}
+	}
+}
+
+static void factor_gemm_block(DWORD task,WORD thread,void* arg){
+	FactorGemmJob* job=(FactorGemmJob*)arg;
+	DWORD ic=task*GEMM_MC,mc,i,j;
+	FACTOR_TYPE* packed_A=job->packed_A+(DWORD)thread*GEMM_MC*GEMM_KC;
+	mc=job->m-ic<GEMM_MC?job->m-ic:GEMM_MC;
+	pack_factor_A(job->A,ic,job->a_column,mc,job->kc,packed_A);
+	for(j=0;j<job->nc;j+=FACTOR_NR){
+		for(i=0;i<mc;i+=GEMM_MR){
+			factor_micro_kernel(job->kc,packed_A+i*job->kc,job->packed_B+j*job->kc,job->C,ic+i,job->c_column+job->jc+j,mc-i<GEMM_MR?mc-i:GEMM_MR,job->nc-j<FACTOR_NR?job->nc-j:FACTOR_NR);
+		}
+	}
+}
+
+/*
+ * Trailing update of the FACTOR_TYPE LU, C[0:m,c_column:c_column+n]-=A[0:m,a_column:a_column+k]*B[0:k,c_column:c_column+n].
+ * k is at most one panel, so there is a single pass over k.
+*/
+static void factor_gemm_update(DWORD m,DWORD n,DWORD k,FACTOR_TYPE** A,DWORD a_column,FACTOR_TYPE** B,FACTOR_TYPE** C,DWORD c_column){
+	DWORD i,blocks;
+	FactorGemmJob job;
+	WORD threads;
+	if(m==0||n==0||k==0){
+		return;
+	}
+	threads=(DTYPE)m*n*k<GEMM_PARALLEL_WORK?1:krig_thread_count();
+	blocks=(m+GEMM_MC-1)/GEMM_MC;
+	job.A=A;
+	job.C=C;
+	job.a_column=a_column;
+	job.c_column=c_column;
+	job.m=m;
+	job.kc=k;
+	job.packed_B=Calloc(k*(GEMM_NC<n+FACTOR_NR?GEMM_NC:n+FACTOR_NR),FACTOR_TYPE);
+	job.packed_A=Calloc((DWORD)threads*GEMM_MC*GEMM_KC,FACTOR_TYPE);
+	for(job.jc=0;job.jc<n;job.jc+=GEMM_NC){
+		job.nc=n-job.jc<GEMM_NC?n-job.jc:GEMM_NC;
+		pack_factor_B(B,c_column+job.jc,k,job.nc,job.packed_B);
+		if(threads>1){
+			parallel_for(blocks,factor_gemm_block,&job);
+		}else{
+			for(i=0;i<blocks;i++){
+				factor_gemm_block(i,0,&job);
+			}
+		}
+	}
+	Free(job.packed_B);
+	Free(job.packed_A);
+}
+
+/*
+ * lower_upper_in_place for n*n rows of FACTOR_TYPE. Return FALSE if a pivot is zero.
+*/
+static BOOLEAN factor_lower_upper(FACTOR_TYPE** m,DWORD n,DWORD* permutation){
+	DWORD i,j,k,b,c,pivot,swap;
+	FACTOR_TYPE multiplier,largest;
+	FACTOR_TYPE* temp;
+	for(i=0;i<n;i++){
+		permutation[i]=i;
+	}
+	for(k=0;k<n;k+=LU_BLOCK_SIZE){
+		b=n-k<LU_BLOCK_SIZE?n-k:LU_BLOCK_SIZE;
+		for(j=k;j<k+b;j++){
+			pivot=j;
+			largest=fabsf(m[j][j]);
+			for(i=j+1;i<n;i++){
+				if(fabsf(m[i][j])>largest){
+					largest=fabsf(m[i][j]);
+					pivot=i;
+				}
+			}
+			if(largest==0){
+				return FALSE;
+			}
+			temp=m[j];
+			m[j]=m[pivot];
+			m[pivot]=temp;
+			swap=permutation[j];
+			permutation[j]=permutation[pivot];
+			permutation[pivot]=swap;
+			for(i=j+1;i<n;i++){
+				multiplier=m[i][j]/m[j][j];
+				m[i][j]=multiplier;
+				for(c=j+1;c<k+b;c++){
+					m[i][c]-=multiplier*m[j][c];
+				}
+			}
+		}
+		for(j=k+1;j<k+b;j++){
+			for(i=k;i<j;i++){
+				multiplier=m[j][i];
+				for(c=k+b;c<n;c++){
+					m[j][c]-=multiplier*m[i][c];
+				}
+			}
+		}
+		factor_gemm_update(n-k-b,n-k-b,b,m+k+b,k,m+k,m+k+b,k+b);
+	}
+	return TRUE;
+}
+
+/*
+ * x=U^-1*L^-1*P*rhs for every column of rhs, with the FACTOR_TYPE factors and DTYPE arithmetic.
+*/
+static void factor_solve(FACTOR_TYPE** LU,DWORD* permutation,Matrix* rhs,Matrix* x){
+	DWORD n=x->n_row,columns=x->n_column,i,j,c;
+	DTYPE multiplier;
+	for(i=0;i<n;i++){
+		DTYPE* row=x->matrix[i];
+		memcpy(row,rhs->matrix[permutation[i]],columns*sizeof(DTYPE));
+		for(j=0;j<i;j++){
+			multiplier=LU[i][j];
+			for(c=0;c<columns;c++){
+				row[c]-=multiplier*x->matrix[j][c];
+			}
+		}
+	}
+	for(i=n-1;i>=0;i--){
+		DTYPE* row=x->matrix[i];
+		for(j=i+1;j<n;j++){
+			multiplier=LU[i][j];
+			for(c=0;c<columns;c++){
+				row[c]-=multiplier*x->matrix[j][c];
+			}
+		}
+		multiplier=1/(DTYPE)LU[i][i];
+		for(c=0;c<columns;c++){
+			row[c]*=multiplier;
+		}
+	}
+}
+
+/*
+ * residual=gamma-Gamma*x in DTYPE.
+*/
+static void refinement_residual(Matrix* Gamma,Matrix* gamma,Matrix* x,Matrix* residual){
+	DWORD n=Gamma->n_row,i,j;
+	DTYPE sum;
+	for(i=0;i<n;i++){
+		memcpy(residual->matrix[i],gamma->matrix[i],x->n_column*sizeof(DTYPE));
+	}
+	if(x->n_column>1){
+		gemm_update(n,x->n_column,n,-1,Gamma->matrix,0,x->matrix,0,residual->matrix,0);
+		return;
+	}
+	DTYPE* vector=Calloc(n,DTYPE);
+	for(i=0;i<n;i++){
+		vector[i]=x->matrix[i][0];
+	}
+	for(i=0;i<n;i++){
+		sum=0;
+		for(j=0;j<n;j++){
+			sum+=Gamma->matrix[i][j]*vector[j];
+		}
+		residual->matrix[i][0]-=sum;
+	}
+	Free(vector);
+}
+
+/*
+ * Stopping rule of LAPACK dsgesv, every column needs |r|<=|x|*|Gamma|*eps*sqrt(n) in the infinity norm.
+*/
+static BOOLEAN refinement_converged(Matrix* x,Matrix* residual,DTYPE norm){
+	DWORD i,c;
+	DTYPE x_norm,r_norm;
+	for(c=0;c<x->n_column;c++){
+		x_norm=0;
+		r_norm=0;
+		for(i=0;i<x->n_row;i++){
+			x_norm=fmax(x_norm,fabs(x->matrix[i][c]));
+			r_norm=fmax(r_norm,fabs(residual->matrix[i][c]));
+		}
+		if(!(r_norm<=x_norm*norm*DBL_EPSILON*sqrt(x->n_row))){
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+Matrix* solve_mixed_precision(Matrix* Gamma,Matrix* gamma){
+	DWORD n=Gamma->n_row,i,j,iteration;
+	DTYPE norm=0,sum;
+	BOOLEAN converged=FALSE;
+	if(Gamma->n_column!=n||gamma->n_row!=n){
+		return NULL;
+	}
+	for(i=0;i<n;i++){
+		sum=0;
+		for(j=0;j<n;j++){
+			sum+=fabs(Gamma->matrix[i][j]);
+		}
+		norm=fmax(norm,sum);
+	}
+	//Entries must be representable in FACTOR_TYPE
+	if(!(norm<=FLT_MAX)){
+		return NULL;
+	}
+	FACTOR_TYPE* storage=Calloc(n*n,FACTOR_TYPE);
+	FACTOR_TYPE** LU=Calloc(n,FACTOR_TYPE*);
+	DWORD* permutation=Calloc(n,DWORD);
+	for(i=0;i<n;i++){
+		LU[i]=storage+i*n;
+		for(j=0;j<n;j++){
+			LU[i][j]=Gamma->matrix[i][j];
+		}
+	}
+	Matrix* x=create_matrix(n,gamma->n_column);
+	Matrix* residual=create_matrix(n,gamma->n_column);
+	Matrix* correction=create_matrix(n,gamma->n_column);
+	if(factor_lower_upper(LU,n,permutation)){
+		factor_solve(LU,permutation,gamma,x);
+		for(iteration=0;iteration<MIXED_PRECISION_ITERATIONS&&!converged;iteration++){
+			refinement_residual(Gamma,gamma,x,residual);
+			converged=refinement_converged(x,residual,norm);
+			//The step after the test passes is kept, it costs O(n^2) and removes most of the remaining error
+			factor_solve(LU,permutation,residual,correction);
+			add_to_matrix(x,correction);
+		}
+	}
+	destroy_matrix(residual);
+	destroy_matrix(correction);
+	Free(storage);
+	Free(LU);
+	Free(permutation);
+	if(!converged){
+		destroy_matrix(x);
+		return NULL;
+	}
+	return x;
+}
+
+/*
+ * Inverse from the FACTOR_TYPE factors, refined by Newton-Schulz steps X+=X*(I-Gamma*X), which square the residual every step and run on the blocked multiplication.
+ * Return NULL if the factorization breaks down or the steps do not converge.
+*/
+static Matrix* mixed_precision_inversion(Matrix* m){
+	DWORD n=m->n_row,i,j,c,iteration;
+	DTYPE norm=0,sum,residual_norm;
+	BOOLEAN converged=FALSE;
+	for(i=0;i<n;i++){
+		sum=0;
+		for(j=0;j<n;j++){
+			sum+=fabs(m->matrix[i][j]);
+		}
+		norm=fmax(norm,sum);
+	}
+	if(!(norm<=FLT_MAX)){
+		return NULL;
+	}
+	FACTOR_TYPE* storage=Calloc(n*n,FACTOR_TYPE);
+	FACTOR_TYPE** LU=Calloc(n,FACTOR_TYPE*);
+	DWORD* permutation=Calloc(n,DWORD);
+	for(i=0;i<n;i++){
+		LU[i]=storage+i*n;
+		for(j=0;j<n;j++){
+			LU[i][j]=m->matrix[i][j];
+		}
+	}
+	FACTOR_TYPE* inverse_storage=Calloc(n*n,FACTOR_TYPE);
+	FACTOR_TYPE** inverse=Calloc(n,FACTOR_TYPE*);
+	FACTOR_TYPE factor;
+	Matrix* Y=create_matrix(n,n);
+	Matrix* result=create_matrix(n,n);
+	Matrix* residual=create_matrix(n,n);
+	if(factor_lower_upper(LU,n,permutation)){
+		//The first approximation only needs FACTOR_TYPE accuracy, so it is computed in FACTOR_TYPE as well
+		for(i=0;i<n;i++){
+			//L^-1, row i is zero right of the diagonal
+			inverse[i]=inverse_storage+i*n;
+			FACTOR_TYPE* row=inverse[i];
+			memset(row,0,n*sizeof(FACTOR_TYPE));
+			row[i]=1;
+			for(j=0;j<i;j++){
+				factor=LU[i][j];
+				for(c=0;c<=j;c++){
+					row[c]-=factor*inverse[j][c];
+				}
+			}
+		}
+		for(i=n-1;i>=0;i--){
+			//U^-1*L^-1
+			FACTOR_TYPE* row=inverse[i];
+			for(j=i+1;j<n;j++){
+				factor=LU[i][j];
+				for(c=0;c<n;c++){
+					row[c]-=factor*inverse[j][c];
+				}
+			}
+			factor=1/LU[i][i];
+			for(c=0;c<n;c++){
+				row[c]*=factor;
+			}
+		}
+		//Pm=LU, so the inverse is U^-1*L^-1*P
+		for(i=0;i<n;i++){
+			for(c=0;c<n;c++){
+				result->matrix[i][permutation[c]]=inverse[i][c];
+			}
+		}
+		for(iteration=0;iteration<MIXED_PRECISION_ITERATIONS;iteration++){
+			for(i=0;i<n;i++){
+				memset(residual->matrix[i],0,n*sizeof(DTYPE));
+				residual->matrix[i][i]=1;
+			}
+			gemm_update(n,n,n,-1,m->matrix,0,result->matrix,0,residual->matrix,0);
+			converged=refinement_converged(result,residual,norm);
+			if(converged){
+				break;
+			}
+			residual_norm=0;
+			for(i=0;i<n;i++){
+				sum=0;
+				for(j=0;j<n;j++){
+					sum+=fabs(residual->matrix[i][j]);
+				}
+				residual_norm=fmax(residual_norm,sum);
+			}
+			if(!(residual_norm<1)){
+				break;
+			}
+			for(i=0;i<n;i++){
+				memcpy(Y->matrix[i],result->matrix[i],n*sizeof(DTYPE));
+			}
+			gemm_update(n,n,n,1,Y->matrix,0,residual->matrix,0,result->matrix,0);
+			//The next residual is the square of this one up to rounding, so it need not be computed once that is below DTYPE precision
+			if(residual_norm*residual_norm<=DBL_EPSILON){
+				converged=TRUE;
+				break;
+			}
+		}
+	}
+	destroy_matrix(Y);
+	destroy_matrix(residual);
+	Free(inverse_storage);
+	Free(inverse);
+	Free(storage);
+	Free(LU);
+	Free(permutation);
+	if(!converged){
+		destroy_matrix(result);
+		return NULL;
+	}
+	return result;
+}
+
+typedef struct{
+	Matrix* L;
+	Matrix* U;
+	DWORD* permutation;
+	DTYPE* columns;
+	Matrix* result;
+} InversionJob;
+
+/*
+ * Column task of the inverse. Pm=LU, so column k of the inverse solves LUx=Pe_k.
+*/
+static void inversion_column(DWORD k,WORD thread,void* arg){
+	InversionJob* job=(InversionJob*)arg;
+	Matrix *L=job->L,*U=job->U;
+	DWORD n=L->n_row,i,j;
+	DTYPE* column=job->columns+(DWORD)thread*n;
+	for(i=0;i<n;i++){
+		column[i]=job->permutation[i]==k?1:0;
+		for(j=0;j<i;j++){
+			column[i]-=L->matrix[i][j]*column[j];
+		}
+	}
+	for(i=n-1;i>=0;i--){
+		for(j=i+1;j<n;j++){
+			column[i]-=U->matrix[i][j]*column[j];
+		}
+		column[i]/=U->matrix[i][i];
+		job->result->matrix[i][k]=column[i];
+	}
+}
+
+Matrix* matrix_inversion(Matrix* m){
+	if(m->n_row!=m->n_column){
+		return NULL;
+	}
+	DWORD n=m->n_row,i;
+	Matrix** LUP=NULL;
+	Matrix* LU=NULL;
+	InversionJob job;
+	if(get_solver_type()==MIXED_PRECISION_SOLVER){
+		job.result=mixed_precision_inversion(m);
+		if(job.result!=NULL){
+			return job.result;
+		}
+	}
+	job.permutation=Calloc(n,DWORD);
+	if(n>=LU_BLOCKED_THRESHOLD){
+		//L and U share the factorized matrix, L is read below and U on and above the diagonal
+		LU=copy_matrix(m);
+		lower_upper_in_place(LU,job.permutation);
+		job.L=LU;
+		job.U=LU;
+	}else{
+		LUP=lower_upper_permutation(m);
+		job.L=LUP[0];
+		job.U=LUP[1];
+		for(i=0;i<n;i++){
+			job.permutation[i]=(DWORD)LUP[3]->matrix[i][0];
+		}
+	}
+	job.result=create_matrix(n,n);
+	for(i=0;i<n&&job.result!=NULL;i++){
+		if(job.U->matrix[i][i]==0){
+			destroy_matrix(job.result);
+			job.result=NULL;
+		}
+	}
+	if(job.result!=NULL){
+		job.columns=Calloc((DWORD)krig_thread_count()*n,DTYPE);
+		parallel_for(n,inversion_column,&job);
+		Free(job.columns);
+	}
+	Free(job.permutation);
+	if(LU!=NULL){
+		destroy_matrix(LU);
+	}else{
+		for(i=0;i<4;i++){
+			destroy_matrix(LUP[i]);
+		}
+		Free(LUP);
+	}
+	return job.result;
+}
+
 Matrix* matrix_transpose(Matrix* m){
 	Matrix* result=create_matrix(m->n_column,m->n_row);
 	DWORD i,j;
@@ -514,3 +1343,561 @@ Matrix* matrix_transpose(Matrix* m){
 	}
 	return result;
 }
+
+void destroy_sparse_matrix(SparseMatrix* m){
+	if(m==NULL){
+		return;
+	}
+	Free(m->row_start);
+	Free(m->columns);
+	Free(m->values);
+	Free(m);
+}
+
+void sparse_multiply_vector(SparseMatrix* m,DTYPE* x,DTYPE* y){
+	DWORD i,k;
+	DTYPE sum;
+	for(i=0;i<m->n_row;i++){
+		sum=0;
+		for(k=m->row_start[i];k<m->row_start[i+1];k++){
+			sum+=m->values[k]*x[m->columns[k]];
+		}
+		y[i]=sum;
+	}
+}
+
+
+static DTYPE dot_product(DTYPE* a,DTYPE* b,DWORD n){
+	DWORD i;
+	DTYPE sum=0;
+	for(i=0;i<n;i++){
+		sum+=a[i]*b[i];
+	}
+	return sum;
+}
+
+DWORD solve_minres_operator(DWORD n,LinearOperator product,LinearOperator preconditioner,void* arg,DTYPE* b,DTYPE* x,DWORD max_iterations,DTYPE tolerance){
+	DWORD i,iteration;
+	DTYPE beta,beta1,old_beta,alpha,delta,gamma_bar,gamma,epsilon=0,old_epsilon,delta_bar=0,phi,phi_bar,cs=-1,sn=0,scale,temp;
+	DTYPE* r1=Calloc(n,DTYPE);
+	DTYPE* r2=Calloc(n,DTYPE);
+	DTYPE* y=Calloc(n,DTYPE);
+	DTYPE* v=Calloc(n,DTYPE);
+	DTYPE* w=Calloc(n,DTYPE);
+	DTYPE* w1=Calloc(n,DTYPE);
+	DTYPE* w2=Calloc(n,DTYPE);
+	for(i=0;i<n;i++){
+		x[i]=0;
+		r1[i]=b[i];
+		r2[i]=b[i];
+		w[i]=0;
+		w2[i]=0;
+	}
+	preconditioner(r1,y,arg);
+	beta1=dot_product(r1,y,n);
+	iteration=-1;
+	if(beta1==0){
+		iteration=0;
+	}else if(beta1>0){
+		beta1=sqrt(beta1);
+		beta=beta1;
+		old_beta=0;
+		phi_bar=beta1;
+		for(iteration=1;iteration<=max_iterations;iteration++){
+			/*Lanczos step*/
+			scale=1/beta;
+			for(i=0;i<n;i++){
+				v[i]=scale*y[i];
+			}
+			product(v,y,arg);
+			if(iteration>=2){
+				temp=beta/old_beta;
+				for(i=0;i<n;i++){
+					y[i]-=temp*r1[i];
+				}
+			}
+			alpha=dot_product(v,y,n);
+			temp=alpha/beta;
+			for(i=0;i<n;i++){
+				y[i]-=temp*r2[i];
+				r1[i]=r2[i];
+				r2[i]=y[i];
+			}
+			preconditioner(r2,y,arg);
+			old_beta=beta;
+			beta=dot_product(r2,y,n);
+			if(beta<0){
+				//The preconditioner is not positive definite
+				iteration=-1;
+				break;
+			}
+			beta=sqrt(beta);
+			/*Apply the previous rotation and compute the next one*/
+			old_epsilon=epsilon;
+			delta=cs*delta_bar+sn*alpha;
+			gamma_bar=sn*delta_bar-cs*alpha;
+			epsilon=sn*beta;
+			delta_bar=-cs*beta;
+			gamma=fmax(hypot(gamma_bar,beta),DBL_EPSILON);
+			cs=gamma_bar/gamma;
+			sn=beta/gamma;
+			phi=cs*phi_bar;
+			phi_bar*=sn;
+			/*Update the solution along the new search direction*/
+			for(i=0;i<n;i++){
+				w1[i]=w2[i];
+				w2[i]=w[i];
+				w[i]=(v[i]-old_epsilon*w1[i]-delta*w2[i])/gamma;
+				x[i]+=phi*w[i];
+			}
+			if(phi_bar<=tolerance*beta1||beta==0){
+				break;
+			}
+		}
+		if(iteration>max_iterations){
+			iteration=-1;
+		}
+	}
+	Free(r1);
+	Free(r2);
+	Free(y);
+	Free(v);
+	Free(w);
+	Free(w1);
+	Free(w2);
+	return iteration;
+}
+
+/*Sparse matrix and diagonal preconditioner of solve_minres*/
+typedef struct{
+	SparseMatrix* A;
+	DTYPE* weights;
+} SparseSystem;
+
+static void sparse_product(DTYPE* x,DTYPE* y,void* arg){
+	sparse_multiply_vector(((SparseSystem*)arg)->A,x,y);
+}
+
+static void sparse_preconditioner(DTYPE* r,DTYPE* y,void* arg){
+	SparseSystem* system=(SparseSystem*)arg;
+	DWORD i;
+	for(i=0;i<system->A->n_row;i++){
+		y[i]=system->weights==NULL?r[i]:system->weights[i]*r[i];
+	}
+}
+
+DWORD solve_minres(SparseMatrix* A,DTYPE* b,DTYPE* x,DTYPE* weights,DWORD max_iterations,DTYPE tolerance){
+	SparseSystem system;
+	system.A=A;
+	system.weights=weights;
+	return solve_minres_operator(A->n_row,sparse_product,sparse_preconditioner,&system,b,x,max_iterations,tolerance);
+}
+
+/*Coordinate of a point used as sort key when splitting a cluster*/
+typedef struct{
+	DTYPE key;
+	DWORD index;
+} HClusterKey;
+
+static int hcluster_key_cmp(const void* a,const void* b){
+	DTYPE x=((HClusterKey*)a)->key,y=((HClusterKey*)b)->key;
+	if(x!=y){
+		return x<y?-1:1;
+	}
+	/*Ties keep the original order so that the tree does not depend on qsort*/
+	return ((HClusterKey*)a)->index<((HClusterKey*)b)->index?-1:1;
+}
+
+static HCluster* build_hcluster(SPATIAL_TYPE** points,WORD dimension,DWORD* order,HClusterKey* keys,DWORD start,DWORD size){
+	HCluster* node=Calloc(1,HCluster);
+	DWORD i,axis=0;
+	WORD d;
+	node->start=start;
+	node->size=size;
+	/*Unused axes of 2D points stay at 0*/
+	for(d=0;d<3;d++){
+		node->box[d]=node->box[d+3]=d<dimension?points[order[start]][d]:0;
+	}
+	for(i=start+1;i<start+size;i++){
+		for(d=0;d<dimension;d++){
+			node->box[d]=fmin(node->box[d],points[order[i]][d]);
+			node->box[d+3]=fmax(node->box[d+3],points[order[i]][d]);
+		}
+	}
+	node->children[0]=NULL;
+	node->children[1]=NULL;
+	if(size<=HMATRIX_LEAF_SIZE){
+		return node;
+	}
+	/*Split at the median along the longest side*/
+	for(d=1;d<dimension;d++){
+		if(node->box[d+3]-node->box[d]>node->box[axis+3]-node->box[axis]){
+			axis=d;
+		}
+	}
+	for(i=0;i<size;i++){
+		keys[i].key=points[order[start+i]][axis];
+		keys[i].index=order[start+i];
+	}
+	qsort(keys,size,sizeof(HClusterKey),hcluster_key_cmp);
+	for(i=0;i<size;i++){
+		order[start+i]=keys[i].index;
+	}
+	node->children[0]=build_hcluster(points,dimension,order,keys,start,size/2);
+	node->children[1]=build_hcluster(points,dimension,order,keys,start+size/2,size-size/2);
+	return node;
+}
+
+static void destroy_hcluster(HCluster* node){
+	if(node==NULL){
+		return;
+	}
+	destroy_hcluster(node->children[0]);
+	destroy_hcluster(node->children[1]);
+	Free(node);
+}
+
+static BOOLEAN hcluster_admissible(HCluster* s,HCluster* t){
+	DTYPE gap,separation=0,diameter_s=0,diameter_t=0;
+	WORD d;
+	for(d=0;d<3;d++){
+		gap=fmax(0,fmax(s->box[d]-t->box[d+3],t->box[d]-s->box[d+3]));
+		separation+=gap*gap;
+		diameter_s+=(s->box[d+3]-s->box[d])*(s->box[d+3]-s->box[d]);
+		diameter_t+=(t->box[d+3]-t->box[d])*(t->box[d+3]-t->box[d]);
+	}
+	return separation>0&&sqrt(fmin(diameter_s,diameter_t))<=HMATRIX_ADMISSIBILITY*sqrt(separation);
+}
+
+/*
+ * Shared state of filling the leaves of a block tree.
+ * scale: Largest diagonal entry. Crosses below tolerance*scale end the approximation even if the block itself is tiny, so far blocks of decaying kernels stay at low rank.
+ * used: Per-thread scratch of n flags marking the rows taken by cross approximation.
+*/
+typedef struct{
+	HBlock** leaves;
+	DWORD n_leaves;
+	DWORD capacity;
+	DWORD* order;
+	MatrixEntry entry;
+	void* arg;
+	DTYPE tolerance;
+	DTYPE scale;
+	BOOLEAN* used;
+	DWORD n;
+} HMatrixJob;
+
+static HBlock* build_hblock(HCluster* s,HCluster* t,HMatrixJob* job){
+	HBlock* block=Calloc(1,HBlock);
+	DWORD i;
+	block->row_start=s->start;
+	block->n_row=s->size;
+	block->column_start=t->start;
+	block->n_column=t->size;
+	block->low_rank=FALSE;
+	block->rank=0;
+	block->U=NULL;
+	block->V=NULL;
+	block->dense=NULL;
+	for(i=0;i<4;i++){
+		block->children[i]=NULL;
+	}
+	if(hcluster_admissible(s,t)){
+		block->low_rank=TRUE;
+	}else if(s->children[0]!=NULL&&t->children[0]!=NULL){
+		for(i=0;i<4;i++){
+			block->children[i]=build_hblock(s->children[i/2],t->children[i%2],job);
+		}
+		return block;
+	}
+	/*Leaves are filled afterwards in parallel*/
+	if(job->n_leaves==job->capacity){
+		job->capacity*=2;
+		job->leaves=(HBlock**)realloc(job->leaves,sizeof(HBlock*)*job->capacity);
+	}
+	job->leaves[job->n_leaves++]=block;
+	return block;
+}
+
+static void fill_dense_hblock(HBlock* block,HMatrixJob* job){
+	DWORD i,j;
+	block->dense=Calloc(block->n_row*block->n_column,DTYPE);
+	for(i=0;i<block->n_row;i++){
+		for(j=0;j<block->n_column;j++){
+			block->dense[i*block->n_column+j]=job->entry(job->order[block->row_start+i],job->order[block->column_start+j],job->arg);
+		}
+	}
+}
+
+/*
+ * First unused row of a block whose residual after rank crosses has a squared norm above limit.
+ * Return: n_row if there is none.
+*/
+static DWORD unresolved_hblock_row(HBlock* block,HMatrixJob* job,BOOLEAN* used,DTYPE* U,DTYPE* V,DWORD rank,DTYPE limit){
+	DWORD m=block->n_row,n=block->n_column,i,j,l;
+	DTYPE residual,squares;
+	DWORD* rows=job->order+block->row_start;
+	DWORD* columns=job->order+block->column_start;
+	for(i=0;i<m;i++){
+		if(used[i]){
+			continue;
+		}
+		squares=0;
+		for(j=0;j<n;j++){
+			residual=job->entry(rows[i],columns[j],job->arg);
+			for(l=0;l<rank;l++){
+				residual-=U[l*m+i]*V[l*n+j];
+			}
+			squares+=residual*residual;
+		}
+		if(squares>limit){
+			return i;
+		}
+	}
+	return m;
+}
+
+/*
+ * Adaptive cross approximation with partial pivoting (Bebendorf, 2000).
+ * Every step takes a residual row and the residual column through its largest entry, the next row is the largest entry of that column.
+ * The Frobenius norm of the approximation is updated on the fly and the iteration stops when the last cross is below tolerance times that norm, or times the scale of the matrix.
+ * A row whose residual vanishes gives no cross, the iteration goes on with the next unused row.
+ * Blocks with zero entries, e.g. of compactly supported kernels near the support radius, can have a tiny cross while rows not visited yet hold large entries.
+ * For them every remaining row is checked before stopping, and the iteration goes on with the first one above tolerance.
+ * Return: FALSE if the rank needed is too high for compression to save storage.
+*/
+static BOOLEAN fill_low_rank_hblock(HBlock* block,HMatrixJob* job,BOOLEAN* used){
+	DWORD m=block->n_row,n=block->n_column,i,j,l,i_star=0,j_star,rank=0,capacity=16,max_rank;
+	DTYPE norm=0,pivot,u_norm,v_norm,cross,u_dot,v_dot,limit;
+	BOOLEAN converged=FALSE,compact=FALSE;
+	DWORD* rows=job->order+block->row_start;
+	DWORD* columns=job->order+block->column_start;
+	max_rank=m*n/(m+n);
+	DTYPE* U=Calloc(capacity*m,DTYPE);
+	DTYPE* V=Calloc(capacity*n,DTYPE);
+	memset(used,0,sizeof(BOOLEAN)*m);
+	while(rank<max_rank){
+		if(rank==capacity){
+			capacity*=2;
+			U=(DTYPE*)realloc(U,sizeof(DTYPE)*capacity*m);
+			V=(DTYPE*)realloc(V,sizeof(DTYPE)*capacity*n);
+		}
+		DTYPE* u=U+rank*m;
+		DTYPE* v=V+rank*n;
+		used[i_star]=TRUE;
+		j_star=0;
+		for(j=0;j<n;j++){
+			v[j]=job->entry(rows[i_star],columns[j],job->arg);
+			compact|=v[j]==0;
+			for(l=0;l<rank;l++){
+				v[j]-=U[l*m+i_star]*V[l*n+j];
+			}
+			if(fabs(v[j])>fabs(v[j_star])){
+				j_star=j;
+			}
+		}
+		if(v[j_star]==0){
+			/*The residual row vanishes, which says nothing about the other rows, e.g. with compactly supported variograms. The next unused row is tried, the block is exact once every row vanished.*/
+			for(i_star=0;i_star<m&&used[i_star];i_star++);
+			if(i_star==m){
+				converged=TRUE;
+				break;
+			}
+			continue;
+		}
+		pivot=v[j_star];
+		for(j=0;j<n;j++){
+			v[j]/=pivot;
+		}
+		for(i=0;i<m;i++){
+			u[i]=job->entry(rows[i],columns[j_star],job->arg);
+			for(l=0;l<rank;l++){
+				u[i]-=U[l*m+i]*V[l*n+j_star];
+			}
+		}
+		u_norm=0;
+		for(i=0;i<m;i++){
+			u_norm+=u[i]*u[i];
+		}
+		v_norm=0;
+		for(j=0;j<n;j++){
+			v_norm+=v[j]*v[j];
+		}
+		cross=0;
+		for(l=0;l<rank;l++){
+			u_dot=0;
+			for(i=0;i<m;i++){
+				u_dot+=u[i]*U[l*m+i];
+			}
+			v_dot=0;
+			for(j=0;j<n;j++){
+				v_dot+=v[j]*V[l*n+j];
+			}
+			cross+=u_dot*v_dot;
+		}
+		norm+=2*cross+u_norm*v_norm;
+		rank++;
+		limit=job->tolerance*job->tolerance*fmax(norm,job->scale*job->scale);
+		if(u_norm*v_norm<=limit){
+			i_star=compact?unresolved_hblock_row(block,job,used,U,V,rank,limit):m;
+			if(i_star==m){
+				converged=TRUE;
+				break;
+			}
+			continue;
+		}
+		i_star=m;
+		for(i=0;i<m;i++){
+			if(!used[i]&&(i_star==m||fabs(u[i])>fabs(u[i_star]))){
+				i_star=i;
+			}
+		}
+		if(i_star==m){
+			converged=TRUE;
+			break;
+		}
+	}
+	if(!converged){
+		Free(U);
+		Free(V);
+		return FALSE;
+	}
+	block->rank=rank;
+	block->U=(DTYPE*)realloc(U,sizeof(DTYPE)*(rank>0?rank*m:1));
+	block->V=(DTYPE*)realloc(V,sizeof(DTYPE)*(rank>0?rank*n:1));
+	return TRUE;
+}
+
+static void fill_hblock(DWORD task,WORD thread,void* arg){
+	HMatrixJob* job=(HMatrixJob*)arg;
+	HBlock* block=job->leaves[task];
+	if(block->low_rank&&!fill_low_rank_hblock(block,job,job->used+(DWORD)thread*job->n)){
+		block->low_rank=FALSE;
+	}
+	if(!block->low_rank){
+		fill_dense_hblock(block,job);
+	}
+}
+
+HMatrix* build_hmatrix(DWORD n,SPATIAL_TYPE** points,WORD dimension,MatrixEntry entry,void* arg,DTYPE tolerance){
+	DWORD i;
+	HMatrixJob job;
+	if(n<1){
+		return NULL;
+	}
+	HMatrix* m=Calloc(1,HMatrix);
+	m->n=n;
+	m->order=Calloc(n,DWORD);
+	for(i=0;i<n;i++){
+		m->order[i]=i;
+	}
+	HClusterKey* keys=Calloc(n,HClusterKey);
+	m->tree=build_hcluster(points,dimension,m->order,keys,0,n);
+	Free(keys);
+	job.capacity=64;
+	job.n_leaves=0;
+	job.leaves=Calloc(job.capacity,HBlock*);
+	job.order=m->order;
+	job.entry=entry;
+	job.arg=arg;
+	job.tolerance=tolerance;
+	job.scale=0;
+	for(i=0;i<n;i++){
+		job.scale=fmax(job.scale,fabs(entry(i,i,arg)));
+	}
+	job.n=n;
+	job.used=Calloc(krig_thread_count()*n,BOOLEAN);
+	m->root=build_hblock(m->tree,m->tree,&job);
+	parallel_for(job.n_leaves,fill_hblock,&job);
+	Free(job.leaves);
+	Free(job.used);
+	return m;
+}
+
+static void hblock_multiply_vector(HBlock* block,DTYPE* x,DTYPE* y){
+	DWORD i,j,l;
+	DTYPE sum;
+	DTYPE* xs=x+block->column_start;
+	DTYPE* ys=y+block->row_start;
+	if(block->children[0]!=NULL){
+		for(l=0;l<4;l++){
+			hblock_multiply_vector(block->children[l],x,y);
+		}
+	}else if(block->low_rank){
+		for(l=0;l<block->rank;l++){
+			sum=0;
+			for(j=0;j<block->n_column;j++){
+				sum+=block->V[l*block->n_column+j]*xs[j];
+			}
+			for(i=0;i<block->n_row;i++){
+				ys[i]+=block->U[l*block->n_row+i]*sum;
+			}
+		}
+	}else{
+		for(i=0;i<block->n_row;i++){
+			sum=0;
+			for(j=0;j<block->n_column;j++){
+				sum+=block->dense[i*block->n_column+j]*xs[j];
+			}
+			ys[i]+=sum;
+		}
+	}
+}
+
+void hmatrix_multiply_vector(HMatrix* m,DTYPE* x,DTYPE* y){
+	DWORD i;
+	DTYPE* xt=Calloc(m->n,DTYPE);
+	DTYPE* yt=Calloc(m->n,DTYPE);
+	for(i=0;i<m->n;i++){
+		xt[i]=x[m->order[i]];
+		yt[i]=0;
+	}
+	hblock_multiply_vector(m->root,xt,yt);
+	for(i=0;i<m->n;i++){
+		y[m->order[i]]=yt[i];
+	}
+	Free(xt);
+	Free(yt);
+}
+
+static DWORD hblock_storage(HBlock* block){
+	DWORD l,result=0;
+	if(block->children[0]!=NULL){
+		for(l=0;l<4;l++){
+			result+=hblock_storage(block->children[l]);
+		}
+		return result;
+	}
+	if(block->low_rank){
+		return block->rank*(block->n_row+block->n_column);
+	}
+	return block->n_row*block->n_column;
+}
+
+DWORD hmatrix_storage(HMatrix* m){
+	return hblock_storage(m->root);
+}
+
+static void destroy_hblock(HBlock* block){
+	DWORD l;
+	if(block==NULL){
+		return;
+	}
+	for(l=0;l<4;l++){
+		destroy_hblock(block->children[l]);
+	}
+	Free(block->U);
+	Free(block->V);
+	Free(block->dense);
+	Free(block);
+}
+
+void destroy_hmatrix(HMatrix* m){
+	if(m==NULL){
+		return;
+	}
+	destroy_hblock(m->root);
+	destroy_hcluster(m->tree);
+	Free(m->order);
+	Free(m);
+}
@@ -3,8 +3,10 @@
 */
 #include <stdio.h>
 #include "matrix.h"
+#include "parallel.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #define EPS 0.000001
 
 /*
@@ -13,6 +15,20 @@
  * Matrix operation is the low level part Kriging interpolation.
 */
 
+//Kernel of the hierarchical matrix test, arg holds the points.
+DTYPE test_kernel(DWORD i,DWORD j,void* arg){
+	SPATIAL_TYPE** points=(SPATIAL_TYPE**)arg;
+	DTYPE r=hypot(points[i][0]-points[j][0],points[i][1]-points[j][1]);
+	return i==j?1.5:exp(-r/5);
+}
+
+//Compactly supported kernel, blocks near the support radius have rows that vanish while others do not.
+DTYPE test_compact_kernel(DWORD i,DWORD j,void* arg){
+	SPATIAL_TYPE** points=(SPATIAL_TYPE**)arg;
+	DTYPE r=hypot(points[i][0]-points[j][0],points[i][1]-points[j][1]);
+	return i==j?1.5:(r<30?pow(1-r/30,3):0);
+}
+
 BOOLEAN test_identity(Matrix* m){
 	DWORD i,j;
 	for(i=0;i<m->n_row;i++){
@@ -359,6 +375,309 @@ int main(void){
 	destroy_matrix(LUP[3]);
 	Free(LUP);
 
+	//Test for matrix inversion, the first pivot is zero so rows are permuted.
+	m1=create_matrix(3,3);
+	m1->matrix[0][0]=0;
+	m1->matrix[0][1]=2;
+	m1->matrix[0][2]=3;
+	m1->matrix[1][0]=1;
+	m1->matrix[1][1]=0;
+	m1->matrix[1][2]=3;
+	m1->matrix[2][0]=1;
+	m1->matrix[2][1]=2;
+	m1->matrix[2][2]=0;
+	m2=matrix_inversion(m1);
+	result=matrix_multiplication(m1,m2);
+	if(!test_identity(result)){
+		printf("Test 11 failed: Product of a matrix and its inversion is not identity.");
+		return -1;
+	}
+	destroy_matrix(result);
+	destroy_matrix(m2);
+	m1->matrix[2][0]=1;
+	m1->matrix[2][1]=2;
+	m1->matrix[2][2]=6;
+	if(matrix_inversion(m1)!=NULL){
+		printf("Test 11 failed: Singular matrix is inverted.");
+		return -1;
+	}
+	destroy_matrix(m1);
+
+	//Test for Cholesky solver, A=[4 2;2 3], b=[2;1], x=[0.5;0].
+	m1=create_matrix(2,2);
+	m1->matrix[0][0]=4;
+	m1->matrix[0][1]=2;
+	m1->matrix[1][0]=2;
+	m1->matrix[1][1]=3;
+	gamma=create_matrix(2,1);
+	gamma->matrix[0][0]=2;
+	gamma->matrix[1][0]=1;
+	m2=solve_cholesky(m1,gamma);
+	if(m2==NULL||fabs(m2->matrix[0][0]-0.5)>EPS||fabs(m2->matrix[1][0])>EPS){
+		printf("Test 12 failed: Cholesky solution is not [0.5;0].");
+		return -1;
+	}
+	destroy_matrix(m2);
+	m1->matrix[1][1]=1;
+	if(solve_cholesky(m1,gamma)!=NULL){
+		printf("Test 12 failed: Matrix that is not positive definite is accepted.");
+		return -1;
+	}
+	destroy_matrix(m1);
+	destroy_matrix(gamma);
+
+	//Test for multiplication of odd and rectangular shapes, with blocks cut at every border.
+	DWORD shapes[7][3]={{1,1,1},{3,5,2},{1,300,1},{67,301,9},{130,257,97},{5,7,2050},{301,513,203}};
+	for(i=0;i<7;i++){
+		m1=create_matrix(shapes[i][0],shapes[i][1]);
+		m2=create_matrix(shapes[i][1],shapes[i][2]);
+		for(j=0;j<m1->n_row*m1->n_column;j++){
+			m1->matrix[j/m1->n_column][j%m1->n_column]=(DTYPE)((j*7)%11)-5;
+		}
+		for(j=0;j<m2->n_row*m2->n_column;j++){
+			m2->matrix[j/m2->n_column][j%m2->n_column]=(DTYPE)((j*5)%13)-6;
+		}
+		//The largest shape also runs on several threads
+		set_krig_thread_count(i==6?3:1);
+		result=naive_multiplication(m1,m2);
+		m3=matrix_multiplication(m1,m2);
+		if(!test_equality(result,m3)){
+			printf("Test 13 failed: Multiplication results of %lldx%lld and %lldx%lld matrices are not equal.",shapes[i][0],shapes[i][1],shapes[i][1],shapes[i][2]);
+			return -1;
+		}
+		destroy_matrix(m1);
+		destroy_matrix(m2);
+		destroy_matrix(m3);
+		destroy_matrix(result);
+	}
+	set_krig_thread_count(0);
+
+	//Test for blocked LU above LU_BLOCKED_THRESHOLD, shaped like a Kriging system with a zero diagonal.
+	DWORD n=LU_BLOCKED_THRESHOLD*2+37;
+	DWORD* permutation=Calloc(n,DWORD);
+	DTYPE residual;
+	m1=create_matrix(n,n);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			m1->matrix[i][j]=i==j?0:sqrt((DTYPE)((i*31+j*17)%97+abs((int)(i-j))));
+		}
+		m1->matrix[i][n-1]=1;
+		m1->matrix[n-1][i]=1;
+	}
+	m1->matrix[n-1][n-1]=0;
+	gamma=create_matrix(n,1);
+	for(i=0;i<n;i++){
+		gamma->matrix[i][0]=i%7;
+	}
+	set_krig_thread_count(3);
+	m2=solve_linear_system(m1,gamma);
+	if(m2==NULL){
+		printf("Test 14 failed: Blocked LU found a nonsingular system singular.");
+		return -1;
+	}
+	for(i=0;i<n;i++){
+		residual=-gamma->matrix[i][0];
+		for(j=0;j<n;j++){
+			residual+=m1->matrix[i][j]*m2->matrix[j][0];
+		}
+		if(fabs(residual)>EPS){
+			printf("Test 14 failed: Residual of row %lld is %lf.",i,residual);
+			return -1;
+		}
+	}
+	destroy_matrix(m2);
+	//PA=LU holds entry by entry
+	m2=create_matrix(n,n);
+	for(i=0;i<n;i++){
+		memcpy(m2->matrix[i],m1->matrix[i],n*sizeof(DTYPE));
+	}
+	lower_upper_in_place(m2,permutation);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			DWORD k;
+			residual=-m1->matrix[permutation[i]][j];
+			for(k=0;k<=i&&k<=j;k++){
+				residual+=(k==i?1:m2->matrix[i][k])*m2->matrix[k][j];
+			}
+			if(fabs(residual)>EPS){
+				printf("Test 14 failed: Blocked LU does not add up to PA=LU.");
+				return -1;
+			}
+		}
+	}
+	destroy_matrix(m2);
+	result=matrix_inversion(m1);
+	m2=matrix_multiplication(m1,result);
+	if(!test_identity(m2)){
+		printf("Test 14 failed: Product of a matrix and its inversion is not identity.");
+		return -1;
+	}
+	destroy_matrix(m2);
+	destroy_matrix(result);
+	//A zero row makes the system singular
+	memset(m1->matrix[5],0,n*sizeof(DTYPE));
+	if(solve_linear_system(m1,gamma)!=NULL||matrix_inversion(m1)!=NULL){
+		printf("Test 14 failed: Singular system is solved.");
+		return -1;
+	}
+	set_krig_thread_count(0);
+	destroy_matrix(m1);
+	destroy_matrix(gamma);
+	Free(permutation);
+
+	//Test for mixed precision solver on a Kriging-shaped system, the refined solution must match the double precision one.
+	n=200;
+	m1=create_matrix(n,n);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			m1->matrix[i][j]=i==j?0:1+20*(1-exp(-0.05*abs((int)(i%20-j%20))-0.01*abs((int)(i/20-j/20))));
+		}
+		m1->matrix[i][n-1]=1;
+		m1->matrix[n-1][i]=1;
+	}
+	m1->matrix[n-1][n-1]=0;
+	gamma=create_matrix(n,1);
+	for(i=0;i<n;i++){
+		gamma->matrix[i][0]=1+i%3;
+	}
+	m2=solve_linear_system(m1,gamma);
+	m3=solve_mixed_precision(m1,gamma);
+	if(m3==NULL||!test_equality(m2,m3)){
+		printf("Test 15 failed: Mixed precision solution does not match the double precision one.");
+		return -1;
+	}
+	destroy_matrix(m2);
+	destroy_matrix(m3);
+	set_solver_type(MIXED_PRECISION_SOLVER);
+	result=matrix_inversion(m1);
+	m2=matrix_multiplication(m1,result);
+	if(!test_identity(m2)){
+		printf("Test 15 failed: Product of a matrix and its mixed precision inversion is not identity.");
+		return -1;
+	}
+	destroy_matrix(m2);
+	destroy_matrix(result);
+	//Entries beyond the FACTOR_TYPE range fall back to the double precision solver
+	for(i=0;i<n;i++){
+		m1->matrix[i][i]=1e300;
+	}
+	if(solve_mixed_precision(m1,gamma)!=NULL){
+		printf("Test 15 failed: Mixed precision solver accepts entries it cannot represent.");
+		return -1;
+	}
+	m2=solve_linear_system(m1,gamma);
+	if(m2==NULL){
+		printf("Test 15 failed: Mixed precision solver does not fall back to double precision.");
+		return -1;
+	}
+	set_solver_type(DOUBLE_SOLVER);
+	destroy_matrix(m2);
+	destroy_matrix(m1);
+	destroy_matrix(gamma);
+
+	//Test for MINRES on a sparse bordered system [K 1;1' 0] with a banded K, against the dense solver.
+	n=101;
+	m1=create_matrix(n,n);
+	SparseMatrix* sparse=Calloc(1,SparseMatrix);
+	sparse->n_row=n;
+	sparse->n_column=n;
+	sparse->row_start=Calloc(n+1,DWORD);
+	sparse->columns=Calloc(n*n,DWORD);
+	sparse->values=Calloc(n*n,DTYPE);
+	sparse->row_start[0]=0;
+	for(i=0;i<n;i++){
+		sparse->row_start[i+1]=sparse->row_start[i];
+		for(j=0;j<n;j++){
+			if(i==n-1||j==n-1){
+				m1->matrix[i][j]=i==j?0:1;
+			}else{
+				m1->matrix[i][j]=abs((int)(i-j))<3?3-abs((int)(i-j)):0;
+			}
+			if(m1->matrix[i][j]!=0){
+				sparse->columns[sparse->row_start[i+1]]=j;
+				sparse->values[sparse->row_start[i+1]]=m1->matrix[i][j];
+				sparse->row_start[i+1]++;
+			}
+		}
+	}
+	gamma=create_matrix(n,1);
+	DTYPE* b=Calloc(n,DTYPE);
+	DTYPE* x=Calloc(n,DTYPE);
+	for(i=0;i<n;i++){
+		b[i]=gamma->matrix[i][0]=i==n-1?1:sin(i);
+	}
+	m2=solve_linear_system(m1,gamma);
+	if(solve_minres(sparse,b,x,NULL,10*n,1e-12)<0){
+		printf("Test 16 failed: MINRES did not converge.");
+		return -1;
+	}
+	for(i=0;i<n;i++){
+		if(fabs(x[i]-m2->matrix[i][0])>EPS){
+			printf("Test 16 failed: MINRES solution does not match the dense solution.");
+			return -1;
+		}
+	}
+	destroy_matrix(m1);
+	destroy_matrix(m2);
+	destroy_matrix(gamma);
+	destroy_sparse_matrix(sparse);
+	Free(b);
+	Free(x);
+
+	//Test for a hierarchical matrix of an exponential kernel on a jittered grid, against the dense product.
+	n=1600;
+	SPATIAL_TYPE** test_points=Calloc(n,SPATIAL_TYPE*);
+	for(i=0;i<n;i++){
+		test_points[i]=Calloc(2,SPATIAL_TYPE);
+		test_points[i][0]=(i%40)*5+sin(3*i);
+		test_points[i][1]=(i/40)*5+cos(5*i);
+	}
+	set_krig_thread_count(3);
+	HMatrix* hmatrix=build_hmatrix(n,test_points,2,test_kernel,test_points,1e-8);
+	set_krig_thread_count(0);
+	if(hmatrix_storage(hmatrix)>=n*n/2){
+		printf("Test 17 failed: Hierarchical matrix is not compressed.");
+		return -1;
+	}
+	b=Calloc(n,DTYPE);
+	x=Calloc(n,DTYPE);
+	for(i=0;i<n;i++){
+		b[i]=sin(i);
+	}
+	hmatrix_multiply_vector(hmatrix,b,x);
+	for(i=0;i<n;i++){
+		DTYPE sum=0;
+		for(j=0;j<n;j++){
+			sum+=test_kernel(i,j,test_points)*b[j];
+		}
+		if(fabs(sum-x[i])>EPS){
+			printf("Test 17 failed: Product of a hierarchical matrix does not match the dense product.");
+			return -1;
+		}
+	}
+	destroy_hmatrix(hmatrix);
+
+	//Test for a hierarchical matrix of a compactly supported kernel on the same points, against the dense product.
+	hmatrix=build_hmatrix(n,test_points,2,test_compact_kernel,test_points,1e-8);
+	hmatrix_multiply_vector(hmatrix,b,x);
+	for(i=0;i<n;i++){
+		DTYPE sum=0;
+		for(j=0;j<n;j++){
+			sum+=test_compact_kernel(i,j,test_points)*b[j];
+		}
+		if(fabs(sum-x[i])>EPS){
+			printf("Test 18 failed: Product of a hierarchical matrix of a compactly supported kernel does not match the dense product.");
+			return -1;
+		}
+	}
+	destroy_hmatrix(hmatrix);
+	for(i=0;i<n;i++){
+		Free(test_points[i]);
+	}
+	Free(test_points);
+	Free(b);
+	Free(x);
+
 	printf("Test finished.\n");
 	return 0;
 }
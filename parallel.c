@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016, Northwestern University.
+ * Thread pool for the parallel parts of this package.
+ * See also parallel.h
+*/
+
+#include <pthread.h>
+#include "parallel.h"
+
+static WORD thread_count=0;
+//Set while a thread runs tasks of a parallel_for, nested calls then run serially in that thread.
+static __thread BOOLEAN in_parallel_task=FALSE;
+
+typedef struct{
+	DWORD n_tasks;
+	DWORD next;
+	ParallelTask task;
+	void* arg;
+} ParallelJob;
+
+typedef struct{
+	ParallelJob* job;
+	WORD thread;
+} ParallelWorker;
+
+WORD krig_thread_count(void){
+	char* value;
+	if(in_parallel_task){
+		return 1;
+	}
+	if(thread_count<1){
+		value=getenv(KRIG_THREADS_ENV);
+		if(value!=NULL&&atoi(value)>0){
+			thread_count=atoi(value);
+		}else{
+			thread_count=(WORD)sysconf(_SC_NPROCESSORS_ONLN);
+		}
+		if(thread_count<1){
+			thread_count=1;
+		}
+	}
+	return thread_count;
+}
+
+void set_krig_thread_count(WORD threads){
+	thread_count=threads<1?0:threads;
+}
+
+static void* run_worker(void* arg){
+	ParallelWorker* worker=(ParallelWorker*)arg;
+	ParallelJob* job=worker->job;
+	DWORD task;
+	in_parallel_task=TRUE;
+	/*Tasks are claimed one at a time until none are left*/
+	while((task=__sync_fetch_and_add(&job->next,1))<job->n_tasks){
+		job->task(task,worker->thread,job->arg);
+	}
+	in_parallel_task=FALSE;
+	return NULL;
+}
+
+void parallel_for(DWORD n_tasks,ParallelTask task,void* arg){
+	WORD threads=krig_thread_count(),i;
+	ParallelJob job;
+	DWORD t;
+	if(threads>n_tasks){
+		threads=n_tasks;
+	}
+	if(threads<=1){
+		for(t=0;t<n_tasks;t++){
+			task(t,0,arg);
+		}
+		return;
+	}
+	job.n_tasks=n_tasks;
+	job.next=0;
+	job.task=task;
+	job.arg=arg;
+	pthread_t* handles=Calloc(threads,pthread_t);
+	ParallelWorker* workers=Calloc(threads,ParallelWorker);
+	for(i=0;i<threads;i++){
+		workers[i].job=&job;
+		workers[i].thread=i;
+	}
+	for(i=1;i<threads;i++){
+		if(pthread_create(&handles[i],NULL,run_worker,&workers[i])!=0){
+			/*Remaining tasks are picked up by the threads that did start*/
+			break;
+		}
+	}
+	run_worker(&workers[0]);
+	for(i=i-1;i>0;i--){
+		pthread_join(handles[i],NULL);
+	}
+	Free(handles);
+	Free(workers);
+}
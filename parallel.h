@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016, Northwestern University.
+ * Minimal thread pool interface on top of POSIX threads.
+ * Work is split into tasks that are handed out dynamically. Callers that need deterministic results keep one accumulator per task and reduce them in task order.
+ * See parallel.c
+*/
+
+#ifndef KRIG_PARALLEL_H
+#define KRIG_PARALLEL_H
+
+#include "cluster.h"
+
+//Environment variable that sets the number of threads.
+#define KRIG_THREADS_ENV "KRIG_THREADS"
+
+/*
+ * Task callback.
+ * task: Task number in 0,...,n_tasks-1.
+ * thread: Number of the thread running the task, in 0,...,krig_thread_count()-1. Use it to index per-thread scratch space.
+ * arg: User argument passed to parallel_for.
+*/
+typedef void (*ParallelTask)(DWORD task,WORD thread,void* arg);
+
+/*
+ * Number of threads used by parallel_for.
+ * Taken from KRIG_THREADS if set, otherwise the number of online processors.
+ * Inside a task of a multithreaded parallel_for it is 1, so nested parallel code runs serially instead of starting threads per thread.
+*/
+extern WORD krig_thread_count(void);
+/*
+ * Override the number of threads. Values smaller than 1 restore the default.
+*/
+extern void set_krig_thread_count(WORD threads);
+/*
+ * Run task for every task number and wait until all are done.
+ * The calling thread takes part as thread 0. With a single thread or a single task everything runs in the calling thread.
+ * Calls made from within a task run serially in the thread of that task.
+*/
+extern void parallel_for(DWORD n_tasks,ParallelTask task,void* arg);
+
+#endif
@@ -25,6 +25,12 @@ extern double genrand_real2(void);
  * RETURN: Random value in discrete Poisson distribution.
 */
 extern DWORD poisson(DTYPE lambda);
+/*
+ * Generator for standard normal distribution.
+ * Use MT19937 with Box-Muller transform.
+ * RETURN: Random value with mean 0 and variance 1.
+*/
+extern DTYPE gaussian(void);
 
 /*
  * Fisher-Yates shuffle method for objects
@@ -6,6 +6,237 @@
 #include "krigfunctions.h"
 #include "clusterfunctions.h"
 #include "matrix.h"
+#include "datafunctions.h"
+#include "parallel.h"
+
+static void swap_tree_nodes(KDTree* tree,DWORD i,DWORD j){
+	Object* object=tree->objects[i];
+	SPATIAL_TYPE coordinate;
+	DWORD order;
+	WORD d;
+	tree->objects[i]=tree->objects[j];
+	tree->objects[j]=object;
+	for(d=0;d<tree->dimension;d++){
+		coordinate=tree->coordinates[d][i];
+		tree->coordinates[d][i]=tree->coordinates[d][j];
+		tree->coordinates[d][j]=coordinate;
+	}
+	order=tree->order[i];
+	tree->order[i]=tree->order[j];
+	tree->order[j]=order;
+}
+
+static BOOLEAN tree_node_less(KDTree* tree,DWORD i,DWORD j,WORD axis){
+	SPATIAL_TYPE a=tree->coordinates[axis][i],b=tree->coordinates[axis][j];
+	return a<b||(a==b&&tree->order[i]<tree->order[j]);
+}
+
+/*
+ * Quickselect: move the node of rank k in [low,high) along axis to position k, smaller nodes before it and larger ones after it.
+*/
+static void select_tree_node(KDTree* tree,DWORD low,DWORD high,DWORD k,WORD axis){
+	DWORD i,store;
+	while(high-low>1){
+		swap_tree_nodes(tree,low+(high-low)/2,high-1);
+		store=low;
+		for(i=low;i<high-1;i++){
+			if(tree_node_less(tree,i,high-1,axis)){
+				swap_tree_nodes(tree,i,store++);
+			}
+		}
+		swap_tree_nodes(tree,store,high-1);
+		if(store==k){
+			return;
+		}
+		if(k<store){
+			high=store;
+		}else{
+			low=store+1;
+		}
+	}
+}
+
+static void build_tree_range(KDTree* tree,DWORD low,DWORD high){
+	DWORD i,middle=(low+high)/2;
+	WORD d;
+	SPATIAL_TYPE lower,upper,spread=-1;
+	if(high-low<1){
+		return;
+	}
+	/*Split on the axis with the largest spread*/
+	for(d=0;d<tree->dimension;d++){
+		lower=INFINITY;
+		upper=-INFINITY;
+		for(i=low;i<high;i++){
+			lower=fmin(lower,tree->coordinates[d][i]);
+			upper=fmax(upper,tree->coordinates[d][i]);
+		}
+		if(upper-lower>spread){
+			spread=upper-lower;
+			tree->axis[middle]=d;
+		}
+	}
+	select_tree_node(tree,low,high,middle,tree->axis[middle]);
+	build_tree_range(tree,low,middle);
+	build_tree_range(tree,middle+1,high);
+}
+
+/*
+ * Coordinates the tree is built on, the unit vector for chordal and great-circle distances.
+*/
+static SPATIAL_TYPE* tree_point(SPATIAL_TYPE* coordinates){
+	return get_distance_type()==PLANAR_DISTANCE?coordinates:coordinates+2;
+}
+
+KDTree* build_kd_tree(Objects* data){
+	DWORD i;
+	WORD d;
+	SPATIAL_TYPE* point;
+	KDTree* tree=Calloc(1,KDTree);
+	tree->size=data->size;
+	tree->dimension=get_distance_type()==PLANAR_DISTANCE?2:3;
+	tree->objects=Calloc(data->size,Object*);
+	for(d=0;d<tree->dimension;d++){
+		tree->coordinates[d]=Calloc(data->size,SPATIAL_TYPE);
+	}
+	tree->order=Calloc(data->size,DWORD);
+	tree->axis=Calloc(data->size,WORD);
+	for(i=0;i<data->size;i++){
+		tree->objects[i]=data->objects[i];
+		point=tree_point(data->objects[i]->spatial_coordinates);
+		for(d=0;d<tree->dimension;d++){
+			tree->coordinates[d][i]=point[d];
+		}
+		tree->order[i]=i;
+	}
+	build_tree_range(tree,0,data->size);
+	return tree;
+}
+
+void destroy_kd_tree(KDTree* tree){
+	WORD d;
+	Free(tree->objects);
+	for(d=0;d<tree->dimension;d++){
+		Free(tree->coordinates[d]);
+	}
+	Free(tree->order);
+	Free(tree->axis);
+	Free(tree);
+}
+
+/*
+ * Bounded max-heap of the nearest nodes found so far, keyed by squared distance and then by order.
+*/
+typedef struct{
+	KDTree* tree;
+	SPATIAL_TYPE* point;
+	DWORD capacity;
+	DWORD size;
+	DWORD* nodes;
+	DTYPE* squares;
+} NeighborHeap;
+
+static BOOLEAN heap_greater(NeighborHeap* heap,DWORD i,DWORD j){
+	return heap->squares[i]>heap->squares[j]||(heap->squares[i]==heap->squares[j]&&heap->tree->order[heap->nodes[i]]>heap->tree->order[heap->nodes[j]]);
+}
+
+static void heap_swap(NeighborHeap* heap,DWORD i,DWORD j){
+	DWORD node=heap->nodes[i];
+	DTYPE square=heap->squares[i];
+	heap->nodes[i]=heap->nodes[j];
+	heap->squares[i]=heap->squares[j];
+	heap->nodes[j]=node;
+	heap->squares[j]=square;
+}
+
+static void heap_sift_down(NeighborHeap* heap,DWORD i,DWORD size){
+	DWORD child;
+	while((child=2*i+1)<size){
+		if(child+1<size&&heap_greater(heap,child+1,child)){
+			child++;
+		}
+		if(!heap_greater(heap,child,i)){
+			return;
+		}
+		heap_swap(heap,i,child);
+		i=child;
+	}
+}
+
+static void heap_offer(NeighborHeap* heap,DWORD node,DTYPE square){
+	DWORD i,parent;
+	if(heap->size<heap->capacity){
+		i=heap->size++;
+		heap->nodes[i]=node;
+		heap->squares[i]=square;
+		while(i>0&&heap_greater(heap,i,parent=(i-1)/2)){
+			heap_swap(heap,i,parent);
+			i=parent;
+		}
+		return;
+	}
+	if(square>heap->squares[0]||(square==heap->squares[0]&&heap->tree->order[node]>heap->tree->order[heap->nodes[0]])){
+		return;
+	}
+	heap->nodes[0]=node;
+	heap->squares[0]=square;
+	heap_sift_down(heap,0,heap->size);
+}
+
+static void search_tree_range(NeighborHeap* heap,DWORD low,DWORD high){
+	KDTree* tree=heap->tree;
+	DWORD middle=(low+high)/2;
+	DTYPE square=0,difference;
+	WORD d;
+	if(high-low<1){
+		return;
+	}
+	for(d=0;d<tree->dimension;d++){
+		difference=heap->point[d]-tree->coordinates[d][middle];
+		square+=difference*difference;
+	}
+	/*Objects at the query location are not neighbors*/
+	if(square>0){
+		heap_offer(heap,middle,square);
+	}
+	difference=heap->point[tree->axis[middle]]-tree->coordinates[tree->axis[middle]][middle];
+	if(difference<0){
+		search_tree_range(heap,low,middle);
+		if(heap->size<heap->capacity||difference*difference<=heap->squares[0]){
+			search_tree_range(heap,middle+1,high);
+		}
+	}else{
+		search_tree_range(heap,middle+1,high);
+		if(heap->size<heap->capacity||difference*difference<=heap->squares[0]){
+			search_tree_range(heap,low,middle);
+		}
+	}
+}
+
+DWORD kd_tree_nearest(KDTree* tree,SPATIAL_TYPE* point,DWORD number,DWORD* nodes,DTYPE* distances){
+	NeighborHeap heap;
+	DWORD i;
+	if(number<=0){
+		return 0;
+	}
+	heap.tree=tree;
+	heap.point=tree_point(point);
+	heap.capacity=number;
+	heap.size=0;
+	heap.nodes=nodes;
+	heap.squares=distances;
+	search_tree_range(&heap,0,tree->size);
+	/*Heap sort, nearest first*/
+	for(i=heap.size-1;i>0;i--){
+		heap_swap(&heap,0,i);
+		heap_sift_down(&heap,0,i);
+	}
+	/*Squared chords are ordered as the distances, so only the reported values need converting*/
+	for(i=0;i<heap.size;i++){
+		distances[i]=tree->dimension==3?chord_to_distance(sqrt(distances[i])):sqrt(distances[i]);
+	}
+	return heap.size;
+}
 
 Objects* getNearestNeighbors(Object* target,Objects* data,DWORD number){
 	if(data->size<number||number<=0){
@@ -135,123 +366,256 @@ Objects* get_previous_time_stamps(Object* target,Objects* data,DWORD number){
 	return wrapper;
 }
 /*
- * Insertion sort. Assume the size of set being sorted is small.
- * Otherwise use qsort.
+ * Same as locate_map, but the result is a view into the time index and must not be freed.
+*/
+Objects* locate_map_indexed(TimeIndex* index,DTYPE time,Objects* slice){
+	get_time_slice(index,time,slice,TRUE);
+	return slice;
+}
+/*
+ * Objects directly in front of the time stamp of target in the time index, nearest time stamps first, written into result.
+ * Return: FALSE if fewer than number objects are earlier than target.
+*/
+static BOOLEAN previous_time_stamps(Object* target,TimeIndex* index,DWORD number,Object** result){
+	DWORD i,end=time_lower_bound(index,target->time);
+	if(end<number){
+		return FALSE;
+	}
+	for(i=0;i<number;i++){
+		result[i]=index->objects[end-1-i];
+	}
+	return TRUE;
+}
+/*
+ * Same as get_previous_time_stamps, but the objects are taken directly in front of the target time stamp in the time index.
+ * Nearest time stamps come first in the result.
+*/
+Objects* get_previous_time_stamps_indexed(Object* target,TimeIndex* index,DWORD number){
+	if(number<=0){
+		return NULL;
+	}
+	Object** result=Calloc(number,Object*);
+	if(!previous_time_stamps(target,index,number,result)){
+		Free(result);
+		return NULL;
+	}
+	Objects* wrapper=Calloc(1,Objects);
+	wrapper->size=number;
+	wrapper->objects=result;
+	return wrapper;
+}
+typedef struct{
+	Object* object;
+	DTYPE distance;
+	DWORD position;
+} DistanceKey;
+
+static int distance_key_cmp(const void* k1,const void* k2){
+	const DistanceKey* a=(const DistanceKey*)k1;
+	const DistanceKey* b=(const DistanceKey*)k2;
+	if(a->distance!=b->distance){
+		return a->distance<b->distance?-1:1;
+	}
+	return a->position<b->position?-1:(a->position>b->position);
+}
+/*
+ * Sort objects by distance to target, ties keep their order.
 */
 void sort_by_distance(Object* target,Objects* objects){
-	DWORD i,j,min_index;
-	Object* temp;
-	DTYPE min_dis;
-	DTYPE dis;
+	DWORD i;
+	DistanceKey* keys=Calloc(objects->size,DistanceKey);
 	for(i=0;i<objects->size;i++){
-		min_dis=INFINITY;
-		min_index=i;
-		for(j=i;j<objects->size;j++){
-			dis=distance(target->spatial_coordinates,objects->objects[j]->spatial_coordinates);
-			if(dis<min_dis){
-				min_index=j;
-				min_dis=dis;
-			}
-		}
-		temp=objects->objects[i];
-		objects->objects[i]=objects->objects[min_index];
-		objects->objects[min_index]=temp;
+		keys[i].object=objects->objects[i];
+		keys[i].distance=distance(target->spatial_coordinates,objects->objects[i]->spatial_coordinates);
+		keys[i].position=i;
+	}
+	qsort(keys,objects->size,sizeof(DistanceKey),distance_key_cmp);
+	for(i=0;i<objects->size;i++){
+		objects->objects[i]=keys[i].object;
 	}
+	Free(keys);
 }
 
-DTYPE predict_attribute(Objects* data,Object* target,DWORD time_lag,DWORD neighbor_number,Matrix* coefficients){
-	DTYPE result=0;
+/*
+ * Regressors of target: attributes of the previous time stamps, then attributes of the nearest neighbors divided by their distance.
+ * nodes, distances, previous: Scratch buffers of neighbor_number, neighbor_number and time_lag elements.
+ * Return: FALSE if target has not enough neighbors or previous time stamps.
+*/
+static BOOLEAN st_regressors(KDTree* tree,TimeIndex* index,Object* target,DWORD time_lag,DWORD neighbor_number,DTYPE* f,DWORD* nodes,DTYPE* distances,Object** previous){
+	DWORD j;
+	if(neighbor_number>0&&kd_tree_nearest(tree,target->spatial_coordinates,neighbor_number,nodes,distances)<neighbor_number){
+		return FALSE;
+	}
+	if(time_lag>0&&!previous_time_stamps(target,index,time_lag,previous)){
+		return FALSE;
+	}
+	for(j=0;j<time_lag;j++){
+		f[j]=previous[j]->attribute;
+	}
+	for(j=0;j<neighbor_number;j++){
+		f[time_lag+j]=tree->objects[nodes[j]]->attribute/distances[j];
+	}
+	return TRUE;
+}
+
+DTYPE predict_attribute_indexed(KDTree* tree,TimeIndex* index,Object* target,DWORD time_lag,DWORD neighbor_number,Matrix* coefficients){
 	DWORD i,end=neighbor_number+time_lag;
-	DTYPE dis;
-	Objects *t_neighbors,*s_neighbors;
-	s_neighbors=getNearestNeighbors(target,data,neighbor_number);
-	if(s_neighbors==NULL&&neighbor_number>0){
-		return INFINITY;
-	}
-	//printf("check 1\n");
-	t_neighbors=get_previous_time_stamps(target,data,time_lag);
-	if(t_neighbors==NULL&&time_lag>0){
-		if(s_neighbors!=NULL){
-			Free(s_neighbors->objects);
-			Free(s_neighbors);
+	DTYPE result=INFINITY;
+	DTYPE* f=Calloc(end+1,DTYPE);
+	DWORD* nodes=Calloc(neighbor_number+1,DWORD);
+	DTYPE* distances=Calloc(neighbor_number+1,DTYPE);
+	Object** previous=Calloc(time_lag+1,Object*);
+	if(st_regressors(tree,index,target,time_lag,neighbor_number,f,nodes,distances,previous)){
+		result=coefficients->matrix[end][0];
+		for(i=0;i<end;i++){
+			result+=coefficients->matrix[i][0]*f[i];
 		}
-		return INFINITY;
 	}
-	if(s_neighbors!=NULL){
-		sort_by_distance(target,s_neighbors);
+	Free(f);
+	Free(nodes);
+	Free(distances);
+	Free(previous);
+	return result;
+}
+
+DTYPE predict_attribute(Objects* data,Object* target,DWORD time_lag,DWORD neighbor_number,Matrix* coefficients){
+	KDTree* tree=build_kd_tree(data);
+	TimeIndex* index=build_time_index(data);
+	DTYPE result=predict_attribute_indexed(tree,index,target,time_lag,neighbor_number,coefficients);
+	destroy_kd_tree(tree);
+	destroy_time_index(index);
+	return result;
+}
+
+//Number of row blocks of the accumulation, each with its own normal equations. Fixed, so that results do not depend on the number of threads and accumulator memory does not grow with the data.
+#define REGRESSION_BLOCKS 256
+
+/*
+ * Shared state of a parallel normal equation accumulation.
+ * Block b accumulates rows b*block_rows to (b+1)*block_rows-1, the upper triangle of X'X at ff+b*dimension*dimension and X'y at fy+b*dimension.
+ * Regressor and neighbor buffers are per thread.
+*/
+typedef struct{
+	Objects* data;
+	KDTree* tree;
+	TimeIndex* index;
+	DWORD time_lag;
+	DWORD neighbor_number;
+	DWORD dimension;
+	DWORD block_rows;
+	DTYPE* ff;
+	DTYPE* fy;
+	DTYPE** regressors;
+	DWORD** nodes;
+	DTYPE** distances;
+	Object*** previous;
+} RegressionJob;
+
+static void regression_block(DWORD block,WORD thread,void* arg){
+	RegressionJob* job=(RegressionJob*)arg;
+	DWORD i,j,l,D=job->dimension,end=(block+1)*job->block_rows;
+	DTYPE* ff=job->ff+block*D*D;
+	DTYPE* fy=job->fy+block*D;
+	DTYPE* f=job->regressors[thread];
+	DTYPE y,fj;
+	DTYPE* row;
+	for(j=0;j<D*D;j++){
+		ff[j]=0;
+	}
+	for(j=0;j<D;j++){
+		fy[j]=0;
 	}
-	for(i=0;i<time_lag;i++){
-		result+=coefficients->matrix[i][0]*t_neighbors->objects[i]->attribute;
+	if(end>job->data->size){
+		end=job->data->size;
 	}
-	for(i=time_lag;i<end;i++){
-		dis=distance(s_neighbors->objects[i]->spatial_coordinates,target->spatial_coordinates);
-		result+=coefficients->matrix[i][0]*s_neighbors->objects[i]->attribute/dis;
+	/*Intercept*/
+	f[D-1]=1;
+	for(i=block*job->block_rows;i<end;i++){
+		if(!st_regressors(job->tree,job->index,job->data->objects[i],job->time_lag,job->neighbor_number,f,job->nodes[thread],job->distances[thread],job->previous[thread])){
+			continue;
+		}
+		y=job->data->objects[i]->attribute;
+		/*Symmetric rank-1 update of the upper triangle*/
+		for(j=0;j<D;j++){
+			fj=f[j];
+			fy[j]+=y*fj;
+			row=ff+j*D;
+			for(l=j;l<D;l++){
+				row[l]+=fj*f[l];
+			}
+		}
 	}
-	return result+coefficients->matrix[end][0];
 }
 
 Matrix* construct_st_model(Objects* data,DWORD time_lag,DWORD neighbor_number){
-	DWORD i,j,end=neighbor_number+time_lag;
-	Matrix* f=create_matrix(end+1,1);
-	Matrix* ff=create_matrix(end+1,end+1);
-	Matrix* fy=create_matrix(end+1,1);
-	Matrix* temp;
-	DTYPE dis;
-	Objects *t_neighbors,*s_neighbors;
-	for(i=0;i<ff->n_row;i++){
+	DWORD i,j,b,D=neighbor_number+time_lag+1,n_blocks;
+	WORD t,threads=krig_thread_count();
+	RegressionJob job;
+	Matrix* ff=create_matrix(D,D);
+	Matrix* fy=create_matrix(D,1);
+	for(i=0;i<D;i++){
 		fy->matrix[i][0]=0;
-		for(j=0;j<ff->n_column;j++){
+		for(j=0;j<D;j++){
 			ff->matrix[i][j]=0;
 		}
 	}
-	f->matrix[end][0]=1;
-	for(i=0;i<data->size;i++){
-		s_neighbors=getNearestNeighbors(data->objects[i],data,neighbor_number);
-		if(s_neighbors==NULL&&neighbor_number>0){
-			continue;
-		}
-		//printf("check 1\n");
-		t_neighbors=get_previous_time_stamps(data->objects[i],data,time_lag);
-		if(t_neighbors==NULL&&time_lag>0){
-			if(s_neighbors!=NULL){
-				Free(s_neighbors->objects);
-				Free(s_neighbors);
+	job.data=data;
+	job.tree=build_kd_tree(data);
+	job.index=build_time_index(data);
+	job.time_lag=time_lag;
+	job.neighbor_number=neighbor_number;
+	job.dimension=D;
+	/*Rows are spread over at most REGRESSION_BLOCKS contiguous blocks*/
+	job.block_rows=(data->size+REGRESSION_BLOCKS-1)/REGRESSION_BLOCKS;
+	n_blocks=job.block_rows>0?(data->size+job.block_rows-1)/job.block_rows:0;
+	job.ff=Calloc(n_blocks*D*D,DTYPE);
+	job.fy=Calloc(n_blocks*D,DTYPE);
+	job.regressors=Calloc(threads,DTYPE*);
+	job.nodes=Calloc(threads,DWORD*);
+	job.distances=Calloc(threads,DTYPE*);
+	job.previous=Calloc(threads,Object**);
+	for(t=0;t<threads;t++){
+		job.regressors[t]=Calloc(D,DTYPE);
+		job.nodes[t]=Calloc(neighbor_number+1,DWORD);
+		job.distances[t]=Calloc(neighbor_number+1,DTYPE);
+		job.previous[t]=Calloc(time_lag+1,Object*);
+	}
+	parallel_for(n_blocks,regression_block,&job);
+	/*Reduce block accumulators in block order and mirror the upper triangle*/
+	for(b=0;b<n_blocks;b++){
+		for(i=0;i<D;i++){
+			fy->matrix[i][0]+=job.fy[b*D+i];
+			for(j=i;j<D;j++){
+				ff->matrix[i][j]+=job.ff[b*D*D+i*D+j];
 			}
-			continue;
-		}
-		if(s_neighbors!=NULL){
-			sort_by_distance(data->objects[i],s_neighbors);
-		}
-		for(j=0;j<time_lag;j++){
-			f->matrix[j][0]=t_neighbors->objects[j]->attribute;
-			fy->matrix[j][0]+=data->objects[i]->attribute*f->matrix[j][0];
-		}
-		for(j=time_lag;j<end;j++){
-			dis=distance(s_neighbors->objects[j]->spatial_coordinates,data->objects[i]->spatial_coordinates);
-			f->matrix[j][0]=s_neighbors->objects[j]->attribute/dis;
-			fy->matrix[j][0]+=data->objects[i]->attribute*f->matrix[j][0];
 		}
-		fy->matrix[end][0]+=data->objects[i]->attribute;
-		temp=vector_self_multiplication(f);
-		add_to_matrix(ff,temp);
-		//printf("check 3\n");
-		destroy_matrix(temp);
-		if(t_neighbors!=NULL){
-			Free(t_neighbors->objects);
-			Free(t_neighbors);
-		}
-		if(s_neighbors!=NULL){
-			Free(s_neighbors->objects);
-			Free(s_neighbors);
+	}
+	for(i=0;i<D;i++){
+		for(j=0;j<i;j++){
+			ff->matrix[i][j]=ff->matrix[j][i];
 		}
 	}
-	printf("ff\n");
-	print_matrix(ff);
-	printf("fy\n");
-	print_matrix(fy);
-	//printf("check\n");
-	Matrix* coefficients=solve_linear_system(ff,fy);
-	//print_matrix(matrix_multiplication(ff,coefficients));
+	for(t=0;t<threads;t++){
+		Free(job.regressors[t]);
+		Free(job.nodes[t]);
+		Free(job.distances[t]);
+		Free(job.previous[t]);
+	}
+	Free(job.regressors);
+	Free(job.nodes);
+	Free(job.distances);
+	Free(job.previous);
+	Free(job.ff);
+	Free(job.fy);
+	destroy_kd_tree(job.tree);
+	destroy_time_index(job.index);
+	/*Normal equations are positive definite unless the regressors are collinear, then fall back to LU*/
+	Matrix* coefficients=solve_cholesky(ff,fy);
+	if(coefficients==NULL){
+		coefficients=solve_linear_system(ff,fy);
+	}
+	destroy_matrix(ff);
+	destroy_matrix(fy);
 	return coefficients;
 }
 /*
@@ -261,9 +625,7 @@ void main(){
 	for(i=0;i<10;i++){
 		Object* object=Calloc(1,Object);
 		object->time=i;
-		object->spatial_coordinates=Calloc(2,DTYPE);
-		object->spatial_coordinates[0]=i;
-		object->spatial_coordinates[1]=i;
+		object->spatial_coordinates=create_spatial_coordinates(i,i);
 		add_to_cluster(cluster,object);
 	}
 	Objects* data=cluster_to_objects(cluster);
@@ -5,6 +5,35 @@ extern Matrix* construct_st_model(Objects* data,DWORD time_lag,DWORD neighbor_nu
 extern Objects* getNearestNeighbors(Object* target,Objects* data,DWORD number);
 extern Objects* locate_map(Objects* data,DTYPE time);
 extern Objects* get_previous_time_stamps(Object* target,Objects* data,DWORD number);
+extern Objects* locate_map_indexed(TimeIndex* index,DTYPE time,Objects* slice);
+extern Objects* get_previous_time_stamps_indexed(Object* target,TimeIndex* index,DWORD number);
+/*
+ * Predict the attribute of target with a model from construct_st_model. Builds a k-d tree and a time index of data, use predict_attribute_indexed for repeated predictions.
+*/
 extern DTYPE predict_attribute(Objects* data,Object* target,DWORD time_lag,DWORD neighbor_number,Matrix* coefficients);
+/*
+ * Same as predict_attribute with a prebuilt k-d tree and time index of the data.
+ * Return: Prediction, INFINITY if target has not enough neighbors or previous time stamps.
+*/
+extern DTYPE predict_attribute_indexed(KDTree* tree,TimeIndex* index,Object* target,DWORD time_lag,DWORD neighbor_number,Matrix* coefficients);
+/*
+ * Build a spatial k-d tree of data in O(n log n). The dataset itself is not modified.
+ * Neighbors are searched in the plane of the first two coordinates, or among the unit vectors for chordal and great-circle distances, see set_distance_type.
+*/
+extern KDTree* build_kd_tree(Objects* data);
+/*
+ * Free a k-d tree. Objects referenced by the tree are not freed.
+*/
+extern void destroy_kd_tree(KDTree* tree);
+/*
+ * Nearest neighbors of a point, objects at the point itself excluded.
+ * point: Spatial coordinates of the query.
+ * number: Maximum number of neighbors.
+ * nodes: Output, caller buffer of number elements. Positions of the neighbors in tree->objects, nearest first.
+ * distances: Output, caller buffer of number elements. Distances of the neighbors, in kilometers for chordal and great-circle distances.
+ * Return: Number of neighbors found, smaller than number only if the tree holds fewer objects away from the point.
+*/
+extern DWORD kd_tree_nearest(KDTree* tree,SPATIAL_TYPE* point,DWORD number,DWORD* nodes,DTYPE* distances);
+extern void sort_by_distance(Object* target,Objects* objects);
 
 #endif
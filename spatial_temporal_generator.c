@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2016, Northwestern University.
+ * This file contains the synthetic spatio-temporal data generator.
+ * See also generator.h
+*/
+
+#include "generator.h"
+#include "random.h"
+#include "clusterfunctions.h"
+
+void default_generator_settings(GeneratorSettings* settings){
+	settings->grid_size=256;
+	settings->extent=1000;
+	settings->n_sites=0;
+	settings->time_slices=1;
+	settings->temporal_correlation=0;
+	settings->regimes=1;
+	settings->regime_shift=0;
+	settings->outlier_rate=0;
+	settings->outlier_scale=0;
+	settings->seed=555;
+}
+
+static DWORD site_count(GeneratorSettings* settings){
+	DWORD grid_points=settings->grid_size*settings->grid_size;
+	if(settings->n_sites<=0||settings->n_sites>grid_points){
+		return grid_points;
+	}
+	return settings->n_sites;
+}
+
+DWORD generated_size(GeneratorSettings* settings){
+	return site_count(settings)*settings->time_slices;
+}
+
+/*
+ * Covariance of the field without nugget at lag h, i.e. sill minus variogram.
+*/
+static DTYPE field_covariance(DTYPE h,DTYPE* C,VARIOGRAM_TYPE variogram_type){
+	DTYPE s;
+	switch(variogram_type){
+		case EXPONENTIAL_VARIOGRAM:{
+			return C[1]*exp(-C[2]*h);
+		}
+		case SPHERICAL_VARIOGRAM:{
+			/*Partial sill 2*C1^2 is reached at range C2*/
+			if(h>=C[2]){
+				return 0;
+			}
+			s=h/C[2];
+			return 2*C[1]*C[1]*(1-1.5*s+0.5*s*s*s);
+		}
+		default:{
+			return 0;
+		}
+	}
+}
+
+/*
+ * In-place iterative radix-2 FFT of a complex sequence of length n, n must be a power of two.
+*/
+static void fft(DTYPE* re,DTYPE* im,DWORD n){
+	DWORD i,j,k,length,half;
+	DTYPE angle,w_re,w_im,u_re,u_im,v_re,v_im,temp,step_re,step_im;
+	/*Bit reversal permutation*/
+	for(i=1,j=0;i<n;i++){
+		k=n>>1;
+		while(j&k){
+			j^=k;
+			k>>=1;
+		}
+		j|=k;
+		if(i<j){
+			temp=re[i];re[i]=re[j];re[j]=temp;
+			temp=im[i];im[i]=im[j];im[j]=temp;
+		}
+	}
+	for(length=2;length<=n;length<<=1){
+		half=length>>1;
+		angle=-2*M_PI/length;
+		step_re=cos(angle);
+		step_im=sin(angle);
+		for(i=0;i<n;i+=length){
+			w_re=1;
+			w_im=0;
+			for(j=0;j<half;j++){
+				u_re=re[i+j];
+				u_im=im[i+j];
+				v_re=re[i+j+half]*w_re-im[i+j+half]*w_im;
+				v_im=re[i+j+half]*w_im+im[i+j+half]*w_re;
+				re[i+j]=u_re+v_re;
+				im[i+j]=u_im+v_im;
+				re[i+j+half]=u_re-v_re;
+				im[i+j+half]=u_im-v_im;
+				temp=w_re*step_re-w_im*step_im;
+				w_im=w_re*step_im+w_im*step_re;
+				w_re=temp;
+			}
+		}
+	}
+}
+
+/*
+ * 2D FFT of an n*n row-major complex array, rows first and then columns.
+*/
+static void fft2(DTYPE* re,DTYPE* im,DWORD n,DTYPE* buffer_re,DTYPE* buffer_im){
+	DWORD i,j;
+	for(i=0;i<n;i++){
+		fft(re+i*n,im+i*n,n);
+	}
+	for(j=0;j<n;j++){
+		for(i=0;i<n;i++){
+			buffer_re[i]=re[i*n+j];
+			buffer_im[i]=im[i*n+j];
+		}
+		fft(buffer_re,buffer_im,n);
+		for(i=0;i<n;i++){
+			re[i*n+j]=buffer_re[i];
+			im[i*n+j]=buffer_im[i];
+		}
+	}
+}
+
+Objects* generate_spatial_temporal_data(GeneratorSettings* settings,DWORD* regimes,BOOLEAN* outliers){
+	DWORD m=settings->grid_size,M=1,N,i,j,k,t,site,n_sites,index,label;
+	DTYPE spacing,hx,hy,min_eigenvalue=0,max_eigenvalue=0,rho,innovation,value,d,best;
+	if(m<2||settings->time_slices<1||settings->regimes<1||settings->extent<=0){
+		printf("Invalid generator settings\n");
+		return NULL;
+	}
+	if(settings->variogram_type!=EXPONENTIAL_VARIOGRAM&&settings->variogram_type!=SPHERICAL_VARIOGRAM){
+		printf("Variogram type %x has no covariance function, use an exponential or spherical variogram\n",settings->variogram_type);
+		return NULL;
+	}
+	init_genrand(settings->seed);
+	/*Embed the m*m grid into a periodic M*M grid, M>=2m and a power of two.*/
+	while(M<2*m){
+		M<<=1;
+	}
+	N=M*M;
+	spacing=settings->extent/m;
+	DTYPE* re=Calloc(N,DTYPE);
+	DTYPE* im=Calloc(N,DTYPE);
+	DTYPE* eigenvalues=Calloc(N,DTYPE);
+	DTYPE* buffer_re=Calloc(M,DTYPE);
+	DTYPE* buffer_im=Calloc(M,DTYPE);
+	/*First row of the block circulant covariance matrix, lags wrap around the torus.*/
+	for(i=0;i<M;i++){
+		hy=(i<=M-i?i:M-i)*spacing;
+		for(j=0;j<M;j++){
+			hx=(j<=M-j?j:M-j)*spacing;
+			re[i*M+j]=field_covariance(sqrt(hx*hx+hy*hy),settings->C,settings->variogram_type);
+			im[i*M+j]=0;
+		}
+	}
+	fft2(re,im,M,buffer_re,buffer_im);
+	for(i=0;i<N;i++){
+		if(re[i]<min_eigenvalue){
+			min_eigenvalue=re[i];
+		}
+		if(re[i]>max_eigenvalue){
+			max_eigenvalue=re[i];
+		}
+		/*Negative eigenvalues are clipped, which slightly perturbs the covariance.*/
+		eigenvalues[i]=re[i]>0?sqrt(re[i]/N):0;
+	}
+	if(min_eigenvalue<-1e-8*max_eigenvalue){
+		printf("Circulant embedding is not positive definite (min eigenvalue=%lf,max eigenvalue=%lf), negative eigenvalues are clipped\n",min_eigenvalue,max_eigenvalue);
+	}
+	/*Select sites*/
+	n_sites=site_count(settings);
+	DWORD* sites=Calloc(n_sites,DWORD);
+	if(n_sites==m*m){
+		for(i=0;i<n_sites;i++){
+			sites[i]=i;
+		}
+	}else{
+		unsigned int* selected=random_ints(m*m,n_sites);
+		for(i=0;i<n_sites;i++){
+			sites[i]=selected[i];
+		}
+		Free(selected);
+	}
+	/*Planted regimes are Voronoi cells of random centers.*/
+	DTYPE* centers=Calloc(2*settings->regimes,DTYPE);
+	for(k=0;k<settings->regimes;k++){
+		centers[2*k]=genrand_real2()*settings->extent;
+		centers[2*k+1]=genrand_real2()*settings->extent;
+	}
+	DWORD* site_regimes=Calloc(n_sites,DWORD);
+	for(i=0;i<n_sites;i++){
+		hx=(sites[i]%m)*spacing;
+		hy=(sites[i]/m)*spacing;
+		best=INFINITY;
+		label=0;
+		for(k=0;k<settings->regimes;k++){
+			d=(hx-centers[2*k])*(hx-centers[2*k])+(hy-centers[2*k+1])*(hy-centers[2*k+1]);
+			if(d<best){
+				best=d;
+				label=k;
+			}
+		}
+		site_regimes[i]=label;
+	}
+	Free(centers);
+	/*Simulate the field slice by slice. Every FFT yields two independent fields, in the real and the imaginary part.*/
+	Objects* result=Calloc(1,Objects);
+	result->size=n_sites*settings->time_slices;
+	result->objects=Calloc(result->size,Object*);
+	DTYPE* field=Calloc(n_sites,DTYPE);
+	rho=settings->temporal_correlation;
+	innovation=sqrt(1-rho*rho);
+	index=0;
+	for(t=0;t<settings->time_slices;t++){
+		if(t%2==0){
+			for(i=0;i<N;i++){
+				re[i]=eigenvalues[i]*gaussian();
+				im[i]=eigenvalues[i]*gaussian();
+			}
+			fft2(re,im,M,buffer_re,buffer_im);
+		}
+		for(i=0;i<n_sites;i++){
+			/*Grid point (x,y) of the m*m grid lies at (y,x) of the M*M embedding.*/
+			site=(sites[i]/m)*M+sites[i]%m;
+			value=t%2==0?re[site]:im[site];
+			field[i]=t==0?value:rho*field[i]+innovation*value;
+		}
+		for(i=0;i<n_sites;i++){
+			Object* object=Calloc(1,Object);
+			object->spatial_coordinates=create_spatial_coordinates((sites[i]%m)*spacing,(sites[i]/m)*spacing);
+			object->time=t;
+			object->normalized_value=0;
+			object->neighbors=-1;
+			/*Nugget is white noise on top of the smooth field.*/
+			value=field[i]+sqrt(settings->C[0])*gaussian()+site_regimes[i]*settings->regime_shift;
+			if(outliers!=NULL){
+				outliers[index]=FALSE;
+			}
+			if(settings->outlier_rate>0&&genrand_real2()<settings->outlier_rate){
+				value+=settings->outlier_scale*gaussian();
+				if(outliers!=NULL){
+					outliers[index]=TRUE;
+				}
+			}
+			object->attribute=value;
+			if(regimes!=NULL){
+				regimes[index]=site_regimes[i];
+			}
+			result->objects[index]=object;
+			index++;
+		}
+	}
+	Free(re);
+	Free(im);
+	Free(eigenvalues);
+	Free(buffer_re);
+	Free(buffer_im);
+	Free(sites);
+	Free(site_regimes);
+	Free(field);
+	return result;
+}
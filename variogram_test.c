@@ -25,16 +25,71 @@ int main(){
 	printf("start\n");
 	//Extract variogram samples.
 	Samples* samples=variogram_sampling(data, bound, angle_bound, step_size, steps,angle_steps, C, smoothing_type);
-	
+	//Sampled estimate of the same bins, every bin should lie within a few standard errors of the exact one.
+	Samples* approximate=variogram_sampling_approximate(data, bound, angle_bound, step_size, steps,angle_steps, C, smoothing_type,200,200000);
+	DWORD j,matched=0,outliers=0;
+	for(i=0;i<approximate->size;i++){
+		for(j=0;j<samples->size;j++){
+			if(samples->x[j]==approximate->x[i]&&samples->phi[j]==approximate->phi[i]){
+				matched++;
+				if(fabs(approximate->y[i]-samples->y[j])>4*approximate->se[i]){
+					outliers++;
+					printf("approximate bin x=%lf,phi=%lf: y=%lf,exact=%lf,se=%lf\n",approximate->x[i],approximate->phi[i],approximate->y[i],samples->y[j],approximate->se[i]);
+				}
+				break;
+			}
+		}
+	}
+	printf("approximate sampling: %lld of %lld bins matched, %lld beyond 4 se\n",matched,samples->size,outliers);
+	if(matched==0||outliers*10>matched){
+		printf("Approximate variogram sampling disagrees with the exact sampler.\n");
+		return 1;
+	}
+	destroy_samples(approximate);
+	//Reseed so the fits below see the same random stream as before the check.
+	init_genrand(seed);
+
 	randomize_variogram(samples, C, variogram_type);
 	C[3]=1.9;
 	C[0]=14000;
-	C=variogram_PSO(data,samples,epochs, n_particles, variogram_type, c1,c2,alpha);
-	variogram_WLS(samples,C,5000, variogram_type,0.1);
+	//Multi-start PSO with early stopping
+	PSOSettings settings;
+	PSOStats stats;
+	default_PSO_settings(&settings);
+	settings.n_particles=n_particles;
+	settings.epochs=epochs;
+	settings.c1=c1;
+	settings.c2=c2;
+	settings.alpha=alpha;
+	Free(C);
+	C=variogram_PSO_multistart(samples,variogram_type,&settings,&stats);
+	printf("PSO best=%lf,swarm=%lld,epochs=%lld,evaluations=%lld\n",stats.best,stats.best_swarm,stats.epochs,stats.evaluations);
+	destroy_PSO_stats(&stats);
+	//Refine the best particle with Levenberg-Marquardt
+	printf("LM iterations=%lld\n",variogram_LM(samples,C,variogram_type,NULL,NULL,100,1e-9));
+	//variogram_WLS(samples,C,5000, variogram_type,0.1);
+	//Variable projection fit for comparison, linear parameters in closed form
+	DTYPE* C_VP=Calloc(variogram_size,DTYPE);
+	printf("VP mse=%lf\n",variogram_VP(samples,C_VP,variogram_type,1e-9));
+	Free(C_VP);
+	//Tune the variogram for Kriging accuracy with leave-one-out cross validation on the data
+	settings.swarms=2;
+	settings.n_particles=20;
+	settings.epochs=30;
+	settings.variable_projection=TRUE;
+	settings.validation=data;
+	DTYPE* C_CV=variogram_PSO_multistart(samples,variogram_type,&settings,&stats);
+	printf("CV score=%lf,chi square=%lf,n=%lld,evaluations=%lld\n",stats.best,krig_leave_one_out(data,C_CV,variogram_type,NULL,NULL),data->size,stats.evaluations);
+	printf("chi square of WLS fit=%lf\n",krig_leave_one_out(data,C,variogram_type,NULL,NULL));
+	//Same metric with the single precision factorization and iterative refinement
+	set_solver_type(MIXED_PRECISION_SOLVER);
+	printf("chi square of WLS fit, mixed precision=%lf\n",krig_leave_one_out(data,C,variogram_type,NULL,NULL));
+	set_solver_type(DOUBLE_SOLVER);
+	destroy_PSO_stats(&stats);
+	Free(C_CV);
 	//C=variogram_PSO(data,samples,epochs, n_particles, variogram_type, c1,c2,alpha);
 	//variogram_WLS_line_search(samples,C, 10, variogram_type);
 
-	DWORD j;
 	for(j=0;j<4;j++){
 		printf("C[%lld]=%lf,",j,C[j]);
 	}
@@ -2,6 +2,7 @@
 #include "clusterfunctions.h"
 #include "krigfunctions.h"
 #include "random.h"
+#include "parallel.h"
 #define VARIOGRAM_EXP_BOUND .05
 
 Samples* create_samples(DWORD size){
@@ -12,6 +13,9 @@ Samples* create_samples(DWORD size){
 	samples->y=Calloc(size,DTYPE);
 	samples->phi=Calloc(size,DTYPE);
 	samples->N=Calloc(size,DWORD);
+	samples->se=Calloc(size,DTYPE);
+	samples->u=Calloc(size,DTYPE);
+	memset(samples->u,0,sizeof(DTYPE)*size);
 	samples->size=size;
 	return samples;
 }
@@ -21,6 +25,8 @@ void destroy_samples(Samples *samples){
 	Free(samples->y);
 	Free(samples->phi);
 	Free(samples->N);
+	Free(samples->se);
+	Free(samples->u);
 	Free(samples);
 }
 
@@ -73,32 +79,726 @@ void smooth_variance_estimation(Samples* samples,DWORD index,Objects* objects,DT
 	//printf("smoother=%lf\n",smoother);
 }
 
+static int index_cmp(const void* a,const void* b){
+	DWORD x=*(DWORD*)a,y=*(DWORD*)b;
+	return x<y?-1:(x>y);
+}
+
+//Number of row blocks of the pair enumeration, each with its own bin accumulators. Fixed, so that results do not depend on the number of threads and accumulator memory does not grow with the data.
+#define VARIOGRAM_BLOCKS 256
+
+/*
+ * Rows per block when size rows are split into at most VARIOGRAM_BLOCKS contiguous blocks.
+*/
+static DWORD variogram_block_rows(DWORD size){
+	return (size+VARIOGRAM_BLOCKS-1)/VARIOGRAM_BLOCKS;
+}
+
+/*
+ * Largest number of objects in a 3x3 block of cells, 3x3x3 for grids over unit vectors, around a non-empty cell.
+ * Bounds the candidates of any row of variogram_block, so per-thread scratch does not grow with the number of objects.
+*/
+static DWORD max_neighborhood(CellList* cells){
+	DWORD c,cx,cy,cz,gx,gy,gz,row,count,largest=0;
+	for(cz=0;cz<cells->nz;cz++){
+		for(cy=0;cy<cells->ny;cy++){
+			for(cx=0;cx<cells->nx;cx++){
+				c=(cz*cells->ny+cy)*cells->nx+cx;
+				if(cells->start[c+1]==cells->start[c]){
+					continue;
+				}
+				count=0;
+				for(gz=cz-1<0?0:cz-1;gz<=cz+1&&gz<cells->nz;gz++){
+					for(gy=cy-1<0?0:cy-1;gy<=cy+1&&gy<cells->ny;gy++){
+						/*Cells are stored row by row, so the three cells of a row are a contiguous range of members*/
+						row=(gz*cells->ny+gy)*cells->nx;
+						gx=cx+1>=cells->nx?cells->nx-1:cx+1;
+						count+=cells->start[row+gx+1]-cells->start[row+(cx-1<0?0:cx-1)];
+					}
+				}
+				if(count>largest){
+					largest=count;
+				}
+			}
+		}
+	}
+	return largest;
+}
+
+/*
+ * Shared state of a parallel variogram sampling run.
+ * Block b accumulates pairs (i,j), i in rows b*block_rows to (b+1)*block_rows-1, into result, smoother and N at offset b*n_bins.
+ * Per-thread scratch holds candidate indices and their coordinates and attributes in structure of arrays form, max_candidates entries each.
+ * For chordal and great-circle distances candidate_unit holds the unit vectors of the candidates, x components first, then y and z.
+*/
+typedef struct{
+	Objects* objects;
+	CellList* cells;
+	DWORD block_rows;
+	DISTANCE_TYPE distance_type;
+	DTYPE bound;
+	DTYPE angle_bound;
+	DTYPE step_size;
+	DWORD steps;
+	DWORD angle_steps;
+	DTYPE* C;
+	SMOOTHING_TYPE smoothing_type;
+	DTYPE cutoff;
+	DTYPE* lags;
+	DTYPE* angles;
+	DWORD n_bins;
+	DTYPE* result;
+	DTYPE* smoother;
+	DWORD* N;
+	DWORD max_candidates;
+	DWORD** candidates;
+	DTYPE** candidate_x;
+	DTYPE** candidate_y;
+	DTYPE** candidate_unit;
+	DTYPE** candidate_attribute;
+	DTYPE** squares;
+} VariogramJob;
+
+static void variogram_block(DWORD block,WORD thread,void* arg){
+	VariogramJob* job=(VariogramJob*)arg;
+	Objects* objects=job->objects;
+	CellList* cells=job->cells;
+	DWORD i,j,k,a,cx,cy,cz,gx,gy,gz,c,n_candidates,bin,k_min,k_max,a_min,a_max;
+	DWORD end=(block+1)*job->block_rows;
+	DTYPE dis,arc_dis,dx,dy,dz,temp1,temp2,angle_step=M_PI/job->angle_steps;
+	DTYPE limit=job->cutoff*job->cutoff*1.0001;
+	DTYPE* result=job->result+block*job->n_bins;
+	DTYPE* smoother=job->smoother+block*job->n_bins;
+	DWORD* N=job->N+block*job->n_bins;
+	DWORD* candidates=job->candidates[thread];
+	DTYPE* x=job->candidate_x[thread];
+	DTYPE* y=job->candidate_y[thread];
+	DTYPE* unit=job->candidate_unit[thread];
+	DTYPE *ux,*uy,*uz;
+	DTYPE* attribute=job->candidate_attribute[thread];
+	DTYPE* squares=job->squares[thread];
+	SPATIAL_TYPE* p;
+	for(bin=0;bin<job->n_bins;bin++){
+		result[bin]=0;
+		smoother[bin]=0;
+		N[bin]=0;
+	}
+	if(end>objects->size){
+		end=objects->size;
+	}
+	for(i=block*job->block_rows;i<end;i++){
+		p=objects->objects[i]->spatial_coordinates;
+		cell_of(cells,p,&cx,&cy,&cz);
+		/*Collect later objects in the 3x3 block of cells around object i, 3x3x3 for grids over unit vectors*/
+		n_candidates=0;
+		for(gz=cz-1;gz<=cz+1;gz++){
+			if(gz<0||gz>=cells->nz){
+				continue;
+			}
+			for(gy=cy-1;gy<=cy+1;gy++){
+				if(gy<0||gy>=cells->ny){
+					continue;
+				}
+				for(gx=cx-1;gx<=cx+1;gx++){
+					if(gx<0||gx>=cells->nx){
+						continue;
+					}
+					c=(gz*cells->ny+gy)*cells->nx+gx;
+					for(j=cells->start[c];j<cells->start[c+1];j++){
+						if(cells->members[j]>i){
+							candidates[n_candidates++]=cells->members[j];
+						}
+					}
+				}
+			}
+		}
+		qsort(candidates,n_candidates,sizeof(DWORD),index_cmp);
+		/*Gather candidates into contiguous arrays, so that the distance loop below is vectorizable*/
+		for(j=0;j<n_candidates;j++){
+			x[j]=objects->objects[candidates[j]]->spatial_coordinates[0];
+			y[j]=objects->objects[candidates[j]]->spatial_coordinates[1];
+			attribute[j]=objects->objects[candidates[j]]->attribute;
+		}
+		if(job->distance_type==PLANAR_DISTANCE){
+			for(j=0;j<n_candidates;j++){
+				dx=p[0]-x[j];
+				dy=p[1]-y[j];
+				squares[j]=dx*dx+dy*dy;
+			}
+		}else{
+			ux=unit;
+			uy=unit+job->max_candidates;
+			uz=unit+2*job->max_candidates;
+			for(j=0;j<n_candidates;j++){
+				ux[j]=objects->objects[candidates[j]]->spatial_coordinates[2];
+				uy[j]=objects->objects[candidates[j]]->spatial_coordinates[3];
+				uz[j]=objects->objects[candidates[j]]->spatial_coordinates[4];
+			}
+			/*Squared chords of the unit vectors, then squared distances*/
+			for(j=0;j<n_candidates;j++){
+				dx=p[2]-ux[j];
+				dy=p[3]-uy[j];
+				dz=p[4]-uz[j];
+				squares[j]=dx*dx+dy*dy+dz*dz;
+			}
+			for(j=0;j<n_candidates;j++){
+				dis=chord_to_distance(sqrt(squares[j]));
+				squares[j]=dis*dis;
+			}
+		}
+		for(j=0;j<n_candidates;j++){
+			if(squares[j]>limit){
+				continue;
+			}
+			/*Same expressions as distance() and smooth_variance_estimation*/
+			dis=sqrt(squares[j]);
+			arc_dis=atan((p[1]-y[j])/(p[0]-x[j]));
+			if(isnan(arc_dis)){
+				continue;
+			}
+			/*Candidate bins around the pair, the exact test below decides membership.*/
+			k_min=0;
+			k_max=job->steps-1;
+			if(job->step_size>0){
+				k_min=(DWORD)floor((dis-job->bound-job->step_size/2)/job->step_size)-1;
+				k_max=(DWORD)ceil((dis+job->bound-job->step_size/2)/job->step_size)+1;
+				if(k_min<0){
+					k_min=0;
+				}
+				if(k_max>=job->steps){
+					k_max=job->steps-1;
+				}
+			}
+			a_min=(DWORD)floor((arc_dis-job->angle_bound)/angle_step)-1;
+			a_max=(DWORD)ceil((arc_dis+job->angle_bound)/angle_step)+1;
+			if(a_min<0){
+				a_min=0;
+			}
+			if(a_max>=job->angle_steps){
+				a_max=job->angle_steps-1;
+			}
+			temp1=objects->objects[i]->attribute-attribute[j];
+			temp2=kernel_smoother(temp1,job->C,job->smoothing_type);
+			for(k=k_min;k<=k_max;k++){
+				if(!(fabs(dis-job->lags[k])<job->bound)){
+					continue;
+				}
+				for(a=a_min;a<=a_max;a++){
+					if(fabs(arc_dis-job->angles[a])<job->angle_bound){
+						bin=k*job->angle_steps+a;
+						result[bin]+=temp1*temp1*temp2;
+						smoother[bin]+=temp2;
+						N[bin]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Bins are centered at lags step_size/2+k*step_size and angles a*M_PI/angle_steps, a pair falls into every bin whose center is within bound and angle_bound.
+ * Pairs are enumerated once through a cell list with cells as large as the maximum lag plus bound, so pairs beyond the cutoff are never visited.
+ * Rows are split into at most VARIOGRAM_BLOCKS contiguous blocks that run in parallel with their own bin accumulators. Blocks are reduced in order, so the result is the same for any number of threads.
+*/
 Samples* variogram_sampling(Objects *objects,DTYPE bound,DTYPE angle_bound,DTYPE step_size,DWORD steps,DWORD angle_steps,DTYPE *C,SMOOTHING_TYPE smoothing_type){
 	Samples* samples=create_samples(steps*angle_steps);
-	DWORD i,j,index=0;
-	DTYPE lag=step_size/2,angle;
-	for(i=0;i<steps;i++){
-		angle=0;
-		for(j=0;j<angle_steps;j++){
-			samples->x[index]=lag;
-			samples->phi[index]=angle;
-			smooth_variance_estimation(samples,index,objects,bound,angle_bound,lag,angle,C,smoothing_type);
-			angle+=M_PI/angle_steps;
-			if(samples->y[index]>0){
-				index++;
+	DWORD k,a,b,index=0,n_bins=steps*angle_steps,n_blocks;
+	WORD t,threads;
+	VariogramJob job;
+	/*Bin centers are accumulated the same way as in smooth_variance_estimation*/
+	DTYPE* lags=Calloc(steps,DTYPE);
+	DTYPE* angles=Calloc(angle_steps,DTYPE);
+	DTYPE* result=Calloc(n_bins,DTYPE);
+	DTYPE* smoother=Calloc(n_bins,DTYPE);
+	DWORD* N=Calloc(n_bins,DWORD);
+	DTYPE lag=step_size/2,angle=0;
+	for(k=0;k<steps;k++){
+		lags[k]=lag;
+		lag+=step_size;
+	}
+	for(a=0;a<angle_steps;a++){
+		angles[a]=angle;
+		angle+=M_PI/angle_steps;
+	}
+	for(k=0;k<n_bins;k++){
+		result[k]=0;
+		smoother[k]=0;
+		N[k]=0;
+	}
+	if(objects->size>1&&n_bins>0&&bound>0&&angle_bound>0){
+		job.objects=objects;
+		job.distance_type=get_distance_type();
+		job.bound=bound;
+		job.angle_bound=angle_bound;
+		job.step_size=step_size;
+		job.steps=steps;
+		job.angle_steps=angle_steps;
+		job.C=C;
+		job.smoothing_type=smoothing_type;
+		job.cutoff=lags[steps-1]+bound;
+		job.lags=lags;
+		job.angles=angles;
+		job.n_bins=n_bins;
+		/*Cells are slightly larger than the cutoff, so rounding never drops a pair at the cutoff*/
+		job.cells=build_cell_list(objects,job.cutoff*1.0001);
+		job.block_rows=variogram_block_rows(objects->size);
+		n_blocks=(objects->size+job.block_rows-1)/job.block_rows;
+		job.result=Calloc(n_blocks*n_bins,DTYPE);
+		job.smoother=Calloc(n_blocks*n_bins,DTYPE);
+		job.N=Calloc(n_blocks*n_bins,DWORD);
+		job.max_candidates=max_neighborhood(job.cells);
+		threads=krig_thread_count();
+		job.candidates=Calloc(threads,DWORD*);
+		job.candidate_x=Calloc(threads,DTYPE*);
+		job.candidate_y=Calloc(threads,DTYPE*);
+		job.candidate_unit=Calloc(threads,DTYPE*);
+		job.candidate_attribute=Calloc(threads,DTYPE*);
+		job.squares=Calloc(threads,DTYPE*);
+		for(t=0;t<threads;t++){
+			job.candidates[t]=Calloc(job.max_candidates,DWORD);
+			job.candidate_x[t]=Calloc(job.max_candidates,DTYPE);
+			job.candidate_y[t]=Calloc(job.max_candidates,DTYPE);
+			job.candidate_unit[t]=job.distance_type==PLANAR_DISTANCE?NULL:Calloc(3*job.max_candidates,DTYPE);
+			job.candidate_attribute[t]=Calloc(job.max_candidates,DTYPE);
+			job.squares[t]=Calloc(job.max_candidates,DTYPE);
+		}
+		parallel_for(n_blocks,variogram_block,&job);
+		/*Reduce block accumulators in block order*/
+		for(b=0;b<n_blocks;b++){
+			for(k=0;k<n_bins;k++){
+				result[k]+=job.result[b*n_bins+k];
+				smoother[k]+=job.smoother[b*n_bins+k];
+				N[k]+=job.N[b*n_bins+k];
 			}
 		}
+		for(t=0;t<threads;t++){
+			Free(job.candidates[t]);
+			Free(job.candidate_x[t]);
+			Free(job.candidate_y[t]);
+			Free(job.candidate_unit[t]);
+			Free(job.candidate_attribute[t]);
+			Free(job.squares[t]);
+		}
+		Free(job.candidates);
+		Free(job.candidate_x);
+		Free(job.candidate_y);
+		Free(job.candidate_unit);
+		Free(job.candidate_attribute);
+		Free(job.squares);
+		Free(job.result);
+		Free(job.smoother);
+		Free(job.N);
+		destroy_cell_list(job.cells);
+	}
+	/*Keep bins with a positive estimate, in (lag, angle) order*/
+	for(k=0;k<n_bins;k++){
+		samples->x[index]=lags[k/angle_steps];
+		samples->phi[index]=angles[k%angle_steps];
+		samples->N[index]=N[k];
+		samples->y[index]=smoother[k]==0?-1:result[k]/smoother[k];
+		samples->se[index]=0;
+		if(samples->y[index]>0){
+			index++;
+		}
+	}
+	Free(lags);
+	Free(angles);
+	Free(result);
+	Free(smoother);
+	Free(N);
+	samples->x=(DTYPE*)realloc(samples->x,sizeof(DTYPE)*index);
+	samples->y=(DTYPE*)realloc(samples->y,sizeof(DTYPE)*index);
+	samples->phi=(DTYPE*)realloc(samples->phi,sizeof(DTYPE)*index);
+	samples->se=(DTYPE*)realloc(samples->se,sizeof(DTYPE)*index);
+	samples->u=(DTYPE*)realloc(samples->u,sizeof(DTYPE)*index);
+	samples->size=index;
+	return samples;
+}
+
+/*
+ * Pairs are drawn stratum by stratum, one stratum per lag. A draw picks object i uniformly and object j uniformly from the m_i objects in the cells around i that can reach the lag.
+ * Draws that fall into a bin of the stratum are weighted by m_i, which undoes the non-uniform pair selection.
+ * y is the weighted ratio estimator sum(w*K*d^2)/sum(w*K), se its linearized standard error, and N the estimated number of pairs in the bin.
+*/
+Samples* variogram_sampling_approximate(Objects *objects,DTYPE bound,DTYPE angle_bound,DTYPE step_size,DWORD steps,DWORD angle_steps,DTYPE *C,SMOOTHING_TYPE smoothing_type,DWORD target,DWORD budget){
+	Samples* samples=create_samples(steps*angle_steps);
+	DWORD i,j,k,a,r,bin,index=0,n_bins=steps*angle_steps,draws,stratum_budget,satisfied,reach,cx,cy,cz,gy,gz,gx_min,gx_max,m,row,row_count;
+	DTYPE lag=step_size/2,angle=0,dis,arc_dis,temp1,kernel,w;
+	SPATIAL_TYPE *p,*q;
+	DTYPE* lags=Calloc(steps,DTYPE);
+	DTYPE* angles=Calloc(angle_steps,DTYPE);
+	/*Per-bin sums of w*K, w*K*d^2, (w*K)^2, (w*K)^2*d^2, (w*K)^2*d^4 and w, and the number of hits.*/
+	DTYPE* sum_wk=Calloc(n_bins,DTYPE);
+	DTYPE* sum_wkv=Calloc(n_bins,DTYPE);
+	DTYPE* sum_wk2=Calloc(n_bins,DTYPE);
+	DTYPE* sum_wk2v=Calloc(n_bins,DTYPE);
+	DTYPE* sum_wk2v2=Calloc(n_bins,DTYPE);
+	DTYPE* sum_w=Calloc(n_bins,DTYPE);
+	DWORD* hits=Calloc(n_bins,DWORD);
+	DWORD* stratum_draws=Calloc(steps,DWORD);
+	for(k=0;k<steps;k++){
+		lags[k]=lag;
 		lag+=step_size;
+		stratum_draws[k]=0;
+	}
+	for(a=0;a<angle_steps;a++){
+		angles[a]=angle;
+		angle+=M_PI/angle_steps;
+	}
+	for(bin=0;bin<n_bins;bin++){
+		sum_wk[bin]=0;
+		sum_wkv[bin]=0;
+		sum_wk2[bin]=0;
+		sum_wk2v[bin]=0;
+		sum_wk2v2[bin]=0;
+		sum_w[bin]=0;
+		hits[bin]=0;
 	}
+	if(objects->size>1&&n_bins>0&&bound>0&&angle_bound>0&&step_size>0){
+		CellList* cells=build_cell_list(objects,step_size);
+		stratum_budget=budget/steps;
+		for(k=0;k<steps;k++){
+			/*Cells around i that can contain a partner at distance lags[k]+bound*/
+			reach=(DWORD)ceil(distance_to_chord(lags[k]+bound)/cells->cell_size);
+			for(draws=0;draws<stratum_budget;draws++){
+				/*Stop when every angle bin reached the target. Bins without a single hit after target*angle_steps*4 draws are taken as empty.*/
+				if(draws%angle_steps==0){
+					satisfied=0;
+					for(a=0;a<angle_steps;a++){
+						if(hits[k*angle_steps+a]>=target||(hits[k*angle_steps+a]==0&&draws>=target*angle_steps*4)){
+							satisfied++;
+						}
+					}
+					if(satisfied==angle_steps){
+						break;
+					}
+				}
+				i=(DWORD)(genrand_real2()*objects->size);
+				p=objects->objects[i]->spatial_coordinates;
+				cell_of(cells,p,&cx,&cy,&cz);
+				gx_min=cx-reach<0?0:cx-reach;
+				gx_max=cx+reach>=cells->nx?cells->nx-1:cx+reach;
+				/*Cells are stored row by row, so every row of the window is a contiguous range of members.*/
+				m=0;
+				for(gz=cz-reach<0?0:cz-reach;gz<=cz+reach&&gz<cells->nz;gz++){
+					for(gy=cy-reach<0?0:cy-reach;gy<=cy+reach&&gy<cells->ny;gy++){
+						row=(gz*cells->ny+gy)*cells->nx;
+						m+=cells->start[row+gx_max+1]-cells->start[row+gx_min];
+					}
+				}
+				r=(DWORD)(genrand_real2()*m);
+				j=-1;
+				for(gz=cz-reach<0?0:cz-reach;gz<=cz+reach&&gz<cells->nz&&j<0;gz++){
+					for(gy=cy-reach<0?0:cy-reach;gy<=cy+reach&&gy<cells->ny;gy++){
+						row=(gz*cells->ny+gy)*cells->nx;
+						row_count=cells->start[row+gx_max+1]-cells->start[row+gx_min];
+						if(r<row_count){
+							j=cells->members[cells->start[row+gx_min]+r];
+							break;
+						}
+						r-=row_count;
+					}
+				}
+				stratum_draws[k]++;
+				if(j<0||j==i){
+					continue;
+				}
+				q=objects->objects[j]->spatial_coordinates;
+				dis=distance(p,q);
+				if(!(fabs(dis-lags[k])<bound)){
+					continue;
+				}
+				/*Orient the pair as in the exact sampler, atan is symmetric in the pair order.*/
+				arc_dis=atan((p[1]-q[1])/(p[0]-q[0]));
+				temp1=objects->objects[i]->attribute-objects->objects[j]->attribute;
+				kernel=kernel_smoother(temp1,C,smoothing_type);
+				w=m;
+				for(a=0;a<angle_steps;a++){
+					if(fabs(arc_dis-angles[a])<angle_bound){
+						bin=k*angle_steps+a;
+						sum_wk[bin]+=w*kernel;
+						sum_wkv[bin]+=w*kernel*temp1*temp1;
+						sum_wk2[bin]+=w*kernel*w*kernel;
+						sum_wk2v[bin]+=w*kernel*w*kernel*temp1*temp1;
+						sum_wk2v2[bin]+=w*kernel*w*kernel*temp1*temp1*temp1*temp1;
+						sum_w[bin]+=w;
+						hits[bin]++;
+					}
+				}
+			}
+		}
+		destroy_cell_list(cells);
+	}
+	for(bin=0;bin<n_bins;bin++){
+		k=bin/angle_steps;
+		samples->x[index]=lags[k];
+		samples->phi[index]=angles[bin%angle_steps];
+		samples->y[index]=sum_wk[bin]==0?-1:sum_wkv[bin]/sum_wk[bin];
+		/*Every pair is reached from both ends, hence the factor 1/2.*/
+		samples->N[index]=stratum_draws[k]==0?0:(DWORD)(0.5*objects->size*sum_w[bin]/stratum_draws[k]+0.5);
+		if(samples->y[index]>0){
+			/*sum((w*K)^2*(d^2-y)^2)/sum(w*K)^2*/
+			temp1=sum_wk2v2[bin]-2*samples->y[index]*sum_wk2v[bin]+samples->y[index]*samples->y[index]*sum_wk2[bin];
+			samples->se[index]=sqrt(fmax(temp1,0))/sum_wk[bin];
+			index++;
+		}
+	}
+	Free(lags);
+	Free(angles);
+	Free(sum_wk);
+	Free(sum_wkv);
+	Free(sum_wk2);
+	Free(sum_wk2v);
+	Free(sum_wk2v2);
+	Free(sum_w);
+	Free(hits);
+	Free(stratum_draws);
 	samples->x=(DTYPE*)realloc(samples->x,sizeof(DTYPE)*index);
 	samples->y=(DTYPE*)realloc(samples->y,sizeof(DTYPE)*index);
 	samples->phi=(DTYPE*)realloc(samples->phi,sizeof(DTYPE)*index);
+	samples->se=(DTYPE*)realloc(samples->se,sizeof(DTYPE)*index);
+	samples->u=(DTYPE*)realloc(samples->u,sizeof(DTYPE)*index);
+	samples->size=index;
+	return samples;
+}
+
+/*
+ * Shared state of a parallel space-time variogram sampling run.
+ * Objects are gathered in time order into x, y, t and attribute. Block b accumulates pairs whose earlier object lies in its rows at offset b*n_bins.
+ * For chordal and great-circle distances unit holds their unit vectors, x components first, then y and z.
+*/
+typedef struct{
+	DWORD size;
+	DWORD block_rows;
+	DISTANCE_TYPE distance_type;
+	DTYPE* x;
+	DTYPE* y;
+	DTYPE* unit;
+	DTYPE* t;
+	DTYPE* attribute;
+	DTYPE bound;
+	DTYPE time_bound;
+	DTYPE step_size;
+	DWORD steps;
+	DTYPE time_step;
+	DWORD time_steps;
+	DTYPE* C;
+	SMOOTHING_TYPE smoothing_type;
+	DTYPE cutoff;
+	DTYPE time_cutoff;
+	DTYPE* lags;
+	DTYPE* time_lags;
+	DWORD n_bins;
+	DTYPE* result;
+	DTYPE* smoother;
+	DWORD* N;
+} STVariogramJob;
+
+static void ST_variogram_block(DWORD block,WORD thread,void* arg){
+	STVariogramJob* job=(STVariogramJob*)arg;
+	DWORD i,j,k,l,bin,k_min,k_max,l_min,l_max;
+	DWORD end=(block+1)*job->block_rows;
+	DTYPE dis,lag,dx,dy,dz,square,temp1,temp2;
+	DTYPE limit=job->cutoff*job->cutoff*1.0001;
+	DTYPE* ux=job->unit;
+	DTYPE* uy=job->unit+job->size;
+	DTYPE* uz=job->unit+2*job->size;
+	DTYPE* result=job->result+block*job->n_bins;
+	DTYPE* smoother=job->smoother+block*job->n_bins;
+	DWORD* N=job->N+block*job->n_bins;
+	(void)thread;
+	for(bin=0;bin<job->n_bins;bin++){
+		result[bin]=0;
+		smoother[bin]=0;
+		N[bin]=0;
+	}
+	if(end>job->size){
+		end=job->size;
+	}
+	for(i=block*job->block_rows;i<end;i++){
+		/*Objects are sorted by time, so the scan stops at the first object beyond the temporal cutoff*/
+		for(j=i+1;j<job->size&&job->t[j]-job->t[i]<=job->time_cutoff;j++){
+			if(job->distance_type==PLANAR_DISTANCE){
+				dx=job->x[i]-job->x[j];
+				dy=job->y[i]-job->y[j];
+				square=dx*dx+dy*dy;
+			}else{
+				dx=ux[i]-ux[j];
+				dy=uy[i]-uy[j];
+				dz=uz[i]-uz[j];
+				dis=chord_to_distance(sqrt(dx*dx+dy*dy+dz*dz));
+				square=dis*dis;
+			}
+			if(square>limit){
+				continue;
+			}
+			dis=sqrt(square);
+			lag=job->t[j]-job->t[i];
+			k_min=0;
+			k_max=job->steps-1;
+			if(job->step_size>0){
+				k_min=(DWORD)floor((dis-job->bound-job->step_size/2)/job->step_size)-1;
+				k_max=(DWORD)ceil((dis+job->bound-job->step_size/2)/job->step_size)+1;
+				if(k_min<0){
+					k_min=0;
+				}
+				if(k_max>=job->steps){
+					k_max=job->steps-1;
+				}
+			}
+			l_min=0;
+			l_max=job->time_steps-1;
+			if(job->time_step>0){
+				l_min=(DWORD)floor((lag-job->time_bound)/job->time_step)-1;
+				l_max=(DWORD)ceil((lag+job->time_bound)/job->time_step)+1;
+				if(l_min<0){
+					l_min=0;
+				}
+				if(l_max>=job->time_steps){
+					l_max=job->time_steps-1;
+				}
+			}
+			temp1=job->attribute[i]-job->attribute[j];
+			temp2=kernel_smoother(temp1,job->C,job->smoothing_type);
+			for(k=k_min;k<=k_max;k++){
+				if(!(fabs(dis-job->lags[k])<job->bound)){
+					continue;
+				}
+				for(l=l_min;l<=l_max;l++){
+					if(fabs(lag-job->time_lags[l])<job->time_bound){
+						bin=k*job->time_steps+l;
+						result[bin]+=temp1*temp1*temp2;
+						smoother[bin]+=temp2;
+						N[bin]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+static int time_order_cmp(const void* a,const void* b){
+	const Object* x=*(const Object**)a;
+	const Object* y=*(const Object**)b;
+	return x->time<y->time?-1:(x->time>y->time);
+}
+
+/*
+ * Bins are centered at spatial lags step_size/2+k*step_size and temporal lags l*time_step, a pair falls into every bin whose center is within bound and time_bound.
+ * Objects are sorted by time once, and the pairs of an object are scanned forward in time until the temporal cutoff, so pairs that are too far apart in time are never visited.
+ * Rows are split into fixed blocks as in variogram_sampling, so the result is the same for any number of threads.
+*/
+Samples* variogram_sampling_ST(Objects *objects,DTYPE bound,DTYPE step_size,DWORD steps,DTYPE time_bound,DTYPE time_step,DWORD time_steps,DTYPE *C,SMOOTHING_TYPE smoothing_type){
+	Samples* samples=create_samples(steps*time_steps);
+	DWORD i,k,b,index=0,n_bins=steps*time_steps,n_blocks;
+	STVariogramJob job;
+	DTYPE* lags=Calloc(steps,DTYPE);
+	DTYPE* time_lags=Calloc(time_steps,DTYPE);
+	DTYPE* result=Calloc(n_bins,DTYPE);
+	DTYPE* smoother=Calloc(n_bins,DTYPE);
+	DWORD* N=Calloc(n_bins,DWORD);
+	DTYPE lag=step_size/2;
+	for(k=0;k<steps;k++){
+		lags[k]=lag;
+		lag+=step_size;
+	}
+	for(k=0;k<time_steps;k++){
+		time_lags[k]=k*time_step;
+	}
+	for(k=0;k<n_bins;k++){
+		result[k]=0;
+		smoother[k]=0;
+		N[k]=0;
+	}
+	if(objects->size>1&&n_bins>0&&bound>0&&time_bound>0){
+		Object** sorted=Calloc(objects->size,Object*);
+		memcpy(sorted,objects->objects,sizeof(Object*)*objects->size);
+		qsort(sorted,objects->size,sizeof(Object*),time_order_cmp);
+		job.size=objects->size;
+		job.distance_type=get_distance_type();
+		job.unit=Calloc(3*objects->size,DTYPE);
+		job.x=Calloc(objects->size,DTYPE);
+		job.y=Calloc(objects->size,DTYPE);
+		job.t=Calloc(objects->size,DTYPE);
+		job.attribute=Calloc(objects->size,DTYPE);
+		for(i=0;i<objects->size;i++){
+			job.x[i]=sorted[i]->spatial_coordinates[0];
+			if(job.distance_type!=PLANAR_DISTANCE){
+				job.unit[i]=sorted[i]->spatial_coordinates[2];
+				job.unit[objects->size+i]=sorted[i]->spatial_coordinates[3];
+				job.unit[2*objects->size+i]=sorted[i]->spatial_coordinates[4];
+			}
+			job.y[i]=sorted[i]->spatial_coordinates[1];
+			job.t[i]=sorted[i]->time;
+			job.attribute[i]=sorted[i]->attribute;
+		}
+		Free(sorted);
+		job.bound=bound;
+		job.time_bound=time_bound;
+		job.step_size=step_size;
+		job.steps=steps;
+		job.time_step=time_step;
+		job.time_steps=time_steps;
+		job.C=C;
+		job.smoothing_type=smoothing_type;
+		job.cutoff=lags[steps-1]+bound;
+		job.time_cutoff=time_lags[time_steps-1]+time_bound;
+		job.lags=lags;
+		job.time_lags=time_lags;
+		job.n_bins=n_bins;
+		job.block_rows=variogram_block_rows(objects->size);
+		n_blocks=(objects->size+job.block_rows-1)/job.block_rows;
+		job.result=Calloc(n_blocks*n_bins,DTYPE);
+		job.smoother=Calloc(n_blocks*n_bins,DTYPE);
+		job.N=Calloc(n_blocks*n_bins,DWORD);
+		parallel_for(n_blocks,ST_variogram_block,&job);
+		/*Reduce block accumulators in block order*/
+		for(b=0;b<n_blocks;b++){
+			for(k=0;k<n_bins;k++){
+				result[k]+=job.result[b*n_bins+k];
+				smoother[k]+=job.smoother[b*n_bins+k];
+				N[k]+=job.N[b*n_bins+k];
+			}
+		}
+		Free(job.x);
+		Free(job.y);
+		Free(job.unit);
+		Free(job.t);
+		Free(job.attribute);
+		Free(job.result);
+		Free(job.smoother);
+		Free(job.N);
+	}
+	/*Keep bins with a positive estimate, in (spatial lag, temporal lag) order*/
+	for(k=0;k<n_bins;k++){
+		samples->x[index]=lags[k/time_steps];
+		samples->u[index]=time_lags[k%time_steps];
+		samples->phi[index]=0;
+		samples->N[index]=N[k];
+		samples->y[index]=smoother[k]==0?-1:result[k]/smoother[k];
+		samples->se[index]=0;
+		if(samples->y[index]>0){
+			index++;
+		}
+	}
+	Free(lags);
+	Free(time_lags);
+	Free(result);
+	Free(smoother);
+	Free(N);
+	samples->x=(DTYPE*)realloc(samples->x,sizeof(DTYPE)*index);
+	samples->y=(DTYPE*)realloc(samples->y,sizeof(DTYPE)*index);
+	samples->phi=(DTYPE*)realloc(samples->phi,sizeof(DTYPE)*index);
+	samples->se=(DTYPE*)realloc(samples->se,sizeof(DTYPE)*index);
+	samples->u=(DTYPE*)realloc(samples->u,sizeof(DTYPE)*index);
 	samples->size=index;
 	return samples;
 }
 
 void randomize_variogram(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type){
 	DTYPE min=samples->y[0],max=samples->y[0],mean=samples->y[0];
+	DTYPE x_max=0,u_max=0,x_mean=0,u_mean=0;
 	DWORD i;
 	for(i=1;i<samples->size;i++){
 		if(samples->y[i]>max){
@@ -110,6 +810,23 @@ void randomize_variogram(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_ty
 		mean+=samples->y[i];
 	}
 	mean/=samples->size;
+	for(i=0;i<samples->size;i++){
+		x_max=fmax(x_max,samples->x[i]);
+		u_max=fmax(u_max,samples->u[i]);
+		x_mean+=samples->x[i];
+		u_mean+=samples->u[i];
+	}
+	x_mean/=samples->size;
+	u_mean/=samples->size;
+	/*Purely spatial samples have no temporal scale*/
+	if(u_max<=0){
+		u_max=1;
+		u_mean=1;
+	}
+	if(x_max<=0){
+		x_max=1;
+		x_mean=1;
+	}
 	
 	switch(variogram_type){
 		case EXPONENTIAL_VARIOGRAM:{
@@ -125,7 +842,9 @@ void randomize_variogram(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_ty
 			break;
 		}
 		case POWER_VARIOGRAM:{
-			
+			C[0]=(genrand_real2()*.25+.75)*min;
+			C[2]=.5+genrand_real2()*1.5;
+			C[1]=(mean-C[0])/pow(samples->x[samples->size-1],C[2]);
 			break;
 		}
 		case ANISOTROPHY_POWER_VARIOGRAM:{
@@ -136,44 +855,29 @@ void randomize_variogram(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_ty
 			break;
 		}
 		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
-			
-			break;
-		}
-
-		case ST_EXPONENTIAL_PRODUCT_VARIOGRAM:{
-			
-			break;
-		}
-		default:{
-			
+			/*Nugget and sill are split between the spatial, temporal and joint terms, each term reaches C1/2 at its range*/
+			C[0]=genrand_real2()*x_max/u_max;
+			C[1]=(genrand_real2()*.25+.75)*min/3;
+			C[2]=genrand_real2()*4*(max-min)/3;
+			C[3]=(1+genrand_real2())*x_max;
+			C[4]=(genrand_real2()*.25+.75)*min/3;
+			C[5]=genrand_real2()*4*(max-min)/3;
+			C[6]=(1+genrand_real2())*u_max;
+			C[7]=(genrand_real2()*.25+.75)*min/3;
+			C[8]=genrand_real2()*4*(max-min)/3;
+			C[9]=(1+genrand_real2())*sqrt(x_max*x_max+C[0]*C[0]*u_max*u_max);
 			break;
 		}
-	}
-}
 
-DWORD variogram_model_length(VARIOGRAM_TYPE variogram_type){
-	switch(variogram_type){
-		case EXPONENTIAL_VARIOGRAM:{
-			return 3;
-			break;
-		}
-		case SPHERICAL_VARIOGRAM:{
-			return 3;
-			break;
-		}
-		case POWER_VARIOGRAM:{
-			break;
-		}
-		case ANISOTROPHY_POWER_VARIOGRAM:{
-			return 4;
-			break;
-		}
-		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
-			
-			break;
-		}
 		case ST_EXPONENTIAL_PRODUCT_VARIOGRAM:{
-	
+			/*With small k the variogram is about C2*vs+C5*vt, so C2 and C5 scale like the square root of the variogram*/
+			C[0]=genrand_real2()/max;
+			C[2]=sqrt(genrand_real2()*max/2);
+			C[1]=(genrand_real2()*.25+.75)*min/(4*C[2]);
+			C[3]=-(1+genrand_real2())*log(VARIOGRAM_EXP_BOUND)/x_mean;
+			C[5]=sqrt(genrand_real2()*max/2);
+			C[4]=(genrand_real2()*.25+.75)*min/(4*C[5]);
+			C[6]=-(1+genrand_real2())*log(VARIOGRAM_EXP_BOUND)/u_mean;
 			break;
 		}
 		default:{
@@ -181,50 +885,16 @@ DWORD variogram_model_length(VARIOGRAM_TYPE variogram_type){
 			break;
 		}
 	}
-	return -1;
-}
-
-Particle* create_variogram_particle(DWORD size){
-	Particle* particle=Calloc(1,Particle);
-	particle->C=Calloc(size,DTYPE);
-	particle->local_best=Calloc(size,DTYPE);
-	memset(particle->local_best,0,size*sizeof(DTYPE));
-	particle->velocity=Calloc(size,DTYPE);
-	memset(particle->velocity,0,size*sizeof(DTYPE));
-	return particle;
-}
-
-Particle** create_variogram_particles(DWORD size,VARIOGRAM_TYPE variogram_size){
-	Particle **particles=Calloc(size,Particle*);
-	DWORD i;
-	for(i=0;i<size;i++){
-		particles[i]=create_variogram_particle(variogram_size);
-	}
-	return particles;
-}
-
-void destroy_variogram_particle(Particle* particle){
-	Free(particle->C);
-	Free(particle->local_best);
-	Free(particle->velocity);
-	Free(particle);
-}
-
-void destroy_variogram_particles(Particle** particles,DWORD size){
-	DWORD i;
-	for(i=0;i<size;i++){
-		destroy_variogram_particle(particles[i]);
-	}
-	Free(particles);
 }
 
 DTYPE evaluate_model(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type){
 	DWORD i;
-	DTYPE parameters[2];
+	DTYPE parameters[3];
 	DTYPE gamma_hat,result=0,temp;
 	for(i=0;i<samples->size;i++){
 		parameters[0]=samples->x[i];
 		parameters[1]=samples->phi[i];
+		parameters[2]=samples->u[i];
 		gamma_hat=compute_variogram_by_parameters(parameters,C,variogram_type);
 		temp=gamma_hat/samples->y[i]-1;
 		result+=samples->N[i]*temp*temp;
@@ -233,6 +903,31 @@ DTYPE evaluate_model(Samples* samples, DTYPE* C, VARIOGRAM_TYPE variogram_type){
 	return result;
 }
 
+/*
+ * Descent direction of evaluate_model from compute_variogram_derivatives, with the same scaling as the other cases of compute_variogram_gradient.
+*/
+static void derivative_gradient(Samples* samples,VARIOGRAM_TYPE variogram_type,DTYPE* C,DTYPE* gradients){
+	DWORD i,k,n=variogram_model_length(variogram_type),count=0;
+	DTYPE parameters[3],derivatives[10],base;
+	for(k=0;k<n;k++){
+		gradients[k]=0;
+	}
+	for(i=0;i<samples->size;i++){
+		parameters[0]=samples->x[i];
+		parameters[1]=samples->phi[i];
+		parameters[2]=samples->u[i];
+		base=2*samples->N[i]*(1-compute_variogram_by_parameters(parameters,C,variogram_type)/samples->y[i])/samples->y[i];
+		compute_variogram_derivatives(parameters,C,variogram_type,derivatives);
+		for(k=0;k<n;k++){
+			gradients[k]+=base*derivatives[k];
+		}
+		count+=samples->N[i];
+	}
+	for(k=0;k<n&&count>0;k++){
+		gradients[k]/=count;
+	}
+}
+
 void compute_variogram_gradient(Samples* samples,VARIOGRAM_TYPE variogram_type,DTYPE*C,DTYPE* gradients){
 	DWORD i;
 	DTYPE estimation;
@@ -257,28 +952,9 @@ void compute_variogram_gradient(Samples* samples,VARIOGRAM_TYPE variogram_type,D
 			gradients[2]/=count;
 			break;
 		}
-		case SPHERICAL_VARIOGRAM:{
-			DTYPE base;
-			DWORD count=0;
-			gradients[0]=0;
-			gradients[1]=0;
-			gradients[2]=0;
-			DTYPE parameters[1];
-			for(i=0;i<samples->size;i++){
-				parameters[0]=samples->x[i];
-				estimation=compute_variogram_by_parameters(parameters,C,variogram_type);
-				base=2*samples->N[i]*(1-estimation/samples->y[i])/samples->y[i];
-				gradients[1]+=base*2*C[1]*(1.5*samples->x[i]/C[2]-0.5*samples->x[i]*samples->x[i]*samples->x[i]/(C[2]*C[2]*C[2]));
-				gradients[2]+=base*C[1]*C[1]*1.5*(samples->x[i]*samples->x[i]*samples->x[i]/(C[2]*C[2]*C[2]*C[2])-samples->x[i]/(C[2]*C[2]));
-				count+=samples->N[i];
-			}
-			gradients[0]/=count;
-			gradients[1]/=count;
-			gradients[2]/=count;
-			break;
-		}
+		case SPHERICAL_VARIOGRAM:
 		case POWER_VARIOGRAM:{
-			
+			derivative_gradient(samples,variogram_type,C,gradients);
 			break;
 		}
 		case ANISOTROPHY_POWER_VARIOGRAM:{
@@ -314,12 +990,12 @@ void compute_variogram_gradient(Samples* samples,VARIOGRAM_TYPE variogram_type,D
 			break;
 		}
 		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
-			
+			derivative_gradient(samples,variogram_type,C,gradients);
 			break;
 		}
 
 		case ST_EXPONENTIAL_PRODUCT_VARIOGRAM:{
-			
+			derivative_gradient(samples,variogram_type,C,gradients);
 			break;
 		}
 		default:{
@@ -494,89 +1170,645 @@ void variogram_WLS_line_search(Samples* samples,DTYPE *C, DWORD epochs, VARIOGRA
 	Free(d);
 }
 
-void copy_particle(DTYPE* src,DTYPE* dest,DTYPE variogram_size){
-	memcpy(dest,src,variogram_size*sizeof(DTYPE));
+//Damping limits of the Levenberg-Marquardt fitter. A step that cannot lower the objective below LM_MAX_DAMPING means a local minimum.
+#define LM_INITIAL_DAMPING 1e-3
+#define LM_MIN_DAMPING 1e-12
+#define LM_MAX_DAMPING 1e12
+
+void default_variogram_bounds(VARIOGRAM_TYPE variogram_type,DTYPE* lower,DTYPE* upper){
+	DWORD i,n=variogram_model_length(variogram_type);
+	for(i=0;i<n;i++){
+		lower[i]=0;
+		upper[i]=INFINITY;
+	}
+	switch(variogram_type){
+		case SPHERICAL_VARIOGRAM:{
+			lower[2]=1e-12;
+			break;
+		}
+		case POWER_VARIOGRAM:{
+			upper[2]=2;
+			break;
+		}
+		case ANISOTROPHY_POWER_VARIOGRAM:{
+			lower[3]=1e-3;
+			upper[3]=2;
+			break;
+		}
+		case ST_SPHERICAL_PRODUCT_VARIOGRAM:{
+			lower[3]=1e-12;
+			lower[6]=1e-12;
+			lower[9]=1e-12;
+			break;
+		}
+		case ST_EXPONENTIAL_PRODUCT_VARIOGRAM:{
+			break;
+		}
+		default:{
+			break;
+		}
+	}
+}
+
+/*
+ * Residuals sqrt(N)*(gamma_hat/y-1) of evaluate_model and, if jacobian is not NULL, their derivatives, jacobian[i*n+k] for sample i and parameter k.
+ * Return: Sum of squared residuals, equal to evaluate_model.
+*/
+static DTYPE variogram_residuals(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DWORD n,DTYPE* residuals,DTYPE* jacobian){
+	DWORD i,k;
+	DTYPE parameters[3];
+	DTYPE weight,result=0;
+	for(i=0;i<samples->size;i++){
+		parameters[0]=samples->x[i];
+		parameters[1]=samples->phi[i];
+		parameters[2]=samples->u[i];
+		weight=sqrt((DTYPE)samples->N[i])/samples->y[i];
+		residuals[i]=weight*compute_variogram_by_parameters(parameters,C,variogram_type)-sqrt((DTYPE)samples->N[i]);
+		result+=residuals[i]*residuals[i];
+		if(jacobian!=NULL){
+			compute_variogram_derivatives(parameters,C,variogram_type,jacobian+i*n);
+			for(k=0;k<n;k++){
+				jacobian[i*n+k]*=weight;
+			}
+		}
+	}
+	return result;
 }
 
-void update_particle(Particle* particle,DTYPE* global_best,DTYPE c1,DTYPE c2,DTYPE alpha,DTYPE phi1,DTYPE phi2,DWORD variogram_size){
+DWORD variogram_LM(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* lower,DTYPE* upper,DWORD max_iterations,DTYPE tolerance){
+	DWORD n=variogram_model_length(variogram_type),m=samples->size,i,j,k,iteration;
+	DTYPE cost,trial_cost,damping=LM_INITIAL_DAMPING,sum,step;
+	BOOLEAN accepted,converged=FALSE;
+	if(n<=0||m==0){
+		return 0;
+	}
+	DTYPE* default_lower=Calloc(n,DTYPE);
+	DTYPE* default_upper=Calloc(n,DTYPE);
+	default_variogram_bounds(variogram_type,default_lower,default_upper);
+	if(lower==NULL){
+		lower=default_lower;
+	}
+	if(upper==NULL){
+		upper=default_upper;
+	}
+	DTYPE* residuals=Calloc(m,DTYPE);
+	DTYPE* jacobian=Calloc(m*n,DTYPE);
+	DTYPE* trial=Calloc(n,DTYPE);
+	Matrix* A=create_matrix(n,n);
+	Matrix* damped=create_matrix(n,n);
+	Matrix* g=create_matrix(n,1);
+	for(k=0;k<n;k++){
+		C[k]=fmin(fmax(C[k],lower[k]),upper[k]);
+	}
+	cost=variogram_residuals(samples,C,variogram_type,n,residuals,jacobian);
+	for(iteration=0;iteration<max_iterations&&!converged;iteration++){
+		/*Normal equations J'J*delta=-J'r*/
+		for(j=0;j<n;j++){
+			for(k=j;k<n;k++){
+				sum=0;
+				for(i=0;i<m;i++){
+					sum+=jacobian[i*n+j]*jacobian[i*n+k];
+				}
+				A->matrix[j][k]=sum;
+				A->matrix[k][j]=sum;
+			}
+			sum=0;
+			for(i=0;i<m;i++){
+				sum+=jacobian[i*n+j]*residuals[i];
+			}
+			g->matrix[j][0]=-sum;
+		}
+		accepted=FALSE;
+		while(!accepted&&damping<=LM_MAX_DAMPING){
+			/*Marquardt scaling, parameters without influence are damped as if their curvature were one*/
+			for(j=0;j<n;j++){
+				for(k=0;k<n;k++){
+					damped->matrix[j][k]=A->matrix[j][k];
+				}
+				damped->matrix[j][j]+=damping*(A->matrix[j][j]>0?A->matrix[j][j]:1);
+			}
+			Matrix* delta=solve_linear_system(damped,g);
+			step=0;
+			for(k=0;k<n&&delta!=NULL;k++){
+				trial[k]=fmin(fmax(C[k]+delta->matrix[k][0],lower[k]),upper[k]);
+				step=fmax(step,fabs(trial[k]-C[k])/(fabs(C[k])+tolerance));
+			}
+			trial_cost=delta!=NULL?variogram_residuals(samples,trial,variogram_type,n,residuals,NULL):NAN;
+			destroy_matrix(delta);
+			if(trial_cost<cost){
+				accepted=TRUE;
+				damping=fmax(damping/10,LM_MIN_DAMPING);
+				converged=cost-trial_cost<=tolerance*cost||step<=tolerance;
+				memcpy(C,trial,sizeof(DTYPE)*n);
+				cost=variogram_residuals(samples,C,variogram_type,n,residuals,jacobian);
+			}else{
+				damping*=10;
+			}
+		}
+		if(!accepted){
+			converged=TRUE;
+		}
+	}
+	destroy_matrix(A);
+	destroy_matrix(damped);
+	destroy_matrix(g);
+	Free(residuals);
+	Free(jacobian);
+	Free(trial);
+	Free(default_lower);
+	Free(default_upper);
+	return iteration;
+}
+
+//Grid points per nonlinear parameter that bracket the minimum before the golden-section search of variogram_VP.
+#define VP_GRID_POINTS 32
+#define VP_MAX_PASSES 20
+#define GOLDEN_RATIO 0.6180339887498949
+
+BOOLEAN variogram_projection_supported(VARIOGRAM_TYPE variogram_type){
+	return variogram_type==EXPONENTIAL_VARIOGRAM||variogram_type==SPHERICAL_VARIOGRAM||variogram_type==POWER_VARIOGRAM||variogram_type==ANISOTROPHY_POWER_VARIOGRAM;
+}
+
+DTYPE variogram_projection(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type){
+	DWORD i,k;
+	DTYPE g,w,y,t=0,r2;
+	DTYPE sw=0,sg=0,sgg=0,sy=0,sgy=0,syy=0;
+	DTYPE det,c0,beta,value,best=INFINITY,best_c0=0,best_beta=0;
+	DTYPE candidates[8];
+	if(variogram_type==ANISOTROPHY_POWER_VARIOGRAM){
+		/*gamma=C0+C1*(r^2*(a+t*b))^(P/2) with t=(C2/C1)^(2/P), so only the ratio of C1 and C2 is nonlinear*/
+		if(!(C[1]>0)||!(C[2]>=0)||!(C[3]>0)){
+			return INFINITY;
+		}
+		t=pow(C[2]/C[1],2/C[3]);
+	}
+	for(i=0;i<samples->size;i++){
+		switch(variogram_type){
+			case EXPONENTIAL_VARIOGRAM:{
+				g=1-exp(-C[2]*samples->x[i]);
+				break;
+			}
+			case SPHERICAL_VARIOGRAM:{
+				g=samples->x[i]>=C[2]?1:1.5*samples->x[i]/C[2]-0.5*pow(samples->x[i]/C[2],3);
+				break;
+			}
+			case POWER_VARIOGRAM:{
+				g=pow(samples->x[i],C[2]);
+				break;
+			}
+			case ANISOTROPHY_POWER_VARIOGRAM:{
+				r2=samples->x[i]*samples->x[i];
+				g=pow(r2*(pow(cos(M_PI/4-samples->phi[i]),2)+t*pow(cos(M_PI/4+samples->phi[i]),2)),C[3]/2);
+				break;
+			}
+			default:{
+				return INFINITY;
+			}
+		}
+		/*evaluate_model is the weighted least squares sum of N/y^2*(gamma_hat-y)^2*/
+		y=samples->y[i];
+		w=samples->N[i]/(y*y);
+		sw+=w;
+		sg+=w*g;
+		sgg+=w*g*g;
+		sy+=w*y;
+		sgy+=w*g*y;
+		syy+=w*y*y;
+	}
+	if(isnan(sgg)||isinf(sgg)){
+		return INFINITY;
+	}
+	/*Non-negative least squares in two unknowns: the unconstrained solution if feasible, otherwise the best solution on the boundary*/
+	k=0;
+	det=sw*sgg-sg*sg;
+	if(det>1e-12*sw*sgg){
+		candidates[k++]=(sy*sgg-sg*sgy)/det;
+		candidates[k++]=(sw*sgy-sg*sy)/det;
+	}
+	candidates[k++]=0;
+	candidates[k++]=sgg>0?fmax(sgy/sgg,0):0;
+	candidates[k++]=sw>0?fmax(sy/sw,0):0;
+	candidates[k++]=0;
+	for(i=0;i<k;i+=2){
+		c0=candidates[i];
+		beta=candidates[i+1];
+		if(c0<0||beta<0){
+			continue;
+		}
+		value=c0*c0*sw+beta*beta*sgg+syy+2*c0*beta*sg-2*c0*sy-2*beta*sgy;
+		if(value<best){
+			best=value;
+			best_c0=c0;
+			best_beta=beta;
+		}
+	}
+	C[0]=best_c0;
+	switch(variogram_type){
+		case SPHERICAL_VARIOGRAM:{
+			C[1]=sqrt(best_beta/2);
+			break;
+		}
+		case ANISOTROPHY_POWER_VARIOGRAM:{
+			C[1]=best_beta;
+			C[2]=best_beta*pow(t,C[3]/2);
+			break;
+		}
+		default:{
+			C[1]=best_beta;
+			break;
+		}
+	}
+	return fmax(best,0);
+}
+
+/*
+ * Nonlinear parameters searched by variogram_VP, in search coordinates theta. Ranges and rates are searched on a log scale.
+*/
+static DWORD projection_search_space(Samples* samples,VARIOGRAM_TYPE variogram_type,DTYPE* lower,DTYPE* upper){
 	DWORD i;
-	DTYPE l_best,g_best,loc;
-	for(i=1;i<variogram_size;i++){
-		l_best=particle->local_best[i];
-		g_best=global_best[i];
-		loc=particle->C[i];
-		particle->velocity[i]=loc*alpha+phi1*c1*(l_best-loc)+phi2*c2*(g_best-loc);
-		particle->C[i]+=particle->velocity[i];
+	DTYPE x_min=INFINITY,x_max=0;
+	for(i=0;i<samples->size;i++){
+		if(samples->x[i]>0){
+			x_min=fmin(x_min,samples->x[i]);
+			x_max=fmax(x_max,samples->x[i]);
+		}
+	}
+	if(isinf(x_min)){
+		x_min=x_max=1;
+	}
+	switch(variogram_type){
+		case EXPONENTIAL_VARIOGRAM:{
+			lower[0]=log(0.01/x_max);
+			upper[0]=log(100/x_min);
+			return 1;
+		}
+		case SPHERICAL_VARIOGRAM:{
+			lower[0]=log(0.1*x_min);
+			upper[0]=log(100*x_max);
+			return 1;
+		}
+		case POWER_VARIOGRAM:{
+			lower[0]=1e-3;
+			upper[0]=2;
+			return 1;
+		}
+		case ANISOTROPHY_POWER_VARIOGRAM:{
+			/*Exponent P and the log of the ratio t of the squared axis scales*/
+			lower[0]=0.05;
+			upper[0]=2;
+			lower[1]=log(1e-4);
+			upper[1]=log(1e4);
+			return 2;
+		}
+		default:{
+			return 0;
+		}
 	}
 }
 
-DTYPE* variogram_PSO(Objects *objects,Samples* samples,DWORD epochs, DWORD n_particles, VARIOGRAM_TYPE variogram_type, DTYPE c1,DTYPE c2,DTYPE alpha){
-	DWORD i,j;
-	DTYPE *temp_best=NULL,*global_best;
-	DTYPE best=-1,temp;
-	DTYPE *phi1=Calloc(n_particles,DTYPE);
-	DTYPE *phi2=Calloc(n_particles,DTYPE);
-	DWORD variogram_size=variogram_model_length(variogram_type);
-	DTYPE* distances=Calloc(2,DTYPE);
-	distances[0]=DIS_UNCHECKED;
-	distances[1]=DIS_UNCHECKED;
-	//Create cluster and insert points
-        Cluster *cluster=create_cluster();
-	for(i=0;i<objects->size;i++){
-		add_to_cluster(cluster,objects->objects[i]);
+static DTYPE projection_objective(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* theta){
+	switch(variogram_type){
+		case EXPONENTIAL_VARIOGRAM:
+		case SPHERICAL_VARIOGRAM:{
+			C[2]=exp(theta[0]);
+			break;
+		}
+		case POWER_VARIOGRAM:{
+			C[2]=theta[0];
+			break;
+		}
+		case ANISOTROPHY_POWER_VARIOGRAM:{
+			C[1]=1;
+			C[2]=exp(theta[1]*theta[0]/2);
+			C[3]=theta[0];
+			break;
+		}
+		default:{
+			return INFINITY;
+		}
+	}
+	return variogram_projection(samples,C,variogram_type);
+}
+
+/*
+ * Golden-section search for theta[k] in [a,b], the other search coordinates are fixed.
+*/
+static DTYPE golden_section(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE* theta,DWORD k,DTYPE a,DTYPE b,DTYPE width){
+	DTYPE x1=b-GOLDEN_RATIO*(b-a),x2=a+GOLDEN_RATIO*(b-a),f1,f2;
+	theta[k]=x1;
+	f1=projection_objective(samples,C,variogram_type,theta);
+	theta[k]=x2;
+	f2=projection_objective(samples,C,variogram_type,theta);
+	while(b-a>width){
+		if(f1<=f2){
+			b=x2;
+			x2=x1;
+			f2=f1;
+			x1=b-GOLDEN_RATIO*(b-a);
+			theta[k]=x1;
+			f1=projection_objective(samples,C,variogram_type,theta);
+		}else{
+			a=x1;
+			x1=x2;
+			f1=f2;
+			x2=a+GOLDEN_RATIO*(b-a);
+			theta[k]=x2;
+			f2=projection_objective(samples,C,variogram_type,theta);
+		}
+	}
+	theta[k]=f1<=f2?x1:x2;
+	return fmin(f1,f2);
+}
+
+DTYPE variogram_VP(Samples* samples,DTYPE* C,VARIOGRAM_TYPE variogram_type,DTYPE tolerance){
+	DTYPE lower[2],upper[2],theta[2],best_theta[2],step[2],value,best=INFINITY,previous,a,b;
+	DWORD K,i,j,k,pass;
+	if(samples->size==0||!variogram_projection_supported(variogram_type)){
+		return INFINITY;
 	}
-	//initialize particles
-	Particle **particles=create_variogram_particles(n_particles, variogram_size);
-	for(i=0;i<n_particles;i++){
-		randomize_variogram(samples, particles[i]->C, variogram_type);
-		particles[i]->C[0]=25;
+	K=projection_search_space(samples,variogram_type,lower,upper);
+	for(k=0;k<K;k++){
+		step[k]=(upper[k]-lower[k])/(VP_GRID_POINTS-1);
+		best_theta[k]=lower[k];
 	}
-	//compute g_best
-	for(i=0;i<n_particles;i++){
-		particles[i]->mse=evaluate_model(samples, particles[i]->C, variogram_type);
-		for(j=0;j<variogram_size;j++){
-			//printf("C[%lld]=%lf,",j,particles[i]->C[j]);
+	/*Coarse grid to bracket the global minimum*/
+	for(i=0;i<VP_GRID_POINTS;i++){
+		for(j=0;j<(K>1?VP_GRID_POINTS:1);j++){
+			theta[0]=lower[0]+i*step[0];
+			if(K>1){
+				theta[1]=lower[1]+j*step[1];
+			}
+			value=projection_objective(samples,C,variogram_type,theta);
+			if(value<best){
+				best=value;
+				memcpy(best_theta,theta,sizeof(DTYPE)*K);
+			}
 		}
-		//printf("mse=%lf\n",particles[i]->mse);
 	}
-	for(i=0;i<n_particles;i++){
-		if(best==-1||particles[i]->mse<best){
-			best=particles[i]->mse;
-			temp_best=particles[i]->C;
+	/*Golden-section refinement within one grid step of the best point, coordinate by coordinate*/
+	for(pass=0;pass<VP_MAX_PASSES;pass++){
+		previous=best;
+		for(k=0;k<K;k++){
+			memcpy(theta,best_theta,sizeof(DTYPE)*K);
+			a=fmax(best_theta[k]-step[k],lower[k]);
+			b=fmin(best_theta[k]+step[k],upper[k]);
+			value=golden_section(samples,C,variogram_type,theta,k,a,b,tolerance*(upper[k]-lower[k]));
+			if(value<best){
+				best=value;
+				memcpy(best_theta,theta,sizeof(DTYPE)*K);
+			}
+		}
+		if(K==1||previous-best<=tolerance*previous){
+			break;
 		}
 	}
-	global_best=Calloc(variogram_size,DTYPE);
-	copy_particle(temp_best,global_best,variogram_size);
-	//PSO algorithm
-	for(i=0;i<epochs;i++){
-                //DTYPE cluster_error=sqrt(sum_krig_variance(cluster,global_best,distances,variogram_type));
-		//printf("epoch %lld, g_best=%lf,Kriging error=%lf\n",i,best,cluster_error);
-		for(j=0;j<n_particles;j++){
-			phi1[j]=genrand_real2();
-			phi2[j]=genrand_real2();
-		}
-		temp_best=NULL;
-		for(j=0;j<n_particles;j++){
-			update_particle(particles[j],global_best,c1,c2,alpha,phi1[j],phi2[j],variogram_size);
-			temp=evaluate_model(samples, particles[j]->C, variogram_type);
-			if(temp<particles[j]->mse){
-				particles[j]->mse=temp;
-				copy_particle(particles[j]->C,particles[j]->local_best,variogram_size);
-				if(particles[j]->mse<best){
-					best=particles[j]->mse;
-					temp_best=particles[j]->C;
+	return projection_objective(samples,C,variogram_type,best_theta);
+}
+
+DTYPE variogram_cross_validation(Objects* objects,DTYPE* C,VARIOGRAM_TYPE variogram_type){
+	DWORD i,n=objects->size;
+	DTYPE result=0,chi;
+	if(n<2){
+		return INFINITY;
+	}
+	DTYPE* errors=Calloc(n,DTYPE);
+	DTYPE* variances=Calloc(n,DTYPE);
+	chi=krig_leave_one_out(objects,C,variogram_type,errors,variances);
+	if(!isinf(chi)&&!isnan(chi)){
+		/*Gaussian predictive score: the normalized errors pull chi towards n, the log variances keep the predictions sharp. Variances are positive here, krig_leave_one_out rejects the rest.*/
+		for(i=0;i<n;i++){
+			result+=errors[i]*errors[i]/variances[i]+log(variances[i]);
+		}
+		result/=n;
+	}else{
+		result=INFINITY;
+	}
+	Free(errors);
+	Free(variances);
+	return result;
+}
+
+//Particles evaluated by one task of the parallel objective evaluation.
+#define PSO_BLOCK_PARTICLES 16
+
+void default_PSO_settings(PSOSettings* settings){
+	settings->swarms=4;
+	settings->n_particles=50;
+	settings->epochs=200;
+	settings->stagnation_epochs=30;
+	settings->tolerance=1e-6;
+	settings->c1=2;
+	settings->c2=2;
+	settings->alpha=0.729;
+	settings->variable_projection=FALSE;
+	settings->validation=NULL;
+}
+
+/*
+ * Swarm state in structure of arrays form. Particle p of swarm s uses entries (s*n_particles+p)*dimension to (s*n_particles+p+1)*dimension-1 of position, velocity and local_best.
+*/
+typedef struct{
+	Samples* samples;
+	VARIOGRAM_TYPE variogram_type;
+	BOOLEAN variable_projection;
+	Objects* validation;
+	DWORD dimension;
+	DWORD n_particles;
+	DWORD total;
+	DTYPE* position;
+	DTYPE* velocity;
+	DTYPE* local_best;
+	DTYPE* local_mse;
+	DTYPE* mse;
+	BOOLEAN* active;
+} Swarms;
+
+static void evaluate_particles(DWORD block,WORD thread,void* arg){
+	Swarms* swarms=(Swarms*)arg;
+	DWORD i,end=(block+1)*PSO_BLOCK_PARTICLES;
+	DTYPE value;
+	(void)thread;
+	if(end>swarms->total){
+		end=swarms->total;
+	}
+	for(i=block*PSO_BLOCK_PARTICLES;i<end;i++){
+		if(!swarms->active[i/swarms->n_particles]){
+			continue;
+		}
+		if(swarms->variable_projection){
+			/*Linear parameters of the particle are replaced by their least squares solution*/
+			value=variogram_projection(swarms->samples,swarms->position+i*swarms->dimension,swarms->variogram_type);
+		}else{
+			value=evaluate_model(swarms->samples,swarms->position+i*swarms->dimension,swarms->variogram_type);
+		}
+		if(swarms->validation!=NULL&&!isinf(value)&&!isnan(value)){
+			value=variogram_cross_validation(swarms->validation,swarms->position+i*swarms->dimension,swarms->variogram_type);
+		}
+		/*Invalid parameters, e.g. negative bases of pow, never become a best position.*/
+		swarms->mse[i]=isnan(value)?INFINITY:value;
+	}
+}
+
+DTYPE* variogram_PSO_multistart(Samples* samples,VARIOGRAM_TYPE variogram_type,PSOSettings* settings,PSOStats* stats){
+	DWORD s,p,d,i,epoch,n_blocks,evaluations=0,running,best_swarm=0;
+	DWORD S=settings->swarms,P=settings->n_particles,D=variogram_model_length(variogram_type);
+	Swarms swarms;
+	DTYPE best=INFINITY,r1,r2;
+	if(S<1||P<1||D<1||samples->size==0){
+		return NULL;
+	}
+	swarms.samples=samples;
+	swarms.variogram_type=variogram_type;
+	swarms.variable_projection=settings->variable_projection&&variogram_projection_supported(variogram_type);
+	swarms.validation=settings->validation;
+	swarms.dimension=D;
+	swarms.n_particles=P;
+	swarms.total=S*P;
+	swarms.position=Calloc(S*P*D,DTYPE);
+	swarms.velocity=Calloc(S*P*D,DTYPE);
+	swarms.local_best=Calloc(S*P*D,DTYPE);
+	swarms.local_mse=Calloc(S*P,DTYPE);
+	swarms.mse=Calloc(S*P,DTYPE);
+	swarms.active=Calloc(S,BOOLEAN);
+	DTYPE* global_best=Calloc(S*D,DTYPE);
+	DTYPE* global_mse=Calloc(S,DTYPE);
+	DTYPE* last_improvement=Calloc(S,DTYPE);
+	DWORD* stagnant=Calloc(S,DWORD);
+	DWORD* swarm_epochs=Calloc(S,DWORD);
+	DTYPE* history=Calloc(settings->epochs+1,DTYPE);
+	n_blocks=(S*P+PSO_BLOCK_PARTICLES-1)/PSO_BLOCK_PARTICLES;
+	/*Random initial positions, all drawn in this thread so the run only depends on the seed.*/
+	for(i=0;i<S*P;i++){
+		randomize_variogram(samples,swarms.position+i*D,variogram_type);
+		for(d=0;d<D;d++){
+			swarms.velocity[i*D+d]=0;
+		}
+	}
+	for(s=0;s<S;s++){
+		swarms.active[s]=TRUE;
+		stagnant[s]=0;
+		swarm_epochs[s]=0;
+	}
+	parallel_for(n_blocks,evaluate_particles,&swarms);
+	evaluations+=S*P;
+	for(s=0;s<S;s++){
+		global_mse[s]=INFINITY;
+		for(p=0;p<P;p++){
+			i=s*P+p;
+			swarms.local_mse[i]=swarms.mse[i];
+			memcpy(swarms.local_best+i*D,swarms.position+i*D,D*sizeof(DTYPE));
+			/*Strict comparison keeps a usable position even if every objective is infinite.*/
+			if(p==0||swarms.mse[i]<global_mse[s]){
+				global_mse[s]=swarms.mse[i];
+				memcpy(global_best+s*D,swarms.position+i*D,D*sizeof(DTYPE));
+			}
+		}
+		last_improvement[s]=global_mse[s];
+		if(s==0||global_mse[s]<best){
+			best=global_mse[s];
+			best_swarm=s;
+		}
+	}
+	history[0]=best;
+	running=S;
+	for(epoch=0;epoch<settings->epochs&&running>0;epoch++){
+		/*Move particles of active swarms*/
+		for(s=0;s<S;s++){
+			if(!swarms.active[s]){
+				continue;
+			}
+			for(p=0;p<P;p++){
+				i=s*P+p;
+				for(d=0;d<D;d++){
+					r1=genrand_real2();
+					r2=genrand_real2();
+					swarms.velocity[i*D+d]=settings->alpha*swarms.velocity[i*D+d]+settings->c1*r1*(swarms.local_best[i*D+d]-swarms.position[i*D+d])+settings->c2*r2*(global_best[s*D+d]-swarms.position[i*D+d]);
+					swarms.position[i*D+d]+=swarms.velocity[i*D+d];
 				}
 			}
 		}
-		if(temp_best!=NULL){
-			copy_particle(temp_best,global_best,variogram_size);
+		parallel_for(n_blocks,evaluate_particles,&swarms);
+		/*Update bests in particle order, independent of the evaluation order*/
+		for(s=0;s<S;s++){
+			if(!swarms.active[s]){
+				continue;
+			}
+			evaluations+=P;
+			swarm_epochs[s]++;
+			for(p=0;p<P;p++){
+				i=s*P+p;
+				if(swarms.mse[i]<swarms.local_mse[i]){
+					swarms.local_mse[i]=swarms.mse[i];
+					memcpy(swarms.local_best+i*D,swarms.position+i*D,D*sizeof(DTYPE));
+					if(swarms.mse[i]<global_mse[s]){
+						global_mse[s]=swarms.mse[i];
+						memcpy(global_best+s*D,swarms.position+i*D,D*sizeof(DTYPE));
+					}
+				}
+			}
+			if(global_mse[s]<best){
+				best=global_mse[s];
+				best_swarm=s;
+			}
+			/*Stagnation check*/
+			if(global_mse[s]<last_improvement[s]-settings->tolerance*fabs(last_improvement[s])||(isinf(last_improvement[s])&&!isinf(global_mse[s]))){
+				last_improvement[s]=global_mse[s];
+				stagnant[s]=0;
+			}else{
+				stagnant[s]++;
+				if(settings->stagnation_epochs>0&&stagnant[s]>=settings->stagnation_epochs){
+					swarms.active[s]=FALSE;
+					running--;
+				}
+			}
 		}
-
+		history[epoch+1]=best;
 	}
-	destroy_variogram_particles(particles,n_particles);
-	Free(phi1);
-	Free(phi2);
-	Free(distances);
-	return global_best;
+	DTYPE* result=Calloc(D,DTYPE);
+	memcpy(result,global_best+best_swarm*D,D*sizeof(DTYPE));
+	if(stats!=NULL){
+		stats->best=best;
+		stats->best_swarm=best_swarm;
+		stats->evaluations=evaluations;
+		stats->epochs=epoch;
+		stats->history=(DTYPE*)realloc(history,sizeof(DTYPE)*(epoch+1));
+		stats->swarm_best=global_mse;
+		stats->swarm_epochs=swarm_epochs;
+	}else{
+		Free(history);
+		Free(global_mse);
+		Free(swarm_epochs);
+	}
+	Free(swarms.position);
+	Free(swarms.velocity);
+	Free(swarms.local_best);
+	Free(swarms.local_mse);
+	Free(swarms.mse);
+	Free(swarms.active);
+	Free(global_best);
+	Free(last_improvement);
+	Free(stagnant);
+	return result;
+}
+
+void destroy_PSO_stats(PSOStats* stats){
+	Free(stats->history);
+	Free(stats->swarm_best);
+	Free(stats->swarm_epochs);
+}
+
+DTYPE* variogram_PSO(Objects *objects,Samples* samples,DWORD epochs, DWORD n_particles, VARIOGRAM_TYPE variogram_type, DTYPE c1,DTYPE c2,DTYPE alpha){
+	PSOSettings settings;
+	(void)objects;
+	/*A single swarm without early stopping*/
+	default_PSO_settings(&settings);
+	settings.swarms=1;
+	settings.n_particles=n_particles;
+	settings.epochs=epochs;
+	settings.stagnation_epochs=0;
+	settings.c1=c1;
+	settings.c2=c2;
+	settings.alpha=alpha;
+	return variogram_PSO_multistart(samples,variogram_type,&settings,NULL);
 }
 